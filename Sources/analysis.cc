@@ -0,0 +1,57 @@
+#include "analysis.h"
+
+namespace GLSLTools{
+  void NodeCountPass::Print(std::ostream& stream) const{
+  #define PRINT_COUNT(BaseName) \
+    stream << #BaseName << ": " << counts_[k##BaseName] << std::endl;
+    FOR_EACH_NODE(PRINT_COUNT)
+  #undef PRINT_COUNT
+  }
+
+  void ConstantExprPass::LeaveNode(AstNode* node){
+    if(node->IsLiteral() || node->IsLoadLocal()){
+      operands_.push_back(node->IsConstantExpr() ? 1 : 0);
+    } else if(node->IsCall()){
+      operands_.push_back(0);
+    } else if(node->IsBinaryOp()){
+      bool right = Pop();
+      bool left = Pop();
+      if(left && right) count_++;
+      operands_.push_back(left && right ? 1 : 0);
+    } else if(node->IsReturn() || node->IsStoreLocal() || node->IsIf() || node->IsFor()){
+      // statements consume their value or condition, blocks push nothing
+      Pop();
+    }
+  }
+
+  void UniformExprPass::LeaveNode(AstNode* node){
+    if(node->IsLiteral()){
+      operands_.push_back({ node, node->GetType(), kConstant });
+    } else if(node->IsLoadLocal()){
+      LocalVariable* local = node->AsLoadLocal()->GetLocal();
+      State state = local->IsUniform() ?
+                    kUniform :
+                    (local->IsConstant() ? kConstant : kVarying);
+      operands_.push_back({ node, local->GetType(), state });
+    } else if(node->IsCall()){
+      operands_.push_back({ node, Type::ERROR, kVarying });
+    } else if(node->IsBinaryOp()){
+      // types are tracked here as well, GetType walks the whole chain below
+      Operand right = Pop();
+      Operand left = Pop();
+      BinaryOpNode* op = node->AsBinaryOp();
+      Type* type = BinaryOpNode::GetResultType(op->GetKind(), left.type, right.type);
+      State state = left.state == kVarying || right.state == kVarying ?
+                    kVarying :
+                    (left.state == kUniform || right.state == kUniform ? kUniform : kConstant);
+      if(state == kUniform && (left.type->GetSize() != 1 || right.type->GetSize() != 1)) state = kVarying;
+      if(state != kUniform){
+        Keep(left);
+        Keep(right);
+      }
+      operands_.push_back({ node, type, state });
+    } else if(node->IsReturn() || node->IsStoreLocal() || node->IsIf() || node->IsFor()){
+      Keep(Pop());
+    }
+  }
+}
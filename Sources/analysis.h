@@ -0,0 +1,243 @@
+#ifndef GLSLTOOLS_ANALYSIS_H
+#define GLSLTOOLS_ANALYSIS_H
+
+#include "pass_manager.h"
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace GLSLTools{
+  // Analyses written as AstPasses, so any number of them costs one walk.
+  // Results cover every function the pass was run over.
+
+  class NodeCountPass : public AstPass{
+  public:
+    enum Kind{
+    #define DEFINE_KIND(BaseName) k##BaseName,
+      FOR_EACH_NODE(DEFINE_KIND)
+    #undef DEFINE_KIND
+      kNumberOfKinds
+    };
+  private:
+    size_t counts_[kNumberOfKinds];
+  public:
+    NodeCountPass(){
+      memset(counts_, 0, sizeof(counts_));
+    }
+    ~NodeCountPass(){}
+
+    const char* GetName() const{
+      return "node-count";
+    }
+
+    size_t GetCount(Kind kind) const{
+      return counts_[kind];
+    }
+
+    void Print(std::ostream& stream) const;
+
+    #define DEFINE_VISIT(BaseName) \
+      void Visit##BaseName(BaseName##Node*){ counts_[k##BaseName]++; }
+      FOR_EACH_NODE(DEFINE_VISIT)
+    #undef DEFINE_VISIT
+  };
+
+  class DepthPass : public AstPass{
+  private:
+    size_t depth_;
+    size_t max_depth_;
+  public:
+    DepthPass():
+      depth_(0),
+      max_depth_(0){}
+    ~DepthPass(){}
+
+    const char* GetName() const{
+      return "depth";
+    }
+
+    size_t GetMaxDepth() const{
+      return max_depth_;
+    }
+
+    void LeaveNode(AstNode*){
+      depth_--;
+    }
+
+    #define DEFINE_VISIT(BaseName) \
+      void Visit##BaseName(BaseName##Node*){ if(++depth_ > max_depth_) max_depth_ = depth_; }
+      FOR_EACH_NODE(DEFINE_VISIT)
+    #undef DEFINE_VISIT
+  };
+
+  class CallTargetPass : public AstPass{
+  private:
+    std::unordered_set<std::string> targets_;
+  public:
+    CallTargetPass():
+      targets_(){}
+    ~CallTargetPass(){}
+
+    const char* GetName() const{
+      return "call-targets";
+    }
+
+    const std::unordered_set<std::string>& GetTargets() const{
+      return targets_;
+    }
+
+    void VisitCall(CallNode* node){
+      targets_.insert(node->GetTarget());
+    }
+  };
+
+  // Binary operations the constant folder could replace. Constness is
+  // propagated bottom up in LeaveNode, asking every node IsConstantExpr
+  // would walk long chains over and over.
+  class ConstantExprPass : public AstPass{
+  private:
+    std::vector<char> operands_;
+    size_t count_;
+
+    bool Pop(){
+      bool constant = operands_.back() != 0;
+      operands_.pop_back();
+      return constant;
+    }
+  public:
+    ConstantExprPass():
+      operands_(),
+      count_(0){}
+    ~ConstantExprPass(){}
+
+    const char* GetName() const{
+      return "constant-exprs";
+    }
+
+    size_t GetCount() const{
+      return count_;
+    }
+
+    void LeaveNode(AstNode* node);
+  };
+
+  // Binary operations whose operands are uniforms and constants only, so
+  // their value is the same for every invocation and could be computed once
+  // on the CPU. Only the outermost of them are kept, and only those on
+  // scalars, which is all the constant folder can evaluate. Operations on
+  // constants alone are left to the folder.
+  class UniformExprPass : public AstPass{
+  private:
+    enum State{
+      kVarying,
+      kConstant,
+      kUniform
+    };
+
+    struct Operand{
+      AstNode* node;
+      Type* type;
+      State state;
+    };
+
+    std::vector<Operand> operands_;
+    std::vector<BinaryOpNode*> roots_;
+
+    Operand Pop(){
+      Operand operand = operands_.back();
+      operands_.pop_back();
+      return operand;
+    }
+
+    // operand is consumed by something that isn't hoisted with it
+    void Keep(const Operand& operand){
+      if(operand.state == kUniform && operand.node->IsBinaryOp()) roots_.push_back(operand.node->AsBinaryOp());
+    }
+  public:
+    UniformExprPass():
+      operands_(),
+      roots_(){}
+    ~UniformExprPass(){}
+
+    const char* GetName() const{
+      return "uniform-exprs";
+    }
+
+    size_t GetCount() const{
+      return roots_.size();
+    }
+
+    // In the order their walks finished
+    const std::vector<BinaryOpNode*>& GetRoots() const{
+      return roots_;
+    }
+
+    void LeaveNode(AstNode* node);
+  };
+
+  class LocalUsePass : public AstPass{
+  public:
+    struct Uses{
+      size_t loads;
+      size_t stores;
+    };
+  private:
+    std::unordered_map<LocalVariable*, Uses> uses_;
+  public:
+    LocalUsePass():
+      uses_(){}
+    ~LocalUsePass(){}
+
+    const char* GetName() const{
+      return "local-uses";
+    }
+
+    size_t GetNumberOfLocals() const{
+      return uses_.size();
+    }
+
+    Uses GetUses(LocalVariable* local) const{
+      auto pos = uses_.find(local);
+      return pos != uses_.end() ?
+             pos->second :
+             Uses{ 0, 0 };
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      uses_[node->GetLocal()].loads++;
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      uses_[node->GetLocal()].stores++;
+    }
+  };
+
+  // Stores to locals that are never loaded, gl_Position is an output and
+  // always live. Requires local-uses.
+  class DeadStorePass : public AstPass{
+  private:
+    const LocalUsePass* uses_;
+    size_t count_;
+  public:
+    DeadStorePass(const LocalUsePass* uses):
+      uses_(uses),
+      count_(0){}
+    ~DeadStorePass(){}
+
+    const char* GetName() const{
+      return "dead-stores";
+    }
+
+    size_t GetCount() const{
+      return count_;
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      LocalVariable* local = node->GetLocal();
+      if(local->GetName() != "gl_Position" && uses_->GetUses(local).loads == 0) count_++;
+    }
+  };
+}
+
+#endif //GLSLTOOLS_ANALYSIS_H
@@ -2,23 +2,94 @@
 #define GLSLTOOLS_ARRAY_H
 
 #include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace GLSLTools{
+  // Room for N elements inside the Array itself, none when N is 0
+  template<typename T, size_t N>
+  struct ArrayStorage{
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type inline_[N];
+
+    T* GetInline(){
+      return reinterpret_cast<T*>(inline_);
+    }
+  };
+
   template<typename T>
-  class Array{
+  struct ArrayStorage<T, 0>{
+    T* GetInline(){
+      return nullptr;
+    }
+  };
+
+  // Growable array keeping its first N elements inline, so short lists such
+  // as a block's children never touch the heap. Past that it grows to the
+  // next power of two. Trivially copyable elements are moved with realloc,
+  // anything else is move constructed and destroyed in place.
+  template<typename T, size_t N = 0>
+  class Array : private ArrayStorage<T, N>{
   private:
+    static const bool kTrivial = std::is_trivially_copyable<T>::value;
+
     size_t length_;
     size_t capacity_;
     T* data_;
 
-    void Resize(size_t nlen){
-      if(nlen > capacity_){
-        size_t ncap = RoundUpPowTwo(nlen);
-        T* ndata = reinterpret_cast<T*>(realloc(data_, nlen * sizeof(T)));
-        data_ = ndata;
-        capacity_ = ncap;
+    bool IsInline() const{
+      return N > 0 && data_ == const_cast<Array*>(this)->GetInline();
+    }
+
+    void Grow(size_t ncap){
+      ncap = RoundUpPowTwo(ncap);
+      if(ncap <= capacity_) return;
+
+      T* ndata;
+      if(kTrivial && !IsInline()){
+        ndata = reinterpret_cast<T*>(realloc(data_, ncap * sizeof(T)));
+      } else{
+        ndata = reinterpret_cast<T*>(malloc(ncap * sizeof(T)));
+        for(size_t i = 0; i < length_; i++){
+          new (&ndata[i]) T(std::move(data_[i]));
+          data_[i].~T();
+        }
+        if(!IsInline()) free(data_);
+      }
+      if(ndata == nullptr) std::abort();
+      data_ = ndata;
+      capacity_ = ncap;
+    }
+
+    void Destroy(size_t from){
+      if(!kTrivial){
+        for(size_t i = from; i < length_; i++) data_[i].~T();
+      }
+      length_ = from;
+    }
+
+    void Release(){
+      Destroy(0);
+      if(!IsInline()) free(data_);
+      data_ = this->GetInline();
+      capacity_ = N;
+    }
+
+    // Takes other's elements, leaving it empty
+    void Steal(Array& other){
+      if(other.IsInline()){
+        Reserve(other.length_);
+        for(size_t i = 0; i < other.length_; i++) new (&data_[i]) T(std::move(other.data_[i]));
+        length_ = other.length_;
+        other.Destroy(0);
+        return;
       }
-      length_ = nlen;
+      data_ = other.data_;
+      capacity_ = other.capacity_;
+      length_ = other.length_;
+      other.data_ = other.GetInline();
+      other.capacity_ = N;
+      other.length_ = 0;
     }
 
     static size_t RoundUpPowTwo(size_t x){
@@ -34,23 +105,54 @@ namespace GLSLTools{
       return x + 1;
     }
   public:
-    Array(size_t initCap):
+    Array(size_t initCap = 0):
       length_(0),
-      capacity_(0),
-      data_(nullptr){
-        if(initCap > 0){
-          capacity_ = RoundUpPowTwo(initCap);
-          data_ = reinterpret_cast<T*>(malloc(capacity_ * sizeof(T)));
-        }
+      capacity_(N),
+      data_(this->GetInline()){
+      if(initCap > N) Grow(initCap);
+    }
+    Array(const Array& other):
+      length_(0),
+      capacity_(N),
+      data_(this->GetInline()){
+      Reserve(other.length_);
+      for(size_t i = 0; i < other.length_; i++) new (&data_[i]) T(other.data_[i]);
+      length_ = other.length_;
+    }
+    Array(Array&& other):
+      length_(0),
+      capacity_(N),
+      data_(this->GetInline()){
+      Steal(other);
     }
     ~Array(){
-      free(data_);
+      Release();
+    }
+
+    Array& operator=(const Array& other){
+      if(this == &other) return *this;
+      Destroy(0);
+      Reserve(other.length_);
+      for(size_t i = 0; i < other.length_; i++) new (&data_[i]) T(other.data_[i]);
+      length_ = other.length_;
+      return *this;
+    }
+
+    Array& operator=(Array&& other){
+      if(this == &other) return *this;
+      Release();
+      Steal(other);
+      return *this;
     }
 
     size_t Length() const{
       return length_;
     }
 
+    size_t GetCapacity() const{
+      return capacity_;
+    }
+
     T& operator[](size_t index) const{
       return data_[index];
     }
@@ -59,19 +161,67 @@ namespace GLSLTools{
       return operator[](length_ - 1);
     }
 
+    void Reserve(size_t capacity){
+      if(capacity > capacity_) Grow(capacity);
+    }
+
     void Add(const T& value){
-      Resize(Length() + 1);
-      Last() = value;
+      if(length_ == capacity_){
+        // value may live in the storage about to move
+        T copy(value);
+        Grow(length_ + 1);
+        new (&data_[length_++]) T(std::move(copy));
+        return;
+      }
+      new (&data_[length_++]) T(value);
+    }
+
+    void Add(T&& value){
+      if(length_ == capacity_){
+        T moved(std::move(value));
+        Grow(length_ + 1);
+        new (&data_[length_++]) T(std::move(moved));
+        return;
+      }
+      new (&data_[length_++]) T(std::move(value));
+    }
+
+    // args must not refer to elements of this Array
+    template<typename... Args>
+    T& Emplace(Args&&... args){
+      if(length_ == capacity_) Grow(length_ + 1);
+      new (&data_[length_]) T(std::forward<Args>(args)...);
+      return data_[length_++];
+    }
+
+    void RemoveLast(){
+      Destroy(length_ - 1);
     }
 
     void Clear(){
-      length_ = 0;
+      Destroy(0);
+    }
+
+    // Drops every element from length on, capacity is kept
+    void Truncate(size_t length){
+      if(length < length_) Destroy(length);
     }
 
     bool IsEmpty() const{
       return Length() == 0;
     }
+
+    T* begin() const{
+      return data_;
+    }
+
+    T* end() const{
+      return data_ + length_;
+    }
   };
+
+  template<typename T, size_t N>
+  const bool Array<T, N>::kTrivial;
 }
 
 #endif //GLSLTOOLS_ARRAY_H
@@ -1,4 +1,6 @@
 #include "ast.h"
+#include <climits>
+#include <limits>
 
 namespace GLSLTools{
   #define DEFINE_VISIT_FUNCTION(BaseName) \
@@ -7,4 +9,183 @@ namespace GLSLTools{
     }
   FOR_EACH_NODE(DEFINE_VISIT_FUNCTION)
   #undef DEFINE_VISIT_FUNCTION
+
+  template<typename T>
+  static bool FoldBinaryOp(BinaryOpNode::Kind kind, T left, T right, T* result){
+    switch(kind){
+      case BinaryOpNode::kAdd: *result = left + right; return true;
+      case BinaryOpNode::kSubtract: *result = left - right; return true;
+      case BinaryOpNode::kMultiply: *result = left * right; return true;
+      case BinaryOpNode::kDivide:
+        if(std::numeric_limits<T>::is_integer && right == 0) return false;
+        *result = left / right;
+        return true;
+      default: return false;
+    }
+  }
+
+  template<typename T>
+  static bool Compare(BinaryOpNode::Kind kind, T left, T right){
+    switch(kind){
+      case BinaryOpNode::kLess: return left < right;
+      case BinaryOpNode::kLessEqual: return left <= right;
+      case BinaryOpNode::kGreater: return left > right;
+      case BinaryOpNode::kGreaterEqual: return left >= right;
+      case BinaryOpNode::kEqual: return left == right;
+      default: return left != right;
+    }
+  }
+
+  Value* BinaryOpNode::Fold(Kind kind, Value* left, Value* right){
+    if(left == nullptr || right == nullptr || !left->IsConstant() || !right->IsConstant()) return nullptr;
+
+    Type* left_type = left->GetType();
+    Type* right_type = right->GetType();
+    if(IsComparison(kind)){
+      if(left_type == Type::DOUBLE || right_type == Type::DOUBLE) return Value::NewInstance(Compare(kind, left->AsDouble(), right->AsDouble()), true);
+      if(left_type->IsCompatibile(*Type::FLOAT) || right_type->IsCompatibile(*Type::FLOAT)){
+        return Value::NewInstance(Compare(kind, static_cast<float>(left->AsDouble()), static_cast<float>(right->AsDouble())), true);
+      }
+      if(left_type == Type::UINT || right_type == Type::UINT) return Value::NewInstance(Compare(kind, left->AsUInt(), right->AsUInt()), true);
+      return Value::NewInstance(Compare(kind, left->AsInt(), right->AsInt()), true);
+    } else if(left_type == Type::DOUBLE || right_type == Type::DOUBLE){
+      double result;
+      if(FoldBinaryOp(kind, left->AsDouble(), right->AsDouble(), &result)) return Value::NewInstance(result, true);
+    } else if(left_type->IsCompatibile(*Type::FLOAT) || right_type->IsCompatibile(*Type::FLOAT)){
+      float result;
+      if(FoldBinaryOp(kind, static_cast<float>(left->AsDouble()), static_cast<float>(right->AsDouble()), &result)) return Value::NewInstance(result, true);
+    } else if(left_type == Type::UINT || right_type == Type::UINT){
+      unsigned int result;
+      if(FoldBinaryOp(kind, left->AsUInt(), right->AsUInt(), &result)) return Value::NewInstance(result, true);
+    } else if(left_type->IsCompatibile(*Type::INT) && right_type->IsCompatibile(*Type::INT)){
+      // ints wrap like they do on the GPU, INT_MIN / -1 is left alone
+      unsigned int result;
+      if(kind == kDivide){
+        int divisor = right->AsInt();
+        if(divisor != 0 && !(left->AsInt() == INT_MIN && divisor == -1)) return Value::NewInstance(left->AsInt() / divisor, true);
+      } else if(FoldBinaryOp(kind, left->AsUInt(), right->AsUInt(), &result)){
+        return Value::NewInstance(static_cast<int>(result), true);
+      }
+    }
+    return nullptr;
+  }
+
+  Value* BinaryOpNode::EvalConstantExpr(){
+    Value* left = GetLeft()->EvalConstantExpr();
+    Value* right = GetRight()->EvalConstantExpr();
+    Value* value = Fold(GetKind(), left, right);
+    delete left;
+    delete right;
+    return value;
+  }
+
+  // Looks for stores to one local anywhere below the node it visits
+  class StoreFinder : public AstNodeVisitor{
+  private:
+    LocalVariable* local_;
+    bool found_;
+  public:
+    StoreFinder(LocalVariable* local):
+      local_(local),
+      found_(false){}
+    ~StoreFinder(){}
+
+    bool IsFound() const{
+      return found_;
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      if(node->GetLocal() == local_) found_ = true;
+      node->VisitChildren(this);
+    }
+
+  #define DEFINE_VISIT(BaseName) \
+    void Visit##BaseName(BaseName##Node* node){ node->VisitChildren(this); }
+    DEFINE_VISIT(Sequence)
+    DEFINE_VISIT(Return)
+    DEFINE_VISIT(BinaryOp)
+    DEFINE_VISIT(If)
+    DEFINE_VISIT(For)
+  #undef DEFINE_VISIT
+  };
+
+  static bool GetConstantInt(AstNode* node, int64_t* result){
+    if(node == nullptr || !node->IsConstantExpr()) return false;
+    Value* value = node->EvalConstantExpr();
+    bool scalar = value != nullptr && (value->GetType() == Type::INT || value->GetType() == Type::UINT);
+    if(scalar) *result = value->GetType() == Type::UINT ? static_cast<int64_t>(value->AsUInt()) : static_cast<int64_t>(value->AsInt());
+    delete value;
+    return scalar;
+  }
+
+  static bool IsLoadOf(AstNode* node, LocalVariable* local){
+    return node != nullptr && node->IsLoadLocal() && node->AsLoadLocal()->GetLocal() == local;
+  }
+
+  // b > i is i < b
+  static BinaryOpNode::Kind Mirror(BinaryOpNode::Kind kind){
+    switch(kind){
+      case BinaryOpNode::kLess: return BinaryOpNode::kGreater;
+      case BinaryOpNode::kLessEqual: return BinaryOpNode::kGreaterEqual;
+      case BinaryOpNode::kGreater: return BinaryOpNode::kLess;
+      case BinaryOpNode::kGreaterEqual: return BinaryOpNode::kLessEqual;
+      default: return kind;
+    }
+  }
+
+  bool ForNode::GetInduction(size_t limit, Induction* induction) const{
+    StoreLocalNode* init = GetInit() != nullptr ? GetInit()->AsStoreLocal() : nullptr;
+    StoreLocalNode* step = GetStep() != nullptr ? GetStep()->AsStoreLocal() : nullptr;
+    BinaryOpNode* condition = GetCondition()->AsBinaryOp();
+    if(init == nullptr || step == nullptr || condition == nullptr || !BinaryOpNode::IsComparison(condition->GetKind())) return false;
+
+    LocalVariable* local = init->GetLocal();
+    Type* type = local->GetType();
+    if(!init->IsDeclaration() || (type != Type::INT && type != Type::UINT) || step->GetLocal() != local) return false;
+
+    int64_t start;
+    int64_t bound;
+    int64_t delta = 0;
+    BinaryOpNode::Kind kind = condition->GetKind();
+    if(IsLoadOf(condition->GetLeft(), local)){
+      if(!GetConstantInt(condition->GetRight(), &bound)) return false;
+    } else if(IsLoadOf(condition->GetRight(), local)){
+      if(!GetConstantInt(condition->GetLeft(), &bound)) return false;
+      kind = Mirror(kind);
+    } else{
+      return false;
+    }
+
+    BinaryOpNode* update = step->GetValue()->AsBinaryOp();
+    if(!GetConstantInt(init->GetValue(), &start) || update == nullptr) return false;
+    bool stepped = false;
+    if(update->GetKind() == BinaryOpNode::kAdd){
+      stepped = IsLoadOf(update->GetLeft(), local) ?
+                GetConstantInt(update->GetRight(), &delta) :
+                IsLoadOf(update->GetRight(), local) && GetConstantInt(update->GetLeft(), &delta);
+    } else if(update->GetKind() == BinaryOpNode::kSubtract && IsLoadOf(update->GetLeft(), local)){
+      stepped = GetConstantInt(update->GetRight(), &delta);
+      delta = -delta;
+    }
+    if(!stepped) return false;
+
+    StoreFinder finder(local);
+    GetBody()->Visit(&finder);
+    if(finder.IsFound()) return false;
+
+    // stepping stays exact as long as i fits its type, wrapping gives up
+    int64_t min = type == Type::UINT ? 0 : INT_MIN;
+    int64_t max = type == Type::UINT ? static_cast<int64_t>(UINT_MAX) : INT_MAX;
+    if(start < min || start > max) return false;
+    size_t trips = 0;
+    for(int64_t value = start; Compare(kind, value, bound); value += delta){
+      if(trips++ == limit || value + delta < min || value + delta > max) return false;
+    }
+
+    induction->local = local;
+    induction->start = start;
+    induction->step = delta;
+    induction->trips = trips;
+    return true;
+  }
 }
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "type.h"
 #include "scope.h"
+#include "token.h"
 #include <iostream>
 
 namespace GLSLTools{
@@ -13,7 +14,10 @@ namespace GLSLTools{
     V(Sequence) \
     V(BinaryOp) \
     V(LoadLocal) \
-    V(StoreLocal)
+    V(StoreLocal) \
+    V(Call) \
+    V(If) \
+    V(For)
 
     #define DECLARE_COMMON_NODE_FUNCTIONS(BaseName) \
       virtual const char* Name(){ return #BaseName; } \
@@ -36,11 +40,26 @@ namespace GLSLTools{
       #undef DECLARE_VISIT_FUNCTION
     };
 
+    // Every node owns its child nodes and deletes them with itself. A
+    // SequenceNode also owns its LocalScope, a LiteralNode owns its Value.
+    // LoadLocal/StoreLocal only reference locals owned by a scope.
     class AstNode{
+    private:
+      SourceSpan span_;
     public:
-      AstNode(){}
+      AstNode():
+        span_(){}
       virtual ~AstNode(){}
 
+      // Source text the node was parsed from, empty for synthesized nodes
+      const SourceSpan& GetSpan() const{
+        return span_;
+      }
+
+      void SetSpan(const SourceSpan& span){
+        span_ = span;
+      }
+
       #define DEFINE_TYPE_CHECK(BaseName) \
         bool Is##BaseName(){ return As##BaseName() != nullptr; } \
         virtual BaseName##Node* As##BaseName(){ return nullptr; }
@@ -56,6 +75,12 @@ namespace GLSLTools{
           return false;
         }
 
+        // Static type of the value this node produces
+        virtual Type* GetType(){
+          return Type::VOID;
+        }
+
+        // Returns a new Value owned by the caller, or nullptr
         virtual Value* EvalConstantExpr(){
           return nullptr;
         }
@@ -63,24 +88,35 @@ namespace GLSLTools{
 
     class SequenceNode : public AstNode{
     private:
-      Array<AstNode*> children_;
+      Array<AstNode*, 4> children_;
       LocalScope* scope_;
     public:
       SequenceNode(LocalScope* scope = nullptr):
         scope_(new LocalScope(scope)),
-        children_(10){
-
-        LocalVariable* local = new LocalVariable("gl_Position", Type::VEC2);
-        if(!scope_->AddLocal(local)){
-          std::cerr << "Unable to define basic locals" << std::endl;
-          std::exit(1);
+        children_(){
+        // nested blocks, and bodies in a CodeUnit's global scope, see the
+        // builtins through their parent scope
+        if(scope == nullptr) AddBuiltins(scope_);
+      }
+      ~SequenceNode(){
+        for(size_t i = 0; i < children_.Length(); i++){
+          delete children_[i];
         }
+        delete scope_;
       }
 
       LocalScope* GetScope() const{
         return scope_;
       }
 
+      static void AddBuiltins(LocalScope* scope){
+        LocalVariable* local = new LocalVariable("gl_Position", Type::VEC2);
+        if(!scope->AddLocal(local)){
+          std::cerr << "Unable to define basic locals" << std::endl;
+          std::exit(1);
+        }
+      }
+
       void Add(AstNode* node){
         children_.Add(node);
       }
@@ -99,10 +135,16 @@ namespace GLSLTools{
         return children_.Length();
       }
 
+      // The previous child is not deleted, ownership passes to the caller
       void SetChildAt(size_t idx, AstNode* child){
         children_[idx] = child;
       }
 
+      // Drops every child from length on without deleting them
+      void Truncate(size_t length){
+        children_.Truncate(length);
+      }
+
       DECLARE_COMMON_NODE_FUNCTIONS(Sequence);
     };
 
@@ -112,7 +154,9 @@ namespace GLSLTools{
     public:
       LiteralNode(Value* value):
         value_(value){}
-      ~LiteralNode(){}
+      ~LiteralNode(){
+        delete value_;
+      }
 
       Value* GetValue() const{
         return value_;
@@ -120,12 +164,20 @@ namespace GLSLTools{
 
       void VisitChildren(AstNodeVisitor* vis){}
 
-      virtual bool IsConstantExpr(){
-        return value_->IsConstant();
+      Type* GetType(){
+        return value_ != nullptr ?
+               value_->GetType() :
+               Type::ERROR;
+      }
+
+      virtual bool IsConstantExpr() const{
+        return value_ != nullptr && value_->IsConstant();
       }
 
       virtual Value* EvalConstantExpr(){
-        return value_;
+        return value_ != nullptr ?
+               value_->Copy() :
+               nullptr;
       }
 
       DECLARE_COMMON_NODE_FUNCTIONS(Literal);
@@ -137,16 +189,27 @@ namespace GLSLTools{
     public:
       ReturnNode(AstNode* value):
         value_(value){}
-      ~ReturnNode(){}
+      ~ReturnNode(){
+        delete value_;
+      }
 
       AstNode* GetValue() const{
         return value_;
       }
 
+      // The previous value is not deleted, ownership passes to the caller
+      void SetValue(AstNode* value){
+        value_ = value;
+      }
+
       void VisitChildren(AstNodeVisitor* vis){
         GetValue()->Visit(vis);
       }
 
+      Type* GetType(){
+        return GetValue()->GetType();
+      }
+
       DECLARE_COMMON_NODE_FUNCTIONS(Return);
     };
 
@@ -157,6 +220,12 @@ namespace GLSLTools{
         kSubtract,
         kDivide,
         kMultiply,
+        kLess,
+        kLessEqual,
+        kGreater,
+        kGreaterEqual,
+        kEqual,
+        kNotEqual,
         kUnknown
       };
     private:
@@ -168,6 +237,10 @@ namespace GLSLTools{
         kind_(kind),
         left_(left),
         right_(right){}
+      ~BinaryOpNode(){
+        delete left_;
+        delete right_;
+      }
 
       AstNode* GetLeft() const{
         return left_;
@@ -181,39 +254,70 @@ namespace GLSLTools{
         return kind_;
       }
 
+      // The previous operands are not deleted, ownership passes to the caller
+      void SetLeft(AstNode* left){
+        left_ = left;
+      }
+
+      void SetRight(AstNode* right){
+        right_ = right;
+      }
+
+      static const char* GetOperator(Kind kind){
+        switch(kind){
+          case kAdd: return "+";
+          case kSubtract: return "-";
+          case kDivide: return "/";
+          case kMultiply: return "*";
+          case kLess: return "<";
+          case kLessEqual: return "<=";
+          case kGreater: return ">";
+          case kGreaterEqual: return ">=";
+          case kEqual: return "==";
+          case kNotEqual: return "!=";
+          default: return "?";
+        }
+      }
+
+      static bool IsComparison(Kind kind){
+        return kind >= kLess && kind <= kNotEqual;
+      }
+
       void VisitChildren(AstNodeVisitor* vis){
         GetLeft()->Visit(vis);
         GetRight()->Visit(vis);
       }
 
-      virtual Value* EvalConstantExpr(){
-        Value* left = GetLeft()->EvalConstantExpr();
-        Value* right = GetRight()->EvalConstantExpr();
-
-        if(left->IsConstant() && right->IsConstant()){
-          if(left->GetType()->IsCompatibile(*Type::INT)){
-            int result = left->AsInt();
-            switch(GetKind()){
-              case kAdd: result += right->AsInt();
-              case kSubtract: result -= right->AsInt();
-              default: result = -1;
-            }
-            return Value::NewInstance(result);
-          } else if(left->GetType()->IsCompatibile(*Type::FLOAT)){
-            float result = left->AsFloat();
-            switch(GetKind()){
-              case kAdd: result += right->AsFloat();
-              case kSubtract: result -= right->AsFloat();
-              default: result = -1;
-            }
-            return Value::NewInstance(result);
-          }
+      // The type of kind applied to operands of the given types. Comparisons
+      // give a bool, a scalar is widened to the vector operand and scalars
+      // promote to double, then float, then uint like Fold does.
+      static Type* GetResultType(Kind kind, Type* left, Type* right){
+        if(IsComparison(kind)) return Type::BOOL;
+        if(left->GetSize() != right->GetSize()){
+          return right->GetSize() > left->GetSize() ?
+                 right :
+                 left;
         }
+        if(left->GetSize() != 1) return left;
+        if(left == Type::DOUBLE || right == Type::DOUBLE) return Type::DOUBLE;
+        if(left == Type::FLOAT || right == Type::FLOAT) return Type::FLOAT;
+        if(left == Type::UINT || right == Type::UINT) return Type::UINT;
+        return left;
+      }
 
-        return nullptr;
+      Type* GetType(){
+        return GetResultType(GetKind(), GetLeft()->GetType(), GetRight()->GetType());
       }
 
-      virtual bool IsConstantExpr(){
+      // Folds scalar operands, promoted to the wider of their types,
+      // comparisons fold to a bool
+      virtual Value* EvalConstantExpr();
+
+      // Returns a new constant Value owned by the caller, or nullptr when the
+      // operands aren't constant scalars or the result is undefined
+      static Value* Fold(Kind kind, Value* left, Value* right);
+
+      virtual bool IsConstantExpr() const{
         return GetLeft()->IsConstantExpr() &&
                GetRight()->IsConstantExpr();
       }
@@ -234,6 +338,20 @@ namespace GLSLTools{
 
       void VisitChildren(AstNodeVisitor* vis){}
 
+      Type* GetType(){
+        return local_->GetType();
+      }
+
+      virtual bool IsConstantExpr() const{
+        return local_->IsConstant();
+      }
+
+      virtual Value* EvalConstantExpr(){
+        return local_->IsConstant() ?
+               local_->GetConstantValue()->Copy() :
+               nullptr;
+      }
+
       DECLARE_COMMON_NODE_FUNCTIONS(LoadLocal);
     };
 
@@ -241,25 +359,208 @@ namespace GLSLTools{
     private:
       LocalVariable* local_;
       AstNode* value_;
+      bool is_declaration_;
     public:
-      StoreLocalNode(LocalVariable* local, AstNode* value):
+      StoreLocalNode(LocalVariable* local, AstNode* value, bool is_declaration = false):
         local_(local),
-        value_(value){}
+        value_(value),
+        is_declaration_(is_declaration){}
+      ~StoreLocalNode(){
+        delete value_;
+      }
 
       LocalVariable* GetLocal() const{
         return local_;
       }
 
+      bool IsDeclaration() const{
+        return is_declaration_;
+      }
+
       AstNode* GetValue() const{
         return value_;
       }
 
+      // The previous value is not deleted, ownership passes to the caller
+      void SetValue(AstNode* value){
+        value_ = value;
+      }
+
       void VisitChildren(AstNodeVisitor* vis){
         GetValue()->Visit(vis);
       }
 
+      Type* GetType(){
+        return local_->GetType();
+      }
+
       DECLARE_COMMON_NODE_FUNCTIONS(StoreLocal);
     };
+
+    class CallNode : public AstNode{
+    private:
+      std::string target_;
+    public:
+      CallNode(std::string target):
+        target_(target){}
+
+      const std::string& GetTarget() const{
+        return target_;
+      }
+
+      void VisitChildren(AstNodeVisitor* vis){}
+
+      // resolving the target needs the CodeUnit
+      Type* GetType(){
+        return Type::ERROR;
+      }
+
+      DECLARE_COMMON_NODE_FUNCTIONS(Call);
+    };
+
+    class IfNode : public AstNode{
+    private:
+      AstNode* condition_;
+      SequenceNode* then_;
+      SequenceNode* else_;
+    public:
+      IfNode(AstNode* condition, SequenceNode* then_block, SequenceNode* else_block = nullptr):
+        condition_(condition),
+        then_(then_block),
+        else_(else_block){}
+      ~IfNode(){
+        delete condition_;
+        delete then_;
+        delete else_;
+      }
+
+      AstNode* GetCondition() const{
+        return condition_;
+      }
+
+      SequenceNode* GetThen() const{
+        return then_;
+      }
+
+      // nullptr without an else branch
+      SequenceNode* GetElse() const{
+        return else_;
+      }
+
+      bool HasElse() const{
+        return else_ != nullptr;
+      }
+
+      // The previous condition is not deleted, ownership passes to the caller
+      void SetCondition(AstNode* condition){
+        condition_ = condition;
+      }
+
+      void VisitChildren(AstNodeVisitor* vis){
+        GetCondition()->Visit(vis);
+        GetThen()->Visit(vis);
+        if(HasElse()) GetElse()->Visit(vis);
+      }
+
+      DECLARE_COMMON_NODE_FUNCTIONS(If);
+    };
+
+    // for(init; condition; step) body, a while loop has neither init nor
+    // step. The loop owns a scope of its own for the locals init declares,
+    // the body's scope is a child of it.
+    class ForNode : public AstNode{
+    private:
+      LocalScope* scope_;
+      AstNode* init_;
+      AstNode* condition_;
+      AstNode* step_;
+      SequenceNode* body_;
+    public:
+      ForNode(LocalScope* scope):
+        scope_(new LocalScope(scope)),
+        init_(nullptr),
+        condition_(nullptr),
+        step_(nullptr),
+        body_(nullptr){}
+      ~ForNode(){
+        delete init_;
+        delete condition_;
+        delete step_;
+        // the body's scope unlinks itself from ours
+        delete body_;
+        delete scope_;
+      }
+
+      LocalScope* GetScope() const{
+        return scope_;
+      }
+
+      // nullptr when the loop has none
+      AstNode* GetInit() const{
+        return init_;
+      }
+
+      AstNode* GetCondition() const{
+        return condition_;
+      }
+
+      // nullptr when the loop has none
+      AstNode* GetStep() const{
+        return step_;
+      }
+
+      SequenceNode* GetBody() const{
+        return body_;
+      }
+
+      bool IsWhile() const{
+        return init_ == nullptr && step_ == nullptr;
+      }
+
+      // Setters take ownership, the previous node is not deleted
+      void SetInit(AstNode* init){
+        init_ = init;
+      }
+
+      void SetCondition(AstNode* condition){
+        condition_ = condition;
+      }
+
+      void SetStep(AstNode* step){
+        step_ = step;
+      }
+
+      void SetBody(SequenceNode* body){
+        body_ = body;
+      }
+
+      // Induction variable i of a loop of the form
+      //
+      //   for(int i = start; i <op> bound; i = i +/- step)
+      //
+      // where start, bound and step are constant, i is an int or uint the
+      // body never stores and op is any comparison. Value k of i is
+      // start + k * step.
+      struct Induction{
+        LocalVariable* local;
+        int64_t start;
+        int64_t step;
+        size_t trips;
+      };
+
+      // Finds the trip count by stepping i. Fails for any other loop and
+      // for ones running more than limit times.
+      bool GetInduction(size_t limit, Induction* induction) const;
+
+      void VisitChildren(AstNodeVisitor* vis){
+        if(GetInit() != nullptr) GetInit()->Visit(vis);
+        GetCondition()->Visit(vis);
+        if(GetStep() != nullptr) GetStep()->Visit(vis);
+        GetBody()->Visit(vis);
+      }
+
+      DECLARE_COMMON_NODE_FUNCTIONS(For);
+    };
 }
 
 #endif //GLSLTOOLS_AST_H
@@ -43,11 +43,7 @@ namespace GLSLTools{
 
     void VisitBinaryOp(BinaryOpNode* node){
       node->GetLeft()->Visit(this);
-      switch(node->GetKind()){
-        case BinaryOpNode::kAdd: stream_ << " + "; break;
-        case BinaryOpNode::kSubtract: stream_ << " - "; break;
-        default: stream_ << " ? "; break;
-      }
+      stream_ << " " << BinaryOpNode::GetOperator(node->GetKind()) << " ";
       node->GetRight()->Visit(this);
     }
 
@@ -62,6 +58,37 @@ namespace GLSLTools{
     void VisitLoadLocal(LoadLocalNode* node){
       stream_ << "$" << node->GetLocal()->GetName();
     }
+
+    void VisitCall(CallNode* node){
+      stream_ << node->GetTarget() << "()";
+    }
+
+    void VisitIf(IfNode* node){
+      Adjust();
+      stream_ << "if ";
+      node->GetCondition()->Visit(this);
+      stream_ << std::endl;
+      node->GetThen()->Visit(this);
+      if(node->HasElse()){
+        Adjust();
+        stream_ << "else" << std::endl;
+        node->GetElse()->Visit(this);
+      }
+    }
+
+    void VisitFor(ForNode* node){
+      Adjust();
+      stream_ << "loop" << std::endl;
+      indent_++;
+      if(node->GetInit() != nullptr) node->GetInit()->Visit(this);
+      Adjust();
+      stream_ << "while ";
+      node->GetCondition()->Visit(this);
+      stream_ << std::endl;
+      if(node->GetStep() != nullptr) node->GetStep()->Visit(this);
+      indent_--;
+      node->GetBody()->Visit(this);
+    }
   };
 }
 
@@ -0,0 +1,1075 @@
+#include "binary_module.h"
+#include "glsl_emitter.h"
+#include "trace.h"
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+namespace GLSLTools{
+  const uint32_t BinaryModule::kMagic;
+  const uint32_t BinaryModule::kVersion;
+  const size_t BinaryModule::kHeaderSize;
+
+  static const size_t kWordCountShift = 16;
+  static const uint32_t kOpcodeMask = 0xFFFF;
+
+  const char* BinaryModule::GetOpcodeName(Opcode opcode){
+    switch(opcode){
+    #define DEFINE_NAME(Name, Layout) case kOp##Name: return "Op" #Name;
+      FOR_EACH_OPCODE(DEFINE_NAME)
+    #undef DEFINE_NAME
+      default: return "OpUnknown";
+    }
+  }
+
+  const char* BinaryModule::GetOpcodeLayout(Opcode opcode){
+    switch(opcode){
+    #define DEFINE_LAYOUT(Name, Layout) case kOp##Name: return Layout;
+      FOR_EACH_OPCODE(DEFINE_LAYOUT)
+    #undef DEFINE_LAYOUT
+      default: return "";
+    }
+  }
+
+  BinaryModule::BinaryModule(const uint32_t* words, size_t count):
+    words_(count){
+    for(size_t i = 0; i < count; i++){
+      words_.Add(words[i]);
+    }
+  }
+
+  // Words of a scalar constant, two for a double
+  static size_t GetValueWords(Type* type){
+    return type == Type::DOUBLE ? 2 : 1;
+  }
+
+  static size_t GetStringWords(const std::string& text){
+    return text.size() / sizeof(uint32_t) + 1;
+  }
+
+  // Reads the string starting at words, false if it runs past end
+  static bool ReadString(const uint32_t* words, const uint32_t* end, std::string* text, size_t* length){
+    const char* bytes = reinterpret_cast<const char*>(words);
+    size_t limit = static_cast<size_t>(end - words) * sizeof(uint32_t);
+    const void* nul = memchr(bytes, '\0', limit);
+    if(nul == nullptr) return false;
+    text->assign(bytes, static_cast<const char*>(nul) - bytes);
+    *length = GetStringWords(*text);
+    return true;
+  }
+
+  // Lowers the tree in post order. Declarations go to their own stream,
+  // appended ahead of the functions once every type and constant is known.
+  class ModuleEncoder : public AstNodeVisitor{
+  private:
+    Array<uint32_t> declarations_;
+    Array<uint32_t> code_;
+    uint32_t next_id_;
+    std::unordered_map<Type*, uint32_t> types_;
+    std::unordered_map<std::string, uint32_t> constants_;
+    std::unordered_map<LocalVariable*, uint32_t> locals_;
+    uint32_t result_;
+    std::string error_;
+
+    uint32_t NewId(){
+      return next_id_++;
+    }
+
+    void SetError(const std::string& error){
+      if(error_.empty()) error_ = error;
+    }
+
+    static void Emit(Array<uint32_t>* stream, BinaryModule::Opcode opcode, std::initializer_list<uint32_t> operands){
+      stream->Add(static_cast<uint32_t>((operands.size() + 1) << kWordCountShift) | opcode);
+      for(auto operand : operands) stream->Add(operand);
+    }
+
+    static void EmitName(Array<uint32_t>* stream, uint32_t id, const std::string& name){
+      size_t length = GetStringWords(name);
+      stream->Add(static_cast<uint32_t>((length + 2) << kWordCountShift) | BinaryModule::kOpName);
+      stream->Add(id);
+      size_t start = stream->Length();
+      for(size_t i = 0; i < length; i++) stream->Add(0);
+      memcpy(&(*stream)[start], name.data(), name.size());
+    }
+
+    uint32_t GetType(Type* type){
+      auto pos = types_.find(type);
+      if(pos != types_.end()) return pos->second;
+
+      uint32_t id;
+      if(type == Type::VOID){
+        Emit(&declarations_, BinaryModule::kOpTypeVoid, { id = NewId() });
+      } else if(type == Type::BOOL){
+        Emit(&declarations_, BinaryModule::kOpTypeBool, { id = NewId() });
+      } else if(type == Type::INT || type == Type::UINT){
+        Emit(&declarations_, BinaryModule::kOpTypeInt, { id = NewId(), 32u, type == Type::INT ? 1u : 0u });
+      } else if(type == Type::FLOAT || type == Type::DOUBLE){
+        Emit(&declarations_, BinaryModule::kOpTypeFloat, { id = NewId(), type == Type::FLOAT ? 32u : 64u });
+      } else if(type == Type::VEC2 || type == Type::VEC3 || type == Type::VEC4){
+        uint32_t component = GetType(Type::FLOAT);
+        Emit(&declarations_, BinaryModule::kOpTypeVector, { id = NewId(), component, static_cast<uint32_t>(type->GetSize()) });
+      } else{
+        SetError("Cannot encode type: " + type->GetName());
+        return 0;
+      }
+      types_.insert({ type, id });
+      return id;
+    }
+
+    uint32_t GetConstant(Value* value){
+      // equal constants share their id, keyed by type and bits
+      std::string key;
+      uint32_t words[2] = { 0, 0 };
+      std::vector<uint32_t> components;
+      if(value == nullptr){
+        key = "undef";
+      } else if(value->IsScalar()){
+        for(size_t i = 0; i < value->GetScalarSize(); i++){
+          components.push_back(GetConstant(value->GetAt(i)));
+        }
+        key = value->GetType()->GetName();
+        key.append(reinterpret_cast<const char*>(components.data()), components.size() * sizeof(uint32_t));
+      } else{
+        Type* type = value->GetType();
+        if(type == Type::DOUBLE){
+          double number = value->AsDouble();
+          memcpy(words, &number, sizeof(number));
+        } else if(type == Type::FLOAT){
+          float number = value->AsFloat();
+          memcpy(words, &number, sizeof(number));
+        } else{
+          words[0] = value->AsUInt();
+        }
+        key = type->GetName();
+        key.append(reinterpret_cast<const char*>(words), GetValueWords(type) * sizeof(uint32_t));
+      }
+      auto pos = constants_.find(key);
+      if(pos != constants_.end()) return pos->second;
+
+      uint32_t id;
+      if(value == nullptr){
+        Emit(&declarations_, BinaryModule::kOpUndef, { id = NewId() });
+      } else if(value->IsScalar()){
+        uint32_t type = GetType(value->GetType());
+        id = NewId();
+        declarations_.Add(static_cast<uint32_t>((components.size() + 3) << kWordCountShift) | BinaryModule::kOpConstantComposite);
+        declarations_.Add(type);
+        declarations_.Add(id);
+        for(auto component : components) declarations_.Add(component);
+      } else{
+        uint32_t type = GetType(value->GetType());
+        id = NewId();
+        if(GetValueWords(value->GetType()) == 2){
+          Emit(&declarations_, BinaryModule::kOpConstant, { type, id, words[0], words[1] });
+        } else{
+          Emit(&declarations_, BinaryModule::kOpConstant, { type, id, words[0] });
+        }
+      }
+      constants_.insert({ key, id });
+      return id;
+    }
+
+    uint32_t GetLocal(LocalVariable* local){
+      auto pos = locals_.find(local);
+      if(pos != locals_.end()) return pos->second;
+      if(local->IsUniform() || local->GetOwner() == nullptr){
+        SetError("Local used outside of its scope: " + local->GetName());
+        return 0;
+      }
+
+      // any other local missing here is a builtin, declared on first use
+      uint32_t type = GetType(local->GetType());
+      uint32_t id = NewId();
+      EmitName(&declarations_, id, local->GetName());
+      Emit(&declarations_, BinaryModule::kOpBuiltin, { type, id });
+      locals_.insert({ local, id });
+      return id;
+    }
+
+    void DeclareInterface(BinaryModule::Opcode opcode, LocalVariable* local){
+      uint32_t type = GetType(local->GetType());
+      uint32_t id = NewId();
+      EmitName(&declarations_, id, local->GetName());
+      Emit(&declarations_, opcode, { type, id, static_cast<uint32_t>(local->GetPrecision()), static_cast<uint32_t>(local->GetLocation()) });
+      locals_.insert({ local, id });
+    }
+
+    uint32_t Lower(AstNode* node){
+      result_ = 0;
+      node->Visit(this);
+      return result_;
+    }
+
+    void Statements(SequenceNode* node){
+      for(size_t i = 0; i < node->GetChildrenSize(); i++){
+        AstNode* child = node->GetChildAt(i);
+        if(child->IsLiteral() || child->IsBinaryOp() || child->IsLoadLocal() || child->IsCall()){
+          SetError("Expression used as a statement");
+          continue;
+        }
+        child->Visit(this);
+      }
+    }
+  public:
+    ModuleEncoder():
+      declarations_(256),
+      code_(1024),
+      next_id_(1),
+      types_(),
+      constants_(),
+      locals_(),
+      result_(0),
+      error_(){}
+    ~ModuleEncoder(){}
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    void Encode(CodeUnit* unit, Array<uint32_t>* words){
+      for(size_t i = 0; i < unit->GetNumberOfUniforms(); i++){
+        LocalVariable* uniform = unit->GetUniformAt(i);
+        uint32_t type = GetType(uniform->GetType());
+        uint32_t id = NewId();
+        EmitName(&declarations_, id, uniform->GetName());
+        Emit(&declarations_, BinaryModule::kOpUniform, { type, id, static_cast<uint32_t>(uniform->GetPrecision()) });
+        locals_.insert({ uniform, id });
+      }
+      for(size_t i = 0; i < unit->GetNumberOfInputs(); i++){
+        DeclareInterface(BinaryModule::kOpInput, unit->GetInputAt(i));
+      }
+      for(size_t i = 0; i < unit->GetNumberOfOutputs(); i++){
+        DeclareInterface(BinaryModule::kOpOutput, unit->GetOutputAt(i));
+      }
+
+      for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+        Function* func = unit->GetFunctionAt(i);
+        uint32_t type = GetType(func->GetResultType());
+        uint32_t id = NewId();
+        EmitName(&code_, id, func->GetName());
+        Emit(&code_, BinaryModule::kOpFunction, { type, id });
+        Statements(func->GetCode());
+        Emit(&code_, BinaryModule::kOpFunctionEnd, {});
+      }
+
+      words->Add(BinaryModule::kMagic);
+      words->Add(BinaryModule::kVersion);
+      words->Add(0);
+      words->Add(next_id_);
+      words->Add(0);
+      words->Reserve(words->Length() + declarations_.Length() + code_.Length());
+      for(auto word : declarations_) words->Add(word);
+      for(auto word : code_) words->Add(word);
+    }
+
+    void VisitSequence(SequenceNode* node){
+      Emit(&code_, BinaryModule::kOpBlock, {});
+      Statements(node);
+      Emit(&code_, BinaryModule::kOpBlockEnd, {});
+    }
+
+    void VisitLiteral(LiteralNode* node){
+      result_ = GetConstant(node->GetValue());
+    }
+
+    void VisitReturn(ReturnNode* node){
+      if(node->GetValue() == nullptr){
+        Emit(&code_, BinaryModule::kOpReturn, {});
+        return;
+      }
+      uint32_t value = Lower(node->GetValue());
+      Emit(&code_, BinaryModule::kOpReturn, { value });
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      uint32_t left = Lower(node->GetLeft());
+      uint32_t right = Lower(node->GetRight());
+      BinaryModule::Opcode opcode = static_cast<BinaryModule::Opcode>(BinaryModule::kOpAdd + node->GetKind());
+      if(node->GetKind() >= BinaryOpNode::kUnknown){
+        SetError("Unknown binary operator");
+        opcode = BinaryModule::kOpAdd;
+      }
+      Emit(&code_, opcode, { result_ = NewId(), left, right });
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      uint32_t local = GetLocal(node->GetLocal());
+      Emit(&code_, BinaryModule::kOpLoad, { result_ = NewId(), local });
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      // the initializer is lowered first, it can't see the local it defines
+      uint32_t value = Lower(node->GetValue());
+      LocalVariable* local = node->GetLocal();
+      uint32_t id;
+      if(node->IsDeclaration()){
+        uint32_t type = GetType(local->GetType());
+        id = NewId();
+        EmitName(&code_, id, local->GetName());
+        Emit(&code_, BinaryModule::kOpVariable, { type, id, static_cast<uint32_t>(local->GetPrecision()) });
+        locals_[local] = id;
+      } else{
+        id = GetLocal(local);
+      }
+      Emit(&code_, BinaryModule::kOpStore, { id, value });
+    }
+
+    void VisitCall(CallNode* node){
+      const std::string& target = node->GetTarget();
+      size_t length = GetStringWords(target);
+      code_.Add(static_cast<uint32_t>((length + 2) << kWordCountShift) | BinaryModule::kOpCall);
+      code_.Add(result_ = NewId());
+      size_t start = code_.Length();
+      for(size_t i = 0; i < length; i++) code_.Add(0);
+      memcpy(&code_[start], target.data(), target.size());
+    }
+
+    void VisitIf(IfNode* node){
+      uint32_t condition = Lower(node->GetCondition());
+      Emit(&code_, BinaryModule::kOpIf, { condition });
+      Statements(node->GetThen());
+      if(node->HasElse()){
+        Emit(&code_, BinaryModule::kOpElse, {});
+        Statements(node->GetElse());
+      }
+      Emit(&code_, BinaryModule::kOpEndIf, {});
+    }
+
+    void VisitFor(ForNode* node){
+      Emit(&code_, BinaryModule::kOpLoop, {});
+      if(node->GetInit() != nullptr) node->GetInit()->Visit(this);
+      Emit(&code_, BinaryModule::kOpLoopCondition, {});
+      uint32_t condition = Lower(node->GetCondition());
+      Emit(&code_, BinaryModule::kOpLoopStep, { condition });
+      if(node->GetStep() != nullptr) node->GetStep()->Visit(this);
+      Emit(&code_, BinaryModule::kOpLoopBody, {});
+      Statements(node->GetBody());
+      Emit(&code_, BinaryModule::kOpLoopEnd, {});
+    }
+  };
+
+  BinaryModule* BinaryModule::Encode(CodeUnit* unit, std::string* error){
+    TRACE_SCOPE("EncodeModule", "binary");
+    BinaryModule* module = new BinaryModule();
+    ModuleEncoder encoder;
+    encoder.Encode(unit, &module->words_);
+    if(!encoder.GetError().empty()){
+      *error = encoder.GetError();
+      delete module;
+      return nullptr;
+    }
+    return module;
+  }
+
+  // Walks the instructions of a module, checking each fits its layout
+  class InstructionReader{
+  private:
+    const uint32_t* words_;
+    size_t count_;
+    size_t pos_;
+    std::string error_;
+  public:
+    BinaryModule::Opcode opcode;
+    const uint32_t* operands;
+    size_t length;
+
+    InstructionReader(const uint32_t* words, size_t count):
+      words_(words),
+      count_(count),
+      pos_(BinaryModule::kHeaderSize),
+      error_(),
+      opcode(BinaryModule::kNumberOfOpcodes),
+      operands(nullptr),
+      length(0){}
+    ~InstructionReader(){}
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    bool CheckHeader(){
+      if(count_ < BinaryModule::kHeaderSize || words_[0] != BinaryModule::kMagic){
+        error_ = "Not a module";
+        return false;
+      }
+      if(words_[1] != BinaryModule::kVersion){
+        error_ = "Unsupported module version";
+        return false;
+      }
+      return true;
+    }
+
+    uint32_t GetBound() const{
+      return words_[3];
+    }
+
+    size_t GetOffset() const{
+      return pos_;
+    }
+
+    bool AtEnd() const{
+      return pos_ >= count_;
+    }
+
+    // Moves to the next instruction, false at the end or on a malformed one
+    bool Next(){
+      if(AtEnd() || !error_.empty()) return false;
+      uint32_t word = words_[pos_];
+      size_t words = word >> kWordCountShift;
+      if(words == 0 || pos_ + words > count_){
+        error_ = "Truncated instruction at word " + std::to_string(pos_);
+        return false;
+      }
+      if((word & kOpcodeMask) >= BinaryModule::kNumberOfOpcodes){
+        error_ = "Unknown opcode " + std::to_string(word & kOpcodeMask) + " at word " + std::to_string(pos_);
+        return false;
+      }
+      opcode = static_cast<BinaryModule::Opcode>(word & kOpcodeMask);
+      operands = &words_[pos_ + 1];
+      length = words - 1;
+
+      // fixed layouts are checked here, strings and values by their readers
+      const char* layout = BinaryModule::GetOpcodeLayout(opcode);
+      size_t fixed = 0;
+      bool open = false;
+      for(const char* c = layout; *c != '\0'; c++){
+        if(*c == '*' || *c == 's' || *c == 'v'){
+          open = true;
+        } else{
+          fixed++;
+        }
+      }
+      if(length < fixed || (!open && length != fixed)){
+        error_ = std::string("Wrong operand count for ") + BinaryModule::GetOpcodeName(opcode) + " at word " + std::to_string(pos_);
+        return false;
+      }
+      pos_ += words;
+      return true;
+    }
+  };
+
+  // Rebuilds a CodeUnit, resolving every id to the entry defining it
+  class ModuleDecoder{
+  private:
+    enum Kind{
+      kFree,
+      kType,
+      kConstant,
+      kUndef,
+      kVariable,
+      kExpression,
+      kFunction
+    };
+
+    struct Entry{
+      Kind kind;
+      Type* type;
+      Value* value;
+      LocalVariable* local;
+      AstNode* node;
+    };
+
+    InstructionReader reader_;
+    CodeUnit* unit_;
+    std::vector<Entry> ids_;
+    std::unordered_map<uint32_t, std::string> names_;
+    std::string error_;
+
+    bool Fail(const std::string& error){
+      if(error_.empty()) error_ = error;
+      return false;
+    }
+
+    bool Define(uint32_t id, const Entry& entry){
+      if(id == 0 || id >= ids_.size()) return Fail("Id out of bounds: " + std::to_string(id));
+      if(ids_[id].kind != kFree) return Fail("Id defined twice: " + std::to_string(id));
+      ids_[id] = entry;
+      return true;
+    }
+
+    Type* GetType(uint32_t id){
+      if(id >= ids_.size() || ids_[id].kind != kType){
+        Fail("Not a type: " + std::to_string(id));
+        return nullptr;
+      }
+      return ids_[id].type;
+    }
+
+    LocalVariable* GetVariable(uint32_t id){
+      if(id >= ids_.size() || ids_[id].kind != kVariable){
+        Fail("Not a variable: " + std::to_string(id));
+        return nullptr;
+      }
+      return ids_[id].local;
+    }
+
+    std::string TakeName(uint32_t id){
+      auto pos = names_.find(id);
+      if(pos == names_.end()){
+        Fail("Missing name for id " + std::to_string(id));
+        return std::string();
+      }
+      std::string name = pos->second;
+      names_.erase(pos);
+      return name;
+    }
+
+    // Constants are copied on every use, expressions are moved out
+    AstNode* TakeOperand(uint32_t id){
+      if(id >= ids_.size()){
+        Fail("Id out of bounds: " + std::to_string(id));
+        return nullptr;
+      }
+      Entry& entry = ids_[id];
+      switch(entry.kind){
+        case kConstant: return new LiteralNode(entry.value->Copy());
+        case kUndef: return new LiteralNode(nullptr);
+        case kExpression:{
+          AstNode* node = entry.node;
+          if(node == nullptr){
+            Fail("Expression used twice: " + std::to_string(id));
+            return nullptr;
+          }
+          entry.node = nullptr;
+          return node;
+        }
+        default:
+          Fail("Not a value: " + std::to_string(id));
+          return nullptr;
+      }
+    }
+
+    bool ReadValue(Type* type, Value** result){
+      size_t words = GetValueWords(type);
+      if(reader_.length != 2 + words) return Fail("Wrong operand count for OpConstant");
+      const uint32_t* bits = reader_.operands + 2;
+      if(type == Type::DOUBLE){
+        double number;
+        memcpy(&number, bits, sizeof(number));
+        *result = Value::NewInstance(number, true);
+      } else if(type == Type::FLOAT){
+        float number;
+        memcpy(&number, bits, sizeof(number));
+        *result = Value::NewInstance(number, true);
+      } else if(type == Type::INT){
+        *result = Value::NewInstance(static_cast<int>(bits[0]), true);
+      } else if(type == Type::UINT){
+        *result = Value::NewInstance(static_cast<unsigned int>(bits[0]), true);
+      } else if(type == Type::BOOL){
+        *result = Value::NewInstance(bits[0] != 0, true);
+      } else{
+        return Fail("Constant of type " + type->GetName());
+      }
+      return true;
+    }
+
+    bool Declare(){
+      const uint32_t* ops = reader_.operands;
+      switch(reader_.opcode){
+        case BinaryModule::kOpTypeVoid: return Define(ops[0], { kType, Type::VOID, nullptr, nullptr, nullptr });
+        case BinaryModule::kOpTypeBool: return Define(ops[0], { kType, Type::BOOL, nullptr, nullptr, nullptr });
+        case BinaryModule::kOpTypeInt:
+          if(ops[1] != 32) return Fail("Unsupported int width: " + std::to_string(ops[1]));
+          return Define(ops[0], { kType, ops[2] != 0 ? Type::INT : Type::UINT, nullptr, nullptr, nullptr });
+        case BinaryModule::kOpTypeFloat:
+          if(ops[1] != 32 && ops[1] != 64) return Fail("Unsupported float width: " + std::to_string(ops[1]));
+          return Define(ops[0], { kType, ops[1] == 32 ? Type::FLOAT : Type::DOUBLE, nullptr, nullptr, nullptr });
+        case BinaryModule::kOpTypeVector:{
+          Type* component = GetType(ops[1]);
+          if(component == nullptr) return false;
+          if(component != Type::FLOAT || ops[2] < 2 || ops[2] > 4) return Fail("Unsupported vector type");
+          Type* type = ops[2] == 2 ? Type::VEC2 : (ops[2] == 3 ? Type::VEC3 : Type::VEC4);
+          return Define(ops[0], { kType, type, nullptr, nullptr, nullptr });
+        }
+        case BinaryModule::kOpConstant:{
+          Type* type = GetType(ops[0]);
+          Value* value = nullptr;
+          if(type == nullptr || !ReadValue(type, &value)) return false;
+          if(!Define(ops[1], { kConstant, type, value, nullptr, nullptr })){
+            delete value;
+            return false;
+          }
+          return true;
+        }
+        case BinaryModule::kOpConstantComposite:{
+          Type* type = GetType(ops[0]);
+          if(type == nullptr) return false;
+          size_t size = reader_.length - 2;
+          if(type->GetSize() != size || type->IsCompatibile(*Type::INT) || size < 2) return Fail("Composite constant doesn't match its type");
+          Value* value = Value::NewVector(size);
+          for(size_t i = 0; i < size; i++){
+            uint32_t component = ops[2 + i];
+            if(component < ids_.size() && ids_[component].kind == kUndef) continue;
+            if(component >= ids_.size() || ids_[component].kind != kConstant || ids_[component].value->IsScalar()){
+              delete value;
+              return Fail("Not a scalar constant: " + std::to_string(component));
+            }
+            value->SetAt(i, ids_[component].value->Copy());
+          }
+          if(!Define(ops[1], { kConstant, type, value, nullptr, nullptr })){
+            delete value;
+            return false;
+          }
+          return true;
+        }
+        case BinaryModule::kOpUndef: return Define(ops[0], { kUndef, nullptr, nullptr, nullptr, nullptr });
+        case BinaryModule::kOpUniform:
+        case BinaryModule::kOpInput:
+        case BinaryModule::kOpOutput:
+        case BinaryModule::kOpBuiltin:{
+          Type* type = GetType(ops[0]);
+          if(type == nullptr) return false;
+          std::string name = TakeName(ops[1]);
+          if(!error_.empty()) return false;
+          LocalVariable* local;
+          if(reader_.opcode == BinaryModule::kOpBuiltin){
+            if(!unit_->GetGlobals()->LocalLookup(name, &local) || local->IsUniform() || local->GetInterface() != kNoInterface || local->GetType() != type) return Fail("Unknown builtin: " + name);
+          } else{
+            if(ops[2] > kHighPrecision) return Fail("Invalid precision: " + std::to_string(ops[2]));
+            int location = static_cast<int>(ops[reader_.length - 1]);
+            if(reader_.opcode != BinaryModule::kOpUniform && location < LocalVariable::kNoLocation) return Fail("Invalid location for " + name);
+            local = new LocalVariable(name, type, static_cast<Precision>(ops[2]));
+            bool added;
+            if(reader_.opcode == BinaryModule::kOpUniform){
+              added = unit_->AddUniform(local);
+            } else{
+              local->SetLocation(location);
+              added = reader_.opcode == BinaryModule::kOpInput ? unit_->AddInput(local) : unit_->AddOutput(local);
+            }
+            if(!added){
+              delete local;
+              return Fail("Redefinition of " + name);
+            }
+          }
+          return Define(ops[1], { kVariable, type, nullptr, local, nullptr });
+        }
+        default: return Fail(std::string("Unexpected ") + BinaryModule::GetOpcodeName(reader_.opcode) + " among declarations");
+      }
+    }
+
+    // Reads statements into statements until one of the instructions closing
+    // a structured part, which is returned
+    BinaryModule::Opcode ReadStatements(LocalScope* scope, std::vector<AstNode*>* statements){
+      LocalVariable* declared = nullptr;
+      while(reader_.Next()){
+        const uint32_t* ops = reader_.operands;
+        BinaryModule::Opcode opcode = reader_.opcode;
+        switch(opcode){
+          case BinaryModule::kOpFunctionEnd:
+          case BinaryModule::kOpBlockEnd:
+          case BinaryModule::kOpElse:
+          case BinaryModule::kOpEndIf:
+          case BinaryModule::kOpLoopCondition:
+          case BinaryModule::kOpLoopStep:
+          case BinaryModule::kOpLoopBody:
+          case BinaryModule::kOpLoopEnd:
+            if(declared != nullptr) Fail("Variable without its store: " + declared->GetName());
+            return opcode;
+          case BinaryModule::kOpName:{
+            std::string name;
+            size_t length;
+            if(!ReadString(ops + 1, ops + reader_.length, &name, &length) || length + 1 != reader_.length){
+              Fail("Malformed string");
+              break;
+            }
+            names_[ops[0]] = name;
+            break;
+          }
+          case BinaryModule::kOpLoad:{
+            LocalVariable* local = GetVariable(ops[1]);
+            if(local == nullptr) break;
+            AstNode* node = new LoadLocalNode(local);
+            if(!Define(ops[0], { kExpression, nullptr, nullptr, nullptr, node })) delete node;
+            break;
+          }
+          case BinaryModule::kOpAdd:
+          case BinaryModule::kOpSubtract:
+          case BinaryModule::kOpDivide:
+          case BinaryModule::kOpMultiply:
+          case BinaryModule::kOpLess:
+          case BinaryModule::kOpLessEqual:
+          case BinaryModule::kOpGreater:
+          case BinaryModule::kOpGreaterEqual:
+          case BinaryModule::kOpEqual:
+          case BinaryModule::kOpNotEqual:{
+            AstNode* left = TakeOperand(ops[1]);
+            AstNode* right = TakeOperand(ops[2]);
+            BinaryOpNode::Kind kind = static_cast<BinaryOpNode::Kind>(opcode - BinaryModule::kOpAdd);
+            AstNode* node = new BinaryOpNode(kind, left, right);
+            if(left == nullptr || right == nullptr || !Define(ops[0], { kExpression, nullptr, nullptr, nullptr, node })) delete node;
+            break;
+          }
+          case BinaryModule::kOpCall:{
+            std::string target;
+            size_t length;
+            if(!ReadString(ops + 1, ops + reader_.length, &target, &length) || length + 1 != reader_.length){
+              Fail("Malformed string");
+              break;
+            }
+            AstNode* node = new CallNode(target);
+            if(!Define(ops[0], { kExpression, nullptr, nullptr, nullptr, node })) delete node;
+            break;
+          }
+          case BinaryModule::kOpVariable:{
+            Type* type = GetType(ops[0]);
+            std::string name = TakeName(ops[1]);
+            if(type == nullptr || !error_.empty()) break;
+            if(ops[2] > kHighPrecision){
+              Fail("Invalid precision: " + std::to_string(ops[2]));
+              break;
+            }
+            // added to the scope by its store, after the initializer
+            declared = new LocalVariable(name, type, static_cast<Precision>(ops[2]));
+            if(!Define(ops[1], { kVariable, type, nullptr, declared, nullptr })){
+              delete declared;
+              declared = nullptr;
+            }
+            break;
+          }
+          case BinaryModule::kOpStore:{
+            AstNode* value = TakeOperand(ops[1]);
+            LocalVariable* local = GetVariable(ops[0]);
+            if(value == nullptr || local == nullptr){
+              delete value;
+              break;
+            }
+            bool declaration = local == declared;
+            if(declaration){
+              declared = nullptr;
+              if(!scope->AddLocal(local)){
+                Fail("Redefinition of local: " + local->GetName());
+                // unowned, the entry keeps it for the destructor
+                delete value;
+                break;
+              }
+            } else if(local->GetOwner() == nullptr){
+              Fail("Store to a variable without a scope: " + local->GetName());
+              delete value;
+              break;
+            }
+            statements->push_back(new StoreLocalNode(local, value, declaration));
+            break;
+          }
+          case BinaryModule::kOpReturn:{
+            AstNode* value = nullptr;
+            if(reader_.length > 1){
+              Fail("Wrong operand count for OpReturn");
+              break;
+            }
+            if(reader_.length == 1 && (value = TakeOperand(ops[0])) == nullptr) break;
+            statements->push_back(new ReturnNode(value));
+            break;
+          }
+          case BinaryModule::kOpBlock:{
+            SequenceNode* block = new SequenceNode(scope);
+            statements->push_back(block);
+            ReadBlock(block, BinaryModule::kOpBlockEnd);
+            break;
+          }
+          case BinaryModule::kOpIf:{
+            AstNode* condition = TakeOperand(ops[0]);
+            if(condition == nullptr) break;
+            SequenceNode* then_block = new SequenceNode(scope);
+            SequenceNode* else_block = nullptr;
+            if(ReadBlock(then_block, BinaryModule::kOpElse, BinaryModule::kOpEndIf) == BinaryModule::kOpElse){
+              else_block = new SequenceNode(scope);
+              ReadBlock(else_block, BinaryModule::kOpEndIf);
+            }
+            statements->push_back(new IfNode(condition, then_block, else_block));
+            break;
+          }
+          case BinaryModule::kOpLoop: ReadLoop(scope, statements); break;
+          default: Fail(std::string("Unexpected ") + BinaryModule::GetOpcodeName(opcode) + " in a function");
+        }
+        if(!error_.empty()) return BinaryModule::kNumberOfOpcodes;
+      }
+      if(error_.empty()) Fail(!reader_.GetError().empty() ? reader_.GetError() : "Unexpected end of module");
+      return BinaryModule::kNumberOfOpcodes;
+    }
+
+    BinaryModule::Opcode ReadBlock(SequenceNode* block, BinaryModule::Opcode end, BinaryModule::Opcode other = BinaryModule::kNumberOfOpcodes){
+      std::vector<AstNode*> statements;
+      BinaryModule::Opcode opcode = ReadStatements(block->GetScope(), &statements);
+      for(auto statement : statements) block->Add(statement);
+      if(error_.empty() && opcode != end && opcode != other){
+        Fail(std::string("Unexpected ") + BinaryModule::GetOpcodeName(opcode));
+      }
+      return opcode;
+    }
+
+    // A part of a loop holding at most one statement
+    AstNode* ReadPart(LocalScope* scope, BinaryModule::Opcode end){
+      std::vector<AstNode*> statements;
+      BinaryModule::Opcode opcode = ReadStatements(scope, &statements);
+      if(error_.empty() && (opcode != end || statements.size() > 1 || (statements.size() == 1 && !statements[0]->IsStoreLocal()))){
+        Fail("Malformed loop");
+      }
+      if(!error_.empty()){
+        for(auto statement : statements) delete statement;
+        return nullptr;
+      }
+      return statements.empty() ? nullptr : statements[0];
+    }
+
+    void ReadLoop(LocalScope* scope, std::vector<AstNode*>* statements){
+      ForNode* loop = new ForNode(scope);
+      statements->push_back(loop);
+      loop->SetInit(ReadPart(loop->GetScope(), BinaryModule::kOpLoopCondition));
+      if(!error_.empty()) return;
+      std::vector<AstNode*> none;
+      if(ReadStatements(loop->GetScope(), &none) != BinaryModule::kOpLoopStep || !none.empty()){
+        for(auto statement : none) delete statement;
+        Fail("Malformed loop");
+        return;
+      }
+      loop->SetCondition(TakeOperand(reader_.operands[0]));
+      if(loop->GetCondition() == nullptr) return;
+      loop->SetStep(ReadPart(loop->GetScope(), BinaryModule::kOpLoopBody));
+      if(!error_.empty()) return;
+      loop->SetBody(new SequenceNode(loop->GetScope()));
+      ReadBlock(loop->GetBody(), BinaryModule::kOpLoopEnd);
+    }
+
+    bool ReadFunction(){
+      const uint32_t* ops = reader_.operands;
+      Type* type = GetType(ops[0]);
+      std::string name = TakeName(ops[1]);
+      if(type == nullptr || !error_.empty()) return false;
+      if(!Define(ops[1], { kFunction, type, nullptr, nullptr, nullptr })) return false;
+      SequenceNode* code = new SequenceNode(unit_->GetGlobals());
+      unit_->AddFunction(new Function(name, type, code));
+      ReadBlock(code, BinaryModule::kOpFunctionEnd);
+      return error_.empty();
+    }
+  public:
+    ModuleDecoder(const uint32_t* words, size_t count):
+      reader_(words, count),
+      unit_(nullptr),
+      ids_(),
+      names_(),
+      error_(){}
+    ~ModuleDecoder(){
+      for(auto& entry : ids_){
+        delete entry.value;
+        delete entry.node;
+        // declared but never stored, so no scope owns it
+        if(entry.kind == kVariable && entry.local != nullptr && entry.local->GetOwner() == nullptr) delete entry.local;
+      }
+      delete unit_;
+    }
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    CodeUnit* Decode(){
+      if(!reader_.CheckHeader()){
+        Fail(reader_.GetError());
+        return nullptr;
+      }
+      // every id is below the bound, so this also caps what a module can allocate
+      if(reader_.GetBound() > 4 * reader_.GetOffset() + 4 * 1024 * 1024){
+        Fail("Id bound out of range");
+        return nullptr;
+      }
+      ids_.assign(reader_.GetBound(), Entry{ kFree, nullptr, nullptr, nullptr, nullptr });
+      unit_ = new CodeUnit();
+
+      while(error_.empty() && reader_.Next()){
+        if(reader_.opcode == BinaryModule::kOpName){
+          std::string name;
+          size_t length;
+          const uint32_t* ops = reader_.operands;
+          if(!ReadString(ops + 1, ops + reader_.length, &name, &length) || length + 1 != reader_.length){
+            Fail("Malformed string");
+          } else{
+            names_[ops[0]] = name;
+          }
+        } else if(reader_.opcode == BinaryModule::kOpFunction){
+          ReadFunction();
+        } else{
+          Declare();
+        }
+      }
+      if(error_.empty() && !reader_.GetError().empty()) Fail(reader_.GetError());
+      if(!error_.empty()) return nullptr;
+
+      CodeUnit* unit = unit_;
+      unit_ = nullptr;
+      return unit;
+    }
+  };
+
+  CodeUnit* BinaryModule::Decode(std::string* error) const{
+    TRACE_SCOPE("DecodeModule", "binary");
+    ModuleDecoder decoder(GetWords(), GetNumberOfWords());
+    CodeUnit* unit = decoder.Decode();
+    if(unit == nullptr) *error = decoder.GetError();
+    return unit;
+  }
+
+  bool BinaryModule::Disassemble(std::ostream& stream, std::string* error) const{
+    InstructionReader reader(GetWords(), GetNumberOfWords());
+    if(!reader.CheckHeader()){
+      *error = reader.GetError();
+      return false;
+    }
+    stream << "; Version: " << (kVersion >> 16) << "." << ((kVersion >> 8) & 0xFF) << std::endl;
+    stream << "; Bound: " << reader.GetBound() << std::endl;
+
+    // constants are printed by the type they were declared with
+    std::unordered_map<uint32_t, Type*> types;
+    int indent = 0;
+    while(reader.Next()){
+      Opcode opcode = reader.opcode;
+      const uint32_t* ops = reader.operands;
+      const char* layout = GetOpcodeLayout(opcode);
+      if(opcode == kOpFunctionEnd || opcode == kOpBlockEnd || opcode == kOpEndIf || opcode == kOpLoopEnd) indent--;
+
+      std::stringstream line;
+      for(int i = 0; i < indent; i++) line << "  ";
+      size_t idx = 0;
+      if(layout[0] == 'r'){
+        line << "%" << ops[idx++] << " = ";
+      } else if(strlen(layout) > 1 && layout[1] == 'r'){
+        // the type comes first in the words but reads better after the result
+        line << "%" << ops[1] << " = ";
+      }
+      line << GetOpcodeName(opcode);
+      for(const char* c = layout; *c != '\0' && idx < reader.length; c++){
+        if(*c == 'r'){
+          if(c != layout) idx++;
+          continue;
+        }
+        switch(*c){
+          case 'i':
+            line << " %" << ops[idx++];
+            break;
+          case 'l':
+            line << " " << ops[idx++];
+            break;
+          case 'o':
+            if(ops[idx] == ~0u){
+              line << " none";
+            } else{
+              line << " " << ops[idx];
+            }
+            idx++;
+            break;
+          case 'p':
+            line << " " << (ops[idx] <= kHighPrecision && ops[idx] != kDefaultPrecision ? GetPrecisionName(static_cast<Precision>(ops[idx])) : "default");
+            idx++;
+            break;
+          case 's':{
+            std::string text;
+            size_t length;
+            if(!ReadString(ops + idx, ops + reader.length, &text, &length)){
+              *error = "Malformed string";
+              return false;
+            }
+            line << " \"" << text << "\"";
+            idx += length;
+            break;
+          }
+          case 'v':{
+            auto pos = types.find(ops[0]);
+            Type* type = pos != types.end() ? pos->second : nullptr;
+            if(type == nullptr || reader.length - idx != GetValueWords(type)){
+              *error = "Constant of unknown type";
+              return false;
+            }
+            Value* value = nullptr;
+            uint32_t bits[2] = { ops[idx], GetValueWords(type) == 2 ? ops[idx + 1] : 0 };
+            if(type == Type::DOUBLE){
+              double number;
+              memcpy(&number, bits, sizeof(number));
+              value = Value::NewInstance(number, true);
+            } else if(type == Type::FLOAT){
+              float number;
+              memcpy(&number, bits, sizeof(number));
+              value = Value::NewInstance(number, true);
+            } else if(type == Type::BOOL){
+              value = Value::NewInstance(bits[0] != 0, true);
+            } else if(type == Type::UINT){
+              value = Value::NewInstance(static_cast<unsigned int>(bits[0]), true);
+            } else{
+              value = Value::NewInstance(static_cast<int>(bits[0]), true);
+            }
+            line << " ";
+            GlslEmitter emitter(line);
+            emitter.EmitValue(value);
+            delete value;
+            idx = reader.length;
+            break;
+          }
+          case '*':
+            while(idx < reader.length) line << " %" << ops[idx++];
+            break;
+        }
+      }
+      stream << line.str() << std::endl;
+
+      switch(opcode){
+        case kOpTypeVoid: types[ops[0]] = Type::VOID; break;
+        case kOpTypeBool: types[ops[0]] = Type::BOOL; break;
+        case kOpTypeInt: types[ops[0]] = ops[2] != 0 ? Type::INT : Type::UINT; break;
+        case kOpTypeFloat: types[ops[0]] = ops[1] == 64 ? Type::DOUBLE : Type::FLOAT; break;
+        case kOpFunction:
+        case kOpBlock:
+        case kOpIf:
+        case kOpLoop:
+          indent++;
+          break;
+        default: break;
+      }
+    }
+    if(!reader.GetError().empty()){
+      *error = reader.GetError();
+      return false;
+    }
+    return true;
+  }
+
+  bool BinaryModule::WriteFile(const std::string& filename, std::string* error) const{
+    std::ofstream stream(filename, std::ofstream::binary);
+    if(!stream){
+      *error = "Cannot open file: " + filename;
+      return false;
+    }
+    stream.write(reinterpret_cast<const char*>(GetWords()), GetSize());
+    if(!stream){
+      *error = "Cannot write file: " + filename;
+      return false;
+    }
+    return true;
+  }
+
+  BinaryModule* BinaryModule::ReadFile(const std::string& filename, std::string* error){
+    TRACE_SCOPE_DETAIL("ReadModule", "io", filename);
+    std::ifstream stream(filename, std::ifstream::binary);
+    if(!stream){
+      *error = "Cannot open file: " + filename;
+      return nullptr;
+    }
+    std::string data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    if(data.size() % sizeof(uint32_t) != 0){
+      *error = "Module size isn't a multiple of 4 bytes: " + filename;
+      return nullptr;
+    }
+
+    BinaryModule* module = new BinaryModule();
+    size_t count = data.size() / sizeof(uint32_t);
+    module->words_.Reserve(count);
+    for(size_t i = 0; i < count; i++){
+      uint32_t word;
+      memcpy(&word, data.data() + i * sizeof(uint32_t), sizeof(word));
+      module->words_.Add(word);
+    }
+    if(count > 0 && module->words_[0] == __builtin_bswap32(kMagic)){
+      for(auto& word : module->words_) word = __builtin_bswap32(word);
+    }
+    return module;
+  }
+}
@@ -0,0 +1,129 @@
+#ifndef GLSLTOOLS_BINARY_MODULE_H
+#define GLSLTOOLS_BINARY_MODULE_H
+
+#include "ast.h"
+#include "array.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace GLSLTools{
+  // Opcodes with the layout of their operands: r the id an instruction
+  // defines, i an id it uses, l a literal word, p a Precision, o a location
+  // (~0u for none), v the words of a constant of the instruction's type, s a
+  // nul terminated string packed into words and * any number of ids. The binary operations follow the
+  // order of BinaryOpNode::Kind.
+  #define FOR_EACH_OPCODE(V) \
+    V(Name, "is") \
+    V(TypeVoid, "r") \
+    V(TypeBool, "r") \
+    V(TypeInt, "rll") \
+    V(TypeFloat, "rl") \
+    V(TypeVector, "ril") \
+    V(Constant, "irv") \
+    V(ConstantComposite, "ir*") \
+    V(Undef, "r") \
+    V(Uniform, "irp") \
+    V(Builtin, "ir") \
+    V(Input, "irpo") \
+    V(Output, "irpo") \
+    V(Function, "ir") \
+    V(FunctionEnd, "") \
+    V(Block, "") \
+    V(BlockEnd, "") \
+    V(Variable, "irp") \
+    V(Load, "ri") \
+    V(Store, "ii") \
+    V(Add, "rii") \
+    V(Subtract, "rii") \
+    V(Divide, "rii") \
+    V(Multiply, "rii") \
+    V(Less, "rii") \
+    V(LessEqual, "rii") \
+    V(Greater, "rii") \
+    V(GreaterEqual, "rii") \
+    V(Equal, "rii") \
+    V(NotEqual, "rii") \
+    V(Call, "rs") \
+    V(Return, "*") \
+    V(If, "i") \
+    V(Else, "") \
+    V(EndIf, "") \
+    V(Loop, "") \
+    V(LoopCondition, "") \
+    V(LoopStep, "i") \
+    V(LoopBody, "") \
+    V(LoopEnd, "")
+
+  // A CodeUnit lowered to a stream of 32-bit words in the style of SPIR-V,
+  // so a runtime can load shaders without lexing and parsing text. After a
+  // five word header (magic, version, generator, id bound, zero) every
+  // instruction starts with a word holding its length in words in the high
+  // half and its opcode in the low half.
+  //
+  // Types, constants, builtins, uniforms and the stage's inputs and outputs
+  // (with their location, ~0u for none) are declared first, followed by the
+  // functions. Unlike SPIR-V, expressions are trees: every expression
+  // id is used exactly once, and control flow stays structured (If, Else,
+  // EndIf and Loop, LoopCondition, LoopStep, LoopBody, LoopEnd bracket their
+  // parts, Block and BlockEnd a nested scope), so a module decodes back
+  // into the tree it came from. Names precede the instruction defining
+  // their id, results carry no type as the tree implies it, and source
+  // spans aren't kept.
+  class BinaryModule{
+  public:
+    static const uint32_t kMagic = 0x4C534C47;
+    static const uint32_t kVersion = 0x00010100;
+    static const size_t kHeaderSize = 5;
+
+    enum Opcode{
+    #define DEFINE_OPCODE(Name, Layout) kOp##Name,
+      FOR_EACH_OPCODE(DEFINE_OPCODE)
+    #undef DEFINE_OPCODE
+      kNumberOfOpcodes
+    };
+  private:
+    Array<uint32_t> words_;
+
+    BinaryModule():
+      words_(1024){}
+  public:
+    // Copies count words, which are checked by Decode and Disassemble
+    BinaryModule(const uint32_t* words, size_t count);
+    BinaryModule(const BinaryModule& other) = delete;
+    ~BinaryModule(){}
+
+    const uint32_t* GetWords() const{
+      return words_.Length() > 0 ? &words_[0] : nullptr;
+    }
+
+    size_t GetNumberOfWords() const{
+      return words_.Length();
+    }
+
+    size_t GetSize() const{
+      return words_.Length() * sizeof(uint32_t);
+    }
+
+    // Returns a new module owned by the caller, or nullptr and sets error
+    // for trees it has no encoding for
+    static BinaryModule* Encode(CodeUnit* unit, std::string* error);
+
+    // Returns a new CodeUnit owned by the caller, or nullptr and sets error
+    // if the module is malformed
+    CodeUnit* Decode(std::string* error) const;
+
+    // One instruction per line, "%<id> = Op<name> <operands>"
+    bool Disassemble(std::ostream& stream, std::string* error) const;
+
+    bool WriteFile(const std::string& filename, std::string* error) const;
+
+    // Byte swapped modules are swapped back
+    static BinaryModule* ReadFile(const std::string& filename, std::string* error);
+
+    static const char* GetOpcodeName(Opcode opcode);
+    static const char* GetOpcodeLayout(Opcode opcode);
+  };
+}
+
+#endif //GLSLTOOLS_BINARY_MODULE_H
@@ -0,0 +1,85 @@
+#include "compilation.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "ast_printer.h"
+#include "glsl_emitter.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace GLSLTools{
+  Compilation::~Compilation(){
+    delete unit_;
+  }
+
+  bool Compilation::Parse(Parser& parser){
+    delete unit_;
+    error_.clear();
+
+    unit_ = parser.ParseUnit();
+    if(unit_ == nullptr){
+      error_ = parser.GetError();
+      return false;
+    }
+    unit_->SetName(name_);
+    return true;
+  }
+
+  bool Compilation::Parse(const char* data, size_t length){
+    Parser parser(data, length);
+    return Parse(parser);
+  }
+
+  bool Compilation::ParseStream(int fd){
+    Parser parser(fd);
+    return Parse(parser);
+  }
+
+  bool Compilation::ParseParallel(const char* data, size_t length, size_t threads){
+    TokenBuffer* tokens = Tokenizer::Tokenize(data, length, threads);
+    Parser parser(tokens);
+    bool result = Parse(parser);
+    delete tokens;
+    return result;
+  }
+
+  bool Compilation::ParseFile(const std::string& filename){
+    if(name_.empty()) name_ = filename;
+    TRACE_SCOPE_DETAIL("ParseFile", "io", filename);
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0){
+      delete unit_;
+      unit_ = nullptr;
+      error_ = "Cannot open file: " + filename;
+      return false;
+    }
+
+    bool result = ParseStream(fd);
+    close(fd);
+    return result;
+  }
+
+  void Compilation::Run(AstNodeVisitor* pass){
+    if(unit_ == nullptr) return;
+    for(size_t i = 0; i < unit_->GetNumberOfFunctions(); i++){
+      unit_->GetFunctionAt(i)->GetCode()->Visit(pass);
+    }
+  }
+
+  void Compilation::Emit(std::ostream& stream){
+    if(unit_ == nullptr) return;
+    GlslEmitter emitter(stream);
+    emitter.EmitUnit(unit_);
+  }
+
+  void Compilation::Dump(std::ostream& stream){
+    if(unit_ == nullptr) return;
+    AstPrinter printer(stream);
+    for(size_t i = 0; i < unit_->GetNumberOfFunctions(); i++){
+      Function* func = unit_->GetFunctionAt(i);
+      stream << func->GetResultType()->GetName() << " " << func->GetName() << "()" << std::endl;
+      func->GetCode()->Visit(&printer);
+    }
+  }
+}
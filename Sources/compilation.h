@@ -0,0 +1,64 @@
+#ifndef GLSLTOOLS_COMPILATION_H
+#define GLSLTOOLS_COMPILATION_H
+
+#include "ast.h"
+#include <string>
+#include <iostream>
+
+#define GLSLTOOLS_API_VERSION 1
+
+namespace GLSLTools{
+  class Parser;
+
+  // In-process entry point for embedding glsl-tools. A Compilation owns the
+  // CodeUnit it parses and shares no state with other Compilations, so
+  // separate instances can be used from separate threads.
+  class Compilation{
+  private:
+    std::string name_;
+    CodeUnit* unit_;
+    std::string error_;
+
+    bool Parse(Parser& parser);
+  public:
+    Compilation(std::string name = ""):
+      name_(name),
+      unit_(nullptr),
+      error_(){}
+    ~Compilation();
+
+    std::string GetName() const{
+      return name_;
+    }
+
+    CodeUnit* GetUnit() const{
+      return unit_;
+    }
+
+    bool HasError() const{
+      return !error_.empty();
+    }
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    bool Parse(const char* data, size_t length);
+    bool ParseFile(const std::string& filename);
+
+    // Parses from fd as data arrives, without buffering the whole input.
+    // fd is not closed.
+    bool ParseStream(int fd);
+
+    // Lexes data on up to threads threads (0 for all cores) before parsing
+    bool ParseParallel(const char* data, size_t length, size_t threads = 0);
+
+    // Runs the visitor over the body of every function in the unit
+    void Run(AstNodeVisitor* pass);
+
+    void Emit(std::ostream& stream);
+    void Dump(std::ostream& stream);
+  };
+}
+
+#endif //GLSLTOOLS_COMPILATION_H
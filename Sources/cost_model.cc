@@ -0,0 +1,259 @@
+#include "cost_model.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace GLSLTools{
+  const size_t CostEstimator::kMaxTripCount;
+
+  static const char* kCostNames[] = {
+  #define DEFINE_NAME(Name, Text, Default) Text,
+    FOR_EACH_COST(DEFINE_NAME)
+  #undef DEFINE_NAME
+  };
+
+  CostTable::CostTable(){
+  #define SET_DEFAULT(Name, Text, Default) costs_[k##Name] = Default;
+    FOR_EACH_COST(SET_DEFAULT)
+  #undef SET_DEFAULT
+  }
+
+  const char* CostTable::GetName(Cost cost){
+    return kCostNames[cost];
+  }
+
+  double CostTable::GetCost(BinaryOpNode::Kind kind, Type* type) const{
+    size_t components = type->GetSize() > 1 ? type->GetSize() : 1;
+    bool vector = components > 1;
+    switch(kind){
+      case BinaryOpNode::kAdd: return costs_[vector ? kAddVector : kAddScalar] * components;
+      case BinaryOpNode::kSubtract: return costs_[vector ? kSubtractVector : kSubtractScalar] * components;
+      case BinaryOpNode::kMultiply: return costs_[vector ? kMultiplyVector : kMultiplyScalar] * components;
+      case BinaryOpNode::kDivide: return costs_[vector ? kDivideVector : kDivideScalar] * components;
+      default: return 0.0;
+    }
+  }
+
+  bool CostTable::Set(const std::string& name, double cost){
+    for(size_t i = 0; i < kNumberOfCosts; i++){
+      if(name == kCostNames[i]){
+        costs_[i] = cost;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool CostTable::Load(const std::string& filename, std::string* error){
+    std::ifstream stream(filename);
+    if(!stream){
+      *error = "Cannot open file: " + filename;
+      return false;
+    }
+
+    std::string line;
+    size_t row = 0;
+    while(std::getline(stream, line)){
+      row++;
+      size_t comment = line.find('#');
+      if(comment != std::string::npos) line.erase(comment);
+      std::stringstream fields(line);
+      std::string name;
+      double cost;
+      if(!(fields >> name)) continue;
+      if(!(fields >> cost) || cost < 0.0){
+        *error = filename + ":" + std::to_string(row) + ": invalid cost for " + name;
+        return false;
+      }
+      if(!Set(name, cost)){
+        *error = filename + ":" + std::to_string(row) + ": unknown cost " + name;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  double CostEstimator::Pop(size_t count){
+    double cost = 0.0;
+    for(size_t i = 0; i < count; i++){
+      cost += costs_.back();
+      costs_.pop_back();
+    }
+    return cost;
+  }
+
+  void CostEstimator::EnterFunction(Function* func){
+    function_index_[func->GetName()] = functions_.size();
+    uint32_t first_call = static_cast<uint32_t>(calls_.size());
+    functions_.push_back({ func, 0.0, 0.0, first_call, first_call });
+  }
+
+  void CostEstimator::LeaveFunction(Function*){
+    functions_.back().self_cost = Pop(1);
+    functions_.back().cost = functions_.back().self_cost;
+    functions_.back().last_call = static_cast<uint32_t>(calls_.size());
+  }
+
+  void CostEstimator::VisitFor(ForNode* node){
+    ForNode::Induction induction;
+    double trips = node->GetInduction(kMaxTripCount, &induction) ? static_cast<double>(induction.trips) : 1.0;
+    loops_.push_back({ trips, GetTrips() * trips });
+  }
+
+  void CostEstimator::LeaveNode(AstNode* node){
+    double cost;
+    if(node->IsSequence()){
+      blocks_.pop_back();
+      cost = Pop(node->AsSequence()->GetChildrenSize());
+    } else if(node->IsBinaryOp()){
+      BinaryOpNode* op = node->AsBinaryOp();
+      cost = Pop(2) + table_.GetCost(op->GetKind(), op->GetType());
+    } else if(node->IsStoreLocal()){
+      cost = Pop(1) + table_.GetCost(CostTable::kStore);
+    } else if(node->IsReturn()){
+      cost = Pop(1) + table_.GetCost(CostTable::kReturn);
+    } else if(node->IsLoadLocal()){
+      cost = table_.GetCost(CostTable::kLoad);
+    } else if(node->IsCall()){
+      calls_.push_back({ &node->AsCall()->GetTarget(), GetTrips() });
+      cost = table_.GetCost(CostTable::kCall);
+    } else if(node->IsIf()){
+      cost = Pop(node->AsIf()->HasElse() ? 3 : 2) + table_.GetCost(CostTable::kBranch);
+    } else if(node->IsFor()){
+      ForNode* loop = node->AsFor();
+      double body = Pop(1);
+      double step = loop->GetStep() != nullptr ? Pop(1) : 0.0;
+      double condition = Pop(1) + table_.GetCost(CostTable::kBranch);
+      double init = loop->GetInit() != nullptr ? Pop(1) : 0.0;
+      double trips = loops_.back().trips;
+      loops_.pop_back();
+      // the condition runs once more than the body
+      cost = init + condition + trips * (condition + step + body);
+    } else{
+      size_t components = node->GetType()->GetSize();
+      cost = table_.GetCost(CostTable::kLiteral) * (components > 1 ? components : 1);
+    }
+    costs_.push_back(cost);
+
+    if(blocks_.empty()) return;
+    Block& block = blocks_.back();
+    if(block.node->GetChildAt(block.next) != node) return;
+    block.next++;
+    // statements nest inside if and loop bodies, so the range starts where
+    // this one did rather than where the last statement recorded ended
+    uint32_t first_call = block.first_call;
+    block.first_call = static_cast<uint32_t>(calls_.size());
+    if(node->IsSequence()) return;
+
+    statements_.push_back({ functions_.size() - 1, node, cost, cost, GetTrips(), first_call, block.first_call });
+  }
+
+  void CostEstimator::Resolve(){
+    static const char kUnvisited = 0;
+    static const char kActive = 1;
+    static const char kDone = 2;
+
+    // depth first over the call graph without recursing, call chains can
+    // be as long as the shader
+    std::vector<char> state(functions_.size(), kUnvisited);
+    std::vector<std::pair<size_t, uint32_t>> stack;
+    for(size_t root = 0; root < functions_.size(); root++){
+      if(state[root] != kUnvisited) continue;
+      state[root] = kActive;
+      functions_[root].cost = functions_[root].self_cost;
+      stack.push_back({ root, functions_[root].first_call });
+      while(!stack.empty()){
+        size_t idx = stack.back().first;
+        uint32_t call = stack.back().second;
+        if(call == functions_[idx].last_call){
+          state[idx] = kDone;
+          stack.pop_back();
+          // the caller's cursor is one past the call that got here
+          if(!stack.empty()) functions_[stack.back().first].cost += functions_[idx].cost * calls_[stack.back().second - 1].trips;
+          continue;
+        }
+        stack.back().second++;
+
+        auto pos = function_index_.find(*calls_[call].target);
+        if(pos == function_index_.end()) continue;
+        size_t callee = pos->second;
+        if(state[callee] == kDone){
+          functions_[idx].cost += functions_[callee].cost * calls_[call].trips;
+        } else if(state[callee] == kUnvisited){
+          state[callee] = kActive;
+          functions_[callee].cost = functions_[callee].self_cost;
+          stack.push_back({ callee, functions_[callee].first_call });
+        }
+      }
+    }
+
+    for(auto& statement : statements_){
+      statement.cost = statement.self_cost;
+      for(uint32_t i = statement.first_call; i < statement.last_call; i++){
+        // a statement counts one trip of the loops around it
+        auto pos = function_index_.find(*calls_[i].target);
+        if(pos != function_index_.end() && pos->second != statement.function){
+          statement.cost += functions_[pos->second].cost * calls_[i].trips / statement.trips;
+        }
+      }
+    }
+  }
+
+  double CostEstimator::GetShaderCost() const{
+    auto pos = function_index_.find("main");
+    if(pos != function_index_.end()) return functions_[pos->second].cost;
+    double cost = 0.0;
+    for(auto& func : functions_) cost += func.cost;
+    return cost;
+  }
+
+  // Indices sorted by descending cost, at most top of them
+  template<typename T>
+  static std::vector<size_t> Rank(const std::vector<T>& items, size_t top){
+    std::vector<size_t> order(items.size());
+    for(size_t i = 0; i < order.size(); i++) order[i] = i;
+    top = std::min(top, order.size());
+    std::partial_sort(order.begin(), order.begin() + top, order.end(), [&items](size_t a, size_t b){
+      return items[a].cost > items[b].cost || (items[a].cost == items[b].cost && a < b);
+    });
+    order.resize(top);
+    return order;
+  }
+
+  void CostEstimator::PrintReport(std::ostream& stream, size_t top) const{
+    stream << "Shader cost: " << GetShaderCost() << std::endl;
+    stream << "Functions:" << std::endl;
+    for(auto idx : Rank(functions_, functions_.size())){
+      const FunctionCost& func = functions_[idx];
+      stream << "  " << func.function->GetName() << " " << func.cost << " (self " << func.self_cost << ")" << std::endl;
+    }
+    stream << "Hotspots:" << std::endl;
+    for(auto idx : Rank(statements_, top)){
+      const Statement& statement = statements_[idx];
+      stream << "  " << statement.cost << " " << functions_[statement.function].function->GetName()
+             << " " << statement.node->GetSpan().ToString() << " " << statement.node->Name() << std::endl;
+    }
+  }
+
+  void CostEstimator::PrintJson(std::ostream& stream, size_t top) const{
+    // function names are identifiers, nothing needs escaping
+    stream << "{\"cost\":" << GetShaderCost() << ",\"functions\":[";
+    bool first = true;
+    for(auto idx : Rank(functions_, functions_.size())){
+      const FunctionCost& func = functions_[idx];
+      stream << (first ? "" : ",") << "{\"name\":\"" << func.function->GetName() << "\",\"cost\":" << func.cost << ",\"self\":" << func.self_cost << "}";
+      first = false;
+    }
+    stream << "],\"hotspots\":[";
+    first = true;
+    for(auto idx : Rank(statements_, top)){
+      const Statement& statement = statements_[idx];
+      const SourceSpan& span = statement.node->GetSpan();
+      stream << (first ? "" : ",") << "{\"function\":\"" << functions_[statement.function].function->GetName() << "\""
+             << ",\"row\":" << span.start.row << ",\"column\":" << span.start.column
+             << ",\"kind\":\"" << statement.node->Name() << "\",\"cost\":" << statement.cost << "}";
+      first = false;
+    }
+    stream << "]}";
+  }
+}
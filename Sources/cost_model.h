@@ -0,0 +1,181 @@
+#ifndef GLSLTOOLS_COST_MODEL_H
+#define GLSLTOOLS_COST_MODEL_H
+
+#include "pass_manager.h"
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GLSLTools{
+  // Name in cost tables and default ALU cost. Vector costs are per
+  // component, so a vec3 add costs three times add.vector.
+  #define FOR_EACH_COST(V) \
+    V(Literal, "literal", 0.0) \
+    V(Load, "load", 1.0) \
+    V(Store, "store", 1.0) \
+    V(Call, "call", 4.0) \
+    V(Return, "return", 1.0) \
+    V(Branch, "branch", 1.0) \
+    V(AddScalar, "add.scalar", 1.0) \
+    V(AddVector, "add.vector", 1.0) \
+    V(SubtractScalar, "sub.scalar", 1.0) \
+    V(SubtractVector, "sub.vector", 1.0) \
+    V(MultiplyScalar, "mul.scalar", 1.0) \
+    V(MultiplyVector, "mul.vector", 1.0) \
+    V(DivideScalar, "div.scalar", 4.0) \
+    V(DivideVector, "div.vector", 4.0)
+
+  class CostTable{
+  public:
+    enum Cost{
+    #define DEFINE_COST(Name, Text, Default) k##Name,
+      FOR_EACH_COST(DEFINE_COST)
+    #undef DEFINE_COST
+      kNumberOfCosts
+    };
+  private:
+    double costs_[kNumberOfCosts];
+  public:
+    CostTable();
+    ~CostTable(){}
+
+    double GetCost(Cost cost) const{
+      return costs_[cost];
+    }
+
+    // Cost of a binary operation producing type
+    double GetCost(BinaryOpNode::Kind kind, Type* type) const;
+
+    bool Set(const std::string& name, double cost);
+
+    // Reads "<name> <cost>" lines, # starts a comment. Entries not listed
+    // keep their current cost.
+    bool Load(const std::string& filename, std::string* error);
+
+    static const char* GetName(Cost cost);
+  };
+
+  // Estimates the ALU cost of every statement and function it is run over.
+  // A statement is a direct child of a block other than a nested block, its
+  // cost includes everything evaluated by it. Calls add the call cost, and
+  // the inclusive cost of their target once Resolve has run.
+  //
+  // An if costs both branches, as lanes that diverge run both. A loop costs
+  // its body, step and condition once per iteration when the trip count is
+  // constant, once otherwise; statements in a body count one iteration.
+  // Callees are added once per call site, times the trip counts of the
+  // loops around the call.
+  class CostEstimator : public AstPass{
+  public:
+    // Loops running longer than this are costed as unknown
+    static const size_t kMaxTripCount = 1 << 20;
+
+    struct Statement{
+      size_t function;
+      AstNode* node;
+      double self_cost;
+      double cost;
+      // trips of the loops around the statement
+      double trips;
+      uint32_t first_call;
+      uint32_t last_call;
+    };
+
+    struct FunctionCost{
+      Function* function;
+      double self_cost;
+      double cost;
+      uint32_t first_call;
+      uint32_t last_call;
+    };
+  private:
+    struct Block{
+      SequenceNode* node;
+      size_t next;
+      // calls made since the last statement of the block ended
+      uint32_t first_call;
+    };
+
+    struct Call{
+      const std::string* target;
+      // trips of the loops around the call, in its function
+      double trips;
+    };
+
+    struct Loop{
+      double trips;
+      // trips times those of the loops around this one
+      double total_trips;
+    };
+
+    const CostTable& table_;
+    std::vector<Statement> statements_;
+    std::vector<FunctionCost> functions_;
+    std::unordered_map<std::string, size_t> function_index_;
+    std::vector<Call> calls_;
+    std::vector<double> costs_;
+    std::vector<Block> blocks_;
+    std::vector<Loop> loops_;
+
+    double Pop(size_t count);
+
+    double GetTrips() const{
+      return loops_.empty() ? 1.0 : loops_.back().total_trips;
+    }
+  public:
+    CostEstimator(const CostTable& table):
+      table_(table),
+      statements_(),
+      functions_(),
+      function_index_(),
+      calls_(),
+      costs_(),
+      blocks_(),
+      loops_(){}
+    ~CostEstimator(){}
+
+    const char* GetName() const{
+      return "cost";
+    }
+
+    void EnterFunction(Function* func);
+    void LeaveFunction(Function* func);
+    void LeaveNode(AstNode* node);
+
+    void VisitSequence(SequenceNode* node){
+      blocks_.push_back({ node, 0, static_cast<uint32_t>(calls_.size()) });
+    }
+
+    void VisitFor(ForNode* node);
+
+    // Adds the inclusive cost of callees, which may be defined after their
+    // callers. Recursive calls only count the call itself.
+    void Resolve();
+
+    size_t GetNumberOfStatements() const{
+      return statements_.size();
+    }
+
+    const Statement& GetStatementAt(size_t idx) const{
+      return statements_[idx];
+    }
+
+    size_t GetNumberOfFunctions() const{
+      return functions_.size();
+    }
+
+    const FunctionCost& GetFunctionAt(size_t idx) const{
+      return functions_[idx];
+    }
+
+    // Inclusive cost of main, or of every function when there is none
+    double GetShaderCost() const;
+
+    // Functions and the top statements by inclusive cost
+    void PrintReport(std::ostream& stream, size_t top) const;
+    void PrintJson(std::ostream& stream, size_t top) const;
+  };
+}
+
+#endif //GLSLTOOLS_COST_MODEL_H
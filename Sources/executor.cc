@@ -0,0 +1,573 @@
+#include "executor.h"
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE__) || defined(_M_X64)
+  #include <xmmintrin.h>
+  #define GLSLTOOLS_SSE
+#endif
+
+namespace GLSLTools{
+  #define FOR_EACH_LANE_OP(V) \
+    V(Add, +, add) \
+    V(Subtract, -, sub) \
+    V(Multiply, *, mul) \
+    V(Divide, /, div)
+
+#ifdef GLSLTOOLS_SSE
+  #define DEFINE_LANE_KERNEL(Name, Op, Intrinsic) \
+    static void Name##Lanes(float* out, const float* a, const float* b, size_t lanes){ \
+      size_t i = 0; \
+      for(; (i + 4) <= lanes; i += 4){ \
+        _mm_storeu_ps(out + i, _mm_##Intrinsic##_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))); \
+      } \
+      for(; i < lanes; i++) out[i] = a[i] Op b[i]; \
+    }
+#else
+  #define DEFINE_LANE_KERNEL(Name, Op, Intrinsic) \
+    static void Name##Lanes(float* out, const float* a, const float* b, size_t lanes){ \
+      for(size_t i = 0; i < lanes; i++) out[i] = a[i] Op b[i]; \
+    }
+#endif
+  FOR_EACH_LANE_OP(DEFINE_LANE_KERNEL)
+  #undef DEFINE_LANE_KERNEL
+
+  #define FOR_EACH_INT_LANE_OP(V) \
+    V(Add, +) \
+    V(Subtract, -) \
+    V(Multiply, *)
+
+  // ints wrap like they do on the GPU, so these work on the unsigned bits
+  #define DEFINE_INT_LANE_KERNEL(Name, Op) \
+    static void Name##IntLanes(int32_t* out, const int32_t* a, const int32_t* b, size_t lanes){ \
+      for(size_t i = 0; i < lanes; i++) out[i] = static_cast<int32_t>(static_cast<uint32_t>(a[i]) Op static_cast<uint32_t>(b[i])); \
+    }
+  FOR_EACH_INT_LANE_OP(DEFINE_INT_LANE_KERNEL)
+  #undef DEFINE_INT_LANE_KERNEL
+
+  // division by zero is undefined in GLSL, those lanes get 0; INT_MIN / -1
+  // wraps to INT_MIN
+  static void DivideIntLanes(int32_t* out, const int32_t* a, const int32_t* b, size_t lanes){
+    for(size_t i = 0; i < lanes; i++){
+      if(b[i] == 0){
+        out[i] = 0;
+      } else if(b[i] == -1){
+        out[i] = static_cast<int32_t>(0u - static_cast<uint32_t>(a[i]));
+      } else{
+        out[i] = a[i] / b[i];
+      }
+    }
+  }
+
+  static void DivideUIntLanes(uint32_t* out, const uint32_t* a, const uint32_t* b, size_t lanes){
+    for(size_t i = 0; i < lanes; i++) out[i] = b[i] != 0 ? a[i] / b[i] : 0;
+  }
+
+  #define FOR_EACH_COMPARE_OP(V) \
+    V(Less, <) \
+    V(LessEqual, <=) \
+    V(Greater, >) \
+    V(GreaterEqual, >=) \
+    V(Equal, ==) \
+    V(NotEqual, !=)
+
+  // Writes a bool per lane
+  template<typename T>
+  static void CompareLanes(BinaryOpNode::Kind kind, int32_t* out, const T* a, const T* b, size_t lanes){
+    switch(kind){
+    #define DEFINE_SWITCH_CASE(Name, Op) \
+      case BinaryOpNode::k##Name: for(size_t i = 0; i < lanes; i++) out[i] = a[i] Op b[i]; break;
+      FOR_EACH_COMPARE_OP(DEFINE_SWITCH_CASE)
+    #undef DEFINE_SWITCH_CASE
+      default: break;
+    }
+  }
+
+  static size_t CountLanes(const int32_t* mask, size_t lanes){
+    size_t count = 0;
+    for(size_t i = 0; i < lanes; i++) count += mask[i] != 0;
+    return count;
+  }
+
+  static void AndLanes(int32_t* out, const int32_t* a, const int32_t* b, size_t lanes){
+    for(size_t i = 0; i < lanes; i++) out[i] = a[i] != 0 && b[i] != 0;
+  }
+
+  static void FillLanes(float* out, float value, size_t lanes){
+    for(size_t i = 0; i < lanes; i++) out[i] = value;
+  }
+
+  static void FillIntLanes(int32_t* out, int32_t value, size_t lanes){
+    for(size_t i = 0; i < lanes; i++) out[i] = value;
+  }
+
+  static int32_t* AsInts(float* data){
+    return reinterpret_cast<int32_t*>(data);
+  }
+
+  static const int32_t* AsInts(const float* data){
+    return reinterpret_cast<const int32_t*>(data);
+  }
+
+  // int, uint and bool, which are all scalars
+  static bool IsIntegral(Type* type){
+    return type->IsNumber() && type->GetSize() > 0;
+  }
+
+  // Copies the lanes of value set in mask into out, bit for bit so it works
+  // for every type
+  static void SelectLanes(float* out, const float* value, const int32_t* mask, size_t lanes){
+    int32_t* dst = AsInts(out);
+    const int32_t* src = AsInts(value);
+    for(size_t i = 0; i < lanes; i++) dst[i] = mask[i] != 0 ? src[i] : dst[i];
+  }
+
+  // Converts one component of lanes between the representations of two
+  // scalar types, in and out must not overlap
+  static void ConvertLanes(float* out, Type* to, const float* in, Type* from, size_t lanes){
+    if(IsIntegral(to) && IsIntegral(from)){
+      const int32_t* src = AsInts(in);
+      int32_t* dst = AsInts(out);
+      for(size_t i = 0; i < lanes; i++) dst[i] = to == Type::BOOL ? (src[i] != 0) : src[i];
+    } else if(IsIntegral(to)){
+      int32_t* dst = AsInts(out);
+      for(size_t i = 0; i < lanes; i++){
+        if(to == Type::BOOL){
+          dst[i] = in[i] != 0.0f;
+        } else if(to == Type::UINT){
+          dst[i] = static_cast<int32_t>(static_cast<uint32_t>(static_cast<int64_t>(in[i])));
+        } else{
+          dst[i] = static_cast<int32_t>(in[i]);
+        }
+      }
+    } else if(from == Type::UINT){
+      const uint32_t* src = reinterpret_cast<const uint32_t*>(in);
+      for(size_t i = 0; i < lanes; i++) out[i] = static_cast<float>(src[i]);
+    } else if(IsIntegral(from)){
+      const int32_t* src = AsInts(in);
+      for(size_t i = 0; i < lanes; i++) out[i] = static_cast<float>(src[i]);
+    } else{
+      memcpy(out, in, lanes * sizeof(float));
+    }
+  }
+
+  static size_t GetComponents(Type* type){
+    return type->GetSize() > 0 ?
+           type->GetSize() :
+           1;
+  }
+
+  static float GetScalar(Value* value){
+    if(value == nullptr) return 0.0f;
+    return static_cast<float>(value->AsDouble());
+  }
+
+  class LocalCollector : public AstNodeVisitor{
+  private:
+    Array<LocalVariable*>& locals_;
+  public:
+    LocalCollector(Array<LocalVariable*>& locals):
+      locals_(locals){}
+    ~LocalCollector(){}
+
+    void VisitSequence(SequenceNode* node){
+      LocalScope* scope = node->GetScope();
+      for(size_t i = 0; i < scope->GetNumberOfLocals(); i++){
+        locals_.Add(scope->GetLocalAt(i));
+      }
+      node->VisitChildren(this);
+    }
+
+    void VisitReturn(ReturnNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      locals_.Add(node->GetLocal());
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      locals_.Add(node->GetLocal());
+      node->VisitChildren(this);
+    }
+
+    void VisitIf(IfNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitFor(ForNode* node){
+      node->VisitChildren(this);
+    }
+  };
+
+  const size_t BatchExecutor::kMaxIterations;
+
+  BatchExecutor::BatchExecutor(Function* func, size_t lanes):
+    func_(func),
+    lanes_(lanes),
+    locals_(),
+    temps_(16),
+    temps_used_(0),
+    result_(nullptr),
+    result_type_(func->GetResultType()),
+    live_(reinterpret_cast<int32_t*>(malloc(lanes * sizeof(int32_t)))),
+    live_count_(lanes),
+    mask_(nullptr),
+    returned_(false),
+    error_(){
+    Array<LocalVariable*> locals(16);
+    LocalCollector collector(locals);
+    func->GetCode()->Visit(&collector);
+    for(size_t i = 0; i < locals.Length(); i++){
+      GetSlot(locals[i]);
+    }
+    if(result_type_->GetSize() > 0){
+      result_ = reinterpret_cast<float*>(calloc(GetComponents(result_type_) * lanes_, sizeof(float)));
+    }
+  }
+
+  BatchExecutor::~BatchExecutor(){
+    for(auto& it : locals_){
+      free(it.second.data);
+    }
+    for(size_t i = 0; i < temps_.Length(); i++){
+      free(temps_[i]);
+    }
+    free(result_);
+    free(live_);
+  }
+
+  void BatchExecutor::ReportError(const std::string& message){
+    if(HasError()) return;
+    error_ = message;
+  }
+
+  float* BatchExecutor::GetSlot(LocalVariable* local){
+    auto pos = locals_.find(local);
+    if(pos != locals_.end()) return pos->second.data;
+
+    Slot slot;
+    slot.local = local;
+    slot.data = reinterpret_cast<float*>(calloc(GetComponents(local->GetType()) * lanes_, sizeof(float)));
+    locals_.insert({ local, slot });
+    return slot.data;
+  }
+
+  // The lanes stores and returns may touch, nullptr when all of them. The
+  // mask only ever holds live lanes.
+  int32_t* BatchExecutor::GetActive() const{
+    if(mask_ != nullptr) return mask_;
+    return live_count_ < lanes_ ?
+           live_ :
+           nullptr;
+  }
+
+  // Lanes that returned are out of the current mask and every later one
+  void BatchExecutor::RetireLanes(const int32_t* active){
+    for(size_t i = 0; i < lanes_; i++){
+      if(active[i] == 0 || live_[i] == 0) continue;
+      live_[i] = 0;
+      live_count_--;
+      if(mask_ != nullptr) mask_[i] = 0;
+    }
+    if(live_count_ == 0) returned_ = true;
+  }
+
+  void BatchExecutor::SetInput(LocalVariable* local, const float* data){
+    memcpy(GetSlot(local), data, GetComponents(local->GetType()) * lanes_ * sizeof(float));
+  }
+
+  float* BatchExecutor::AcquireTemp(){
+    // temporaries are released in reverse order, so they form a stack
+    if(temps_used_ == temps_.Length()){
+      temps_.Add(reinterpret_cast<float*>(malloc(4 * lanes_ * sizeof(float))));
+    }
+    return temps_[temps_used_++];
+  }
+
+  void BatchExecutor::ReleaseTemp(){
+    temps_used_--;
+  }
+
+  void BatchExecutor::EvalLiteral(Value* value, float* out){
+    if(value != nullptr && IsIntegral(value->GetType())){
+      FillIntLanes(AsInts(out), value->AsInt(), lanes_);
+    } else if(value != nullptr && value->IsScalar()){
+      for(size_t c = 0; c < value->GetScalarSize(); c++){
+        FillLanes(out + c * lanes_, GetScalar(value->GetAt(c)), lanes_);
+      }
+    } else{
+      FillLanes(out, GetScalar(value), lanes_);
+    }
+  }
+
+  const float* BatchExecutor::EvalOperand(AstNode* node, float* scratch){
+    // locals are read in place instead of being copied to a temporary
+    if(node->IsLoadLocal()) return GetSlot(node->AsLoadLocal()->GetLocal());
+    Eval(node, scratch);
+    return scratch;
+  }
+
+  const float* BatchExecutor::EvalFloatOperand(AstNode* node, float* scratch){
+    Type* type = node->GetType();
+    if(!IsIntegral(type)) return EvalOperand(node, scratch);
+    const float* ints = EvalOperand(node, AcquireTemp());
+    ConvertLanes(scratch, Type::FLOAT, ints, type, lanes_);
+    ReleaseTemp();
+    return scratch;
+  }
+
+  void BatchExecutor::EvalFloatBinaryOp(BinaryOpNode* binop, float* out){
+    const float* left = EvalFloatOperand(binop->GetLeft(), AcquireTemp());
+    const float* right = EvalFloatOperand(binop->GetRight(), AcquireTemp());
+    if(BinaryOpNode::IsComparison(binop->GetKind())){
+      if(binop->GetLeft()->GetType()->GetSize() > 1 || binop->GetRight()->GetType()->GetSize() > 1){
+        ReportError("Cannot compare vectors");
+      } else{
+        CompareLanes(binop->GetKind(), AsInts(out), left, right, lanes_);
+      }
+      ReleaseTemp();
+      ReleaseTemp();
+      return;
+    }
+
+    Type* type = binop->GetType();
+    size_t left_comps = GetComponents(binop->GetLeft()->GetType());
+    size_t right_comps = GetComponents(binop->GetRight()->GetType());
+    size_t comps = GetComponents(type);
+    if(left_comps != right_comps && left_comps != 1 && right_comps != 1){
+      ReportError("Mismatched vector sizes in binary operator");
+      comps = 0;
+    }
+    for(size_t c = 0; c < comps; c++){
+      float* dst = out + c * lanes_;
+      const float* a = left + (left_comps == 1 ? 0 : c * lanes_);
+      const float* b = right + (right_comps == 1 ? 0 : c * lanes_);
+      switch(binop->GetKind()){
+      #define DEFINE_SWITCH_CASE(Name, Op, Intrinsic) \
+        case BinaryOpNode::k##Name: Name##Lanes(dst, a, b, lanes_); break;
+        FOR_EACH_LANE_OP(DEFINE_SWITCH_CASE)
+      #undef DEFINE_SWITCH_CASE
+        default: ReportError("Unsupported binary operator"); break;
+      }
+    }
+    ReleaseTemp();
+    ReleaseTemp();
+  }
+
+  void BatchExecutor::EvalIntBinaryOp(BinaryOpNode* binop, float* out){
+    const int32_t* left = AsInts(EvalOperand(binop->GetLeft(), AcquireTemp()));
+    const int32_t* right = AsInts(EvalOperand(binop->GetRight(), AcquireTemp()));
+    int32_t* dst = AsInts(out);
+    bool is_unsigned = binop->GetLeft()->GetType() == Type::UINT || binop->GetRight()->GetType() == Type::UINT;
+    if(BinaryOpNode::IsComparison(binop->GetKind())){
+      if(is_unsigned){
+        CompareLanes(binop->GetKind(), dst, reinterpret_cast<const uint32_t*>(left), reinterpret_cast<const uint32_t*>(right), lanes_);
+      } else{
+        CompareLanes(binop->GetKind(), dst, left, right, lanes_);
+      }
+      ReleaseTemp();
+      ReleaseTemp();
+      return;
+    }
+
+    switch(binop->GetKind()){
+    #define DEFINE_SWITCH_CASE(Name, Op) \
+      case BinaryOpNode::k##Name: Name##IntLanes(dst, left, right, lanes_); break;
+      FOR_EACH_INT_LANE_OP(DEFINE_SWITCH_CASE)
+    #undef DEFINE_SWITCH_CASE
+      case BinaryOpNode::kDivide:
+        if(is_unsigned){
+          DivideUIntLanes(reinterpret_cast<uint32_t*>(dst), reinterpret_cast<const uint32_t*>(left), reinterpret_cast<const uint32_t*>(right), lanes_);
+        } else{
+          DivideIntLanes(dst, left, right, lanes_);
+        }
+        break;
+      default: ReportError("Unsupported binary operator"); break;
+    }
+    ReleaseTemp();
+    ReleaseTemp();
+  }
+
+  void BatchExecutor::Eval(AstNode* node, float* out){
+    if(node->IsLiteral()){
+      EvalLiteral(node->AsLiteral()->GetValue(), out);
+    } else if(node->IsLoadLocal()){
+      LocalVariable* local = node->AsLoadLocal()->GetLocal();
+      memcpy(out, GetSlot(local), GetComponents(local->GetType()) * lanes_ * sizeof(float));
+    } else if(node->IsBinaryOp()){
+      BinaryOpNode* binop = node->AsBinaryOp();
+      if(IsIntegral(binop->GetLeft()->GetType()) && IsIntegral(binop->GetRight()->GetType())){
+        EvalIntBinaryOp(binop, out);
+      } else{
+        EvalFloatBinaryOp(binop, out);
+      }
+    } else{
+      ReportError(std::string("Cannot evaluate ") + node->Name() + " node");
+    }
+  }
+
+  void BatchExecutor::VisitSequence(SequenceNode* node){
+    for(size_t i = 0; i < node->GetChildrenSize() && !returned_ && !HasError(); i++){
+      node->GetChildAt(i)->Visit(this);
+    }
+  }
+
+  bool BatchExecutor::Assign(float* dst, Type* type, const float* value, Type* value_type){
+    size_t comps = GetComponents(type);
+    size_t value_comps = GetComponents(value_type);
+    if(value_comps != comps && value_comps != 1) return false;
+
+    // an int assigned to a float or vector is converted before splatting
+    float* converted = nullptr;
+    if(value_type != type && (IsIntegral(value_type) || IsIntegral(type))){
+      converted = AcquireTemp();
+      ConvertLanes(converted, IsIntegral(type) ? type : Type::FLOAT, value, value_type, lanes_);
+      value = converted;
+    }
+    int32_t* active = GetActive();
+    for(size_t c = 0; c < comps; c++){
+      const float* src = value + (value_comps == 1 ? 0 : c * lanes_);
+      if(active == nullptr){
+        memcpy(dst + c * lanes_, src, lanes_ * sizeof(float));
+      } else{
+        SelectLanes(dst + c * lanes_, src, active, lanes_);
+      }
+    }
+    if(converted != nullptr) ReleaseTemp();
+    return true;
+  }
+
+  void BatchExecutor::VisitReturn(ReturnNode* node){
+    int32_t* active = GetActive();
+    if(result_ != nullptr && active == nullptr && node->GetType() == result_type_){
+      Eval(node->GetValue(), result_);
+    } else if(result_ != nullptr){
+      // only the active lanes return, the others carry on
+      float* value = AcquireTemp();
+      Eval(node->GetValue(), value);
+      if(!Assign(result_, result_type_, value, node->GetType())){
+        ReportError("Cannot return " + node->GetType()->GetName() + " from " + func_->GetName());
+      }
+      ReleaseTemp();
+    }
+
+    if(active == nullptr){
+      returned_ = true;
+    } else{
+      RetireLanes(active);
+    }
+  }
+
+  void BatchExecutor::VisitStoreLocal(StoreLocalNode* node){
+    // evaluate into a temporary first, the value may read the local
+    float* value = AcquireTemp();
+    Eval(node->GetValue(), value);
+    LocalVariable* local = node->GetLocal();
+    Type* value_type = node->GetValue()->GetType();
+    if(!Assign(GetSlot(local), local->GetType(), value, value_type)){
+      ReportError("Cannot store " + value_type->GetName() + " into " + local->GetName());
+    }
+    ReleaseTemp();
+  }
+
+  void BatchExecutor::VisitCall(CallNode* node){
+    ReportError("Cannot execute call to " + node->GetTarget());
+  }
+
+  void BatchExecutor::VisitIf(IfNode* node){
+    AstNode* condition = node->GetCondition();
+    if(!IsIntegral(condition->GetType())){
+      ReportError("Cannot branch on " + condition->GetType()->GetName());
+      return;
+    }
+
+    int32_t* outer = mask_;
+    int32_t* active = GetActive();
+    float* condition_lanes = AcquireTemp();
+    Eval(condition, condition_lanes);
+    const int32_t* taken = AsInts(condition_lanes);
+    int32_t* then_mask = AsInts(AcquireTemp());
+    int32_t* else_mask = AsInts(AcquireTemp());
+    for(size_t i = 0; i < lanes_; i++){
+      bool on = active == nullptr || active[i] != 0;
+      then_mask[i] = on && taken[i] != 0;
+      else_mask[i] = on && taken[i] == 0;
+    }
+
+    // a branch every active lane takes keeps the outer mask
+    size_t then_lanes = CountLanes(then_mask, lanes_);
+    size_t else_lanes = CountLanes(else_mask, lanes_);
+    if(then_lanes > 0){
+      mask_ = else_lanes == 0 ? outer : then_mask;
+      node->GetThen()->Visit(this);
+    }
+    if(node->HasElse() && else_lanes > 0 && !returned_ && !HasError()){
+      mask_ = then_lanes == 0 ? outer : else_mask;
+      node->GetElse()->Visit(this);
+    }
+    mask_ = outer;
+    if(outer != nullptr && live_count_ < lanes_) AndLanes(outer, outer, live_, lanes_);
+    ReleaseTemp();
+    ReleaseTemp();
+    ReleaseTemp();
+  }
+
+  void BatchExecutor::VisitFor(ForNode* node){
+    if(node->GetInit() != nullptr) node->GetInit()->Visit(this);
+
+    // a constant trip count is the same in every lane
+    ForNode::Induction induction;
+    if(node->GetInduction(kMaxIterations, &induction)){
+      for(size_t i = 0; i < induction.trips && !returned_ && !HasError(); i++){
+        node->GetBody()->Visit(this);
+        if(!returned_) node->GetStep()->Visit(this);
+      }
+      return;
+    }
+
+    AstNode* condition = node->GetCondition();
+    if(!IsIntegral(condition->GetType())){
+      ReportError("Cannot branch on " + condition->GetType()->GetName());
+      return;
+    }
+    int32_t* outer = mask_;
+    int32_t* active = GetActive();
+    int32_t* loop_mask = AsInts(AcquireTemp());
+    float* taken = AcquireTemp();
+    for(size_t i = 0; i < lanes_; i++) loop_mask[i] = active == nullptr || active[i] != 0;
+
+    // a lane leaves the loop for good once its condition fails
+    size_t iterations = 0;
+    mask_ = loop_mask;
+    while(!returned_ && !HasError()){
+      Eval(condition, taken);
+      AndLanes(loop_mask, loop_mask, AsInts(taken), lanes_);
+      if(CountLanes(loop_mask, lanes_) == 0) break;
+      if(iterations++ == kMaxIterations){
+        ReportError("Loop ran for more than " + std::to_string(kMaxIterations) + " iterations");
+        break;
+      }
+      node->GetBody()->Visit(this);
+      if(node->GetStep() != nullptr && !returned_) node->GetStep()->Visit(this);
+    }
+    mask_ = outer;
+    if(outer != nullptr && live_count_ < lanes_) AndLanes(outer, outer, live_, lanes_);
+    ReleaseTemp();
+    ReleaseTemp();
+  }
+
+  bool BatchExecutor::Execute(){
+    error_.clear();
+    returned_ = false;
+    temps_used_ = 0;
+    for(size_t i = 0; i < lanes_; i++) live_[i] = 1;
+    live_count_ = lanes_;
+    mask_ = nullptr;
+    func_->GetCode()->Visit(this);
+    return !HasError();
+  }
+}
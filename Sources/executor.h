@@ -0,0 +1,104 @@
+#ifndef GLSLTOOLS_EXECUTOR_H
+#define GLSLTOOLS_EXECUTOR_H
+
+#include "ast.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace GLSLTools{
+  // Runs a Function over a batch of invocations on the CPU. Every local is
+  // stored as structure of arrays: component c of invocation i lives at
+  // data[c * lanes + i], so each BinaryOpNode becomes one SIMD loop per
+  // component across all invocations. Lanes are 4 bytes wide, int, uint and
+  // bool values keep their int32 bits in them and are converted where they
+  // meet a float.
+  //
+  // Control flow runs under a mask of active lanes: both sides of an if run
+  // for the lanes taking them, stores and returns only touch active lanes,
+  // and a loop runs until its condition fails in every lane. Loops with a
+  // constant trip count, see ForNode::GetInduction, and ifs that go the
+  // same way in every lane run unmasked.
+  class BatchExecutor : public AstNodeVisitor{
+  public:
+    // Loops running longer fail instead of hanging
+    static const size_t kMaxIterations = 1 << 16;
+  private:
+    struct Slot{
+      LocalVariable* local;
+      float* data;
+    };
+
+    Function* func_;
+    size_t lanes_;
+    std::unordered_map<LocalVariable*, Slot> locals_;
+    Array<float*> temps_;
+    size_t temps_used_;
+    float* result_;
+    Type* result_type_;
+    int32_t* live_;
+    size_t live_count_;
+    int32_t* mask_;
+    bool returned_;
+    std::string error_;
+
+    float* AcquireTemp();
+    void ReleaseTemp();
+    float* GetSlot(LocalVariable* local);
+    int32_t* GetActive() const;
+    void RetireLanes(const int32_t* active);
+    void Eval(AstNode* node, float* out);
+    void EvalFloatBinaryOp(BinaryOpNode* binop, float* out);
+    void EvalIntBinaryOp(BinaryOpNode* binop, float* out);
+    const float* EvalOperand(AstNode* node, float* scratch);
+    const float* EvalFloatOperand(AstNode* node, float* scratch);
+    void EvalLiteral(Value* value, float* out);
+    bool Assign(float* dst, Type* type, const float* value, Type* value_type);
+    void ReportError(const std::string& message);
+  public:
+    BatchExecutor(Function* func, size_t lanes);
+    ~BatchExecutor();
+
+    size_t GetLanes() const{
+      return lanes_;
+    }
+
+    bool HasError() const{
+      return !error_.empty();
+    }
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    // Lane storage for a local, laid out as described above. Locals are
+    // keyed by variable rather than name since inner blocks may shadow one.
+    float* GetLocal(LocalVariable* local){
+      return GetSlot(local);
+    }
+
+    // Lanes of the function's result type, each holding the value its
+    // invocation returned, converted to that type. nullptr for void.
+    float* GetResult() const{
+      return result_;
+    }
+
+    Type* GetResultType() const{
+      return result_type_;
+    }
+
+    // Copies components * lanes values into the local before execution
+    void SetInput(LocalVariable* local, const float* data);
+
+    bool Execute();
+
+    void VisitSequence(SequenceNode* node);
+    void VisitReturn(ReturnNode* node);
+    void VisitStoreLocal(StoreLocalNode* node);
+    void VisitCall(CallNode* node);
+    void VisitIf(IfNode* node);
+    void VisitFor(ForNode* node);
+  };
+}
+
+#endif //GLSLTOOLS_EXECUTOR_H
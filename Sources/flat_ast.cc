@@ -0,0 +1,194 @@
+#include "flat_ast.h"
+#include <unordered_map>
+
+namespace GLSLTools{
+  class FlatAstBuilder : public AstNodeVisitor{
+  private:
+    FlatAst* ast_;
+    FlatAst::NodeIndex result_;
+    std::unordered_map<LocalVariable*, uint32_t> locals_;
+  public:
+    FlatAstBuilder(FlatAst* ast):
+      ast_(ast),
+      result_(FlatAst::kNoNode),
+      locals_(){}
+    ~FlatAstBuilder(){}
+
+    FlatAst::NodeIndex Convert(AstNode* node){
+      result_ = FlatAst::kNoNode;
+      node->Visit(this);
+      if(result_ != FlatAst::kNoNode){
+        ast_->rows_[result_] = node->GetSpan().start.row;
+        ast_->columns_[result_] = node->GetSpan().start.column;
+      }
+      return result_;
+    }
+
+    uint32_t InternLocal(LocalVariable* local){
+      auto pos = locals_.find(local);
+      if(pos != locals_.end()) return pos->second;
+      uint32_t idx = static_cast<uint32_t>(ast_->locals_.Length());
+      ast_->locals_.Add(local);
+      locals_.insert({ local, idx });
+      return idx;
+    }
+
+    void VisitSequence(SequenceNode* node){
+      // children are converted first so their own child lists don't
+      // interleave with this node's range
+      Array<FlatAst::NodeIndex, 8> children(node->GetChildrenSize());
+      for(size_t i = 0; i < node->GetChildrenSize(); i++){
+        children.Add(Convert(node->GetChildAt(i)));
+      }
+
+      uint32_t start = static_cast<uint32_t>(ast_->children_.Length());
+      for(size_t i = 0; i < children.Length(); i++){
+        ast_->children_.Add(children[i]);
+      }
+      result_ = ast_->NewNode(FlatAst::kSequence, 0, start, static_cast<uint32_t>(children.Length()));
+    }
+
+    void VisitLiteral(LiteralNode* node){
+      uint32_t idx = static_cast<uint32_t>(ast_->values_.Length());
+      ast_->values_.Add(node->GetValue());
+      result_ = ast_->NewNode(FlatAst::kLiteral, 0, idx, 0);
+    }
+
+    void VisitReturn(ReturnNode* node){
+      FlatAst::NodeIndex value = Convert(node->GetValue());
+      result_ = ast_->NewNode(FlatAst::kReturn, 0, value, 0);
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      FlatAst::NodeIndex left = Convert(node->GetLeft());
+      FlatAst::NodeIndex right = Convert(node->GetRight());
+      result_ = ast_->NewNode(FlatAst::kBinaryOp, static_cast<uint8_t>(node->GetKind()), left, right);
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      result_ = ast_->NewNode(FlatAst::kLoadLocal, 0, 0, InternLocal(node->GetLocal()));
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      FlatAst::NodeIndex value = Convert(node->GetValue());
+      result_ = ast_->NewNode(FlatAst::kStoreLocal, 0, value, InternLocal(node->GetLocal()));
+    }
+
+    void VisitCall(CallNode* node){
+      uint32_t idx = static_cast<uint32_t>(ast_->targets_.Length());
+      ast_->targets_.Add(&node->GetTarget());
+      result_ = ast_->NewNode(FlatAst::kCall, 0, idx, 0);
+    }
+
+    void VisitIf(IfNode* node){
+      FlatAst::NodeIndex parts[] = {
+        Convert(node->GetCondition()),
+        Convert(node->GetThen()),
+        node->HasElse() ? Convert(node->GetElse()) : FlatAst::kNoNode
+      };
+      result_ = AddParts(FlatAst::kIf, parts, 3);
+    }
+
+    void VisitFor(ForNode* node){
+      FlatAst::NodeIndex parts[] = {
+        node->GetInit() != nullptr ? Convert(node->GetInit()) : FlatAst::kNoNode,
+        Convert(node->GetCondition()),
+        node->GetStep() != nullptr ? Convert(node->GetStep()) : FlatAst::kNoNode,
+        Convert(node->GetBody())
+      };
+      result_ = AddParts(FlatAst::kFor, parts, 4);
+    }
+
+    FlatAst::NodeIndex AddParts(FlatAst::Kind kind, const FlatAst::NodeIndex* parts, uint32_t count){
+      uint32_t start = static_cast<uint32_t>(ast_->children_.Length());
+      for(uint32_t i = 0; i < count; i++){
+        ast_->children_.Add(parts[i]);
+      }
+      return ast_->NewNode(kind, 0, start, count);
+    }
+  };
+
+  FlatAst::NodeIndex FlatAst::NewNode(Kind kind, uint8_t op, uint32_t first, uint32_t second){
+    NodeIndex idx = static_cast<NodeIndex>(kinds_.Length());
+    kinds_.Add(static_cast<uint8_t>(kind));
+    ops_.Add(op);
+    first_.Add(first);
+    second_.Add(second);
+    rows_.Add(0);
+    columns_.Add(0);
+    return idx;
+  }
+
+  FlatAst* FlatAst::FromCodeUnit(CodeUnit* unit){
+    FlatAst* ast = new FlatAst();
+    FlatAstBuilder builder(ast);
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      Function* func = unit->GetFunctionAt(i);
+      FunctionEntry entry;
+      entry.function = func;
+      entry.root = builder.Convert(func->GetCode());
+      ast->functions_.Add(entry);
+    }
+    return ast;
+  }
+
+  size_t FlatAst::GetMemoryUsage() const{
+    return kinds_.Length() * sizeof(uint8_t) +
+           ops_.Length() * sizeof(uint8_t) +
+           first_.Length() * sizeof(uint32_t) +
+           second_.Length() * sizeof(uint32_t) +
+           rows_.Length() * sizeof(uint32_t) +
+           columns_.Length() * sizeof(uint32_t) +
+           children_.Length() * sizeof(NodeIndex) +
+           values_.Length() * sizeof(Value*) +
+           locals_.Length() * sizeof(LocalVariable*) +
+           targets_.Length() * sizeof(const std::string*) +
+           functions_.Length() * sizeof(FunctionEntry);
+  }
+
+  const char* FlatAst::GetKindName(Kind kind){
+    switch(kind){
+    #define DEFINE_SWITCH_CASE(BaseName) \
+      case k##BaseName: return #BaseName;
+      FOR_EACH_NODE(DEFINE_SWITCH_CASE)
+    #undef DEFINE_SWITCH_CASE
+      default: return "<unknown>";
+    }
+  }
+
+  void FlatAst::Print(std::ostream& stream) const{
+    for(size_t i = 0; i < kinds_.Length(); i++){
+      NodeIndex idx = static_cast<NodeIndex>(i);
+      stream << "#" << idx << " " << GetKindName(GetKind(idx));
+      switch(GetKind(idx)){
+        case kSequence:
+        case kIf:
+        case kFor:{
+          stream << " [";
+          for(size_t j = 0; j < GetChildrenSize(idx); j++){
+            if(j > 0) stream << ", ";
+            if(GetChildren(idx)[j] == kNoNode){
+              stream << "-";
+            } else{
+              stream << "#" << GetChildren(idx)[j];
+            }
+          }
+          stream << "]";
+          break;
+        }
+        case kLiteral: stream << " " << GetValue(idx)->ToString(); break;
+        case kReturn: stream << " #" << GetOperand(idx); break;
+        case kBinaryOp: stream << " op=" << static_cast<int>(GetBinaryOp(idx)) << " #" << GetLeft(idx) << " #" << GetRight(idx); break;
+        case kLoadLocal: stream << " $" << GetLocal(idx)->GetName(); break;
+        case kStoreLocal: stream << " $" << GetLocal(idx)->GetName() << " #" << GetOperand(idx); break;
+        case kCall: stream << " " << GetTarget(idx) << "()"; break;
+        default: break;
+      }
+      stream << std::endl;
+    }
+
+    for(size_t i = 0; i < functions_.Length(); i++){
+      stream << functions_[i].function->GetName() << " -> #" << functions_[i].root << std::endl;
+    }
+  }
+}
@@ -0,0 +1,140 @@
+#ifndef GLSLTOOLS_FLAT_AST_H
+#define GLSLTOOLS_FLAT_AST_H
+
+#include "ast.h"
+#include "array.h"
+#include <cstdint>
+#include <iostream>
+
+namespace GLSLTools{
+  // Compact, index based copy of a CodeUnit. Nodes are stored as parallel
+  // arrays addressed by 32-bit indices, children of a Sequence occupy a
+  // contiguous range of children_. If and For keep their parts there too,
+  // in the order they are visited, with kNoNode for the parts they lack.
+  // Values, locals and call targets are borrowed from the CodeUnit the
+  // FlatAst was built from.
+  class FlatAst{
+  public:
+    typedef uint32_t NodeIndex;
+
+    static const NodeIndex kNoNode = 0xFFFFFFFF;
+
+    enum Kind{
+    #define DEFINE_KIND(BaseName) k##BaseName,
+      FOR_EACH_NODE(DEFINE_KIND)
+    #undef DEFINE_KIND
+      kNumberOfKinds
+    };
+
+    struct FunctionEntry{
+      Function* function;
+      NodeIndex root;
+    };
+  private:
+    Array<uint8_t> kinds_;
+    Array<uint8_t> ops_;
+    Array<uint32_t> first_;
+    Array<uint32_t> second_;
+    Array<uint32_t> rows_;
+    Array<uint32_t> columns_;
+    Array<NodeIndex> children_;
+    Array<Value*> values_;
+    Array<LocalVariable*> locals_;
+    Array<const std::string*> targets_;
+    Array<FunctionEntry> functions_;
+
+    NodeIndex NewNode(Kind kind, uint8_t op, uint32_t first, uint32_t second);
+
+    friend class FlatAstBuilder;
+  public:
+    FlatAst():
+      kinds_(64),
+      ops_(64),
+      first_(64),
+      second_(64),
+      rows_(64),
+      columns_(64),
+      children_(64),
+      values_(16),
+      locals_(16),
+      targets_(16),
+      functions_(4){}
+    ~FlatAst(){}
+
+    size_t GetNumberOfNodes() const{
+      return kinds_.Length();
+    }
+
+    size_t GetNumberOfFunctions() const{
+      return functions_.Length();
+    }
+
+    const FunctionEntry& GetFunctionAt(size_t idx) const{
+      return functions_[idx];
+    }
+
+    Kind GetKind(NodeIndex idx) const{
+      return static_cast<Kind>(kinds_[idx]);
+    }
+
+    // BinaryOp
+    BinaryOpNode::Kind GetBinaryOp(NodeIndex idx) const{
+      return static_cast<BinaryOpNode::Kind>(ops_[idx]);
+    }
+
+    NodeIndex GetLeft(NodeIndex idx) const{
+      return first_[idx];
+    }
+
+    NodeIndex GetRight(NodeIndex idx) const{
+      return second_[idx];
+    }
+
+    // Return, StoreLocal
+    NodeIndex GetOperand(NodeIndex idx) const{
+      return first_[idx];
+    }
+
+    // Literal
+    Value* GetValue(NodeIndex idx) const{
+      return values_[first_[idx]];
+    }
+
+    // LoadLocal, StoreLocal
+    LocalVariable* GetLocal(NodeIndex idx) const{
+      return locals_[second_[idx]];
+    }
+
+    // Call
+    const std::string& GetTarget(NodeIndex idx) const{
+      return *targets_[first_[idx]];
+    }
+
+    // Sequence; If: condition, then, else; For: init, condition, step, body
+    const NodeIndex* GetChildren(NodeIndex idx) const{
+      return &children_[first_[idx]];
+    }
+
+    size_t GetChildrenSize(NodeIndex idx) const{
+      return second_[idx];
+    }
+
+    unsigned int GetRow(NodeIndex idx) const{
+      return rows_[idx];
+    }
+
+    unsigned int GetColumn(NodeIndex idx) const{
+      return columns_[idx];
+    }
+
+    // Bytes used by the node pools, excluding borrowed Values and locals
+    size_t GetMemoryUsage() const;
+
+    void Print(std::ostream& stream) const;
+
+    static const char* GetKindName(Kind kind);
+    static FlatAst* FromCodeUnit(CodeUnit* unit);
+  };
+}
+
+#endif //GLSLTOOLS_FLAT_AST_H
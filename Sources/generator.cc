@@ -0,0 +1,119 @@
+#include "generator.h"
+#include <algorithm>
+
+namespace GLSLTools{
+  const size_t ShaderGenerator::kMaxDepth;
+  const size_t ShaderGenerator::kMaxChain;
+
+  void ShaderGenerator::GenerateIdentifiers(size_t size){
+    // a handful of locals whose names are size characters long
+    static const size_t kNumberOfLocals = 8;
+    std::string base(size, 'x');
+    stream_ << "float identifiers(){" << std::endl;
+    for(size_t i = 0; i < kNumberOfLocals; i++){
+      stream_ << "  float " << base << i << " = " << i << ".0;" << std::endl;
+    }
+    for(size_t i = 1; i < kNumberOfLocals; i++){
+      stream_ << "  " << base << i << " = " << base << (i - 1) << " + " << base << i << ";" << std::endl;
+    }
+    stream_ << "  return " << base << (kNumberOfLocals - 1) << ";" << std::endl;
+    stream_ << "}" << std::endl;
+  }
+
+  void ShaderGenerator::GenerateBlocks(size_t size){
+    // size blocks, nested kMaxDepth deep and repeated side by side
+    stream_ << "float blocks(){" << std::endl;
+    stream_ << "  float b = 0.0;" << std::endl;
+    size_t emitted = 0;
+    while(emitted < size){
+      size_t depth = std::min(kMaxDepth, size - emitted);
+      for(size_t i = 0; i < depth; i++){
+        stream_ << std::string(i + 1, ' ') << "{ float b" << i << " = b + " << i << ".0;" << std::endl;
+      }
+      stream_ << std::string(depth + 1, ' ') << "b = b" << (depth - 1) << ";" << std::endl;
+      for(size_t i = depth; i > 0; i--){
+        stream_ << std::string(i, ' ') << "}" << std::endl;
+      }
+      emitted += depth;
+    }
+    stream_ << "  return b;" << std::endl;
+    stream_ << "}" << std::endl;
+  }
+
+  void ShaderGenerator::GenerateLocals(size_t size){
+    stream_ << "float locals(){" << std::endl;
+    stream_ << "  float l0 = 1.0;" << std::endl;
+    for(size_t i = 1; i < size; i++){
+      stream_ << "  float l" << i << " = l" << (i - 1) << " * 2.0;" << std::endl;
+    }
+    stream_ << "  return l" << (size > 0 ? size - 1 : 0) << ";" << std::endl;
+    stream_ << "}" << std::endl;
+  }
+
+  void ShaderGenerator::GenerateExpressions(size_t size){
+    static const char* kOperators[] = { " + ", " * ", " - ", " / " };
+    stream_ << "float expressions(){" << std::endl;
+    stream_ << "  float e = 1.0;" << std::endl;
+    size_t emitted = 0;
+    while(emitted < size){
+      size_t chain = std::min(kMaxChain, size - emitted);
+      stream_ << "  e = e";
+      for(size_t i = 1; i < chain; i++){
+        stream_ << kOperators[i % 4] << (i % 7 == 0 ? "(e + 1.0)" : "2.0");
+      }
+      stream_ << ";" << std::endl;
+      emitted += chain;
+    }
+    stream_ << "  return e;" << std::endl;
+    stream_ << "}" << std::endl;
+  }
+
+  void ShaderGenerator::GenerateFunctions(size_t size){
+    stream_ << "float f0(){" << std::endl;
+    stream_ << "  return 1.0;" << std::endl;
+    stream_ << "}" << std::endl;
+    for(size_t i = 1; i < size; i++){
+      stream_ << "float f" << i << "(){" << std::endl;
+      stream_ << "  return f" << (i - 1) << "() + 1.0;" << std::endl;
+      stream_ << "}" << std::endl;
+    }
+  }
+
+  void ShaderGenerator::Generate(Shape shape, size_t size){
+    switch(shape){
+      case kIdentifiers: GenerateIdentifiers(size); break;
+      case kBlocks: GenerateBlocks(size); break;
+      case kLocals: GenerateLocals(size); break;
+      case kExpressions: GenerateExpressions(size); break;
+      case kFunctions: GenerateFunctions(size); break;
+      case kMixed:{
+        size_t part = size / 5 > 0 ? size / 5 : 1;
+        GenerateIdentifiers(part);
+        GenerateBlocks(part);
+        GenerateLocals(part);
+        GenerateExpressions(part);
+        GenerateFunctions(part);
+        break;
+      }
+      default: break;
+    }
+  }
+
+  const char* ShaderGenerator::GetShapeName(Shape shape){
+    switch(shape){
+    #define DEFINE_SWITCH_CASE(Name, Text) \
+      case k##Name: return Text;
+      FOR_EACH_SHAPE(DEFINE_SWITCH_CASE)
+    #undef DEFINE_SWITCH_CASE
+      default: return "<unknown>";
+    }
+  }
+
+  ShaderGenerator::Shape ShaderGenerator::GetShape(const std::string& name){
+    #define DEFINE_CHECK(Name, Text) \
+      if(name == Text) return k##Name;
+    FOR_EACH_SHAPE(DEFINE_CHECK)
+    #undef DEFINE_CHECK
+    return kNumberOfShapes;
+  }
+}
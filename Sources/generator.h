@@ -0,0 +1,53 @@
+#ifndef GLSLTOOLS_GENERATOR_H
+#define GLSLTOOLS_GENERATOR_H
+
+#include <string>
+#include <iostream>
+
+namespace GLSLTools{
+  #define FOR_EACH_SHAPE(V) \
+    V(Identifiers, "identifiers") \
+    V(Blocks, "blocks") \
+    V(Locals, "locals") \
+    V(Expressions, "expressions") \
+    V(Functions, "functions") \
+    V(Mixed, "mixed")
+
+  // Writes synthetic shaders whose input size grows linearly with size, each
+  // shape stressing one dimension of the front end. Nesting is bounded
+  // (kMaxDepth blocks, kMaxChain operands per expression) and repeated
+  // beyond that so recursive passes don't run out of stack.
+  class ShaderGenerator{
+  public:
+    enum Shape{
+    #define DEFINE_SHAPE(Name, Text) k##Name,
+      FOR_EACH_SHAPE(DEFINE_SHAPE)
+    #undef DEFINE_SHAPE
+      kNumberOfShapes
+    };
+
+    static const size_t kMaxDepth = 128;
+    static const size_t kMaxChain = 2048;
+  private:
+    std::ostream& stream_;
+
+    void GenerateIdentifiers(size_t size);
+    void GenerateBlocks(size_t size);
+    void GenerateLocals(size_t size);
+    void GenerateExpressions(size_t size);
+    void GenerateFunctions(size_t size);
+  public:
+    ShaderGenerator(std::ostream& stream):
+      stream_(stream){}
+    ~ShaderGenerator(){}
+
+    void Generate(Shape shape, size_t size);
+
+    static const char* GetShapeName(Shape shape);
+
+    // Returns kNumberOfShapes for unknown names
+    static Shape GetShape(const std::string& name);
+  };
+}
+
+#endif //GLSLTOOLS_GENERATOR_H
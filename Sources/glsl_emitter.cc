@@ -0,0 +1,153 @@
+#include "glsl_emitter.h"
+#include "trace.h"
+#include <sstream>
+#include <locale>
+#include <limits>
+
+namespace GLSLTools{
+  void GlslEmitter::EmitValue(Value* value){
+    if(value == nullptr){
+      stream_ << "0";
+    } else if(value->IsScalar()){
+      stream_ << value->GetType()->GetName() << "(";
+      for(size_t i = 0; i < value->GetScalarSize(); i++){
+        if(i > 0) stream_ << ", ";
+        EmitValue(value->GetAt(i));
+      }
+      stream_ << ")";
+    } else if(value->GetType()->IsCompatibile(*Type::FLOAT)){
+      // always keep a decimal point so the literal stays a float
+      bool is_double = value->GetType() == Type::DOUBLE;
+      std::stringstream text;
+      text.imbue(std::locale::classic());
+      if(is_double){
+        text.precision(std::numeric_limits<double>::max_digits10);
+        text << value->AsDouble();
+      } else{
+        text.precision(std::numeric_limits<float>::max_digits10);
+        text << value->AsFloat();
+      }
+      std::string str = text.str();
+      if(str.find_first_of(".eEn") == std::string::npos) str += ".0";
+      stream_ << str << (is_double ? "lf" : "");
+    } else if(value->GetType() == Type::BOOL){
+      stream_ << (value->AsInt() != 0 ? "true" : "false");
+    } else if(value->GetType() == Type::UINT){
+      stream_ << value->AsUInt() << "u";
+    } else if(value->GetType()->IsCompatibile(*Type::INT)){
+      // there's no unary minus, negative bit patterns are written in hex
+      if(value->AsInt() < 0){
+        stream_ << "0x" << std::hex << static_cast<unsigned int>(value->AsInt()) << std::dec;
+      } else{
+        stream_ << value->AsInt();
+      }
+    } else{
+      stream_ << value->ToString();
+    }
+  }
+
+  void GlslEmitter::EmitBlock(SequenceNode* node){
+    stream_ << "{" << std::endl;
+    indent_++;
+    node->VisitChildren(this);
+    indent_--;
+    Adjust();
+    stream_ << "}";
+  }
+
+  void GlslEmitter::EmitStore(StoreLocalNode* node){
+    if(node->IsDeclaration()){
+      LocalVariable* local = node->GetLocal();
+      if(local->GetPrecision() != kDefaultPrecision) stream_ << GetPrecisionName(local->GetPrecision()) << " ";
+      stream_ << local->GetType()->GetName() << " ";
+    }
+    stream_ << node->GetLocal()->GetName() << " = ";
+    node->GetValue()->Visit(this);
+  }
+
+  void GlslEmitter::EmitCondition(AstNode* node){
+    // the statement's own parentheses stand in for the operation's
+    BinaryOpNode* op = node->AsBinaryOp();
+    if(op == nullptr){
+      node->Visit(this);
+      return;
+    }
+    op->GetLeft()->Visit(this);
+    stream_ << " " << BinaryOpNode::GetOperator(op->GetKind()) << " ";
+    op->GetRight()->Visit(this);
+  }
+
+  void GlslEmitter::VisitIf(IfNode* node){
+    Adjust();
+    while(true){
+      stream_ << "if(";
+      EmitCondition(node->GetCondition());
+      stream_ << ")";
+      EmitBlock(node->GetThen());
+      if(!node->HasElse()) break;
+
+      // an else block holding nothing but an if is written as else if
+      SequenceNode* otherwise = node->GetElse();
+      stream_ << " else";
+      if(otherwise->GetChildrenSize() == 1 && otherwise->GetChildAt(0)->IsIf()){
+        stream_ << " ";
+        node = otherwise->GetChildAt(0)->AsIf();
+        continue;
+      }
+      EmitBlock(otherwise);
+      break;
+    }
+    stream_ << std::endl;
+  }
+
+  void GlslEmitter::VisitFor(ForNode* node){
+    Adjust();
+    if(node->IsWhile()){
+      stream_ << "while(";
+      EmitCondition(node->GetCondition());
+    } else{
+      stream_ << "for(";
+      if(node->GetInit() != nullptr) EmitStore(node->GetInit()->AsStoreLocal());
+      stream_ << "; ";
+      EmitCondition(node->GetCondition());
+      stream_ << "; ";
+      if(node->GetStep() != nullptr) EmitStore(node->GetStep()->AsStoreLocal());
+    }
+    stream_ << ")";
+    EmitBlock(node->GetBody());
+    stream_ << std::endl;
+  }
+
+  void GlslEmitter::EmitGlobal(const char* qualifier, LocalVariable* local){
+    if(local->HasLocation()) stream_ << "layout(location = " << local->GetLocation() << ") ";
+    stream_ << qualifier << " ";
+    if(local->GetPrecision() != kDefaultPrecision) stream_ << GetPrecisionName(local->GetPrecision()) << " ";
+    stream_ << local->GetType()->GetName() << " " << local->GetName() << ";" << std::endl;
+  }
+
+  void GlslEmitter::EmitFunction(Function* func){
+    Adjust();
+    stream_ << func->GetResultType()->GetName() << " " << func->GetName() << "()";
+    func->GetCode()->Visit(this);
+    stream_ << std::endl;
+  }
+
+  void GlslEmitter::EmitUnit(CodeUnit* unit){
+    TRACE_SCOPE("EmitUnit", "emit");
+    for(size_t i = 0; i < unit->GetNumberOfUniforms(); i++){
+      EmitGlobal("uniform", unit->GetUniformAt(i));
+    }
+    for(size_t i = 0; i < unit->GetNumberOfInputs(); i++){
+      EmitGlobal("in", unit->GetInputAt(i));
+    }
+    for(size_t i = 0; i < unit->GetNumberOfOutputs(); i++){
+      EmitGlobal("out", unit->GetOutputAt(i));
+    }
+    size_t globals = unit->GetNumberOfUniforms() + unit->GetNumberOfInputs() + unit->GetNumberOfOutputs();
+    if(globals > 0 && unit->GetNumberOfFunctions() > 0) stream_ << std::endl;
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      if(i > 0) stream_ << std::endl;
+      EmitFunction(unit->GetFunctionAt(i));
+    }
+  }
+}
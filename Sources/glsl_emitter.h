@@ -0,0 +1,77 @@
+#ifndef GLSLTOOLS_GLSL_EMITTER_H
+#define GLSLTOOLS_GLSL_EMITTER_H
+
+#include "ast.h"
+#include <iostream>
+
+namespace GLSLTools{
+  // Writes a CodeUnit back out as GLSL source
+  class GlslEmitter : public AstNodeVisitor{
+  private:
+    std::ostream& stream_;
+    int indent_ = 0;
+
+    inline void Adjust(){
+      for(int i = 0; i < indent_; i++) stream_ << "  ";
+    }
+
+    void EmitGlobal(const char* qualifier, LocalVariable* local);
+    void EmitFunction(Function* func);
+    void EmitBlock(SequenceNode* node);
+    void EmitStore(StoreLocalNode* node);
+    void EmitCondition(AstNode* node);
+  public:
+    GlslEmitter(std::ostream& stream):
+      stream_(stream){}
+    ~GlslEmitter(){}
+
+    void EmitUnit(CodeUnit* unit);
+    void EmitValue(Value* value);
+
+    void VisitSequence(SequenceNode* node){
+      // function bodies follow the signature, nested blocks are statements
+      bool nested = indent_ > 0;
+      if(nested) Adjust();
+      EmitBlock(node);
+      if(nested) stream_ << std::endl;
+    }
+
+    void VisitLiteral(LiteralNode* node){
+      EmitValue(node->GetValue());
+    }
+
+    void VisitReturn(ReturnNode* node){
+      Adjust();
+      stream_ << "return ";
+      node->VisitChildren(this);
+      stream_ << ";" << std::endl;
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      stream_ << "(";
+      node->GetLeft()->Visit(this);
+      stream_ << " " << BinaryOpNode::GetOperator(node->GetKind()) << " ";
+      node->GetRight()->Visit(this);
+      stream_ << ")";
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      Adjust();
+      EmitStore(node);
+      stream_ << ";" << std::endl;
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      stream_ << node->GetLocal()->GetName();
+    }
+
+    void VisitCall(CallNode* node){
+      stream_ << node->GetTarget() << "()";
+    }
+
+    void VisitIf(IfNode* node);
+    void VisitFor(ForNode* node);
+  };
+}
+
+#endif //GLSLTOOLS_GLSL_EMITTER_H
@@ -0,0 +1,441 @@
+#include "hash_cons.h"
+
+namespace GLSLTools{
+  const HashConsTable::NodeId HashConsTable::kNoNode;
+
+  uint64_t HashCombine(uint64_t hash, uint64_t value){
+    // FNV style combine with a murmur finalizer on every step
+    hash = (hash ^ value) * 0x100000001B3ULL;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash;
+  }
+
+  static uint64_t HashString(const std::string& value){
+    return std::hash<std::string>()(value);
+  }
+
+  static uint64_t HashSymbol(LocalVariable* local){
+    return HashCombine(HashCombine(HashString(local->GetName()), HashString(local->GetType()->GetName())), local->GetPrecision());
+  }
+
+  // Bit pattern of a non vector value, so 0.0 and -0.0 stay apart
+  static uint64_t GetBits(Value* value){
+    uint64_t bits = 0;
+    if(value->GetType() == Type::DOUBLE){
+      double number = value->AsDouble();
+      memcpy(&bits, &number, sizeof(number));
+    } else if(value->GetType()->IsCompatibile(*Type::FLOAT)){
+      float number = value->AsFloat();
+      memcpy(&bits, &number, sizeof(number));
+    } else{
+      bits = value->AsUInt();
+    }
+    return bits;
+  }
+
+  uint64_t HashValue(Value* value){
+    if(value == nullptr) return 0;
+    uint64_t hash = HashCombine(HashString(value->GetType()->GetName()), value->IsConstant() ? 1 : 0);
+    if(value->IsScalar()){
+      for(size_t i = 0; i < value->GetScalarSize(); i++){
+        hash = HashCombine(hash, HashValue(value->GetAt(i)));
+      }
+      return hash;
+    }
+    return HashCombine(hash, GetBits(value));
+  }
+
+  static bool ValuesEqual(Value* a, Value* b){
+    if(a == nullptr || b == nullptr) return a == b;
+    if(a->GetType() != b->GetType() || a->IsConstant() != b->IsConstant()) return false;
+    if(a->IsScalar()){
+      if(a->GetScalarSize() != b->GetScalarSize()) return false;
+      for(size_t i = 0; i < a->GetScalarSize(); i++){
+        if(!ValuesEqual(a->GetAt(i), b->GetAt(i))) return false;
+      }
+      return true;
+    }
+    return GetBits(a) == GetBits(b);
+  }
+
+  // Computes node hashes bottom up, and interns them when given a table
+  class HashConsBuilder : public AstNodeVisitor{
+  private:
+    HashConsTable* table_;
+    uint64_t hash_;
+    HashConsTable::NodeId result_;
+
+    void Finish(FlatAst::Kind kind, uint8_t op, uint32_t first, uint32_t second, uint64_t hash, const HashConsTable::NodeId* children = nullptr, size_t count = 0){
+      hash_ = HashCombine(HashCombine(hash, kind), op);
+      result_ = table_ != nullptr ?
+                table_->InternNode(kind, op, first, second, hash_, children, count) :
+                HashConsTable::kNoNode;
+    }
+  public:
+    HashConsBuilder(HashConsTable* table):
+      table_(table),
+      hash_(0),
+      result_(HashConsTable::kNoNode){}
+    ~HashConsBuilder(){}
+
+    uint64_t GetHash() const{
+      return hash_;
+    }
+
+    HashConsTable::NodeId Convert(AstNode* node){
+      node->Visit(this);
+      return result_;
+    }
+
+    void VisitSequence(SequenceNode* node){
+      std::vector<HashConsTable::NodeId> children;
+      children.reserve(node->GetChildrenSize());
+      uint64_t hash = node->GetChildrenSize();
+      for(size_t i = 0; i < node->GetChildrenSize(); i++){
+        children.push_back(Convert(node->GetChildAt(i)));
+        hash = HashCombine(hash, hash_);
+      }
+      Finish(FlatAst::kSequence, 0, 0, static_cast<uint32_t>(children.size()), hash, children.data(), children.size());
+    }
+
+    void VisitLiteral(LiteralNode* node){
+      uint32_t value = table_ != nullptr ? table_->InternValue(node->GetValue()) : 0;
+      Finish(FlatAst::kLiteral, 0, value, 0, HashValue(node->GetValue()));
+    }
+
+    void VisitReturn(ReturnNode* node){
+      HashConsTable::NodeId value = Convert(node->GetValue());
+      Finish(FlatAst::kReturn, 0, value, 0, hash_);
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      HashConsTable::NodeId left = Convert(node->GetLeft());
+      uint64_t hash = hash_;
+      HashConsTable::NodeId right = Convert(node->GetRight());
+      Finish(FlatAst::kBinaryOp, static_cast<uint8_t>(node->GetKind()), left, right, HashCombine(hash, hash_));
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      uint32_t symbol = table_ != nullptr ? table_->InternSymbol(node->GetLocal()) : 0;
+      Finish(FlatAst::kLoadLocal, 0, 0, symbol, HashSymbol(node->GetLocal()));
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      HashConsTable::NodeId value = Convert(node->GetValue());
+      uint32_t symbol = table_ != nullptr ? table_->InternSymbol(node->GetLocal()) : 0;
+      Finish(FlatAst::kStoreLocal, node->IsDeclaration() ? 1 : 0, value, symbol, HashCombine(hash_, HashSymbol(node->GetLocal())));
+    }
+
+    void VisitCall(CallNode* node){
+      uint32_t target = table_ != nullptr ? table_->InternTarget(node->GetTarget()) : 0;
+      Finish(FlatAst::kCall, 0, target, 0, HashString(node->GetTarget()));
+    }
+
+    // parts are laid out like FlatAst lays them out
+    void VisitIf(IfNode* node){
+      AstNode* parts[] = { node->GetCondition(), node->GetThen(), node->GetElse() };
+      FinishParts(FlatAst::kIf, parts, 3);
+    }
+
+    void VisitFor(ForNode* node){
+      AstNode* parts[] = { node->GetInit(), node->GetCondition(), node->GetStep(), node->GetBody() };
+      FinishParts(FlatAst::kFor, parts, 4);
+    }
+
+    void FinishParts(FlatAst::Kind kind, AstNode** parts, size_t count){
+      HashConsTable::NodeId children[4];
+      uint64_t hash = count;
+      for(size_t i = 0; i < count; i++){
+        children[i] = parts[i] != nullptr ? Convert(parts[i]) : HashConsTable::kNoNode;
+        hash = HashCombine(hash, parts[i] != nullptr ? hash_ : 0);
+      }
+      Finish(kind, 0, 0, static_cast<uint32_t>(count), hash, children, count);
+    }
+  };
+
+  uint64_t HashNode(AstNode* node){
+    HashConsBuilder builder(nullptr);
+    builder.Convert(node);
+    return builder.GetHash();
+  }
+
+  HashConsTable::HashConsTable():
+    kinds_(256),
+    ops_(256),
+    first_(256),
+    second_(256),
+    hashes_(256),
+    next_(256),
+    children_(256),
+    values_(64),
+    nodes_(),
+    value_index_(),
+    symbols_(),
+    symbol_index_(),
+    targets_(),
+    target_index_(),
+    units_(),
+    interned_(0),
+    mutex_(){}
+
+  HashConsTable::~HashConsTable(){
+    for(size_t i = 0; i < values_.Length(); i++){
+      delete values_[i];
+    }
+  }
+
+  uint32_t HashConsTable::InternValue(Value* value){
+    uint64_t hash = HashValue(value);
+    auto pos = value_index_.find(hash);
+    if(pos != value_index_.end() && ValuesEqual(values_[pos->second], value)) return pos->second;
+
+    // a colliding value is stored again rather than chained, values are small
+    uint32_t idx = static_cast<uint32_t>(values_.Length());
+    values_.Add(value != nullptr ? value->Copy() : nullptr);
+    if(pos == value_index_.end()) value_index_.insert({ hash, idx });
+    return idx;
+  }
+
+  uint32_t HashConsTable::InternSymbol(LocalVariable* local){
+    std::string key = local->GetName() + '\0' + local->GetType()->GetName() + '\0' + GetPrecisionName(local->GetPrecision());
+    auto pos = symbol_index_.find(key);
+    if(pos != symbol_index_.end()) return pos->second;
+    uint32_t idx = static_cast<uint32_t>(symbols_.size());
+    symbols_.push_back({ local->GetName(), local->GetType(), local->GetPrecision() });
+    symbol_index_.insert({ key, idx });
+    return idx;
+  }
+
+  uint32_t HashConsTable::InternTarget(const std::string& target){
+    auto pos = target_index_.find(target);
+    if(pos != target_index_.end()) return pos->second;
+    uint32_t idx = static_cast<uint32_t>(targets_.size());
+    targets_.push_back(target);
+    target_index_.insert({ target, idx });
+    return idx;
+  }
+
+  HashConsTable::NodeId HashConsTable::InternNode(FlatAst::Kind kind, uint8_t op, uint32_t first, uint32_t second, uint64_t hash, const NodeId* children, size_t count){
+    interned_++;
+
+    // children are interned already, so comparing ids is a full structural compare
+    bool has_children = kind == FlatAst::kSequence || kind == FlatAst::kIf || kind == FlatAst::kFor;
+    auto pos = nodes_.find(hash);
+    NodeId head = pos != nodes_.end() ? pos->second : kNoNode;
+    for(NodeId id = head; id != kNoNode; id = next_[id]){
+      if(kinds_[id] != kind || ops_[id] != op || second_[id] != second) continue;
+      if(has_children){
+        if(count == 0 || memcmp(&children_[first_[id]], children, count * sizeof(NodeId)) == 0) return id;
+      } else if(first_[id] == first){
+        return id;
+      }
+    }
+
+    if(has_children){
+      first = static_cast<uint32_t>(children_.Length());
+      for(size_t i = 0; i < count; i++){
+        children_.Add(children[i]);
+      }
+    }
+
+    NodeId id = static_cast<NodeId>(kinds_.Length());
+    kinds_.Add(static_cast<uint8_t>(kind));
+    ops_.Add(op);
+    first_.Add(first);
+    second_.Add(second);
+    hashes_.Add(hash);
+    next_.Add(head);
+    nodes_[hash] = id;
+    return id;
+  }
+
+  HashConsTable::NodeId HashConsTable::Intern(AstNode* node){
+    std::lock_guard<std::mutex> lock(mutex_);
+    HashConsBuilder builder(this);
+    return builder.Convert(node);
+  }
+
+  HashConsTable::UnitId HashConsTable::AddUnit(CodeUnit* unit){
+    std::lock_guard<std::mutex> lock(mutex_);
+    HashConsBuilder builder(this);
+    UnitEntry entry;
+    entry.name = unit->GetName();
+    for(size_t i = 0; i < unit->GetNumberOfUniforms(); i++){
+      entry.uniforms.push_back(InternSymbol(unit->GetUniformAt(i)));
+    }
+    for(size_t i = 0; i < unit->GetNumberOfInputs(); i++){
+      LocalVariable* input = unit->GetInputAt(i);
+      entry.inputs.push_back({ InternSymbol(input), input->GetLocation() });
+    }
+    for(size_t i = 0; i < unit->GetNumberOfOutputs(); i++){
+      LocalVariable* output = unit->GetOutputAt(i);
+      entry.outputs.push_back({ InternSymbol(output), output->GetLocation() });
+    }
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      Function* func = unit->GetFunctionAt(i);
+      entry.functions.push_back({ func->GetName(), func->GetResultType(), builder.Convert(func->GetCode()) });
+    }
+    units_.push_back(entry);
+    return static_cast<UnitId>(units_.size() - 1);
+  }
+
+  // Rebuilds a tree from the table, resolving locals by name like the parser
+  class UnitBuilder{
+  private:
+    HashConsTable* table_;
+    std::string error_;
+  public:
+    UnitBuilder(HashConsTable* table):
+      table_(table),
+      error_(){}
+    ~UnitBuilder(){}
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    LocalVariable* Resolve(uint32_t symbol, LocalScope* scope){
+      LocalVariable* local = nullptr;
+      const std::string& name = table_->symbols_[symbol].name;
+      if(!scope->Lookup(name, &local) && error_.empty()) error_ = "Undefined local: " + name;
+      return local;
+    }
+
+    AstNode* Build(HashConsTable::NodeId id, LocalScope* scope){
+      uint32_t first = table_->first_[id];
+      uint32_t second = table_->second_[id];
+      switch(table_->GetKind(id)){
+        case FlatAst::kSequence:{
+          SequenceNode* code = new SequenceNode(scope);
+          for(uint32_t i = 0; i < second; i++){
+            AstNode* child = Build(table_->children_[first + i], code->GetScope());
+            if(child != nullptr) code->Add(child);
+          }
+          return code;
+        }
+        case FlatAst::kLiteral:{
+          Value* value = table_->values_[first];
+          return new LiteralNode(value != nullptr ? value->Copy() : nullptr);
+        }
+        case FlatAst::kReturn: return new ReturnNode(Build(first, scope));
+        case FlatAst::kBinaryOp:{
+          AstNode* left = Build(first, scope);
+          AstNode* right = Build(second, scope);
+          return new BinaryOpNode(static_cast<BinaryOpNode::Kind>(table_->ops_[id]), left, right);
+        }
+        case FlatAst::kLoadLocal:{
+          LocalVariable* local = Resolve(second, scope);
+          return local != nullptr ? new LoadLocalNode(local) : nullptr;
+        }
+        case FlatAst::kStoreLocal:{
+          // the initializer can't see the local it defines
+          AstNode* value = Build(first, scope);
+          LocalVariable* local;
+          if(table_->ops_[id] != 0){
+            const HashConsTable::Symbol& symbol = table_->symbols_[second];
+            local = new LocalVariable(symbol.name, symbol.type, symbol.precision);
+            if(!scope->AddLocal(local)){
+              delete local;
+              local = nullptr;
+              if(error_.empty()) error_ = "Redefinition of local: " + symbol.name;
+            }
+          } else{
+            local = Resolve(second, scope);
+          }
+          if(local == nullptr){
+            delete value;
+            return nullptr;
+          }
+          return new StoreLocalNode(local, value, table_->ops_[id] != 0);
+        }
+        case FlatAst::kCall: return new CallNode(table_->targets_[first]);
+        case FlatAst::kIf:{
+          const HashConsTable::NodeId* parts = &table_->children_[first];
+          AstNode* condition = Build(parts[0], scope);
+          AstNode* then_block = Build(parts[1], scope);
+          AstNode* else_block = parts[2] != HashConsTable::kNoNode ? Build(parts[2], scope) : nullptr;
+          if(condition == nullptr || then_block == nullptr || (parts[2] != HashConsTable::kNoNode && else_block == nullptr)){
+            delete condition;
+            delete then_block;
+            delete else_block;
+            return nullptr;
+          }
+          return new IfNode(condition, then_block->AsSequence(), else_block != nullptr ? else_block->AsSequence() : nullptr);
+        }
+        case FlatAst::kFor:{
+          // init declares its locals in the loop's own scope
+          const HashConsTable::NodeId* parts = &table_->children_[first];
+          ForNode* loop = new ForNode(scope);
+          if(parts[0] != HashConsTable::kNoNode) loop->SetInit(Build(parts[0], loop->GetScope()));
+          loop->SetCondition(Build(parts[1], loop->GetScope()));
+          if(parts[2] != HashConsTable::kNoNode) loop->SetStep(Build(parts[2], loop->GetScope()));
+          AstNode* body = Build(parts[3], loop->GetScope());
+          loop->SetBody(body != nullptr ? body->AsSequence() : nullptr);
+          if((parts[0] != HashConsTable::kNoNode && loop->GetInit() == nullptr) || loop->GetCondition() == nullptr ||
+             (parts[2] != HashConsTable::kNoNode && loop->GetStep() == nullptr) || loop->GetBody() == nullptr){
+            delete loop;
+            return nullptr;
+          }
+          return loop;
+        }
+        default:
+          if(error_.empty()) error_ = "Unknown node kind";
+          return nullptr;
+      }
+    }
+  };
+
+  CodeUnit* HashConsTable::BuildUnit(UnitId id, std::string* error){
+    std::lock_guard<std::mutex> lock(mutex_);
+    UnitBuilder builder(this);
+    CodeUnit* unit = new CodeUnit(units_[id].name);
+    for(uint32_t symbol : units_[id].uniforms){
+      LocalVariable* uniform = new LocalVariable(symbols_[symbol].name, symbols_[symbol].type, symbols_[symbol].precision);
+      if(!unit->AddUniform(uniform)) delete uniform;
+    }
+    for(auto& input : units_[id].inputs){
+      const Symbol& symbol = symbols_[input.symbol];
+      LocalVariable* local = new LocalVariable(symbol.name, symbol.type, symbol.precision);
+      local->SetLocation(input.location);
+      if(!unit->AddInput(local)) delete local;
+    }
+    for(auto& output : units_[id].outputs){
+      const Symbol& symbol = symbols_[output.symbol];
+      LocalVariable* local = new LocalVariable(symbol.name, symbol.type, symbol.precision);
+      local->SetLocation(output.location);
+      if(!unit->AddOutput(local)) delete local;
+    }
+    for(auto& entry : units_[id].functions){
+      SequenceNode* code = static_cast<SequenceNode*>(builder.Build(entry.root, unit->GetGlobals()));
+      unit->AddFunction(new Function(entry.name, entry.result_type, code));
+    }
+
+    if(!builder.GetError().empty()){
+      if(error != nullptr) *error = builder.GetError();
+      delete unit;
+      return nullptr;
+    }
+    return unit;
+  }
+
+  size_t HashConsTable::GetMemoryUsage() const{
+    size_t bytes = kinds_.Length() * (2 * sizeof(uint8_t) + 3 * sizeof(uint32_t) + sizeof(uint64_t)) +
+                   children_.Length() * sizeof(NodeId) +
+                   values_.Length() * (sizeof(Value*) + sizeof(Value) + sizeof(uint64_t)) +
+                   nodes_.size() * (sizeof(uint64_t) + sizeof(NodeId) + sizeof(void*)) +
+                   value_index_.size() * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(void*));
+    for(auto& symbol : symbols_){
+      bytes += sizeof(Symbol) + symbol.name.capacity();
+    }
+    for(auto& target : targets_){
+      bytes += sizeof(std::string) + target.capacity();
+    }
+    for(auto& unit : units_){
+      bytes += sizeof(UnitEntry) + unit.uniforms.size() * sizeof(uint32_t) + unit.functions.size() * sizeof(FunctionEntry) +
+               (unit.inputs.size() + unit.outputs.size()) * sizeof(InterfaceEntry);
+    }
+    return bytes;
+  }
+}
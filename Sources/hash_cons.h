@@ -0,0 +1,130 @@
+#ifndef GLSLTOOLS_HASH_CONS_H
+#define GLSLTOOLS_HASH_CONS_H
+
+#include "ast.h"
+#include "array.h"
+#include "flat_ast.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GLSLTools{
+  // Structural hashes, equal for trees that print the same. Locals are
+  // identified by name, type and precision, not by the LocalVariable they
+  // resolve to.
+  uint64_t HashValue(Value* value);
+  uint64_t HashNode(AstNode* node);
+
+  // The step the hashes above are built from, folding value into hash
+  uint64_t HashCombine(uint64_t hash, uint64_t value);
+
+  // Hash-consing table shared by a batch of CodeUnits. Every distinct
+  // subtree is stored once, laid out like a FlatAst and tagged with its
+  // structural hash, so identical function bodies and expressions across
+  // shader permutations share their NodeId. Passes can key caches by NodeId.
+  // Values are copied into the table, so the units can be freed once added
+  // and rebuilt later with BuildUnit (without source spans).
+  class HashConsTable{
+  public:
+    typedef FlatAst::NodeIndex NodeId;
+    typedef uint32_t UnitId;
+
+    static const NodeId kNoNode = FlatAst::kNoNode;
+
+    struct FunctionEntry{
+      std::string name;
+      Type* result_type;
+      NodeId root;
+    };
+  private:
+    struct Symbol{
+      std::string name;
+      Type* type;
+      Precision precision;
+    };
+
+    struct InterfaceEntry{
+      uint32_t symbol;
+      int location;
+    };
+
+    struct UnitEntry{
+      std::string name;
+      std::vector<uint32_t> uniforms;
+      std::vector<InterfaceEntry> inputs;
+      std::vector<InterfaceEntry> outputs;
+      std::vector<FunctionEntry> functions;
+    };
+
+    Array<uint8_t> kinds_;
+    Array<uint8_t> ops_;
+    Array<uint32_t> first_;
+    Array<uint32_t> second_;
+    Array<uint64_t> hashes_;
+    Array<NodeId> next_;
+    Array<NodeId> children_;
+    Array<Value*> values_;
+    std::unordered_map<uint64_t, NodeId> nodes_;
+    std::unordered_map<uint64_t, uint32_t> value_index_;
+    std::vector<Symbol> symbols_;
+    std::unordered_map<std::string, uint32_t> symbol_index_;
+    std::vector<std::string> targets_;
+    std::unordered_map<std::string, uint32_t> target_index_;
+    std::vector<UnitEntry> units_;
+    size_t interned_;
+    std::mutex mutex_;
+
+    friend class HashConsBuilder;
+    friend class UnitBuilder;
+
+    uint32_t InternValue(Value* value);
+    uint32_t InternSymbol(LocalVariable* local);
+    uint32_t InternTarget(const std::string& target);
+    NodeId InternNode(FlatAst::Kind kind, uint8_t op, uint32_t first, uint32_t second, uint64_t hash, const NodeId* children = nullptr, size_t count = 0);
+  public:
+    HashConsTable();
+    HashConsTable(const HashConsTable& other) = delete;
+    ~HashConsTable();
+
+    // Interns every function of unit, which may be deleted afterwards
+    UnitId AddUnit(CodeUnit* unit);
+
+    // Interns a single subtree
+    NodeId Intern(AstNode* node);
+
+    // Returns a new CodeUnit owned by the caller, nullptr if the unit can't be rebuilt
+    CodeUnit* BuildUnit(UnitId id, std::string* error = nullptr);
+
+    size_t GetNumberOfUnits() const{
+      return units_.size();
+    }
+
+    const std::vector<FunctionEntry>& GetFunctions(UnitId id) const{
+      return units_[id].functions;
+    }
+
+    // Distinct subtrees stored
+    size_t GetNumberOfNodes() const{
+      return kinds_.Length();
+    }
+
+    // Subtrees interned in total, duplicates included
+    size_t GetNumberOfInternedNodes() const{
+      return interned_;
+    }
+
+    FlatAst::Kind GetKind(NodeId id) const{
+      return static_cast<FlatAst::Kind>(kinds_[id]);
+    }
+
+    uint64_t GetHash(NodeId id) const{
+      return hashes_[id];
+    }
+
+    size_t GetMemoryUsage() const;
+  };
+}
+
+#endif //GLSLTOOLS_HASH_CONS_H
@@ -0,0 +1,211 @@
+#include "hoist.h"
+#include "analysis.h"
+#include "glsl_emitter.h"
+#include "pass_manager.h"
+#include "trace.h"
+#include <sstream>
+
+namespace GLSLTools{
+  const char* UniformHoister::kPrefix = "hoisted_";
+
+  // Names of every local declared below the node it visits
+  class DeclarationCollector : public AstNodeVisitor{
+  private:
+    std::unordered_set<std::string>* names_;
+  public:
+    DeclarationCollector(std::unordered_set<std::string>* names):
+      names_(names){}
+    ~DeclarationCollector(){}
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      if(node->IsDeclaration()) names_->insert(node->GetLocal()->GetName());
+      node->VisitChildren(this);
+    }
+
+  #define DEFINE_VISIT(BaseName) \
+    void Visit##BaseName(BaseName##Node* node){ node->VisitChildren(this); }
+    DEFINE_VISIT(Sequence)
+    DEFINE_VISIT(Return)
+    DEFINE_VISIT(BinaryOp)
+    DEFINE_VISIT(If)
+    DEFINE_VISIT(For)
+  #undef DEFINE_VISIT
+  };
+
+  UniformHoister::~UniformHoister(){
+    delete description_;
+  }
+
+  void UniformHoister::Run(CodeUnit* unit){
+    TRACE_SCOPE("UniformHoister", "pass");
+    UniformExprPass pass;
+    PassManager passes;
+    passes.AddPass(&pass);
+    passes.Run(unit);
+
+    unit_ = unit;
+    description_ = new CodeUnit(unit->GetName());
+    roots_.insert(pass.GetRoots().begin(), pass.GetRoots().end());
+    if(roots_.empty()) return;
+
+    LocalScope* globals = unit->GetGlobals();
+    for(size_t i = 0; i < globals->GetNumberOfLocals(); i++){
+      names_.insert(globals->GetLocalAt(i)->GetName());
+    }
+    DeclarationCollector collector(&names_);
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      unit->GetFunctionAt(i)->GetCode()->Visit(&collector);
+    }
+
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      unit->GetFunctionAt(i)->GetCode()->Visit(this);
+    }
+  }
+
+  AstNode* UniformHoister::Rewrite(AstNode* node){
+    result_ = node;
+    node->Visit(this);
+    return result_;
+  }
+
+  void UniformHoister::VisitSequence(SequenceNode* node){
+    for(size_t i = 0; i < node->GetChildrenSize(); i++){
+      node->SetChildAt(i, Rewrite(node->GetChildAt(i)));
+    }
+    result_ = node;
+  }
+
+  void UniformHoister::VisitReturn(ReturnNode* node){
+    node->SetValue(Rewrite(node->GetValue()));
+    result_ = node;
+  }
+
+  void UniformHoister::VisitStoreLocal(StoreLocalNode* node){
+    node->SetValue(Rewrite(node->GetValue()));
+    result_ = node;
+  }
+
+  void UniformHoister::VisitIf(IfNode* node){
+    node->SetCondition(Rewrite(node->GetCondition()));
+    node->GetThen()->Visit(this);
+    if(node->HasElse()) node->GetElse()->Visit(this);
+    result_ = node;
+  }
+
+  void UniformHoister::VisitFor(ForNode* node){
+    if(node->GetInit() != nullptr) node->GetInit()->Visit(this);
+    node->SetCondition(Rewrite(node->GetCondition()));
+    if(node->GetStep() != nullptr) node->GetStep()->Visit(this);
+    node->GetBody()->Visit(this);
+    result_ = node;
+  }
+
+  void UniformHoister::VisitBinaryOp(BinaryOpNode* node){
+    if(roots_.find(node) == roots_.end()){
+      node->SetLeft(Rewrite(node->GetLeft()));
+      node->SetRight(Rewrite(node->GetRight()));
+      result_ = node;
+      return;
+    }
+
+    result_ = new LoadLocalNode(Hoist(node));
+    result_->SetSpan(node->GetSpan());
+    delete node;
+  }
+
+  AstNode* UniformHoister::CopyExpression(AstNode* node){
+    // uniforms are read from the description's copies, other locals can
+    // only be constants
+    if(node->IsBinaryOp()){
+      BinaryOpNode* op = node->AsBinaryOp();
+      AstNode* left = CopyExpression(op->GetLeft());
+      AstNode* right = CopyExpression(op->GetRight());
+      return new BinaryOpNode(op->GetKind(), left, right);
+    } else if(node->IsLoadLocal()){
+      LocalVariable* local = node->AsLoadLocal()->GetLocal();
+      if(!local->IsUniform()) return new LiteralNode(local->GetConstantValue()->Copy());
+
+      LocalVariable* uniform;
+      if(!description_->GetGlobals()->LocalLookup(local->GetName(), &uniform)){
+        uniform = new LocalVariable(local->GetName(), local->GetType(), local->GetPrecision());
+        description_->AddUniform(uniform);
+      }
+      return new LoadLocalNode(uniform);
+    }
+    Value* value = node->AsLiteral()->GetValue();
+    return new LiteralNode(value != nullptr ? value->Copy() : nullptr);
+  }
+
+  LocalVariable* UniformHoister::Hoist(BinaryOpNode* node){
+    expressions_++;
+    AstNode* copy = CopyExpression(node);
+    std::stringstream text;
+    GlslEmitter emitter(text);
+    copy->Visit(&emitter);
+    auto pos = hoisted_.find(text.str());
+    if(pos != hoisted_.end()){
+      delete copy;
+      return pos->second;
+    }
+
+    std::string name;
+    do{
+      name = kPrefix + std::to_string(next_++);
+    } while(names_.find(name) != names_.end());
+
+    // uniforms can't be assigned, so the copy holds the whole expression
+    Type* type = node->GetType();
+    LocalVariable* uniform = new LocalVariable(name, type);
+    unit_->AddUniform(uniform);
+    hoisted_.insert({ text.str(), uniform });
+
+    SequenceNode* code = new SequenceNode(description_->GetGlobals());
+    code->Add(new ReturnNode(copy));
+    description_->AddFunction(new Function(name, type, code));
+    return uniform;
+  }
+
+  bool UniformHoister::Precompute(CodeUnit* description, const Variant* bindings, std::vector<Value*>* values, std::string* error){
+    // uniforms are constants while the functions are folded
+    bool bound = true;
+    for(size_t i = 0; i < description->GetNumberOfUniforms() && bound; i++){
+      LocalVariable* uniform = description->GetUniformAt(i);
+      Value* value = bindings->GetConstant(uniform->GetName());
+      if(value == nullptr){
+        *error = "Unbound uniform: " + uniform->GetName();
+        bound = false;
+      } else if((value = Variant::Convert(value, uniform->GetType())) == nullptr){
+        *error = "Uniform must be a scalar: " + uniform->GetName();
+        bound = false;
+      }
+      uniform->SetConstantValue(value);
+    }
+
+    size_t first = values->size();
+    for(size_t i = 0; i < description->GetNumberOfFunctions() && bound; i++){
+      Function* func = description->GetFunctionAt(i);
+      SequenceNode* code = func->GetCode();
+      ReturnNode* result = code->GetChildrenSize() == 1 ? code->GetChildAt(0)->AsReturn() : nullptr;
+      Value* value = result != nullptr ? result->GetValue()->EvalConstantExpr() : nullptr;
+      Value* converted = value != nullptr ? Variant::Convert(value, func->GetResultType()) : nullptr;
+      delete value;
+      if(converted == nullptr){
+        *error = "Cannot evaluate: " + func->GetName();
+        bound = false;
+        break;
+      }
+      values->push_back(converted);
+    }
+
+    for(size_t i = 0; i < description->GetNumberOfUniforms(); i++){
+      description->GetUniformAt(i)->SetConstantValue(nullptr);
+    }
+    if(!bound){
+      for(size_t i = first; i < values->size(); i++){
+        delete (*values)[i];
+      }
+      values->resize(first);
+    }
+    return bound;
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef GLSLTOOLS_HOIST_H
+#define GLSLTOOLS_HOIST_H
+
+#include "ast.h"
+#include "variant.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace GLSLTools{
+  // Moves the expressions found by UniformExprPass out of the shader. Each
+  // one is replaced by a load of a new uniform, expressions printing the
+  // same share theirs, and the host is left to compute its value once per
+  // draw instead of once per invocation.
+  //
+  // What the host has to compute is described by a CodeUnit of its own,
+  // holding the shader uniforms the expressions read and a function per new
+  // uniform returning its value:
+  //
+  //   uniform float scale;
+  //
+  //   float hoisted_0(){
+  //     return (scale * 0.5);
+  //   }
+  //
+  // Precompute evaluates such a description for one set of uniform values.
+  class UniformHoister : public AstNodeVisitor{
+  public:
+    static const char* kPrefix;
+  private:
+    CodeUnit* description_;
+    std::unordered_set<AstNode*> roots_;
+    std::unordered_map<std::string, LocalVariable*> hoisted_;
+    std::unordered_set<std::string> names_;
+    CodeUnit* unit_;
+    size_t next_;
+    size_t expressions_;
+    AstNode* result_;
+
+    AstNode* Rewrite(AstNode* node);
+    AstNode* CopyExpression(AstNode* node);
+    LocalVariable* Hoist(BinaryOpNode* node);
+  public:
+    UniformHoister():
+      description_(nullptr),
+      roots_(),
+      hoisted_(),
+      names_(),
+      unit_(nullptr),
+      next_(0),
+      expressions_(0),
+      result_(nullptr){}
+    UniformHoister(const UniformHoister& other) = delete;
+    ~UniformHoister();
+
+    // Runs once, over a single unit
+    void Run(CodeUnit* unit);
+
+    // Owned by the hoister, nullptr before Run
+    CodeUnit* GetDescription() const{
+      return description_;
+    }
+
+    size_t GetNumberOfUniforms() const{
+      return description_ != nullptr ? description_->GetNumberOfFunctions() : 0;
+    }
+
+    // Expressions replaced, duplicates included
+    size_t GetNumberOfExpressions() const{
+      return expressions_;
+    }
+
+    // Evaluates every function of description with its uniforms bound to the
+    // values of bindings. values receives a new constant Value owned by the
+    // caller per function, in order. Fails on uniforms without a binding and
+    // expressions that don't fold, dividing an int by zero for one.
+    static bool Precompute(CodeUnit* description, const Variant* bindings, std::vector<Value*>* values, std::string* error);
+
+    void VisitSequence(SequenceNode* node);
+    void VisitReturn(ReturnNode* node);
+    void VisitBinaryOp(BinaryOpNode* node);
+    void VisitStoreLocal(StoreLocalNode* node);
+    void VisitIf(IfNode* node);
+    void VisitFor(ForNode* node);
+  };
+}
+
+#endif //GLSLTOOLS_HOIST_H
@@ -0,0 +1,468 @@
+#include "ir.h"
+#include <sstream>
+#include <unordered_map>
+
+namespace GLSLTools{
+  const IrFunction::Register IrFunction::kNoRegister;
+
+  // Every copy of a loop body adds its instructions again
+  static const size_t kMaxTrips = 4096;
+
+  // Vectors only hold floats
+  static Type* GetScalarType(Type* type){
+    return type->GetSize() > 1 ? Type::FLOAT : type;
+  }
+
+  // Whether a value of type from can be used where type to is expected, as
+  // is or splatted
+  static bool Fits(Type* from, Type* to){
+    return GetScalarType(from) == GetScalarType(to) && (from->GetSize() == to->GetSize() || from->GetSize() == 1);
+  }
+
+  // Whether local was declared in scope or a scope nested in it
+  static bool IsDeclaredIn(LocalVariable* local, LocalScope* scope){
+    for(LocalScope* owner = local->GetOwner(); owner != nullptr; owner = owner->GetParent()){
+      if(owner == scope) return true;
+    }
+    return false;
+  }
+
+  class IrBuilder : public AstNodeVisitor{
+  private:
+    IrFunction* ir_;
+    CodeUnit* unit_;
+    std::unordered_map<LocalVariable*, uint32_t> local_ids_;
+    Array<IrFunction::Register> current_;
+    Array<IrFunction::Register> inputs_;
+    IrFunction::Register result_;
+    size_t branches_;
+    bool returned_;
+    std::string error_;
+
+    IrFunction::Register Emit(IrFunction::Opcode opcode, Type* type, IrFunction::Register a, IrFunction::Register b, uint32_t aux,
+                              IrFunction::Register c = IrFunction::kNoRegister){
+      IrFunction::Instruction instr;
+      instr.opcode = static_cast<uint8_t>(opcode);
+      instr.type = type;
+      instr.operands[0] = a;
+      instr.operands[1] = b;
+      instr.operands[2] = c;
+      instr.aux = aux;
+      ir_->instructions_.Add(instr);
+      return static_cast<IrFunction::Register>(ir_->instructions_.Length() - 1);
+    }
+
+    uint32_t GetLocalId(LocalVariable* local){
+      auto pos = local_ids_.find(local);
+      if(pos != local_ids_.end()) return pos->second;
+      uint32_t id = static_cast<uint32_t>(ir_->locals_.Length());
+      ir_->locals_.Add(local);
+      current_.Add(IrFunction::kNoRegister);
+      inputs_.Add(IrFunction::kNoRegister);
+      local_ids_.insert({ local, id });
+      return id;
+    }
+
+    // The incoming value of a local, emitted once however many branches
+    // read it
+    IrFunction::Register GetInput(uint32_t id){
+      if(inputs_[id] == IrFunction::kNoRegister){
+        inputs_[id] = Emit(IrFunction::kInput, ir_->locals_[id]->GetType(), IrFunction::kNoRegister, IrFunction::kNoRegister, id);
+      }
+      return inputs_[id];
+    }
+
+    // Locals of a scope are dead once it ends
+    void EndScope(LocalScope* scope){
+      for(size_t i = 0; i < current_.Length(); i++){
+        if(IsDeclaredIn(ir_->locals_[i], scope)) current_[i] = IrFunction::kNoRegister;
+      }
+    }
+
+    void ReportError(const std::string& message){
+      if(error_.empty()) error_ = message;
+    }
+
+    IrFunction::Register Convert(IrFunction::Register value, Type* type){
+      if(value == IrFunction::kNoRegister || type->GetSize() == 0) return value;
+      Type* from = ir_->GetType(value);
+      if(GetScalarType(from) == GetScalarType(type)) return value;
+      if(from->GetSize() != 1){
+        ReportError("Cannot convert " + from->GetName() + " to " + type->GetName());
+        return value;
+      }
+      return Emit(IrFunction::kConvert, GetScalarType(type), value, IrFunction::kNoRegister, 0);
+    }
+
+    void EmitOutputs(){
+      for(size_t i = 0; i < ir_->locals_.Length(); i++){
+        IrFunction::Register value = current_[i];
+        if(value == IrFunction::kNoRegister) continue;
+        if(ir_->GetOpcode(value) == IrFunction::kInput && ir_->instructions_[value].aux == i) continue;
+        Emit(IrFunction::kOutput, Type::VOID, value, IrFunction::kNoRegister, static_cast<uint32_t>(i));
+      }
+    }
+  public:
+    IrBuilder(IrFunction* ir, CodeUnit* unit):
+      ir_(ir),
+      unit_(unit),
+      local_ids_(),
+      current_(16),
+      inputs_(16),
+      result_(IrFunction::kNoRegister),
+      branches_(0),
+      returned_(false),
+      error_(){}
+    ~IrBuilder(){}
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    void Build(SequenceNode* code){
+      code->Visit(this);
+      if(!returned_) EmitOutputs();
+    }
+
+    IrFunction::Register Lower(AstNode* node){
+      result_ = IrFunction::kNoRegister;
+      node->Visit(this);
+      return result_;
+    }
+
+    void VisitSequence(SequenceNode* node){
+      for(size_t i = 0; i < node->GetChildrenSize() && !returned_; i++){
+        node->GetChildAt(i)->Visit(this);
+      }
+    }
+
+    void VisitLiteral(LiteralNode* node){
+      uint32_t idx = static_cast<uint32_t>(ir_->constants_.Length());
+      ir_->constants_.Add(node->GetValue());
+      result_ = Emit(IrFunction::kConstant, node->GetType(), IrFunction::kNoRegister, IrFunction::kNoRegister, idx);
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      IrFunction::Register left = Lower(node->GetLeft());
+      IrFunction::Register right = Lower(node->GetRight());
+
+      if(left == IrFunction::kNoRegister || right == IrFunction::kNoRegister){
+        result_ = IrFunction::kNoRegister;
+        return;
+      }
+
+      // typed from the registers, call results may be resolved against the
+      // unit; comparisons convert to the type arithmetic would have
+      Type* type = BinaryOpNode::GetResultType(node->GetKind(), ir_->GetType(left), ir_->GetType(right));
+      Type* operand_type = BinaryOpNode::GetResultType(BinaryOpNode::kAdd, ir_->GetType(left), ir_->GetType(right));
+      left = Convert(left, operand_type);
+      right = Convert(right, operand_type);
+
+      IrFunction::Opcode opcode;
+      switch(node->GetKind()){
+        case BinaryOpNode::kAdd: opcode = IrFunction::kAdd; break;
+        case BinaryOpNode::kSubtract: opcode = IrFunction::kSubtract; break;
+        case BinaryOpNode::kMultiply: opcode = IrFunction::kMultiply; break;
+        case BinaryOpNode::kDivide: opcode = IrFunction::kDivide; break;
+        case BinaryOpNode::kLess: opcode = IrFunction::kLess; break;
+        case BinaryOpNode::kLessEqual: opcode = IrFunction::kLessEqual; break;
+        case BinaryOpNode::kGreater: opcode = IrFunction::kGreater; break;
+        case BinaryOpNode::kGreaterEqual: opcode = IrFunction::kGreaterEqual; break;
+        case BinaryOpNode::kEqual: opcode = IrFunction::kEqual; break;
+        case BinaryOpNode::kNotEqual: opcode = IrFunction::kNotEqual; break;
+        default:
+          ReportError("Unknown binary operator");
+          opcode = IrFunction::kAdd;
+          break;
+      }
+      result_ = Emit(opcode, type, left, right, 0);
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      uint32_t id = GetLocalId(node->GetLocal());
+      if(current_[id] == IrFunction::kNoRegister) current_[id] = GetInput(id);
+      result_ = current_[id];
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      IrFunction::Register value = Convert(Lower(node->GetValue()), node->GetLocal()->GetType());
+      current_[GetLocalId(node->GetLocal())] = value;
+      result_ = IrFunction::kNoRegister;
+    }
+
+    void VisitReturn(ReturnNode* node){
+      if(branches_ > 0){
+        ReportError("Cannot lower return inside if statement");
+        return;
+      }
+      IrFunction::Register value = Convert(Lower(node->GetValue()), ir_->function_->GetResultType());
+      EmitOutputs();
+      Emit(IrFunction::kReturn, Type::VOID, value, IrFunction::kNoRegister, 0);
+      returned_ = true;
+    }
+
+    void VisitCall(CallNode* node){
+      uint32_t idx = static_cast<uint32_t>(ir_->targets_.Length());
+      ir_->targets_.Add(&node->GetTarget());
+
+      Type* type = node->GetType();
+      if(unit_ != nullptr){
+        Function* target = unit_->GetFunction(node->GetTarget());
+        if(target == nullptr){
+          ReportError("Call to undefined function: " + node->GetTarget());
+        } else{
+          type = target->GetResultType();
+        }
+      }
+      result_ = Emit(IrFunction::kCall, type, IrFunction::kNoRegister, IrFunction::kNoRegister, idx);
+    }
+
+    // the IR has a single block, so both branches run and the locals they
+    // store are merged with a select
+    void VisitIf(IfNode* node){
+      IrFunction::Register condition = Lower(node->GetCondition());
+      Array<IrFunction::Register> before = current_;
+      branches_++;
+      Lower(node->GetThen());
+      Array<IrFunction::Register> taken = current_;
+      for(size_t i = 0; i < current_.Length(); i++){
+        current_[i] = i < before.Length() ? before[i] : IrFunction::kNoRegister;
+      }
+      if(node->HasElse()) Lower(node->GetElse());
+      branches_--;
+
+      LocalScope* then_scope = node->GetThen()->GetScope();
+      LocalScope* else_scope = node->HasElse() ? node->GetElse()->GetScope() : nullptr;
+      for(size_t i = 0; i < current_.Length(); i++){
+        IrFunction::Register then_value = i < taken.Length() ? taken[i] : IrFunction::kNoRegister;
+        IrFunction::Register else_value = current_[i];
+        LocalVariable* local = ir_->locals_[i];
+        if(then_value == else_value || IsDeclaredIn(local, then_scope) || (else_scope != nullptr && IsDeclaredIn(local, else_scope))) continue;
+        // a local neither branch touched before reads its incoming value
+        if(then_value == IrFunction::kNoRegister) then_value = GetInput(i);
+        if(else_value == IrFunction::kNoRegister) else_value = GetInput(i);
+        current_[i] = Emit(IrFunction::kSelect, local->GetType(), condition, then_value, 0, else_value);
+      }
+      EndScope(then_scope);
+      if(else_scope != nullptr) EndScope(else_scope);
+      result_ = IrFunction::kNoRegister;
+    }
+
+    // unrolled as it's lowered, see LoopUnroller
+    void VisitFor(ForNode* node){
+      ForNode::Induction induction;
+      if(!node->GetInduction(kMaxTrips, &induction)){
+        ReportError("Cannot lower loop without a constant trip count");
+        return;
+      }
+      Lower(node->GetInit());
+      for(size_t i = 0; i < induction.trips && !returned_ && error_.empty(); i++){
+        Lower(node->GetBody());
+        if(!returned_) Lower(node->GetStep());
+      }
+      EndScope(node->GetScope());
+      result_ = IrFunction::kNoRegister;
+    }
+  };
+
+  IrFunction* IrFunction::Lower(Function* function, std::string* error, CodeUnit* unit){
+    IrFunction* ir = new IrFunction(function);
+    IrBuilder builder(ir, unit);
+    builder.Build(function->GetCode());
+    if(!builder.GetError().empty()){
+      if(error != nullptr) *error = builder.GetError();
+      delete ir;
+      return nullptr;
+    }
+    ir->ComputeUses();
+    return ir;
+  }
+
+  int IrFunction::GetNumberOfOperands(Opcode opcode){
+    switch(opcode){
+    #define DEFINE_SWITCH_CASE(Name, Mnemonic, Operands) \
+      case k##Name: return Operands;
+      FOR_EACH_IR_OPCODE(DEFINE_SWITCH_CASE)
+    #undef DEFINE_SWITCH_CASE
+      default: return -1;
+    }
+  }
+
+  const char* IrFunction::GetMnemonic(Opcode opcode){
+    switch(opcode){
+    #define DEFINE_SWITCH_CASE(Name, Mnemonic, Operands) \
+      case k##Name: return Mnemonic;
+      FOR_EACH_IR_OPCODE(DEFINE_SWITCH_CASE)
+    #undef DEFINE_SWITCH_CASE
+      default: return "<unknown>";
+    }
+  }
+
+  void IrFunction::ComputeUses(){
+    size_t count = instructions_.Length();
+    use_offsets_.Clear();
+    uses_.Clear();
+    for(size_t i = 0; i <= count; i++) use_offsets_.Add(0);
+
+    // counting pass, prefix sum, then fill: two linear sweeps
+    for(size_t i = 0; i < count; i++){
+      int operands = GetNumberOfOperands(GetOpcode(i));
+      for(int j = 0; j < operands; j++){
+        use_offsets_[instructions_[i].operands[j] + 1]++;
+      }
+    }
+    for(size_t i = 0; i < count; i++){
+      use_offsets_[i + 1] += use_offsets_[i];
+    }
+
+    for(size_t i = 0; i < use_offsets_[count]; i++) uses_.Add(0);
+    Array<uint32_t> fill(count > 0 ? count : 1);
+    for(size_t i = 0; i < count; i++) fill.Add(use_offsets_[i]);
+    for(size_t i = 0; i < count; i++){
+      int operands = GetNumberOfOperands(GetOpcode(i));
+      for(int j = 0; j < operands; j++){
+        Register def = instructions_[i].operands[j];
+        uses_[fill[def]++] = static_cast<Register>(i);
+      }
+    }
+  }
+
+  bool IrFunction::Verify(std::string* error) const{
+    std::stringstream stream;
+    for(size_t i = 0; i < instructions_.Length(); i++){
+      const Instruction& instr = instructions_[i];
+      if(instr.opcode >= kNumberOfOpcodes){
+        stream << "%" << i << ": invalid opcode " << static_cast<int>(instr.opcode);
+        break;
+      }
+
+      Opcode opcode = static_cast<Opcode>(instr.opcode);
+      int operands = GetNumberOfOperands(opcode);
+      bool valid = true;
+      for(int j = 0; j < operands && valid; j++){
+        Register def = instr.operands[j];
+        if(def >= i){
+          stream << "%" << i << ": operand %" << def << " is not defined before use";
+          valid = false;
+        } else if(GetOpcode(def) == kOutput || GetOpcode(def) == kReturn){
+          stream << "%" << i << ": operand %" << def << " does not define a value";
+          valid = false;
+        }
+      }
+      if(!valid) break;
+
+      switch(opcode){
+        case kConstant:
+          if(instr.aux >= constants_.Length()){
+            stream << "%" << i << ": constant index out of range";
+            valid = false;
+          }
+          break;
+        case kInput:
+        case kOutput:
+          if(instr.aux >= locals_.Length()){
+            stream << "%" << i << ": local index out of range";
+            valid = false;
+          } else if(opcode == kInput ? instr.type != locals_[instr.aux]->GetType() : !Fits(GetType(instr.operands[0]), locals_[instr.aux]->GetType())){
+            stream << "%" << i << ": type doesn't match local " << locals_[instr.aux]->GetName();
+            valid = false;
+          }
+          break;
+        case kConvert:
+          if(instr.type->GetSize() != 1 || GetType(instr.operands[0])->GetSize() != 1){
+            stream << "%" << i << ": convert of " << GetType(instr.operands[0])->GetName() << " to " << instr.type->GetName();
+            valid = false;
+          }
+          break;
+        case kCall:
+          if(instr.aux >= targets_.Length()){
+            stream << "%" << i << ": call target index out of range";
+            valid = false;
+          }
+          break;
+        case kAdd:
+        case kSubtract:
+        case kMultiply:
+        case kDivide:{
+          Type* left = GetType(instr.operands[0]);
+          Type* right = GetType(instr.operands[1]);
+          if(instr.type == Type::BOOL || instr.type->GetSize() == 0){
+            stream << "%" << i << ": arithmetic on " << instr.type->GetName();
+            valid = false;
+          } else if(!Fits(left, instr.type) || !Fits(right, instr.type)){
+            stream << "%" << i << ": operands " << left->GetName() << " and " << right->GetName() << " don't match " << instr.type->GetName();
+            valid = false;
+          } else if(left->GetSize() != instr.type->GetSize() && right->GetSize() != instr.type->GetSize()){
+            stream << "%" << i << ": result type " << instr.type->GetName() << " is wider than its operands";
+            valid = false;
+          }
+          break;
+        }
+        case kLess:
+        case kLessEqual:
+        case kGreater:
+        case kGreaterEqual:
+        case kEqual:
+        case kNotEqual:
+          if(instr.type != Type::BOOL){
+            stream << "%" << i << ": comparison typed " << instr.type->GetName() << " instead of bool";
+            valid = false;
+          } else if(GetType(instr.operands[0])->GetSize() != 1 || GetType(instr.operands[1])->GetSize() != 1){
+            stream << "%" << i << ": comparison of vectors";
+            valid = false;
+          } else if(GetType(instr.operands[0]) != GetType(instr.operands[1])){
+            stream << "%" << i << ": comparison of " << GetType(instr.operands[0])->GetName() << " and " << GetType(instr.operands[1])->GetName();
+            valid = false;
+          }
+          break;
+        case kSelect:
+          if(GetType(instr.operands[0]) != Type::BOOL){
+            stream << "%" << i << ": select on " << GetType(instr.operands[0])->GetName() << " instead of bool";
+            valid = false;
+          } else if(!Fits(GetType(instr.operands[1]), instr.type) || !Fits(GetType(instr.operands[2]), instr.type)){
+            stream << "%" << i << ": selected values don't match type " << instr.type->GetName();
+            valid = false;
+          }
+          break;
+        case kReturn:
+          if(i != instructions_.Length() - 1){
+            stream << "%" << i << ": return must be the last instruction";
+            valid = false;
+          } else if(function_->GetResultType()->GetSize() > 0 && !Fits(GetType(instr.operands[0]), function_->GetResultType())){
+            stream << "%" << i << ": returns " << GetType(instr.operands[0])->GetName() << " from " << function_->GetResultType()->GetName() << " function";
+            valid = false;
+          }
+          break;
+        default: break;
+      }
+      if(!valid) break;
+    }
+
+    if(error != nullptr) *error = stream.str();
+    return stream.str().empty();
+  }
+
+  void IrFunction::Print(std::ostream& stream) const{
+    stream << "function " << function_->GetName() << ":" << std::endl;
+    for(size_t i = 0; i < instructions_.Length(); i++){
+      const Instruction& instr = instructions_[i];
+      Opcode opcode = GetOpcode(i);
+      stream << "  ";
+      if(opcode != kOutput && opcode != kReturn){
+        stream << "%" << i << ":" << instr.type->GetName() << " = ";
+      }
+      stream << GetMnemonic(opcode);
+      switch(opcode){
+        case kConstant: stream << " " << GetConstant(i)->ToString(); break;
+        case kInput: stream << " " << GetLocal(i)->GetName(); break;
+        case kCall: stream << " " << GetTarget(i); break;
+        case kOutput: stream << " " << GetLocal(i)->GetName() << ","; break;
+        default: break;
+      }
+      for(int j = 0; j < GetNumberOfOperands(opcode); j++){
+        stream << (j > 0 ? ", " : " ") << "%" << instr.operands[j];
+      }
+      stream << std::endl;
+    }
+  }
+}
@@ -0,0 +1,138 @@
+#ifndef GLSLTOOLS_IR_H
+#define GLSLTOOLS_IR_H
+
+#include "ast.h"
+#include <cstdint>
+#include <string>
+#include <iostream>
+
+namespace GLSLTools{
+  #define FOR_EACH_IR_OPCODE(V) \
+    V(Constant, "constant", 0) \
+    V(Input, "input", 0) \
+    V(Convert, "convert", 1) \
+    V(Add, "add", 2) \
+    V(Subtract, "sub", 2) \
+    V(Multiply, "mul", 2) \
+    V(Divide, "div", 2) \
+    V(Less, "lt", 2) \
+    V(LessEqual, "le", 2) \
+    V(Greater, "gt", 2) \
+    V(GreaterEqual, "ge", 2) \
+    V(Equal, "eq", 2) \
+    V(NotEqual, "ne", 2) \
+    V(Select, "select", 3) \
+    V(Call, "call", 0) \
+    V(Output, "output", 1) \
+    V(Return, "return", 1)
+
+  // SSA form of a single Function. Every instruction defines the virtual
+  // register with its own index, so a register's definition is found by
+  // indexing instructions_ and operands always refer to earlier entries.
+  // Locals become an Input register holding their incoming value, one
+  // register per store, and an Output marking the final value of every
+  // local that was stored to.
+  //
+  // There is a single block. An if is lowered as both of its branches, with
+  // a select on the condition for every local they store, and a loop with a
+  // constant trip count, see ForNode::GetInduction, as one copy of its body
+  // per trip.
+  //
+  // Operands have the scalar type of the instruction they feed: int, uint
+  // and double values meeting another type go through a convert first. A
+  // scalar operand of a vector instruction is splatted.
+  class IrFunction{
+  public:
+    typedef uint32_t Register;
+
+    static const Register kNoRegister = 0xFFFFFFFF;
+
+    enum Opcode{
+    #define DEFINE_OPCODE(Name, Mnemonic, Operands) k##Name,
+      FOR_EACH_IR_OPCODE(DEFINE_OPCODE)
+    #undef DEFINE_OPCODE
+      kNumberOfOpcodes
+    };
+
+    struct Instruction{
+      uint8_t opcode;
+      Type* type;
+      Register operands[3];
+      uint32_t aux;
+    };
+  private:
+    Function* function_;
+    Array<Instruction> instructions_;
+    Array<Value*> constants_;
+    Array<LocalVariable*> locals_;
+    Array<const std::string*> targets_;
+    Array<uint32_t> use_offsets_;
+    Array<Register> uses_;
+
+    friend class IrBuilder;
+  public:
+    IrFunction(Function* function):
+      function_(function),
+      instructions_(64),
+      constants_(16),
+      locals_(16),
+      targets_(4),
+      use_offsets_(64),
+      uses_(64){}
+    ~IrFunction(){}
+
+    Function* GetFunction() const{
+      return function_;
+    }
+
+    size_t GetNumberOfInstructions() const{
+      return instructions_.Length();
+    }
+
+    const Instruction& GetInstruction(Register reg) const{
+      return instructions_[reg];
+    }
+
+    Opcode GetOpcode(Register reg) const{
+      return static_cast<Opcode>(instructions_[reg].opcode);
+    }
+
+    Type* GetType(Register reg) const{
+      return instructions_[reg].type;
+    }
+
+    Value* GetConstant(Register reg) const{
+      return constants_[instructions_[reg].aux];
+    }
+
+    LocalVariable* GetLocal(Register reg) const{
+      return locals_[instructions_[reg].aux];
+    }
+
+    const std::string& GetTarget(Register reg) const{
+      return *targets_[instructions_[reg].aux];
+    }
+
+    // Def-use chains, valid after ComputeUses
+    size_t GetNumberOfUses(Register reg) const{
+      return use_offsets_[reg + 1] - use_offsets_[reg];
+    }
+
+    Register GetUseAt(Register reg, size_t idx) const{
+      return uses_[use_offsets_[reg] + idx];
+    }
+
+    void ComputeUses();
+    bool Verify(std::string* error) const;
+    void Print(std::ostream& stream) const;
+
+    static int GetNumberOfOperands(Opcode opcode);
+    static const char* GetMnemonic(Opcode opcode);
+
+    // Returns nullptr and sets error for constructs the IR can't express.
+    // Call result types are resolved against unit when one is given.
+    static IrFunction* Lower(Function* function, std::string* error, CodeUnit* unit = nullptr);
+  };
+}
+
+#endif //GLSLTOOLS_IR_H
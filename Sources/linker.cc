@@ -0,0 +1,176 @@
+#include "linker.h"
+#include "compilation.h"
+#include "hash_cons.h"
+#include "scope.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <algorithm>
+
+namespace GLSLTools{
+  static void AddVariables(CodeUnit* unit, bool inputs, std::vector<InterfaceSignature::Variable>* variables){
+    size_t count = inputs ? unit->GetNumberOfInputs() : unit->GetNumberOfOutputs();
+    for(size_t i = 0; i < count; i++){
+      LocalVariable* local = inputs ? unit->GetInputAt(i) : unit->GetOutputAt(i);
+      variables->push_back({ local->GetName(), local->GetType(), local->GetLocation() });
+    }
+    std::sort(variables->begin(), variables->end(), [](const InterfaceSignature::Variable& a, const InterfaceSignature::Variable& b){
+      return a.location != b.location ? a.location < b.location : a.name < b.name;
+    });
+  }
+
+  static uint64_t HashVariables(const std::vector<InterfaceSignature::Variable>& variables){
+    uint64_t hash = variables.size();
+    for(auto& variable : variables){
+      hash = HashCombine(hash, std::hash<std::string>()(variable.name));
+      hash = HashCombine(hash, std::hash<std::string>()(variable.type->GetName()));
+      hash = HashCombine(hash, static_cast<uint32_t>(variable.location));
+    }
+    return hash;
+  }
+
+  static bool SameVariables(const std::vector<InterfaceSignature::Variable>& a, const std::vector<InterfaceSignature::Variable>& b){
+    if(a.size() != b.size()) return false;
+    for(size_t i = 0; i < a.size(); i++){
+      if(a[i].name != b[i].name || a[i].type != b[i].type || a[i].location != b[i].location) return false;
+    }
+    return true;
+  }
+
+  static std::string Describe(const InterfaceSignature::Variable& variable){
+    std::string text = variable.type->GetName() + " " + variable.name;
+    if(variable.location != LocalVariable::kNoLocation) text += " (location " + std::to_string(variable.location) + ")";
+    return text;
+  }
+
+  // Indexes one side by location, and by name for the variables without one
+  static void IndexVariables(const std::vector<InterfaceSignature::Variable>& variables, const char* side,
+                             std::unordered_map<int, const InterfaceSignature::Variable*>* by_location,
+                             std::unordered_map<std::string, const InterfaceSignature::Variable*>* by_name,
+                             std::vector<std::string>* errors){
+    for(auto& variable : variables){
+      if(variable.location == LocalVariable::kNoLocation){
+        by_name->insert({ variable.name, &variable });
+        continue;
+      }
+      auto pos = by_location->insert({ variable.location, &variable });
+      if(!pos.second){
+        errors->push_back(std::string("Location ") + std::to_string(variable.location) + " used by " + side + "s " +
+                          pos.first->second->name + " and " + variable.name);
+      }
+    }
+  }
+
+  InterfaceSignature::InterfaceSignature(CodeUnit* unit):
+    inputs_(),
+    outputs_(),
+    input_hash_(0),
+    output_hash_(0){
+    AddVariables(unit, true, &inputs_);
+    AddVariables(unit, false, &outputs_);
+    input_hash_ = HashVariables(inputs_);
+    output_hash_ = HashVariables(outputs_);
+  }
+
+  bool InterfaceSignature::Link(const InterfaceSignature& next, std::vector<std::string>* errors) const{
+    if(output_hash_ == next.input_hash_ && SameVariables(outputs_, next.inputs_)) return true;
+
+    size_t before = errors->size();
+    std::unordered_map<int, const Variable*> outputs_by_location;
+    std::unordered_map<std::string, const Variable*> outputs_by_name;
+    IndexVariables(outputs_, "output", &outputs_by_location, &outputs_by_name, errors);
+    std::unordered_map<int, const Variable*> inputs_by_location;
+    std::unordered_map<std::string, const Variable*> inputs_by_name;
+    IndexVariables(next.inputs_, "input", &inputs_by_location, &inputs_by_name, errors);
+
+    for(auto& input : next.inputs_){
+      const Variable* output = nullptr;
+      if(input.location != LocalVariable::kNoLocation){
+        auto pos = outputs_by_location.find(input.location);
+        if(pos != outputs_by_location.end()) output = pos->second;
+      } else{
+        auto pos = outputs_by_name.find(input.name);
+        if(pos != outputs_by_name.end()) output = pos->second;
+      }
+
+      if(output == nullptr){
+        errors->push_back("No output for input " + Describe(input));
+      } else if(output->type != input.type){
+        errors->push_back("Type mismatch: output " + Describe(*output) + ", input " + Describe(input));
+      }
+    }
+    return errors->size() == before;
+  }
+
+  InterfaceLinker::~InterfaceLinker(){
+    for(auto& entry : signatures_){
+      delete entry.second->signature;
+    }
+  }
+
+  const InterfaceSignature* InterfaceLinker::GetSignature(const std::string& filename, std::string* error){
+    Entry* entry;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::unique_ptr<Entry>& slot = signatures_[filename];
+      if(slot == nullptr) slot.reset(new Entry());
+      entry = slot.get();
+    }
+
+    // threads asking for a file being parsed wait here for that parse
+    std::call_once(entry->once, [entry, &filename]{
+      TRACE_SCOPE_DETAIL("Signature", "link", filename);
+      Compilation comp(filename);
+      if(!comp.ParseFile(filename)){
+        entry->error = comp.GetError();
+        return;
+      }
+      entry->signature = new InterfaceSignature(comp.GetUnit());
+    });
+    if(entry->signature == nullptr) *error = entry->error;
+    return entry->signature;
+  }
+
+  size_t InterfaceLinker::GetNumberOfSignatures(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    return signatures_.size();
+  }
+
+  bool InterfaceLinker::Link(const std::vector<std::pair<std::string, std::string>>& pairs, std::vector<std::string>* errors){
+    errors->assign(pairs.size(), std::string());
+    auto link = [&](size_t idx){
+      const std::string& first = pairs[idx].first;
+      const std::string& second = pairs[idx].second;
+      std::string error;
+      const InterfaceSignature* producer = GetSignature(first, &error);
+      if(producer == nullptr){
+        (*errors)[idx] = first + ": " + error;
+        return;
+      }
+      const InterfaceSignature* consumer = GetSignature(second, &error);
+      if(consumer == nullptr){
+        (*errors)[idx] = second + ": " + error;
+        return;
+      }
+
+      std::vector<std::string> mismatches;
+      if(producer->Link(*consumer, &mismatches)) return;
+      std::string& message = (*errors)[idx];
+      for(auto& mismatch : mismatches){
+        if(!message.empty()) message += "\n";
+        message += mismatch;
+      }
+    };
+
+    // each task writes its own slot
+    ThreadPool pool(threads_);
+    for(size_t i = 0; i < pairs.size(); i++){
+      pool.Submit([&link, i]{ link(i); });
+    }
+    pool.Wait();
+
+    for(auto& error : *errors){
+      if(!error.empty()) return false;
+    }
+    return true;
+  }
+}
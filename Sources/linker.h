@@ -0,0 +1,97 @@
+#ifndef GLSLTOOLS_LINKER_H
+#define GLSLTOOLS_LINKER_H
+
+#include "type.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GLSLTools{
+  // The inputs and outputs of one stage by name, type and location, sorted
+  // by location and then name. Each side is hashed, so the common case of
+  // an output list equal to the next stage's input list links after one
+  // comparison of hashes and one of the lists.
+  class InterfaceSignature{
+  public:
+    struct Variable{
+      std::string name;
+      Type* type;
+      int location;
+    };
+  private:
+    std::vector<Variable> inputs_;
+    std::vector<Variable> outputs_;
+    uint64_t input_hash_;
+    uint64_t output_hash_;
+  public:
+    InterfaceSignature(CodeUnit* unit);
+    ~InterfaceSignature(){}
+
+    const std::vector<Variable>& GetInputs() const{
+      return inputs_;
+    }
+
+    const std::vector<Variable>& GetOutputs() const{
+      return outputs_;
+    }
+
+    uint64_t GetInputHash() const{
+      return input_hash_;
+    }
+
+    uint64_t GetOutputHash() const{
+      return output_hash_;
+    }
+
+    // Checks that the outputs of this stage feed every input of next: an
+    // input with a location takes the output at that location, one without
+    // the output of its name that has none. Types must be equal, unread
+    // outputs are fine. Appends a message per mismatch to errors.
+    bool Link(const InterfaceSignature& next, std::vector<std::string>* errors) const;
+  };
+
+  // Links pairs of stages given by filename on a pool of threads. A
+  // signature is built the first time its file is asked for and kept for
+  // the life of the linker, so each file is parsed once however many pairs
+  // it is in; the table only locks to find an entry, not while parsing.
+  class InterfaceLinker{
+  private:
+    struct Entry{
+      std::once_flag once;
+      InterfaceSignature* signature;
+      std::string error;
+
+      Entry():
+        once(),
+        signature(nullptr),
+        error(){}
+    };
+
+    size_t threads_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> signatures_;
+  public:
+    // 0 threads picks the number of cores
+    InterfaceLinker(size_t threads = 0):
+      threads_(threads),
+      mutex_(),
+      signatures_(){}
+    InterfaceLinker(const InterfaceLinker& other) = delete;
+    ~InterfaceLinker();
+
+    // Owned by the linker, nullptr and sets error if filename doesn't parse
+    const InterfaceSignature* GetSignature(const std::string& filename, std::string* error);
+
+    size_t GetNumberOfSignatures();
+
+    // Links the first file of every pair to the second. errors receives one
+    // string per pair, empty for pairs that link and the mismatches, one per
+    // line, for the others. Returns whether every pair linked.
+    bool Link(const std::vector<std::pair<std::string, std::string>>& pairs, std::vector<std::string>* errors);
+  };
+}
+
+#endif //GLSLTOOLS_LINKER_H
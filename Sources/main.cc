@@ -1,19 +1,1391 @@
-#include "parser.h"
+#include "compilation.h"
 #include "ast_printer.h"
-#include <fstream>
+#include "flat_ast.h"
+#include "symbol_table.h"
+#include "executor.h"
+#include "ir.h"
+#include "process.h"
+#include "server.h"
+#include "source_index.h"
+#include "generator.h"
+#include "tokenizer.h"
+#include "number_scanner.h"
+#include "hash_cons.h"
+#include "glsl_emitter.h"
+#include "variant.h"
+#include "analysis.h"
+#include "cost_model.h"
+#include "peephole.h"
+#include "unroll.h"
+#include "precision.h"
+#include "hoist.h"
+#include "binary_module.h"
+#include "linker.h"
+#include "watch.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <algorithm>
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 using namespace GLSLTools;
 
+static bool
+ReadFile(const char* filename, std::string* data){
+  std::string name(filename);
+  TRACE_SCOPE_DETAIL("ReadFile", "io", name);
+  std::ifstream stream(filename, std::ifstream::binary);
+  if(!stream) return false;
+  data->assign((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  return true;
+}
+
+static bool
+ParseFile(Compilation* comp, const char* filename, size_t lex_threads = 0){
+  // "-" streams from stdin, so generated shaders can be piped in
+  bool parsed;
+  std::string data;
+  if(strcmp(filename, "-") == 0){
+    parsed = comp->ParseStream(0);
+  } else if(lex_threads > 0 && ReadFile(filename, &data)){
+    parsed = comp->ParseParallel(data.data(), data.size(), lex_threads);
+  } else{
+    parsed = comp->ParseFile(filename);
+  }
+  if(!parsed){
+    std::cerr << filename << ": " << comp->GetError() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static void
+PrintUnits(const char* title, const std::vector<std::string>& units){
+  std::cout << title << ":" << std::endl;
+  for(auto& unit : units){
+    std::cout << "  " << unit << std::endl;
+  }
+}
+
+static void
+PrintLanes(const std::string& name, Type* type, const float* data, size_t lanes){
+  size_t comps = type->GetSize() > 0 ? type->GetSize() : 1;
+  size_t shown = lanes < 4 ? lanes : 4;
+  std::cout << name << " (" << type->GetName() << "):";
+  for(size_t i = 0; i < shown; i++){
+    std::cout << " [";
+    for(size_t c = 0; c < comps; c++){
+      if(c > 0) std::cout << ", ";
+      // int, uint and bool lanes hold int32 bits
+      const void* lane = data + c * lanes + i;
+      if(type == Type::UINT){
+        std::cout << *reinterpret_cast<const uint32_t*>(lane);
+      } else if(type == Type::BOOL){
+        std::cout << (*reinterpret_cast<const int32_t*>(lane) != 0 ? "true" : "false");
+      } else if(type->IsNumber()){
+        std::cout << *reinterpret_cast<const int32_t*>(lane);
+      } else{
+        std::cout << data[c * lanes + i];
+      }
+    }
+    std::cout << "]";
+  }
+  if(shown < lanes) std::cout << " ...";
+  std::cout << std::endl;
+}
+
+// Every input holds the invocation index, so lanes can take different
+// branches
+static int
+Execute(CodeUnit* unit, Function* func, size_t lanes, bool bench){
+  BatchExecutor exec(func, lanes);
+  for(size_t i = 0; i < unit->GetNumberOfInputs(); i++){
+    LocalVariable* input = unit->GetInputAt(i);
+    size_t comps = input->GetType()->GetSize() > 0 ? input->GetType()->GetSize() : 1;
+    std::vector<float> data(comps * lanes);
+    for(size_t j = 0; j < data.size(); j++){
+      size_t lane = j % lanes;
+      if(input->GetType()->IsNumber()){
+        int32_t value = static_cast<int32_t>(lane);
+        memcpy(&data[j], &value, sizeof(value));
+      } else{
+        data[j] = static_cast<float>(lane);
+      }
+    }
+    exec.SetInput(input, data.data());
+  }
+  if(!exec.Execute()){
+    std::cerr << "Execution failed: " << exec.GetError() << std::endl;
+    return 1;
+  }
+
+  if(bench){
+    size_t iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do{
+      exec.Execute();
+      iterations++;
+      elapsed = std::chrono::steady_clock::now() - start;
+    } while(elapsed.count() < 1.0);
+    std::cout << "Lanes: " << lanes << ", Iterations: " << iterations << std::endl;
+    std::cout << "Invocations/s: " << static_cast<double>(iterations * lanes) / elapsed.count() << std::endl;
+    return 0;
+  }
+
+  LocalScope* scope = func->GetCode()->GetScope();
+  for(size_t i = 0; i < scope->GetNumberOfLocals(); i++){
+    LocalVariable* local = scope->GetLocalAt(i);
+    PrintLanes(local->GetName(), local->GetType(), exec.GetLocal(local), lanes);
+  }
+  if(exec.GetResult() != nullptr){
+    PrintLanes("<result>", exec.GetResultType(), exec.GetResult(), lanes);
+  }
+  return 0;
+}
+
+// Parses, lowers and emits the same source over and over, failing if the
+// resident set keeps growing after the warm up iterations
+static int
+LeakCheck(const char* filename, size_t iterations){
+  std::string source;
+  if(!ReadFile(filename, &source)){
+    std::cerr << "Cannot open file: " << filename << std::endl;
+    return 1;
+  }
+
+  static const size_t kMaxGrowth = 1024 * 1024;
+  size_t warmup = iterations / 10;
+  size_t baseline = 0;
+  for(size_t i = 0; i < iterations; i++){
+    if(i == warmup) baseline = GetResidentSetSize();
+
+    Compilation comp(filename);
+    if(!comp.Parse(source.data(), source.size())){
+      std::cerr << filename << ": " << comp.GetError() << std::endl;
+      return 1;
+    }
+    std::stringstream out;
+    comp.Emit(out);
+
+    CodeUnit* code = comp.GetUnit();
+    delete FlatAst::FromCodeUnit(code);
+    for(size_t j = 0; j < code->GetNumberOfFunctions(); j++){
+      delete IrFunction::Lower(code->GetFunctionAt(j), nullptr, code);
+    }
+  }
+
+  std::cout << "Iterations: " << iterations << std::endl;
+#if defined(__SANITIZE_ADDRESS__)
+  // the sanitizer quarantines freed memory, LeakSanitizer reports at exit instead
+  std::cout << "RSS check skipped under AddressSanitizer" << std::endl;
+  return 0;
+#endif
+  size_t current = GetResidentSetSize();
+  size_t growth = current > baseline ? current - baseline : 0;
+  std::cout << "RSS after warm up: " << baseline << " bytes, at exit: " << current << " bytes" << std::endl;
+  if(growth > kMaxGrowth){
+    std::cerr << "RSS grew by " << growth << " bytes" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Runs the front end over source once, returning seconds taken and the
+// heap held by the results in *memory
+static double
+MeasurePipeline(const std::string& source, size_t* memory){
+  size_t heap = GetHeapInUse();
+  auto start = std::chrono::steady_clock::now();
+
+  Compilation comp("scale");
+  if(!comp.Parse(source.data(), source.size())){
+    std::cerr << "Generated shader failed to parse: " << comp.GetError() << std::endl;
+    return -1.0;
+  }
+  std::stringstream out;
+  comp.Emit(out);
+  CodeUnit* code = comp.GetUnit();
+  std::vector<IrFunction*> functions;
+  for(size_t i = 0; i < code->GetNumberOfFunctions(); i++){
+    functions.push_back(IrFunction::Lower(code->GetFunctionAt(i), nullptr, code));
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  size_t used = GetHeapInUse();
+  *memory = used > heap ? used - heap : 0;
+  for(auto func : functions){
+    delete func;
+  }
+  return elapsed.count();
+}
+
+// Least squares slope of log(y) over log(x), 1.0 means linear growth
+static double
+GetGrowthExponent(const std::vector<double>& x, const std::vector<double>& y){
+  double mean_x = 0.0;
+  double mean_y = 0.0;
+  for(size_t i = 0; i < x.size(); i++){
+    mean_x += std::log(x[i]);
+    mean_y += std::log(y[i]);
+  }
+  mean_x /= x.size();
+  mean_y /= y.size();
+
+  double num = 0.0;
+  double den = 0.0;
+  for(size_t i = 0; i < x.size(); i++){
+    double dx = std::log(x[i]) - mean_x;
+    num += dx * (std::log(y[i]) - mean_y);
+    den += dx * dx;
+  }
+  return den > 0.0 ? num / den : 0.0;
+}
+
+// Generates each shape at doubling sizes and fails if time or memory grow
+// faster than size^(1 + threshold)
+static int
+Scale(const char* shape_name, size_t size, double threshold){
+  static const size_t kNumberOfSteps = 4;
+  static const size_t kRepeats = 3;
+  // below this the heap numbers are dominated by allocator noise
+  static const size_t kMinMemory = 256 * 1024;
+
+  int status = 0;
+  for(int s = 0; s < ShaderGenerator::kNumberOfShapes; s++){
+    ShaderGenerator::Shape shape = static_cast<ShaderGenerator::Shape>(s);
+    if(strcmp(shape_name, "all") != 0 && ShaderGenerator::GetShape(shape_name) != shape) continue;
+
+    std::vector<double> sizes;
+    std::vector<double> times;
+    std::vector<double> memory;
+    for(size_t step = 0; step < kNumberOfSteps; step++){
+      size_t n = size << step;
+      std::stringstream source;
+      ShaderGenerator generator(source);
+      generator.Generate(shape, n);
+
+      double best = -1.0;
+      size_t bytes = 0;
+      for(size_t r = 0; r < kRepeats; r++){
+        double t = MeasurePipeline(source.str(), &bytes);
+        if(t < 0.0) return 1;
+        if(best < 0.0 || t < best) best = t;
+      }
+      sizes.push_back(static_cast<double>(source.str().size()));
+      times.push_back(best > 1e-6 ? best : 1e-6);
+      memory.push_back(static_cast<double>(bytes > 0 ? bytes : 1));
+      std::cout << ShaderGenerator::GetShapeName(shape) << " size=" << n << " bytes=" << source.str().size()
+                << " time=" << best * 1000.0 << "ms heap=" << bytes << std::endl;
+    }
+
+    double time_growth = GetGrowthExponent(sizes, times);
+    std::cout << ShaderGenerator::GetShapeName(shape) << " time exponent: " << time_growth;
+    if(time_growth > 1.0 + threshold){
+      std::cout << " FAIL";
+      status = 1;
+    }
+    std::cout << std::endl;
+
+    if(memory.back() >= kMinMemory){
+      double memory_growth = GetGrowthExponent(sizes, memory);
+      std::cout << ShaderGenerator::GetShapeName(shape) << " memory exponent: " << memory_growth;
+      if(memory_growth > 1.0 + threshold){
+        std::cout << " FAIL";
+        status = 1;
+      }
+      std::cout << std::endl;
+    }
+  }
+  return status;
+}
+
+// Times lexing a file on one thread against threads threads
+static int
+BenchLex(const char* filename, size_t threads){
+  std::string data;
+  if(!ReadFile(filename, &data)){
+    std::cerr << "Cannot open file: " << filename << std::endl;
+    return 1;
+  }
+
+  static const size_t kRepeats = 5;
+  size_t counts[2] = { 0, 0 };
+  size_t thread_counts[2] = { 1, threads };
+  for(size_t i = 0; i < 2; i++){
+    double best = -1.0;
+    for(size_t r = 0; r < kRepeats; r++){
+      auto start = std::chrono::steady_clock::now();
+      TokenBuffer* tokens = Tokenizer::Tokenize(data.data(), data.size(), thread_counts[i]);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      counts[i] = tokens->GetNumberOfTokens();
+      delete tokens;
+      if(best < 0.0 || elapsed.count() < best) best = elapsed.count();
+    }
+    std::cout << "Threads: " << thread_counts[i] << ", Tokens: " << counts[i]
+              << ", MB/s: " << data.size() / best / (1024.0 * 1024.0) << std::endl;
+  }
+  if(counts[0] != counts[1]){
+    std::cerr << "Token counts differ" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// The literal conversion ParseLiteral used before NumberScanner
+static double
+ParseNumberLegacy(const std::string& token){
+  std::string text = token;
+  if(text.find(".") != std::string::npos){
+    if(text.size() > 0 && (text[text.size() - 1] == 'f' || text[text.size() - 1] == 'F')){
+      return atof(text.substr(0, text.size() - 1).c_str());
+    }
+    return atof(text.c_str());
+  }
+  return atoi(text.c_str());
+}
+
+// Times NumberScanner against the previous atof/atoi path on generated
+// literals, checking floats against strtod/strtof
+static int
+BenchNumbers(size_t count){
+  std::vector<std::string> literals;
+  literals.reserve(count);
+  uint32_t seed = 12345;
+  for(size_t i = 0; i < count; i++){
+    seed = seed * 1103515245u + 12345u;
+    uint32_t r = seed >> 8;
+    std::stringstream text;
+    switch(i % 5){
+      case 0: text << (r % 100000); break;
+      case 1: text << "0x" << std::hex << r; break;
+      case 2: text << (r % 1000) << "." << (r % 9973) << "f"; break;
+      case 3: text << (r % 100) << "." << r << "e" << static_cast<int>(r % 60) - 30; break;
+      default: text << "0." << r << (r % 7) << "lf"; break;
+    }
+    literals.push_back(text.str());
+  }
+
+  double sink = 0.0;
+  auto start = std::chrono::steady_clock::now();
+  for(auto& literal : literals){
+    sink += ParseNumberLegacy(literal);
+  }
+  std::chrono::duration<double> legacy = std::chrono::steady_clock::now() - start;
+
+  size_t invalid = 0;
+  start = std::chrono::steady_clock::now();
+  for(auto& literal : literals){
+    NumberLiteral result;
+    if(NumberScanner::Scan(literal.data(), literal.data() + literal.size(), &result) != literal.size()){
+      invalid++;
+      continue;
+    }
+    sink += result.kind == NumberLiteral::kDouble ? result.double_value : result.float_value;
+  }
+  std::chrono::duration<double> scanner = std::chrono::steady_clock::now() - start;
+
+  size_t mismatches = 0;
+  for(auto& literal : literals){
+    NumberLiteral result;
+    NumberScanner::Scan(literal.data(), literal.data() + literal.size(), &result);
+    if(result.kind == NumberLiteral::kFloat){
+      std::string digits = literal.substr(0, literal.size() - (literal.back() == 'f' ? 1 : 0));
+      if(result.float_value != strtof(digits.c_str(), nullptr)) mismatches++;
+    } else if(result.kind == NumberLiteral::kDouble){
+      std::string digits = literal.substr(0, literal.size() - 2);
+      if(result.double_value != strtod(digits.c_str(), nullptr)) mismatches++;
+    }
+  }
+
+  std::cout << "Literals: " << count << " (checksum " << sink << ")" << std::endl;
+  std::cout << "atof/atoi: " << legacy.count() * 1e9 / count << " ns/literal" << std::endl;
+  std::cout << "NumberScanner: " << scanner.count() * 1e9 / count << " ns/literal" << std::endl;
+  std::cout << "Invalid: " << invalid << ", Rounding mismatches: " << mismatches << std::endl;
+  return invalid == 0 && mismatches == 0 ? 0 : 1;
+}
+
+// Locals of main whose inferred precision is known. A float lowered too far
+// rounds on the GPU, one kept too high only costs speed.
+struct PrecisionCase{
+  const char* source;
+  const char* local;
+  Precision expected;
+};
+
+static const PrecisionCase kPrecisionCases[] = {
+  // mediump keeps 11 significant bits, 2000.25 would become 2000.0
+  { "void main(){ float e = 2000.25; return e; }", "e", kDefaultPrecision },
+  { "void main(){ float e = 2000.0; return e; }", "e", kMediumPrecision },
+  { "void main(){ float e = 2047.0; return e; }", "e", kMediumPrecision },
+  { "void main(){ float e = 2049.0; return e; }", "e", kDefaultPrecision },
+  { "void main(){ float e = 0.1; return e; }", "e", kDefaultPrecision },
+  { "void main(){ float e = 1.5; return e; }", "e", kLowPrecision },
+  // exact operands with an inexact sum run at highp
+  { "void main(){ float a = 2000.0; float b = 0.25; float e = a + b; return e; }", "a", kDefaultPrecision },
+  { "void main(){ float e = 1.0 / 3.0; return e; }", "e", kDefaultPrecision },
+  { "void main(){ float e = 0.0; for(int i = 0; i < 4; i++){ e = e + 0.25; } return e; }", "e", kLowPrecision },
+};
+
+static int
+CheckPrecision(){
+  size_t failed = 0;
+  for(auto& check : kPrecisionCases){
+    Compilation comp("check");
+    if(!comp.Parse(check.source, strlen(check.source))){
+      std::cerr << check.source << ": " << comp.GetError() << std::endl;
+      return 1;
+    }
+    PrecisionInference inference;
+    inference.Run(comp.GetUnit());
+    LocalScope* scope = comp.GetUnit()->GetFunction("main")->GetCode()->GetScope();
+    Precision precision = kDefaultPrecision;
+    for(size_t i = 0; i < scope->GetNumberOfLocals(); i++){
+      if(scope->GetLocalAt(i)->GetName() == check.local) precision = scope->GetLocalAt(i)->GetPrecision();
+    }
+    bool passed = precision == check.expected;
+    if(!passed) failed++;
+    const char* name = precision == kDefaultPrecision ? "highp" : GetPrecisionName(precision);
+    std::cout << (passed ? "PASS " : "FAIL ") << check.local << " " << name << ": " << check.source << std::endl;
+  }
+  std::cout << "Failed: " << failed << std::endl;
+  return failed == 0 ? 0 : 1;
+}
+
+static bool
+ParsePosition(const char* text, SourcePosition* pos){
+  unsigned int row;
+  unsigned int column;
+  if(sscanf(text, "%u:%u", &row, &column) != 2) return false;
+  *pos = SourcePosition(row, column);
+  return true;
+}
+
+// Emits one specialization of filename per line of the variants file
+static int
+CompileVariants(const char* filename, const char* variants_file, size_t threads){
+  std::ifstream stream(variants_file);
+  if(!stream){
+    std::cerr << "Cannot open file: " << variants_file << std::endl;
+    return 1;
+  }
+
+  std::vector<Variant*> variants;
+  std::string line;
+  int status = 0;
+  while(std::getline(stream, line)){
+    if(line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#') continue;
+    std::string error;
+    Variant* variant = Variant::Parse(line, &error);
+    if(variant == nullptr){
+      std::cerr << variants_file << ": " << error << std::endl;
+      status = 1;
+      break;
+    }
+    variants.push_back(variant);
+  }
+
+  Compilation comp(filename);
+  if(status == 0 && ParseFile(&comp, filename)){
+    VariantCompiler compiler(comp.GetUnit(), threads);
+    std::vector<std::string> outputs;
+    std::vector<std::string> errors;
+    if(!compiler.Compile(variants, &outputs, &errors)) status = 1;
+    for(size_t i = 0; i < variants.size(); i++){
+      if(!errors[i].empty()){
+        std::cerr << variants[i]->GetName() << ": " << errors[i] << std::endl;
+        continue;
+      }
+      if(i > 0) std::cout << std::endl;
+      std::cout << "// " << variants[i]->GetName() << std::endl << outputs[i];
+    }
+  } else{
+    status = 1;
+  }
+
+  for(auto variant : variants){
+    delete variant;
+  }
+  return status;
+}
+
+// Evaluates a description written by --hoist once per line of the
+// bindings file, which binds the shader's uniforms like a variants file
+static int
+Precompute(const char* filename, const char* bindings_file){
+  std::ifstream stream(bindings_file);
+  if(!stream){
+    std::cerr << "Cannot open file: " << bindings_file << std::endl;
+    return 1;
+  }
+
+  Compilation comp(filename);
+  if(!ParseFile(&comp, filename)) return 1;
+  CodeUnit* description = comp.GetUnit();
+
+  std::string line;
+  bool first = true;
+  while(std::getline(stream, line)){
+    if(line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#') continue;
+    std::string error;
+    Variant* bindings = Variant::Parse(line, &error);
+    if(bindings == nullptr){
+      std::cerr << bindings_file << ": " << error << std::endl;
+      return 1;
+    }
+
+    std::vector<Value*> values;
+    bool computed = UniformHoister::Precompute(description, bindings, &values, &error);
+    if(!computed){
+      std::cerr << bindings->GetName() << ": " << error << std::endl;
+      delete bindings;
+      return 1;
+    }
+    if(!first) std::cout << std::endl;
+    first = false;
+    std::cout << "// " << bindings->GetName() << std::endl;
+    GlslEmitter emitter(std::cout);
+    for(size_t i = 0; i < values.size(); i++){
+      std::cout << description->GetFunctionAt(i)->GetName() << " = ";
+      emitter.EmitValue(values[i]);
+      std::cout << std::endl;
+      delete values[i];
+    }
+    delete bindings;
+  }
+  return 0;
+}
+
+// Times loading the shader from text against decoding its binary module,
+// best of kRepeats each, and checks both give the same GLSL
+static int
+BenchBinary(const char* filename){
+  std::string source;
+  if(!ReadFile(filename, &source)){
+    std::cerr << "Cannot open file: " << filename << std::endl;
+    return 1;
+  }
+  Compilation comp(filename);
+  if(!comp.Parse(source.data(), source.size())){
+    std::cerr << filename << ": " << comp.GetError() << std::endl;
+    return 1;
+  }
+  std::string error;
+  BinaryModule* module = BinaryModule::Encode(comp.GetUnit(), &error);
+  if(module == nullptr){
+    std::cerr << filename << ": " << error << std::endl;
+    return 1;
+  }
+  std::stringstream expected;
+  GlslEmitter expected_emitter(expected);
+  expected_emitter.EmitUnit(comp.GetUnit());
+
+  static const size_t kRepeats = 5;
+  double text_time = -1.0;
+  double binary_time = -1.0;
+  for(size_t r = 0; r < kRepeats; r++){
+    auto start = std::chrono::steady_clock::now();
+    Compilation parsed(filename);
+    parsed.Parse(source.data(), source.size());
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if(text_time < 0.0 || elapsed.count() < text_time) text_time = elapsed.count();
+
+    start = std::chrono::steady_clock::now();
+    CodeUnit* unit = module->Decode(&error);
+    elapsed = std::chrono::steady_clock::now() - start;
+    if(binary_time < 0.0 || elapsed.count() < binary_time) binary_time = elapsed.count();
+    if(unit == nullptr){
+      std::cerr << filename << ": " << error << std::endl;
+      delete module;
+      return 1;
+    }
+    if(r == 0){
+      std::stringstream out;
+      GlslEmitter emitter(out);
+      emitter.EmitUnit(unit);
+      if(out.str() != expected.str()){
+        std::cerr << filename << ": decoded unit differs" << std::endl;
+        delete unit;
+        delete module;
+        return 1;
+      }
+    }
+    delete unit;
+  }
+
+  std::cout << "Text: " << source.size() << " bytes, " << text_time << "s, MB/s: " << source.size() / text_time / (1024.0 * 1024.0) << std::endl;
+  std::cout << "Binary: " << module->GetSize() << " bytes, " << binary_time << "s, MB/s: " << module->GetSize() / binary_time / (1024.0 * 1024.0) << std::endl;
+  std::cout << "Size: " << 100.0 * module->GetSize() / source.size() << "% of text, Load: " << text_time / binary_time << "x faster" << std::endl;
+  delete module;
+  return 0;
+}
+
+// Disassembles a module written by --binary, or decodes it back into GLSL
+static int
+LoadBinary(const char* filename, bool disassemble){
+  std::string error;
+  BinaryModule* module = BinaryModule::ReadFile(filename, &error);
+  if(module == nullptr){
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  bool loaded;
+  if(disassemble){
+    loaded = module->Disassemble(std::cout, &error);
+  } else{
+    CodeUnit* unit = module->Decode(&error);
+    loaded = unit != nullptr;
+    if(loaded){
+      GlslEmitter emitter(std::cout);
+      emitter.EmitUnit(unit);
+    }
+    delete unit;
+  }
+  delete module;
+  if(!loaded){
+    std::cerr << filename << ": " << error << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Links the stage pairs listed in pairs_file, one "<producer> <consumer>"
+// pair of filenames per line, printing the mismatches of pairs that fail
+static int
+Link(const char* pairs_file, size_t threads){
+  std::ifstream stream(pairs_file);
+  if(!stream){
+    std::cerr << "Cannot open file: " << pairs_file << std::endl;
+    return 1;
+  }
+  std::vector<std::pair<std::string, std::string>> pairs;
+  std::string line;
+  size_t row = 0;
+  while(std::getline(stream, line)){
+    row++;
+    if(line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#') continue;
+    std::stringstream fields(line);
+    std::string producer;
+    std::string consumer;
+    std::string extra;
+    if(!(fields >> producer >> consumer) || (fields >> extra)){
+      std::cerr << pairs_file << ":" << row << ": expected <producer> <consumer>" << std::endl;
+      return 1;
+    }
+    pairs.push_back({ producer, consumer });
+  }
+
+  InterfaceLinker linker(threads);
+  std::vector<std::string> errors;
+  auto start = std::chrono::steady_clock::now();
+  bool linked = linker.Link(pairs, &errors);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  size_t failed = 0;
+  for(size_t i = 0; i < pairs.size(); i++){
+    if(errors[i].empty()) continue;
+    failed++;
+    std::cout << pairs[i].first << " -> " << pairs[i].second << ":" << std::endl;
+    std::stringstream lines(errors[i]);
+    while(std::getline(lines, line)){
+      std::cout << "  " << line << std::endl;
+    }
+  }
+  std::cout << "Pairs: " << pairs.size() << ", Linked: " << pairs.size() - failed << ", Failed: " << failed << std::endl;
+  std::cout << "Shaders: " << linker.GetNumberOfSignatures() << ", Time: " << elapsed.count() << "s" << std::endl;
+  return linked ? 0 : 1;
+}
+
+// Runs the analysis suite over code, returning the pass manager's wall time
+static double
+RunAnalyses(CodeUnit* code, bool fuse, bool print){
+  NodeCountPass counts;
+  DepthPass depth;
+  CallTargetPass calls;
+  ConstantExprPass constants;
+  UniformExprPass uniforms;
+  LocalUsePass uses;
+  DeadStorePass dead_stores(&uses);
+
+  PassManager passes;
+  passes.SetFusion(fuse);
+  passes.AddPass(&dead_stores, { "local-uses" });
+  passes.AddPass(&counts);
+  passes.AddPass(&depth);
+  passes.AddPass(&calls);
+  passes.AddPass(&constants);
+  passes.AddPass(&uniforms);
+  passes.AddPass(&uses);
+  if(!passes.Run(code)){
+    std::cerr << passes.GetError() << std::endl;
+    return -1.0;
+  }
+  if(!print) return passes.GetTotalTime();
+
+  counts.Print(std::cout);
+  std::cout << "Max depth: " << depth.GetMaxDepth() << std::endl;
+  std::cout << "Call targets: " << calls.GetTargets().size() << std::endl;
+  std::cout << "Constant expressions: " << constants.GetCount() << std::endl;
+  std::cout << "Uniform expressions: " << uniforms.GetCount() << std::endl;
+  std::cout << "Locals used: " << uses.GetNumberOfLocals() << std::endl;
+  std::cout << "Dead stores: " << dead_stores.GetCount() << std::endl;
+  for(size_t i = 0; i < passes.GetNumberOfPasses(); i++){
+    std::cout << passes.GetPassName(i) << ": walk " << passes.GetPassWalk(i) << ", " << passes.GetPassTime(i) << "s" << std::endl;
+  }
+  std::cout << "Walks: " << passes.GetNumberOfWalks() << ", Total: " << passes.GetTotalTime() << "s" << std::endl;
+  return passes.GetTotalTime();
+}
+
+static int
+Analyze(CodeUnit* code){
+  double fused = RunAnalyses(code, true, true);
+  double separate = RunAnalyses(code, false, false);
+  if(fused < 0.0 || separate < 0.0) return 1;
+  std::cout << "Fused: " << fused << "s, One walk per pass: " << separate << "s" << std::endl;
+  return 0;
+}
+
+// Builds count lists the way the AST does, one heap object per list kept
+// alive until the end, with lengths up to max_length skewed towards short
+template<typename List>
+static double
+BenchLists(size_t count, size_t max_length, size_t init_capacity, size_t* heap){
+  size_t heap_before = GetHeapInUse();
+  auto start = std::chrono::steady_clock::now();
+  std::vector<List*> lists;
+  lists.reserve(count);
+  uint32_t seed = 12345;
+  for(size_t i = 0; i < count; i++){
+    seed = seed * 1103515245u + 12345u;
+    size_t length = ((seed >> 8) % (max_length + 1)) * ((seed >> 4) % 4) / 3;
+    List* list = new List(init_capacity);
+    for(size_t j = 0; j < length; j++){
+      list->Add(reinterpret_cast<AstNode*>(j + 1));
+    }
+    lists.push_back(list);
+  }
+  *heap = GetHeapInUse() - heap_before;
+  for(auto list : lists){
+    delete list;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Child and local list workloads on the previous heap-only layout (10 slots
+// up front) against inline storage, and the parse of a generated shader
+static int
+BenchArray(size_t count){
+  struct Workload{
+    const char* name;
+    size_t max_length;
+  };
+  static const Workload kWorkloads[] = {
+    { "children", 8 },
+    { "locals", 3 },
+  };
+
+  for(auto& workload : kWorkloads){
+    size_t heap_old;
+    size_t heap_new;
+    double old_time = BenchLists<Array<AstNode*>>(count, workload.max_length, 10, &heap_old);
+    double new_time = BenchLists<Array<AstNode*, 4>>(count, workload.max_length, 0, &heap_new);
+    std::cout << workload.name << ": heap " << old_time << "s, " << heap_old << " bytes; "
+              << "inline " << new_time << "s, " << heap_new << " bytes" << std::endl;
+  }
+
+  std::stringstream source;
+  ShaderGenerator generator(source);
+  generator.Generate(ShaderGenerator::kMixed, count / 100);
+  size_t memory;
+  double parse = MeasurePipeline(source.str(), &memory);
+  if(parse < 0.0) return 1;
+  std::cout << "parse mixed " << count / 100 << ": " << parse << "s, " << memory << " bytes" << std::endl;
+  return 0;
+}
+
+static std::string
+JsonString(const std::string& text){
+  std::string result = "\"";
+  for(char c : text){
+    if(c == '"' || c == '\\'){
+      result += '\\';
+      result += c;
+    } else if(static_cast<unsigned char>(c) < 0x20){
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      result += escape;
+    } else{
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+// Estimates the cost of every file on a thread pool, printing each report
+// in order and the shaders ranked by cost
+static int
+Cost(const std::vector<const char*>& filenames, const CostTable& table, size_t top, bool json, size_t threads){
+  std::vector<std::string> reports(filenames.size());
+  std::vector<double> costs(filenames.size(), -1.0);
+  ThreadPool pool(threads);
+  for(size_t i = 0; i < filenames.size(); i++){
+    pool.Submit([&, i]{
+      Compilation comp(filenames[i]);
+      if(!comp.ParseFile(filenames[i])){
+        reports[i] = comp.GetError();
+        return;
+      }
+      CostEstimator estimator(table);
+      PassManager passes;
+      passes.AddPass(&estimator);
+      passes.Run(comp.GetUnit());
+      estimator.Resolve();
+
+      std::stringstream report;
+      if(json){
+        estimator.PrintJson(report, top);
+      } else{
+        estimator.PrintReport(report, top);
+      }
+      reports[i] = report.str();
+      costs[i] = estimator.GetShaderCost();
+    });
+  }
+  pool.Wait();
+
+  int status = 0;
+  std::vector<size_t> order;
+  for(size_t i = 0; i < filenames.size(); i++){
+    if(costs[i] < 0.0){
+      std::cerr << filenames[i] << ": " << reports[i] << std::endl;
+      status = 1;
+      continue;
+    }
+    order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&costs](size_t a, size_t b){ return costs[a] > costs[b]; });
+
+  if(json){
+    std::cout << "[";
+    for(size_t i = 0; i < order.size(); i++){
+      std::cout << (i > 0 ? "," : "") << "{\"file\":" << JsonString(filenames[order[i]]) << ",\"report\":" << reports[order[i]] << "}";
+    }
+    std::cout << "]" << std::endl;
+    return status;
+  }
+
+  for(size_t i = 0; i < filenames.size(); i++){
+    if(costs[i] < 0.0) continue;
+    if(filenames.size() > 1) std::cout << filenames[i] << ":" << std::endl;
+    std::cout << reports[i];
+  }
+  if(filenames.size() > 1){
+    std::cout << "Shaders by cost:" << std::endl;
+    for(auto idx : order){
+      std::cout << "  " << costs[idx] << " " << filenames[idx] << std::endl;
+    }
+  }
+  return status;
+}
+
+// Interns every file into one HashConsTable, reports how much of the batch
+// is shared and checks every unit rebuilds to the same GLSL
+static int
+Dedup(const std::vector<const char*>& filenames){
+  std::vector<std::string> expected;
+  for(auto filename : filenames){
+    Compilation comp(filename);
+    if(!ParseFile(&comp, filename)) return 1;
+    std::stringstream out;
+    comp.Emit(out);
+    expected.push_back(out.str());
+  }
+
+  size_t heap = GetHeapInUse();
+  std::vector<Compilation*> comps;
+  for(auto filename : filenames){
+    Compilation* comp = new Compilation(filename);
+    ParseFile(comp, filename);
+    comps.push_back(comp);
+  }
+  size_t units_heap = GetHeapInUse() - heap;
+
+  HashConsTable table;
+  for(auto comp : comps){
+    table.AddUnit(comp->GetUnit());
+    delete comp;
+  }
+  size_t table_heap = GetHeapInUse() - heap;
+
+  std::cout << "Units: " << table.GetNumberOfUnits() << std::endl;
+  std::cout << "Nodes: " << table.GetNumberOfInternedNodes() << ", Unique: " << table.GetNumberOfNodes() << std::endl;
+  std::cout << "Heap with units: " << units_heap << " bytes, with table: " << table_heap << " bytes (" << table.GetMemoryUsage() << " estimated)" << std::endl;
+
+  for(size_t i = 0; i < table.GetNumberOfUnits(); i++){
+    std::string error;
+    CodeUnit* unit = table.BuildUnit(static_cast<HashConsTable::UnitId>(i), &error);
+    if(unit == nullptr){
+      std::cerr << filenames[i] << ": " << error << std::endl;
+      return 1;
+    }
+    std::stringstream out;
+    GlslEmitter emitter(out);
+    emitter.EmitUnit(unit);
+    delete unit;
+    if(out.str() != expected[i]){
+      std::cerr << filenames[i] << ": rebuilt unit differs" << std::endl;
+      return 1;
+    }
+  }
+  std::cout << "Rebuilt units match" << std::endl;
+  return 0;
+}
+
+static void
+PrintNode(AstNode* node){
+  std::cout << node->Name() << " " << node->GetSpan().ToString() << std::endl;
+}
+
+// Records a trace while alive and writes it out when main returns, after
+// every pool and unit created later in main was destroyed
+class TraceOutput{
+private:
+  const char* filename_;
+public:
+  TraceOutput(const char* filename):
+    filename_(filename){
+    if(filename_ != nullptr) Trace::Enable();
+  }
+  ~TraceOutput(){
+    if(filename_ == nullptr) return;
+    Trace::Disable();
+    std::string error;
+    if(!Trace::WriteFile(filename_, &error)){
+      std::cerr << error << std::endl;
+      return;
+    }
+    std::cerr << "trace: " << Trace::GetNumberOfEvents() << " events written to " << filename_ << std::endl;
+  }
+};
+
 int
 main(int argc, char** argv){
-  std::ifstream stream;
-  stream.open(argv[1], std::ifstream::binary);
+  bool flat = false;
+  bool emit = false;
+  bool ir = false;
+  bool exec = false;
+  bool bench_exec = false;
+  bool leak_check = false;
+  size_t lanes = 1024;
+  size_t iterations = 5000;
+  size_t threads = 0;
+  const char* serve = nullptr;
+  const char* symbol = nullptr;
+  const char* at = nullptr;
+  const char* generate = nullptr;
+  const char* scale = nullptr;
+  size_t size = 0;
+  size_t lex_threads = 0;
+  bool bench_lex = false;
+  bool bench_numbers = false;
+  bool check_precision = false;
+  bool dedup = false;
+  bool analyze = false;
+  bool bench_array = false;
+  bool cost = false;
+  bool optimize = false;
+  bool unroll = false;
+  bool precision = false;
+  size_t budget = LoopUnroller::kDefaultBudget;
+  bool json = false;
+  size_t top = 10;
+  const char* costs = nullptr;
+  const char* variants = nullptr;
+  const char* hoist = nullptr;
+  const char* precompute = nullptr;
+  const char* trace = nullptr;
+  const char* binary = nullptr;
+  const char* link = nullptr;
+  bool watch = false;
+  bool disassemble = false;
+  bool from_binary = false;
+  bool bench_binary = false;
+  double threshold = 0.3;
+  const char* range = nullptr;
+  std::vector<const char*> filenames;
+  for(int i = 1; i < argc; i++){
+    if(strcmp(argv[i], "--flat") == 0){
+      flat = true;
+    } else if(strcmp(argv[i], "--emit") == 0){
+      emit = true;
+    } else if(strcmp(argv[i], "--ir") == 0){
+      ir = true;
+    } else if(strcmp(argv[i], "--exec") == 0){
+      exec = true;
+    } else if(strcmp(argv[i], "--bench-exec") == 0){
+      bench_exec = true;
+    } else if(strcmp(argv[i], "--leak-check") == 0){
+      leak_check = true;
+    } else if(strcmp(argv[i], "--iterations") == 0 && (i + 1) < argc){
+      iterations = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--serve") == 0 && (i + 1) < argc){
+      serve = argv[++i];
+    } else if(strcmp(argv[i], "--threads") == 0 && (i + 1) < argc){
+      threads = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--lanes") == 0 && (i + 1) < argc){
+      lanes = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--lex-threads") == 0 && (i + 1) < argc){
+      lex_threads = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--bench-numbers") == 0){
+      bench_numbers = true;
+    } else if(strcmp(argv[i], "--check-precision") == 0){
+      check_precision = true;
+    } else if(strcmp(argv[i], "--variants") == 0 && (i + 1) < argc){
+      variants = argv[++i];
+    } else if(strcmp(argv[i], "--optimize") == 0){
+      optimize = true;
+    } else if(strcmp(argv[i], "--unroll") == 0){
+      unroll = true;
+    } else if(strcmp(argv[i], "--hoist") == 0 && (i + 1) < argc){
+      hoist = argv[++i];
+    } else if(strcmp(argv[i], "--trace") == 0 && (i + 1) < argc){
+      trace = argv[++i];
+    } else if(strcmp(argv[i], "--precompute") == 0 && (i + 1) < argc){
+      precompute = argv[++i];
+    } else if(strcmp(argv[i], "--binary") == 0 && (i + 1) < argc){
+      binary = argv[++i];
+    } else if(strcmp(argv[i], "--link") == 0 && (i + 1) < argc){
+      link = argv[++i];
+    } else if(strcmp(argv[i], "--watch") == 0){
+      watch = true;
+    } else if(strcmp(argv[i], "--disassemble") == 0){
+      disassemble = true;
+    } else if(strcmp(argv[i], "--from-binary") == 0){
+      from_binary = true;
+    } else if(strcmp(argv[i], "--bench-binary") == 0){
+      bench_binary = true;
+    } else if(strcmp(argv[i], "--precision") == 0){
+      precision = true;
+    } else if(strcmp(argv[i], "--budget") == 0 && (i + 1) < argc){
+      budget = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--cost") == 0){
+      cost = true;
+    } else if(strcmp(argv[i], "--json") == 0){
+      json = true;
+    } else if(strcmp(argv[i], "--top") == 0 && (i + 1) < argc){
+      top = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--costs") == 0 && (i + 1) < argc){
+      costs = argv[++i];
+    } else if(strcmp(argv[i], "--bench-array") == 0){
+      bench_array = true;
+    } else if(strcmp(argv[i], "--analyze") == 0){
+      analyze = true;
+    } else if(strcmp(argv[i], "--dedup") == 0){
+      dedup = true;
+    } else if(strcmp(argv[i], "--bench-lex") == 0){
+      bench_lex = true;
+    } else if(strcmp(argv[i], "--generate") == 0 && (i + 1) < argc){
+      generate = argv[++i];
+    } else if(strcmp(argv[i], "--scale") == 0 && (i + 1) < argc){
+      scale = argv[++i];
+    } else if(strcmp(argv[i], "--size") == 0 && (i + 1) < argc){
+      size = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--threshold") == 0 && (i + 1) < argc){
+      threshold = strtod(argv[++i], nullptr);
+    } else if(strcmp(argv[i], "--at") == 0 && (i + 1) < argc){
+      at = argv[++i];
+    } else if(strcmp(argv[i], "--range") == 0 && (i + 1) < argc){
+      range = argv[++i];
+    } else if(strcmp(argv[i], "--symbol") == 0 && (i + 1) < argc){
+      symbol = argv[++i];
+    } else{
+      filenames.push_back(argv[i]);
+    }
+  }
+
+  TraceOutput trace_output(trace);
+
+  if(serve != nullptr){
+    CompileServer server(threads);
+    if(strcmp(serve, "-") == 0){
+      server.Serve(0, 1);
+      return 0;
+    }
+    std::string error;
+    if(!server.Listen(serve, &error)){
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if(bench_numbers){
+    return BenchNumbers(size > 0 ? size : 1000000);
+  } else if(check_precision){
+    return CheckPrecision();
+  } else if(bench_array){
+    return BenchArray(size > 0 ? size : 1000000);
+  }
+
+  if(generate != nullptr){
+    ShaderGenerator::Shape shape = ShaderGenerator::GetShape(generate);
+    if(shape == ShaderGenerator::kNumberOfShapes){
+      std::cerr << "Unknown shape: " << generate << std::endl;
+      return 1;
+    }
+    ShaderGenerator generator(std::cout);
+    generator.Generate(shape, size > 0 ? size : 1000);
+    return 0;
+  } else if(scale != nullptr){
+    if(strcmp(scale, "all") != 0 && ShaderGenerator::GetShape(scale) == ShaderGenerator::kNumberOfShapes){
+      std::cerr << "Unknown shape: " << scale << std::endl;
+      return 1;
+    }
+    return Scale(scale, size > 0 ? size : 4000, threshold);
+  }
+
+  if(link != nullptr){
+    return Link(link, threads);
+  }
+
+  if(filenames.empty()){
+    std::cerr << "Usage: " << argv[0] << " [--unroll [--budget <n>]] [--optimize] [--hoist <description>] [--precision] [--binary <module>] [--flat|--emit|--ir|--exec|--analyze] <file>" << std::endl;
+    std::cerr << "       " << argv[0] << " --disassemble | --from-binary <module>" << std::endl;
+    std::cerr << "       " << argv[0] << " --bench-binary <file>" << std::endl;
+    std::cerr << "       " << argv[0] << " --symbol <name> <file>..." << std::endl;
+    std::cerr << "       " << argv[0] << " --at <row>:<col> | --range <row>:<col>-<row>:<col> <file>" << std::endl;
+    std::cerr << "       " << argv[0] << " --generate <shape> | --scale <shape>|all [--size <n>] [--threshold <t>]" << std::endl;
+    std::cerr << "       " << argv[0] << " [--lex-threads <n>] [--bench-lex] <file>" << std::endl;
+    std::cerr << "       " << argv[0] << " --bench-numbers | --bench-array [--size <n>]" << std::endl;
+    std::cerr << "       " << argv[0] << " --check-precision" << std::endl;
+    std::cerr << "       " << argv[0] << " --cost [--json] [--top <n>] [--costs <table>] [--threads <n>] <file>..." << std::endl;
+    std::cerr << "       " << argv[0] << " --dedup <file>..." << std::endl;
+    std::cerr << "       " << argv[0] << " --variants <variants> [--threads <n>] <file>" << std::endl;
+    std::cerr << "       " << argv[0] << " --precompute <bindings> <description>" << std::endl;
+    std::cerr << "       " << argv[0] << " --link <pairs> [--threads <n>]" << std::endl;
+    std::cerr << "       " << argv[0] << " --watch [--optimize] [--emit|--analyze] <file>..." << std::endl;
+    std::cerr << "       " << argv[0] << " --serve <socket>|- [--threads <n>]" << std::endl;
+    std::cerr << "Any of them takes --trace <file> to write a Chrome trace of the run" << std::endl;
+    return 1;
+  }
+
+  if(symbol != nullptr){
+    SymbolTable symbols;
+    for(auto filename : filenames){
+      Compilation comp;
+      if(!ParseFile(&comp, filename)) return 1;
+      symbols.AddUnit(comp.GetUnit());
+    }
+    PrintUnits("Defined in", symbols.GetDefinitions(symbol));
+    PrintUnits("Called from", symbols.GetCallers(symbol));
+    PrintUnits("Referenced from", symbols.GetReferences(symbol));
+    return 0;
+  }
+
+  if(dedup){
+    return Dedup(filenames);
+  }
+
+  if(watch){
+    // units are rebuilt from disk on every change, so passes may modify them
+    ShaderWatcher watcher(std::cerr, [&](const std::string& filename, CodeUnit* unit){
+      if(optimize){
+        PeepholeOptimizer optimizer;
+        optimizer.Run(unit);
+      }
+      if(emit){
+        std::cout << "// " << filename << std::endl;
+        GlslEmitter emitter(std::cout);
+        emitter.EmitUnit(unit);
+      } else if(analyze){
+        std::cout << "// " << filename << std::endl;
+        RunAnalyses(unit, true, true);
+      }
+      std::cout.flush();
+    });
+    std::string error;
+    for(auto filename : filenames){
+      if(!watcher.Add(filename, &error)){
+        std::cerr << error << std::endl;
+        return 1;
+      }
+    }
+    std::cerr << "Watching " << watcher.GetNumberOfShaders() << " shaders" << std::endl;
+    if(!watcher.Run(0, &error)){
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if(cost){
+    CostTable table;
+    std::string error;
+    if(costs != nullptr && !table.Load(costs, &error)){
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    return Cost(filenames, table, top, json, threads);
+  }
+
+  if(variants != nullptr){
+    return CompileVariants(filenames[0], variants, threads);
+  } else if(precompute != nullptr){
+    return Precompute(filenames[0], precompute);
+  }
+
+  if(disassemble || from_binary){
+    return LoadBinary(filenames[0], disassemble);
+  } else if(bench_binary){
+    return BenchBinary(filenames[0]);
+  }
+
+  if(bench_lex){
+    return BenchLex(filenames[0], lex_threads > 0 ? lex_threads : std::thread::hardware_concurrency());
+  }
+
+  if(leak_check){
+    return LeakCheck(filenames[0], iterations);
+  }
+
+  Compilation comp;
+  if(!ParseFile(&comp, filenames[0], lex_threads)) return 1;
+
+  CodeUnit* code = comp.GetUnit();
+  if(unroll){
+    // before the optimizer, which folds what the unrolled copies made constant
+    LoopUnroller unroller(budget);
+    unroller.Run(code);
+    std::cerr << "unrolled: " << unroller.GetNumberOfUnrolled() << ", over budget: " << unroller.GetNumberOfSkipped() << std::endl;
+  }
+  if(optimize){
+    PeepholeOptimizer optimizer;
+    optimizer.Run(code);
+    for(size_t i = 0; i < PeepholeOptimizer::kNumberOfRules; i++){
+      PeepholeOptimizer::Rule rule = static_cast<PeepholeOptimizer::Rule>(i);
+      if(optimizer.GetCount(rule) > 0) std::cerr << PeepholeOptimizer::GetRuleName(rule) << ": " << optimizer.GetCount(rule) << std::endl;
+    }
+  }
+  if(hoist != nullptr){
+    // after the optimizer, which may leave fewer and simpler expressions
+    UniformHoister hoister;
+    hoister.Run(code);
+    std::ofstream description(hoist);
+    if(!description){
+      std::cerr << "Cannot open file: " << hoist << std::endl;
+      return 1;
+    }
+    GlslEmitter emitter(description);
+    emitter.EmitUnit(hoister.GetDescription());
+    std::cerr << "hoisted: " << hoister.GetNumberOfUniforms() << " uniforms from " << hoister.GetNumberOfExpressions() << " expressions" << std::endl;
+  }
+  if(precision){
+    PrecisionInference inference;
+    inference.Run(code);
+    inference.Print(std::cerr);
+  }
+
+  if(binary != nullptr){
+    // after every pass, so the module holds what --emit would print
+    std::string error;
+    BinaryModule* module = BinaryModule::Encode(code, &error);
+    if(module == nullptr){
+      std::cerr << filenames[0] << ": " << error << std::endl;
+      return 1;
+    }
+    if(!module->WriteFile(binary, &error)){
+      std::cerr << error << std::endl;
+      delete module;
+      return 1;
+    }
+    std::stringstream text;
+    GlslEmitter emitter(text);
+    emitter.EmitUnit(code);
+    std::cerr << "binary: " << module->GetSize() << " bytes, emitted text: " << text.str().size() << " bytes" << std::endl;
+    delete module;
+    return 0;
+  }
+
+  if(at != nullptr || range != nullptr){
+    SourceIndex index(code);
+    if(at != nullptr){
+      SourcePosition pos(0, 0);
+      if(!ParsePosition(at, &pos)){
+        std::cerr << "Invalid position: " << at << std::endl;
+        return 1;
+      }
+      Function* func = nullptr;
+      AstNode* node = index.GetNodeAt(pos, &func);
+      if(node == nullptr){
+        std::cerr << "No node at " << at << std::endl;
+        return 1;
+      }
+      std::cout << func->GetName() << ": ";
+      PrintNode(node);
+      return 0;
+    }
+
+    SourceSpan span;
+    const char* end = strchr(range, '-');
+    if(end == nullptr || !ParsePosition(range, &span.start) || !ParsePosition(end + 1, &span.end)){
+      std::cerr << "Invalid range: " << range << std::endl;
+      return 1;
+    }
+    for(auto node : index.GetNodesIn(span)){
+      PrintNode(node);
+    }
+    return 0;
+  }
+
+  if(analyze){
+    return Analyze(code);
+  }
 
-  std::cout << "Opening file: " << argv[1] << std::endl;
+  if(flat){
+    FlatAst* ast = FlatAst::FromCodeUnit(code);
+    ast->Print(std::cout);
+    std::cout << "Nodes: " << ast->GetNumberOfNodes() << ", Bytes: " << ast->GetMemoryUsage() << std::endl;
+    delete ast;
+    return 0;
+  } else if(emit){
+    comp.Emit(std::cout);
+    return 0;
+  } else if(ir){
+    for(size_t i = 0; i < code->GetNumberOfFunctions(); i++){
+      std::string error;
+      IrFunction* func = IrFunction::Lower(code->GetFunctionAt(i), &error, code);
+      if(func == nullptr){
+        std::cerr << code->GetFunctionAt(i)->GetName() << ": " << error << std::endl;
+        return 1;
+      }
+      func->Print(std::cout);
+      if(!func->Verify(&error)){
+        std::cerr << "Verification failed: " << error << std::endl;
+        delete func;
+        return 1;
+      }
+      delete func;
+    }
+    return 0;
+  }
 
-  Parser parser(&stream);
-  CodeUnit* code = parser.ParseUnit();
-  code->GetFunction("main")->GetCode()->Visit(AstPrinter::SYS_OUT);
+  Function* main_func = code->GetFunction("main");
+  if(main_func == nullptr){
+    std::cerr << filenames[0] << ": no main function" << std::endl;
+    return 1;
+  }
+  if(exec || bench_exec){
+    return Execute(code, main_func, lanes, bench_exec);
+  }
+  main_func->GetCode()->Visit(AstPrinter::SYS_OUT);
   return 0;
 }
@@ -0,0 +1,175 @@
+#include "number_scanner.h"
+#include <cstdlib>
+#include <cstring>
+#include <locale.h>
+#if defined(__APPLE__)
+  #include <xlocale.h>
+#endif
+
+namespace GLSLTools{
+  static const double kPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  static bool IsDigit(char c){
+    return c >= '0' && c <= '9';
+  }
+
+  static int GetHexDigit(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  static size_t Fail(NumberLiteral* result, const char* error){
+    result->kind = NumberLiteral::kInvalid;
+    result->error = error;
+    return 0;
+  }
+
+  static locale_t GetClassicLocale(){
+    static locale_t locale = newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+    return locale;
+  }
+
+  // Correctly rounded conversion of [begin, end), a validated decimal float
+  // without suffix. Mantissas up to 2^53 scaled by powers up to 10^22 are
+  // exact in double, so the hardware rounds once. Floats round that double
+  // again, which only goes wrong if it fell on the midpoint of two floats.
+  // Anything else goes through the C library's conversion on a stack copy.
+  static bool ConvertFloat(const char* begin, const char* end, bool is_double, NumberLiteral* result){
+    static const size_t kMaxLength = 767;
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    const char* pos = begin;
+    for(; pos < end && (IsDigit(*pos) || *pos == '.'); pos++){
+      if(*pos == '.'){
+        for(pos++; pos < end && IsDigit(*pos); pos++){
+          if(mantissa != 0 || *pos != '0') digits++;
+          mantissa = mantissa * 10 + (*pos - '0');
+          exponent--;
+        }
+        break;
+      }
+      if(mantissa != 0 || *pos != '0') digits++;
+      mantissa = mantissa * 10 + (*pos - '0');
+    }
+    if(pos < end && (*pos == 'e' || *pos == 'E')){
+      pos++;
+      bool negative = *pos == '-';
+      if(*pos == '+' || *pos == '-') pos++;
+      int value = 0;
+      for(; pos < end; pos++){
+        if(value < 100000) value = value * 10 + (*pos - '0');
+      }
+      exponent += negative ? -value : value;
+    }
+
+    if(digits <= 19 && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22){
+      double value = static_cast<double>(mantissa);
+      value = exponent < 0 ? value / kPowersOfTen[-exponent] : value * kPowersOfTen[exponent];
+      if(is_double){
+        result->double_value = value;
+        return true;
+      }
+
+      // the 29 bits a float drops are 1 followed by zeros on a midpoint, the
+      // value stays within the normal floats
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      if((bits & 0x1FFFFFFF) != 0x10000000){
+        result->float_value = static_cast<float>(value);
+        return true;
+      }
+    }
+
+    size_t length = static_cast<size_t>(end - begin);
+    if(length > kMaxLength) return false;
+    char buffer[kMaxLength + 1];
+    memcpy(buffer, begin, length);
+    buffer[length] = '\0';
+    if(is_double){
+      result->double_value = strtod_l(buffer, nullptr, GetClassicLocale());
+    } else{
+      result->float_value = strtof_l(buffer, nullptr, GetClassicLocale());
+    }
+    return true;
+  }
+
+  size_t NumberScanner::Scan(const char* begin, const char* end, NumberLiteral* result){
+    const char* pos = begin;
+    if(pos >= end) return Fail(result, "Empty number literal");
+
+    // hex integer
+    if(end - pos > 1 && pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X')){
+      pos += 2;
+      uint64_t value = 0;
+      const char* digits = pos;
+      for(int digit; pos < end && (digit = GetHexDigit(*pos)) >= 0; pos++){
+        value = value * 16 + digit;
+        if(value > 0xFFFFFFFFu) return Fail(result, "Integer literal does not fit in 32 bits");
+      }
+      if(pos == digits) return Fail(result, "Hex literal without digits");
+      bool is_unsigned = pos < end && (*pos == 'u' || *pos == 'U');
+      if(is_unsigned) pos++;
+      result->kind = is_unsigned ? NumberLiteral::kUInt : NumberLiteral::kInt;
+      result->uint_value = static_cast<uint32_t>(value);
+      return static_cast<size_t>(pos - begin);
+    }
+
+    const char* digits = pos;
+    while(pos < end && IsDigit(*pos)) pos++;
+    size_t integer_digits = static_cast<size_t>(pos - digits);
+    bool is_float = false;
+    if(pos < end && *pos == '.'){
+      is_float = true;
+      pos++;
+      const char* fraction = pos;
+      while(pos < end && IsDigit(*pos)) pos++;
+      if(integer_digits == 0 && pos == fraction) return Fail(result, "Number literal without digits");
+    } else if(integer_digits == 0){
+      return Fail(result, "Number literal without digits");
+    }
+    if(pos < end && (*pos == 'e' || *pos == 'E')){
+      is_float = true;
+      pos++;
+      if(pos < end && (*pos == '+' || *pos == '-')) pos++;
+      const char* exponent = pos;
+      while(pos < end && IsDigit(*pos)) pos++;
+      if(pos == exponent) return Fail(result, "Exponent without digits");
+    }
+    const char* number_end = pos;
+
+    if(is_float || (pos < end && (*pos == 'f' || *pos == 'F' || *pos == 'l' || *pos == 'L'))){
+      bool is_double = false;
+      if(pos < end && (*pos == 'f' || *pos == 'F')){
+        pos++;
+      } else if(end - pos > 1 && ((pos[0] == 'l' && pos[1] == 'f') || (pos[0] == 'L' && pos[1] == 'F'))){
+        pos += 2;
+        is_double = true;
+      }
+      if(!is_float) return Fail(result, "Float suffix on an integer literal");
+      if(!ConvertFloat(digits, number_end, is_double, result)) return Fail(result, "Float literal too long");
+      result->kind = is_double ? NumberLiteral::kDouble : NumberLiteral::kFloat;
+      return static_cast<size_t>(pos - begin);
+    }
+
+    // decimal, or octal with a leading zero
+    uint64_t base = integer_digits > 1 && digits[0] == '0' ? 8 : 10;
+    uint64_t value = 0;
+    for(const char* digit = digits; digit < number_end; digit++){
+      if(static_cast<uint64_t>(*digit - '0') >= base) return Fail(result, "Invalid digit in octal literal");
+      value = value * base + (*digit - '0');
+      if(value > 0xFFFFFFFFu) return Fail(result, "Integer literal does not fit in 32 bits");
+    }
+    bool is_unsigned = pos < end && (*pos == 'u' || *pos == 'U');
+    if(is_unsigned) pos++;
+    result->kind = is_unsigned ? NumberLiteral::kUInt : NumberLiteral::kInt;
+    result->uint_value = static_cast<uint32_t>(value);
+    return static_cast<size_t>(pos - begin);
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef GLSLTOOLS_NUMBER_SCANNER_H
+#define GLSLTOOLS_NUMBER_SCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace GLSLTools{
+  struct NumberLiteral{
+    enum Kind{
+      kInt,
+      kUInt,
+      kFloat,
+      kDouble,
+      kInvalid
+    };
+
+    Kind kind;
+    union{
+      int32_t int_value;
+      uint32_t uint_value;
+      float float_value;
+      double double_value;
+    };
+    // set when kind is kInvalid
+    const char* error;
+  };
+
+  // Converts GLSL numeric literals straight from source bytes without
+  // allocating or consulting the current locale:
+  //
+  //   decimal, 0 octal and 0x hex integers with an optional u suffix
+  //   floats with optional fraction and exponent and an f or lf suffix
+  //
+  // Integers must fit in 32 bits. Floats are correctly rounded to the
+  // suffix's precision. Floats past the exact fast path, such as mantissas
+  // over 2^53 or exponents past 10^22, fall back to strtod_l/strtof_l under
+  // a newlocale "C" locale. Those are glibc and BSD extensions (macOS
+  // declares them in <xlocale.h>) and other C libraries need a port.
+  class NumberScanner{
+  public:
+    // Scans the literal at the start of [begin, end). Returns the number of
+    // bytes consumed, 0 with result->kind == kInvalid if it is malformed.
+    static size_t Scan(const char* begin, const char* end, NumberLiteral* result);
+
+    // Whether c extends a number token whose last character is previous.
+    // Lexers use this to find the token, Scan then rejects bad forms such
+    // as 1.2.3 or 08 as a whole.
+    static bool IsContinuation(char previous, char c, bool hex){
+      if((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.' || c == '_') return true;
+      return (c == '+' || c == '-') && !hex && (previous == 'e' || previous == 'E');
+    }
+  };
+}
+
+#endif //GLSLTOOLS_NUMBER_SCANNER_H
@@ -1,61 +1,139 @@
 #include "parser.h"
+#include "trace.h"
 #include <sstream>
+#include <algorithm>
+#include <cstdlib>
 
 namespace GLSLTools{
+  const size_t Parser::kDefaultChunkSize;
+
+  bool Parser::Fill(){
+    if(fd_ < 0) return false;
+    TRACE_SCOPE("Fill", "io");
+    ssize_t count;
+    do{
+      count = read(fd_, buffer_, chunk_size_);
+    } while(count < 0 && errno == EINTR);
+    if(count <= 0){
+      if(count < 0) ReportError(std::string("Cannot read input: ") + strerror(errno));
+      fd_ = -1;
+      return false;
+    }
+    ptr_ = 0;
+    buffer_len_ = static_cast<size_t>(count);
+    return true;
+  }
+
+  void Parser::ReleaseTokens(){
+    size_t kept = 0;
+    for(size_t i = 0; i < tokens_.Length(); i++){
+      Token* token = tokens_[i];
+      if(token == peek_token_ || token == previous_token_){
+        tokens_[kept++] = token;
+      } else{
+        delete token;
+      }
+    }
+    tokens_.Truncate(kept);
+  }
+
   Token* Parser::NextToken(){
     if(peek_token_ != nullptr){
-      Token* result = peek_token_;
+      previous_token_ = peek_token_;
       peek_token_ = nullptr;
-      return result;
+      return previous_token_;
     }
+    return previous_token_ = LexToken();
+  }
+
+  Token* Parser::NextBufferedToken(){
+    if(token_index_ >= token_buffer_->GetNumberOfTokens()){
+      token_start_ = position_;
+      return NewToken("\0", kEOF);
+    }
+
+    size_t idx = token_index_++;
+    TokenKind kind = token_buffer_->GetKind(idx);
+    token_start_ = SourcePosition(token_buffer_->GetRow(idx), token_buffer_->GetColumn(idx));
+    std::string text = token_buffer_->GetText(idx);
+    position_ = SourcePosition(token_start_.row, token_start_.column + text.size());
+    if(kind == kLIT_STRING){
+      // quotes aren't part of the text, and only strings may span lines
+      size_t newline = text.rfind('\n');
+      if(newline != std::string::npos){
+        position_.row += std::count(text.begin(), text.end(), '\n');
+        position_.column = text.size() - newline;
+      } else{
+        position_.column += 2;
+      }
+    }
+    return NewToken(text, kind);
+  }
+
+  Token* Parser::LexToken(){
+    // stop the callers loops once an error has been reported
+    if(HasError()) return NewToken("\0", kEOF);
+    if(token_buffer_ != nullptr) return NextBufferedToken();
 
     char next = NextRealChar();
     switch(next){
-      case '\0': return new Token("\0", kEOF, &position_);
-      case '=': return new Token("=", kEQUALS, &position_);
-      case ',': return new Token(",", kCOMMA, &position_);
-      case '+': return new Token("+", kPLUS, &position_);
-      case '{': return new Token("{", kLBRACE, &position_);
-      case '}': return new Token("}", kRBRACE, &position_);
-      case '(': return new Token("(", kLPAREN, &position_);
-      case ')': return new Token(")", kRPAREN, &position_);
-      case ';': return new Token(";", kSEMICOLON, &position_);
+      case '\0': return NewToken("\0", kEOF);
+      case '=': return Match('=') ? NewToken("==", kEQUALS_EQUALS) : NewToken("=", kEQUALS);
+      case ',': return NewToken(",", kCOMMA);
+      case '+':
+        if(Match('+')) return NewToken("++", kINCREMENT);
+        return Match('=') ? NewToken("+=", kPLUS_EQUALS) : NewToken("+", kPLUS);
+      case '-':
+        if(Match('-')) return NewToken("--", kDECREMENT);
+        return Match('=') ? NewToken("-=", kMINUS_EQUALS) : NewToken("-", kMINUS);
+      case '*': return Match('=') ? NewToken("*=", kMUL_EQUALS) : NewToken("*", kMUL);
+      case '/': return Match('=') ? NewToken("/=", kDIVIDE_EQUALS) : NewToken("/", kDIVIDE);
+      case '<': return Match('=') ? NewToken("<=", kLESS_EQUALS) : NewToken("<", kLESS);
+      case '>': return Match('=') ? NewToken(">=", kGREATER_EQUALS) : NewToken(">", kGREATER);
+      case '!':
+        if(Match('=')) return NewToken("!=", kNOT_EQUALS);
+        break;
+      case '{': return NewToken("{", kLBRACE);
+      case '}': return NewToken("}", kRBRACE);
+      case '(': return NewToken("(", kLPAREN);
+      case ')': return NewToken(")", kRPAREN);
+      case ';': return NewToken(";", kSEMICOLON);
       case '"':{
         std::stringstream stream;
-        while((next = NextChar()) != '"') stream << next;
-        return new Token(stream.str(), kLIT_STRING, &position_);
+        while((next = NextChar()) != '"' && next != '\0') stream << next;
+        return NewToken(stream.str(), kLIT_STRING);
       }
       default: break;
     }
 
     if(isdigit(next) || next == '.'){
-      std::stringstream stream;
-      stream << next;
-      while(isdigit(next = PeekChar()) || next == '.' || next == 'f' || next == 'F') stream << NextChar();
-      return new Token(stream.str(), kLIT_NUMBER, &position_);
+      // the whole run is one token, ParseLiteral rejects malformed ones
+      std::string text(1, next);
+      bool hex = next == '0' && (PeekChar() == 'x' || PeekChar() == 'X');
+      while(NumberScanner::IsContinuation(text.back(), PeekChar(), hex)) text.push_back(NextChar());
+      return NewToken(text, kLIT_NUMBER);
     } else{
       std::stringstream stream;
       stream << next;
 
-      while(!isspace(next = PeekChar()) && !IsSymbolChar(next)){
-        stream << NextChar();
-        if(IsKeyword(stream.str())){
-          std::string val = stream.str();
-          return new Token(val, GetKeyword(val), &position_);
-        }
-      }
-      return new Token(stream.str(), kIDENTIFIER, &position_);
+      // classify the whole word once, keywords are never a prefix match
+      while((next = PeekChar()) != '\0' && !isspace(next) && !IsSymbolChar(next)) stream << NextChar();
+      std::string word = stream.str();
+      TokenKind keyword = GetKeyword(word);
+      return NewToken(word, keyword != kINVALID ? keyword : kIDENTIFIER);
     }
   }
 
-  AstNode* Parser::ParseBinaryExpr(){
+  AstNode* Parser::ParseBinaryExpr(int min_precedence){
     Token* next;
 
+    SourcePosition start = PeekToken()->GetStart();
     AstNode* expr = ParseUnaryExpr();
-    while(IsBinaryExpr(next = PeekToken())){
+    while(IsBinaryExpr(next = PeekToken()) && GetBinaryExprPrecedence(next) >= min_precedence){
       next = NextToken();
-      std::cout << "Parsing binary expression: " << next->GetText() << std::endl;
-      expr = new BinaryOpNode(GetBinaryExprKind(next), expr, ParseBinaryExpr());
+      PARSER_LOG("Parsing binary expression: " << next->GetText());
+      expr = new BinaryOpNode(GetBinaryExprKind(next), expr, ParseBinaryExpr(GetBinaryExprPrecedence(next) + 1));
+      SetSpan(expr, start);
     }
     return expr;
   }
@@ -63,61 +141,48 @@ namespace GLSLTools{
   Value* Parser::ParseVector(int vec_type){
     Token* next;
     Expect(next = NextToken(), kLPAREN);
-    switch(vec_type){
-      case 2:
-      case 3:
-      case 4:{
-        Value* res = Value::NewVector(vec_type);
-        int ptr = 0;
-        while((next = PeekToken())->GetKind() != kRPAREN){
-          res->SetAt(ptr++, ParseLiteral());
-          switch((next = PeekToken())->GetKind()){
-            case kCOMMA: NextToken(); break;
-            case kRPAREN: NextToken(); return res;
-            default: return res;
-          }
-        }
-      }
-      default:{
-        Array<Value*> values(10);
-        while((next = PeekToken())->GetKind() != kRPAREN){
-          values.Add(ParseLiteral());
-        }
-
-        Value* res = Value::NewVector(values.Length() - 1);
-        for(int i = 0; i < values.Length(); i++){
-          res->SetAt(i, values[i]);
-        }
 
+    Value* res = Value::NewVector(vec_type);
+    int ptr = 0;
+    while((next = PeekToken())->GetKind() != kRPAREN && next->GetKind() != kEOF){
+      if(ptr >= vec_type){
+        ReportError("Too many components for vector", next);
         return res;
       }
+      res->SetAt(ptr++, ParseLiteral());
+      if((next = PeekToken())->GetKind() == kCOMMA) NextToken();
     }
+    Expect(next = NextToken(), kRPAREN);
+    if(ptr != vec_type) ReportError("Too few components for vector", next);
+    return res;
   }
 
   Value* Parser::ParseLiteral(){
     Token* next;
     switch((next = NextToken())->GetKind()){
       case kLIT_NUMBER:{
-        std::cout << "Parsing literal nummber: " << next->GetText() << std::endl;
-        std::string text = next->GetText();
-        if(HasDecimalPlace(next->GetText())){
-          float val;
-          if(EndsWith(text, "f") || EndsWith(text, "F")){
-            val = atof(text.substr(text.size() - 1).c_str());
-          } else{
-            val = atof(text.c_str());
-          }
-          return Value::NewInstance(val, true);
-        } else{
-          int val = atoi(text.c_str());
-          return Value::NewInstance(val, true);
+        PARSER_LOG("Parsing literal number: " << next->GetText());
+        const std::string& text = next->GetText();
+        NumberLiteral literal;
+        if(NumberScanner::Scan(text.data(), text.data() + text.size(), &literal) != text.size()){
+          ReportError("Invalid number literal " + text + (literal.kind == NumberLiteral::kInvalid ? std::string(": ") + literal.error : ""), next);
+          return nullptr;
+        }
+        switch(literal.kind){
+          case NumberLiteral::kInt: return Value::NewInstance(static_cast<int>(literal.int_value), true);
+          case NumberLiteral::kUInt: return Value::NewInstance(static_cast<unsigned int>(literal.uint_value), true);
+          case NumberLiteral::kFloat: return Value::NewInstance(literal.float_value, true);
+          case NumberLiteral::kDouble: return Value::NewInstance(literal.double_value, true);
+          default: return nullptr;
         }
       }
+      case kTRUE: return Value::NewInstance(true, true);
+      case kFALSE: return Value::NewInstance(false, true);
       case kVEC2: return ParseVector(2);
       case kVEC3: return ParseVector(3);
       case kVEC4: return ParseVector(4);
       default: {
-        std::cerr << "Unexpected token: " << next->ToString() << std::endl;
+        ReportError("Unexpected token: " + next->GetText(), next);
         return nullptr;
       }
     }
@@ -127,78 +192,432 @@ namespace GLSLTools{
     AstNode* result;
 
     Token* next;
+    SourcePosition start = PeekToken()->GetStart();
     switch((next = PeekToken())->GetKind()){
+      case kIDENTIFIER:{
+        std::string name = NextToken()->GetText();
+        if(PeekToken()->GetKind() == kLPAREN){
+          NextToken();
+          Expect(next = NextToken(), kRPAREN);
+          result = new CallNode(name);
+          SetSpan(result, start);
+          return result;
+        }
+
+        LocalVariable* local;
+        if(!scope_->Lookup(name, &local)){
+          ReportError("Undefined local: " + name, next);
+          return nullptr;
+        }
+        result = new LoadLocalNode(local);
+        SetSpan(result, start);
+        return result;
+      }
+      case kLPAREN:{
+        NextToken();
+        result = ParseBinaryExpr();
+        Expect(next = NextToken(), kRPAREN);
+        return result;
+      }
       default:
-        std::cout << "Peeker: " << next->ToString() << std::endl;
+        PARSER_LOG("Peeker: " << next->ToString());
         break;
     }
 
     result = new LiteralNode(ParseLiteral());
+    SetSpan(result, start);
 
     switch((next = PeekToken())->GetKind()){
       default:
-        std::cout << "P33k: " << next->ToString() << std::endl;
+        PARSER_LOG("P33k: " << next->ToString());
         return result;
     }
   }
 
   AstNode* Parser::ParseBlock(){
+    // called with the opening brace just consumed
+    TRACE_SCOPE("ParseBlock", "parse");
+    SourcePosition block_start = previous_token_->GetStart();
     SequenceNode* code = new SequenceNode(scope_);
     scope_ = code->GetScope();
 
     Token* next;
     while((next = NextToken())->GetKind() != kRBRACE){
-      switch(next->GetKind()){
-        case kRETURN:{
-          code->Add(new ReturnNode(ParseBinaryExpr()));
-          Expect(next = NextToken(), kSEMICOLON);
-          break;
-        }
-        case kIDENTIFIER:{
-          std::string name = next->GetText();
-          Expect(next = NextToken(), kEQUALS);
-
-          LocalVariable* local;
-          if(!scope_->Lookup(name, &local)){
-            std::cerr << "Undefined local: " << name << std::endl;
-            std::exit(1);
-            return nullptr;
+      // earlier statements hold no tokens
+      ReleaseTokens();
+      if(next->GetKind() == kEOF){
+        ReportError("Unexpected end of file, expected '}'", next);
+        scope_ = scope_->GetParent();
+        return code;
+      }
+      ParseStatement(code, next);
+    }
+
+    scope_ = scope_->GetParent();
+    SetSpan(code, block_start);
+    return code;
+  }
+
+  SequenceNode* Parser::ParseBody(){
+    if(PeekToken()->GetKind() == kLBRACE){
+      NextToken();
+      return static_cast<SequenceNode*>(ParseBlock());
+    }
+
+    // a single statement still gets a block, and a scope, of its own
+    SourcePosition start = PeekToken()->GetStart();
+    SequenceNode* code = new SequenceNode(scope_);
+    scope_ = code->GetScope();
+    ParseStatement(code, NextToken());
+    scope_ = scope_->GetParent();
+    SetSpan(code, start);
+    return code;
+  }
+
+  void Parser::ParseStatement(SequenceNode* code, Token* next){
+    SourcePosition start = next->GetStart();
+    switch(next->GetKind()){
+      case kRETURN:{
+        ReturnNode* ret = new ReturnNode(ParseBinaryExpr());
+        code->Add(ret);
+        Expect(next = NextToken(), kSEMICOLON);
+        SetSpan(ret, start);
+        break;
+      }
+      case kVEC2:
+      case kVEC3:
+      case kVEC4:{
+        StoreLocalNode* store = ParseDeclaration(Type::Get(next->GetText()));
+        if(store == nullptr) break;
+        code->Add(store);
+        Expect(next = NextToken(), kSEMICOLON);
+        SetSpan(store, start);
+        break;
+      }
+      case kLOWP:
+      case kMEDIUMP:
+      case kHIGHP:{
+        StoreLocalNode* store = ParseQualifiedDeclaration(next);
+        if(store == nullptr) break;
+        code->Add(store);
+        Expect(next = NextToken(), kSEMICOLON);
+        SetSpan(store, start);
+        break;
+      }
+      case kIDENTIFIER:{
+        StoreLocalNode* store;
+        if(PeekToken()->GetKind() == kIDENTIFIER){
+          Type* type = Type::Get(next->GetText());
+          if(type == Type::ERROR || type == Type::VOID){
+            ReportError("Unknown type: " + next->GetText(), next);
+            break;
           }
-          code->Add(new StoreLocalNode(local, ParseBinaryExpr()));
-          Expect(next = NextToken(), kSEMICOLON);
-          break;
+          store = ParseDeclaration(type);
+        } else{
+          store = ParseAssignment(next);
         }
-        default: std::cerr << "Invalid Token: " << next->ToString() << std::endl;
+        if(store == nullptr) break;
+        code->Add(store);
+        Expect(next = NextToken(), kSEMICOLON);
+        SetSpan(store, start);
+        break;
+      }
+      case kLBRACE:{
+        code->Add(ParseBlock());
+        break;
       }
+      case kIF:{
+        code->Add(ParseIf());
+        break;
+      }
+      case kFOR:{
+        code->Add(ParseFor());
+        break;
+      }
+      case kWHILE:{
+        code->Add(ParseWhile());
+        break;
+      }
+      default: ReportError("Invalid token: " + next->GetText(), next);
+    }
+  }
+
+  AstNode* Parser::ParseCondition(){
+    Token* next;
+    Expect(next = NextToken(), kLPAREN);
+    if(HasError()) return nullptr;
+    AstNode* condition = ParseBinaryExpr();
+    Expect(next = NextToken(), kRPAREN);
+    return condition;
+  }
+
+  AstNode* Parser::ParseIf(){
+    // called with the if keyword just consumed
+    SourcePosition start = previous_token_->GetStart();
+    AstNode* condition = ParseCondition();
+    SequenceNode* then_block = ParseBody();
+    SequenceNode* else_block = nullptr;
+    if(PeekToken()->GetKind() == kELSE){
+      NextToken();
+      // else if is an else block holding just the next if
+      else_block = ParseBody();
+    }
+
+    IfNode* node = new IfNode(condition, then_block, else_block);
+    SetSpan(node, start);
+    return node;
+  }
+
+  AstNode* Parser::ParseFor(){
+    // called with the for keyword just consumed
+    SourcePosition start = previous_token_->GetStart();
+    ForNode* loop = new ForNode(scope_);
+    scope_ = loop->GetScope();
+
+    Token* next;
+    Expect(next = NextToken(), kLPAREN);
+    if(!HasError() && (next = NextToken())->GetKind() != kSEMICOLON){
+      SourcePosition init_start = next->GetStart();
+      StoreLocalNode* init;
+      if(next->GetKind() == kVEC2 || next->GetKind() == kVEC3 || next->GetKind() == kVEC4){
+        init = ParseDeclaration(Type::Get(next->GetText()));
+      } else if(GetPrecision(next) != kDefaultPrecision){
+        init = ParseQualifiedDeclaration(next);
+      } else if(next->GetKind() == kIDENTIFIER && PeekToken()->GetKind() == kIDENTIFIER){
+        Type* type = Type::Get(next->GetText());
+        if(type == Type::ERROR || type == Type::VOID) ReportError("Unknown type: " + next->GetText(), next);
+        init = HasError() ? nullptr : ParseDeclaration(type);
+      } else{
+        init = ParseAssignment(Expect(next, kIDENTIFIER));
+      }
+      SetSpan(init, init_start);
+      loop->SetInit(init);
+      Expect(next = NextToken(), kSEMICOLON);
     }
 
+    // GLSL allows an empty condition, loops here always have one
+    loop->SetCondition(ParseBinaryExpr());
+    Expect(next = NextToken(), kSEMICOLON);
+    if(!HasError() && (next = NextToken())->GetKind() != kRPAREN){
+      SourcePosition step_start = next->GetStart();
+      StoreLocalNode* step = ParseAssignment(Expect(next, kIDENTIFIER));
+      SetSpan(step, step_start);
+      loop->SetStep(step);
+      Expect(next = NextToken(), kRPAREN);
+    }
+
+    if(!HasError()) loop->SetBody(ParseBody());
     scope_ = scope_->GetParent();
-    return code;
+    SetSpan(loop, start);
+    return loop;
+  }
+
+  AstNode* Parser::ParseWhile(){
+    // called with the while keyword just consumed
+    SourcePosition start = previous_token_->GetStart();
+    ForNode* loop = new ForNode(scope_);
+    scope_ = loop->GetScope();
+    loop->SetCondition(ParseCondition());
+    if(!HasError()) loop->SetBody(ParseBody());
+    scope_ = scope_->GetParent();
+    SetSpan(loop, start);
+    return loop;
+  }
+
+  StoreLocalNode* Parser::ParseDeclaration(Type* type, Precision precision){
+    Token* next;
+    std::string name = Expect(next = NextToken(), kIDENTIFIER)->GetText();
+    Expect(next = NextToken(), kEQUALS);
+    if(HasError()) return nullptr;
+
+    // the initializer can't see the local it defines
+    AstNode* value = ParseBinaryExpr();
+    LocalVariable* local = new LocalVariable(name, type, precision);
+    if(!scope_->AddLocal(local)){
+      ReportError("Redefinition of local: " + name, next);
+      delete local;
+      delete value;
+      return nullptr;
+    }
+    return new StoreLocalNode(local, value, true);
+  }
+
+  StoreLocalNode* Parser::ParseQualifiedDeclaration(Token* qualifier){
+    // called with the qualifier just consumed
+    Token* type_token = NextToken();
+    Type* type = Type::Get(type_token->GetText());
+    if(!type->HasPrecision()){
+      ReportError("Unexpected " + type_token->GetText() + " after " + qualifier->GetText(), type_token);
+      return nullptr;
+    }
+    return ParseDeclaration(type, GetPrecision(qualifier));
+  }
+
+  StoreLocalNode* Parser::ParseAssignment(Token* name_token){
+    // called with the local's name just consumed
+    SourceSpan name_span(name_token->GetStart(), name_token->GetEnd());
+    std::string name = name_token->GetText();
+    LocalVariable* local;
+    if(!scope_->Lookup(name, &local)){
+      ReportError("Undefined local: " + name, name_token);
+      return nullptr;
+    }
+    if(local->IsUniform()){
+      ReportError("Cannot assign to uniform: " + name, name_token);
+      return nullptr;
+    }
+    if(local->IsInput()){
+      ReportError("Cannot assign to input: " + name, name_token);
+      return nullptr;
+    }
+
+    // compound assignments and ++/-- become a plain store of the operation
+    Token* next = NextToken();
+    BinaryOpNode::Kind kind = GetAssignmentKind(next);
+    AstNode* value;
+    if(next->GetKind() == kINCREMENT || next->GetKind() == kDECREMENT){
+      Type* type = local->GetType();
+      Value* one = type == Type::INT ? Value::NewInstance(1, true) :
+                   type == Type::UINT ? Value::NewInstance(1u, true) :
+                   type == Type::DOUBLE ? Value::NewInstance(1.0, true) :
+                   Value::NewInstance(1.0f, true);
+      value = new LiteralNode(one);
+    } else if(kind != BinaryOpNode::kUnknown){
+      value = ParseBinaryExpr();
+    } else{
+      Expect(next, kEQUALS);
+      if(HasError()) return nullptr;
+      return new StoreLocalNode(local, ParseBinaryExpr());
+    }
+
+    LoadLocalNode* load = new LoadLocalNode(local);
+    load->SetSpan(name_span);
+    value = new BinaryOpNode(kind, load, value);
+    SetSpan(value, name_span.start);
+    return new StoreLocalNode(local, value);
+  }
+
+  LocalVariable* Parser::ParseGlobal(Token** name_token){
+    // called with the qualifier just consumed
+    Token* next = NextToken();
+    Precision precision = GetPrecision(next);
+    if(precision != kDefaultPrecision) next = NextToken();
+    Type* type = Type::Get(next->GetText());
+    if(type == Type::ERROR || type == Type::VOID){
+      ReportError("Unknown type: " + next->GetText(), next);
+      return nullptr;
+    }
+    if(precision != kDefaultPrecision && !type->HasPrecision()){
+      ReportError("Unexpected " + next->GetText() + " after " + GetPrecisionName(precision), next);
+      return nullptr;
+    }
+
+    std::string name = Expect(*name_token = NextToken(), kIDENTIFIER)->GetText();
+    Expect(NextToken(), kSEMICOLON);
+    if(HasError()) return nullptr;
+    return new LocalVariable(name, type, precision);
+  }
+
+  void Parser::ParseUniform(CodeUnit* unit){
+    // called with the uniform keyword just consumed
+    Token* name_token;
+    LocalVariable* uniform = ParseGlobal(&name_token);
+    if(uniform == nullptr) return;
+    if(!unit->AddUniform(uniform)){
+      ReportError("Redefinition of uniform: " + uniform->GetName(), name_token);
+      delete uniform;
+    }
+  }
+
+  void Parser::ParseInterface(CodeUnit* unit, Token* qualifier, int location){
+    // called with the in or out keyword just consumed
+    Token* name_token;
+    LocalVariable* local = ParseGlobal(&name_token);
+    if(local == nullptr) return;
+    local->SetLocation(location);
+    bool added = qualifier->GetKind() == kIN ? unit->AddInput(local) : unit->AddOutput(local);
+    if(!added){
+      ReportError("Redefinition of " + qualifier->GetText() + ": " + local->GetName(), name_token);
+      delete local;
+    }
+  }
+
+  void Parser::ParseLayout(CodeUnit* unit){
+    // called with the layout keyword just consumed, location is the only
+    // layout qualifier known
+    Expect(NextToken(), kLPAREN);
+    Token* next = Expect(NextToken(), kIDENTIFIER);
+    if(!HasError() && next->GetText() != "location"){
+      ReportError("Unknown layout qualifier: " + next->GetText(), next);
+    }
+    Expect(NextToken(), kEQUALS);
+    next = Expect(NextToken(), kLIT_NUMBER);
+    Expect(NextToken(), kRPAREN);
+    if(HasError()) return;
+
+    const std::string& text = next->GetText();
+    if(text.empty() || text.size() > 5 || text.find_first_not_of("0123456789") != std::string::npos){
+      ReportError("Invalid location: " + text, next);
+      return;
+    }
+    Token* qualifier = NextToken();
+    if(qualifier->GetKind() != kIN && qualifier->GetKind() != kOUT){
+      ReportError("Expected in or out after layout, found: " + qualifier->GetText(), qualifier);
+      return;
+    }
+    ParseInterface(unit, qualifier, atoi(text.c_str()));
   }
 
   CodeUnit* Parser::ParseUnit(){
+    TRACE_SCOPE("ParseUnit", "parse");
     CodeUnit* unit = new CodeUnit();
+    // function bodies see the uniforms, the interface and the builtins
+    scope_ = unit->GetGlobals();
 
     Token* next;
     while((next = NextToken())->GetKind() != kEOF){
+      ReleaseTokens();
       switch(next->GetKind()){
+        case kUNIFORM:{
+          ParseUniform(unit);
+          break;
+        }
+        case kIN:
+        case kOUT:{
+          ParseInterface(unit, next);
+          break;
+        }
+        case kLAYOUT:{
+          ParseLayout(unit);
+          break;
+        }
+        case kVEC2:
+        case kVEC3:
+        case kVEC4:
         case kIDENTIFIER:{
           std::string type = next->GetText();
           std::string name = Expect(next = NextToken(), kIDENTIFIER)->GetText();
 
-          std::cout << "Type: " << type << std::endl;
-          std::cout << "Name: " << name << std::endl;
+          PARSER_LOG("Type: " << type);
+          PARSER_LOG("Name: " << name);
 
           Expect(next = NextToken(), kLPAREN);
           Expect(next = NextToken(), kRPAREN);
           Expect(next = NextToken(), kLBRACE);
-          std::cout << "Parsing block" << std::endl;
+          if(HasError()) break;
+          PARSER_LOG("Parsing block");
           unit->AddFunction(new Function(name, Type::Get(type), static_cast<SequenceNode*>(ParseBlock())));
           break;
         }
+        default: ReportError("Expected function definition, found: " + next->GetText(), next);
       }
     }
 
+    scope_ = nullptr;
+    if(HasError()){
+      delete unit;
+      return nullptr;
+    }
     return unit;
   }
 }
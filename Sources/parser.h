@@ -4,30 +4,70 @@
 #include "token.h"
 #include "ast.h"
 #include "scope.h"
+#include "tokenizer.h"
+#include "number_scanner.h"
 #include <string>
 #include <vector>
 #include <fstream>
 #include <ctype.h>
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#ifdef GLSLTOOLS_DEBUG
+  #define PARSER_LOG(Message) std::cout << Message << std::endl
+#else
+  #define PARSER_LOG(Message)
+#endif
 
 namespace GLSLTools{
+  // Lexes either a memory buffer holding the whole input or a file
+  // descriptor read in chunks of chunk_size. In streaming mode the buffer is
+  // refilled once drained, the lexer only ever looks one character ahead, so
+  // tokens spanning two chunks need no special handling. Tokens are released
+  // between statements, keeping memory bounded by the chunk, the largest
+  // statement and the AST built so far.
   class Parser{
+  public:
+    static const size_t kDefaultChunkSize = 64 * 1024;
   private:
     char* buffer_;
     size_t buffer_len_;
     size_t ptr_;
+    int fd_;
+    size_t chunk_size_;
+    const TokenBuffer* token_buffer_;
+    size_t token_index_;
     SourcePosition position_;
+    SourcePosition token_start_;
     Token* peek_token_;
+    Token* previous_token_;
     LocalScope* scope_;
+    std::string error_;
+    Array<Token*> tokens_;
+
+    // Tokens live until the Parser is destroyed
+    inline Token* NewToken(const std::string& text, TokenKind kind){
+      Token* token = new Token(text, kind, token_start_, position_);
+      tokens_.Add(token);
+      return token;
+    }
+
+    // Reads the next chunk in streaming mode, false at end of input
+    bool Fill();
+
+    // Deletes every token the parser no longer points to
+    void ReleaseTokens();
 
     inline char PeekChar(){
-      if(ptr_ >= buffer_len_) return '\0';
+      if(ptr_ >= buffer_len_ && !Fill()) return '\0';
       return buffer_[ptr_];
     }
 
     inline char NextChar(){
-      if((ptr_ + 1) >= buffer_len_) return '\0';
+      if(ptr_ >= buffer_len_ && !Fill()) return '\0';
       char c = buffer_[ptr_++];
       position_.column++;
       switch(c){
@@ -38,65 +78,130 @@ namespace GLSLTools{
       }
     }
 
+    inline void ReportError(const std::string& message, Token* token = nullptr){
+      if(HasError()) return;
+      std::stringstream stream;
+      if(token != nullptr) stream << token->GetPosition() << ": ";
+      stream << message;
+      error_ = stream.str();
+    }
+
     inline Token* Expect(Token* next, TokenKind expected){
-      std::cout << "Testing: " << next->GetText() << std::endl;
+      PARSER_LOG("Testing: " << next->GetText());
       if(next->GetKind() != expected){
-        std::cerr << "Unexpected: " << next->ToString() << std::endl;
-        std::cerr << "Expected: " << expected << std::endl;
-        std::exit(1);
+        Token tk("", expected);
+        ReportError("Unexpected " + next->GetKindDescription() + ", expected " + tk.GetKindDescription(), next);
       }
       return next;
     }
 
+    // Consumes the next character if it is expected
+    inline bool Match(char expected){
+      if(PeekChar() != expected) return false;
+      NextChar();
+      return true;
+    }
+
+    // Skips whitespace and comments, returning the first character of the next token
     inline char NextRealChar(){
-      char next;
-      while(isspace(next = NextChar()));
-      return next;
+      while(true){
+        while(isspace(PeekChar())) NextChar();
+        token_start_ = position_;
+        char next = NextChar();
+        if(next != '/') return next;
+
+        if(PeekChar() == '/'){
+          while((next = PeekChar()) != '\n' && next != '\0') NextChar();
+        } else if(PeekChar() == '*'){
+          NextChar();
+          char previous = '\0';
+          while((next = NextChar()) != '\0' && !(previous == '*' && next == '/')) previous = next;
+        } else{
+          return next;
+        }
+      }
     }
 
     inline Token* PeekToken(){
       if(peek_token_ != nullptr){
         return peek_token_;
       }
-      return peek_token_ = NextToken();
+      return peek_token_ = LexToken();
+    }
+
+    // Spans node from start to the end of the last consumed token
+    inline void SetSpan(AstNode* node, const SourcePosition& start) const{
+      if(node == nullptr || previous_token_ == nullptr) return;
+      node->SetSpan(SourceSpan(start, previous_token_->GetEnd()));
     }
 
     inline BinaryOpNode::Kind GetBinaryExprKind(Token* token) const{
       switch(token->GetKind()){
         case kPLUS: return BinaryOpNode::kAdd;
         case kMINUS: return BinaryOpNode::kSubtract;
+        case kMUL: return BinaryOpNode::kMultiply;
+        case kDIVIDE: return BinaryOpNode::kDivide;
+        case kLESS: return BinaryOpNode::kLess;
+        case kLESS_EQUALS: return BinaryOpNode::kLessEqual;
+        case kGREATER: return BinaryOpNode::kGreater;
+        case kGREATER_EQUALS: return BinaryOpNode::kGreaterEqual;
+        case kEQUALS_EQUALS: return BinaryOpNode::kEqual;
+        case kNOT_EQUALS: return BinaryOpNode::kNotEqual;
         default: return BinaryOpNode::kUnknown;
       }
     }
 
-    inline bool HasDecimalPlace(std::string value) const{
-      return value.find(".") != std::string::npos;
-    }
-
-    inline bool EndsWith(std::string value, const std::string& end) const{
-      if(end.size() > value.size()) return false;
-      return std::equal(value.begin() + value.size() - end.size(), value.end(), end.begin());
+    inline int GetBinaryExprPrecedence(Token* token) const{
+      switch(token->GetKind()){
+        case kEQUALS_EQUALS:
+        case kNOT_EQUALS: return 1;
+        case kLESS:
+        case kLESS_EQUALS:
+        case kGREATER:
+        case kGREATER_EQUALS: return 2;
+        case kPLUS:
+        case kMINUS: return 3;
+        case kMUL:
+        case kDIVIDE: return 4;
+        default: return 0;
+      }
     }
 
     inline bool IsSymbolChar(char c) const{
-      #define DECLARE_CHECK(Tk, Name) \
-        if(std::string(1, c) == std::string(Name)){ \
-          return true; \
-        }
-      FOR_EACH_SYMBOL(DECLARE_CHECK)
-      #undef DECLARE_CHECK
-      return false;
+      #define DECLARE_CHAR(Tk, Name) Name
+      static const char kSymbolChars[] = FOR_EACH_SYMBOL(DECLARE_CHAR);
+      #undef DECLARE_CHAR
+      return c != '\0' && strchr(kSymbolChars, c) != nullptr;
     }
 
     inline bool IsBinaryExpr(Token* token) const{
+      return GetBinaryExprKind(token) != BinaryOpNode::kUnknown;
+    }
+
+    // Operator applied by a compound assignment, kUnknown for a plain one
+    inline BinaryOpNode::Kind GetAssignmentKind(Token* token) const{
       switch(token->GetKind()){
-        case kPLUS:
-        case kMINUS: return true;
-        default: return false;
+        case kPLUS_EQUALS:
+        case kINCREMENT: return BinaryOpNode::kAdd;
+        case kMINUS_EQUALS:
+        case kDECREMENT: return BinaryOpNode::kSubtract;
+        case kMUL_EQUALS: return BinaryOpNode::kMultiply;
+        case kDIVIDE_EQUALS: return BinaryOpNode::kDivide;
+        default: return BinaryOpNode::kUnknown;
       }
     }
 
-    inline TokenKind GetKeyword(std::string text) const{
+    // kDefaultPrecision for anything but a precision qualifier
+    inline Precision GetPrecision(Token* token) const{
+      switch(token->GetKind()){
+        case kLOWP: return kLowPrecision;
+        case kMEDIUMP: return kMediumPrecision;
+        case kHIGHP: return kHighPrecision;
+        default: return kDefaultPrecision;
+      }
+    }
+
+    inline TokenKind GetKeyword(const std::string& text) const{
       #define DECLARE_CHECK(Tk, Name) \
         if(text == std::string(Name)) return Tk;
       FOR_EACH_KEYWORD(DECLARE_CHECK)
@@ -104,25 +209,48 @@ namespace GLSLTools{
       return kINVALID;
     }
 
-    inline bool IsKeyword(std::string text) const{
+    inline bool IsKeyword(const std::string& text) const{
       return GetKeyword(text) != kINVALID;
     }
 
+    Token* LexToken();
+    Token* NextBufferedToken();
     Token* NextToken();
-    AstNode* ParseBinaryExpr();
+    AstNode* ParseBinaryExpr(int min_precedence = 1);
     AstNode* ParseUnaryExpr();
     AstNode* ParseBlock();
+    SequenceNode* ParseBody();
+    void ParseStatement(SequenceNode* code, Token* next);
+    AstNode* ParseCondition();
+    AstNode* ParseIf();
+    AstNode* ParseFor();
+    AstNode* ParseWhile();
+    StoreLocalNode* ParseDeclaration(Type* type, Precision precision = kDefaultPrecision);
+    StoreLocalNode* ParseQualifiedDeclaration(Token* qualifier);
+    StoreLocalNode* ParseAssignment(Token* name_token);
+    LocalVariable* ParseGlobal(Token** name_token);
+    void ParseUniform(CodeUnit* unit);
+    void ParseInterface(CodeUnit* unit, Token* qualifier, int location = LocalVariable::kNoLocation);
+    void ParseLayout(CodeUnit* unit);
 
     Value* ParseVector(int vec_type);
     Value* ParseLiteral();
   public:
     Parser(std::ifstream* infile):
       buffer_(nullptr),
-      ptr_(0),
       buffer_len_(0),
+      ptr_(0),
+      fd_(-1),
+      chunk_size_(0),
+      token_buffer_(nullptr),
+      token_index_(0),
       position_(0, 0),
+      token_start_(0, 0),
+      peek_token_(nullptr),
+      previous_token_(nullptr),
       scope_(),
-      peek_token_(nullptr){
+      error_(),
+      tokens_(64){
 
       if(*infile){
         std::filebuf* buff = infile->rdbuf();
@@ -133,14 +261,84 @@ namespace GLSLTools{
         buff->sgetn(buffer_, buffer_len_);
         infile->close();
 
-        std::cout << "Buffer Size: " << buffer_len_ << std::endl;
-        std::cout << "Buffer: " << std::string(buffer_) << std::endl;
-        std::cout << "End of buffer" << std::endl;
+        PARSER_LOG("Buffer Size: " << buffer_len_);
+        PARSER_LOG("Buffer: " << std::string(buffer_));
+        PARSER_LOG("End of buffer");
       } else{
-        std::cerr << "Cannot initialize memory buffer for file" << std::endl;
+        ReportError("Cannot initialize memory buffer for file");
+      }
+    }
+    Parser(const char* data, size_t length):
+      buffer_(nullptr),
+      buffer_len_(length),
+      ptr_(0),
+      fd_(-1),
+      chunk_size_(0),
+      token_buffer_(nullptr),
+      token_index_(0),
+      position_(0, 0),
+      token_start_(0, 0),
+      peek_token_(nullptr),
+      previous_token_(nullptr),
+      scope_(),
+      error_(),
+      tokens_(64){
+      buffer_ = reinterpret_cast<char*>(malloc(sizeof(char) * buffer_len_ + 1));
+      memcpy(buffer_, data, buffer_len_);
+      buffer_[buffer_len_] = '\0';
+    }
+    // Streams from fd, which stays owned by the caller
+    Parser(int fd, size_t chunk_size = kDefaultChunkSize):
+      buffer_(nullptr),
+      buffer_len_(0),
+      ptr_(0),
+      fd_(fd),
+      chunk_size_(chunk_size > 0 ? chunk_size : kDefaultChunkSize),
+      token_buffer_(nullptr),
+      token_index_(0),
+      position_(0, 0),
+      token_start_(0, 0),
+      peek_token_(nullptr),
+      previous_token_(nullptr),
+      scope_(),
+      error_(),
+      tokens_(64){
+      buffer_ = reinterpret_cast<char*>(malloc(sizeof(char) * chunk_size_));
+    }
+
+    // Consumes tokens lexed up front by Tokenizer, tokens stays owned by the caller
+    Parser(const TokenBuffer* tokens):
+      buffer_(nullptr),
+      buffer_len_(0),
+      ptr_(0),
+      fd_(-1),
+      chunk_size_(0),
+      token_buffer_(tokens),
+      token_index_(0),
+      position_(0, 0),
+      token_start_(0, 0),
+      peek_token_(nullptr),
+      previous_token_(nullptr),
+      scope_(),
+      error_(),
+      tokens_(64){}
+    Parser(const Parser& other) = delete;
+    ~Parser(){
+      for(size_t i = 0; i < tokens_.Length(); i++){
+        delete tokens_[i];
       }
+      free(buffer_);
+    }
+
+    bool HasError() const{
+      return !error_.empty();
+    }
+
+    std::string GetError() const{
+      return error_;
     }
 
+    // Returns nullptr and sets the error if the input is malformed
     CodeUnit* ParseUnit();
   };
 }
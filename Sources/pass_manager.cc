@@ -0,0 +1,206 @@
+#include "pass_manager.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+
+namespace GLSLTools{
+  typedef std::chrono::steady_clock Clock;
+
+  const size_t PassManager::kSampleInterval;
+
+  static double Seconds(Clock::duration duration){
+    return std::chrono::duration<double>(duration).count();
+  }
+
+  // Smallest time a pair of clock reads reports, taken off every sample
+  static Clock::duration GetClockOverhead(){
+    Clock::duration overhead = Clock::duration::max();
+    for(int i = 0; i < 64; i++){
+      Clock::time_point start = Clock::now();
+      overhead = std::min(overhead, Clock::now() - start);
+    }
+    return overhead;
+  }
+
+  // Drives the passes of one level through a single walk
+  class FusedWalk : public AstNodeVisitor{
+  private:
+    std::vector<AstPass*>& passes_;
+    std::vector<Clock::duration> times_;
+    Clock::duration overhead_;
+    size_t sample_interval_;
+    size_t nodes_;
+
+    void Walk(AstNode* node){
+      if(nodes_++ % sample_interval_ != 0){
+        for(auto pass : passes_) node->Visit(pass);
+        node->VisitChildren(this);
+        for(auto pass : passes_) pass->LeaveNode(node);
+        return;
+      }
+
+      // the sampled node's time includes neither its children nor the walk itself
+      for(size_t i = 0; i < passes_.size(); i++){
+        Clock::time_point start = Clock::now();
+        node->Visit(passes_[i]);
+        times_[i] += std::max(Clock::now() - start - overhead_, Clock::duration::zero());
+      }
+      node->VisitChildren(this);
+      for(size_t i = 0; i < passes_.size(); i++){
+        Clock::time_point start = Clock::now();
+        passes_[i]->LeaveNode(node);
+        times_[i] += std::max(Clock::now() - start - overhead_, Clock::duration::zero());
+      }
+    }
+  public:
+    FusedWalk(std::vector<AstPass*>& passes, size_t sample_interval):
+      passes_(passes),
+      times_(passes.size(), Clock::duration::zero()),
+      overhead_(GetClockOverhead()),
+      sample_interval_(sample_interval),
+      nodes_(0){}
+    ~FusedWalk(){}
+
+    // Scaled up to every node walked
+    double GetTime(size_t idx) const{
+      return Seconds(times_[idx]) * static_cast<double>(sample_interval_);
+    }
+
+    #define DEFINE_VISIT(BaseName) \
+      void Visit##BaseName(BaseName##Node* node){ Walk(node); }
+      FOR_EACH_NODE(DEFINE_VISIT)
+    #undef DEFINE_VISIT
+  };
+
+  bool PassManager::Add(const std::string& name, AstPass* pass, AstNodeVisitor* visitor, const std::vector<std::string>& requires){
+    if(index_.find(name) != index_.end()){
+      error_ = "Duplicate pass: " + name;
+      return false;
+    }
+    index_.insert({ name, passes_.size() });
+    passes_.push_back({ name, pass, visitor, requires, 0, 0, 0.0 });
+    return true;
+  }
+
+  bool PassManager::AddPass(AstPass* pass, const std::vector<std::string>& requires){
+    return Add(pass->GetName(), pass, pass, requires);
+  }
+
+  bool PassManager::AddVisitor(const std::string& name, AstNodeVisitor* visitor, const std::vector<std::string>& requires){
+    return Add(name, nullptr, visitor, requires);
+  }
+
+  bool PassManager::Schedule(){
+    // Kahn's algorithm in registration order, a pass's level follows its requirements
+    std::vector<size_t> pending(passes_.size(), 0);
+    std::vector<std::vector<size_t>> dependents(passes_.size());
+    for(size_t i = 0; i < passes_.size(); i++){
+      passes_[i].level = 0;
+      for(auto& name : passes_[i].requires){
+        auto pos = index_.find(name);
+        if(pos == index_.end()){
+          error_ = "Pass " + passes_[i].name + " requires unknown pass " + name;
+          return false;
+        }
+        pending[i]++;
+        dependents[pos->second].push_back(i);
+      }
+    }
+
+    std::vector<size_t> ready;
+    for(size_t i = 0; i < passes_.size(); i++){
+      if(pending[i] == 0) ready.push_back(i);
+    }
+    size_t scheduled = 0;
+    while(scheduled < ready.size()){
+      size_t idx = ready[scheduled++];
+      for(auto dependent : dependents[idx]){
+        passes_[dependent].level = std::max(passes_[dependent].level, passes_[idx].level + 1);
+        if(--pending[dependent] == 0) ready.push_back(dependent);
+      }
+    }
+    if(scheduled != passes_.size()){
+      for(size_t i = 0; i < passes_.size(); i++){
+        if(pending[i] > 0){
+          error_ = "Cyclic pass requirements involving " + passes_[i].name;
+          return false;
+        }
+      }
+    }
+
+    // one fused walk per level, ahead of that level's plain visitors
+    size_t levels = 0;
+    for(auto& entry : passes_) levels = std::max(levels, entry.level + 1);
+    walks_ = 0;
+    for(size_t level = 0; level < levels; level++){
+      bool fused = false;
+      for(auto& entry : passes_){
+        if(entry.level != level || entry.pass == nullptr) continue;
+        entry.walk = fuse_ ? walks_ : walks_++;
+        fused = true;
+      }
+      if(fused && fuse_) walks_++;
+      for(auto& entry : passes_){
+        if(entry.level != level || entry.pass != nullptr) continue;
+        entry.walk = walks_++;
+      }
+    }
+    return true;
+  }
+
+  bool PassManager::Run(CodeUnit* unit){
+    error_.clear();
+    if(!Schedule()) return false;
+
+    Clock::time_point run_start = Clock::now();
+    for(auto& entry : passes_) entry.seconds = 0.0;
+    for(size_t walk = 0; walk < walks_; walk++){
+      std::vector<AstPass*> fused;
+      std::vector<size_t> fused_idx;
+      AstNodeVisitor* visitor = nullptr;
+      size_t visitor_idx = 0;
+      for(size_t i = 0; i < passes_.size(); i++){
+        if(passes_[i].walk != walk) continue;
+        if(passes_[i].pass != nullptr){
+          fused.push_back(passes_[i].pass);
+          fused_idx.push_back(i);
+        } else{
+          visitor = passes_[i].visitor;
+          visitor_idx = i;
+        }
+      }
+
+      // the walk is shown with the names of the passes it runs
+      std::string names;
+      if(Trace::IsEnabled()){
+        if(visitor != nullptr) names = passes_[visitor_idx].name;
+        for(auto idx : fused_idx){
+          names += (names.empty() ? "" : ", ") + passes_[idx].name;
+        }
+      }
+      TRACE_SCOPE_DETAIL("Walk", "pass", names);
+
+      if(visitor != nullptr){
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+          unit->GetFunctionAt(i)->GetCode()->Visit(visitor);
+        }
+        passes_[visitor_idx].seconds = Seconds(Clock::now() - start);
+        continue;
+      }
+
+      FusedWalk walker(fused, kSampleInterval);
+      for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+        Function* func = unit->GetFunctionAt(i);
+        for(auto pass : fused) pass->EnterFunction(func);
+        func->GetCode()->Visit(&walker);
+        for(auto pass : fused) pass->LeaveFunction(func);
+      }
+      for(size_t i = 0; i < fused_idx.size(); i++){
+        passes_[fused_idx[i]].seconds = walker.GetTime(i);
+      }
+    }
+    seconds_ = Seconds(Clock::now() - run_start);
+    return true;
+  }
+}
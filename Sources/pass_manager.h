@@ -0,0 +1,118 @@
+#ifndef GLSLTOOLS_PASS_MANAGER_H
+#define GLSLTOOLS_PASS_MANAGER_H
+
+#include "ast.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GLSLTools{
+  // A visitor whose Visit functions look at the node they are given only;
+  // the PassManager walks the children, so passes that don't depend on each
+  // other's results share one traversal. Nodes are visited in pre-order,
+  // LeaveNode is called once all of a node's children were visited.
+  class AstPass : public AstNodeVisitor{
+  public:
+    AstPass(){}
+    virtual ~AstPass(){}
+
+    virtual const char* GetName() const = 0;
+
+    virtual void EnterFunction(Function*){}
+    virtual void LeaveNode(AstNode*){}
+    virtual void LeaveFunction(Function*){}
+  };
+
+  // Runs passes over every function of a CodeUnit. Passes are scheduled in
+  // levels: a pass runs one level after the last of the passes it requires.
+  // All AstPasses of a level are fused into a single walk of each function;
+  // plain visitors, which recurse on their own, get a walk of their own.
+  // Passes are borrowed, not owned.
+  class PassManager{
+  private:
+    // time one node in this many, timing every callback would cost more than the passes
+    static const size_t kSampleInterval = 16;
+
+    struct Entry{
+      std::string name;
+      AstPass* pass;
+      AstNodeVisitor* visitor;
+      std::vector<std::string> requires;
+      size_t level;
+      size_t walk;
+      double seconds;
+    };
+
+    std::vector<Entry> passes_;
+    std::unordered_map<std::string, size_t> index_;
+    size_t walks_;
+    double seconds_;
+    bool fuse_;
+    std::string error_;
+
+    bool Add(const std::string& name, AstPass* pass, AstNodeVisitor* visitor, const std::vector<std::string>& requires);
+    bool Schedule();
+  public:
+    PassManager():
+      passes_(),
+      index_(),
+      walks_(0),
+      seconds_(0.0),
+      fuse_(true),
+      error_(){}
+    PassManager(const PassManager& other) = delete;
+    ~PassManager(){}
+
+    // requires names passes that must have finished before this one starts,
+    // they may be added later. Fails if the name is taken.
+    bool AddPass(AstPass* pass, const std::vector<std::string>& requires = std::vector<std::string>());
+    bool AddVisitor(const std::string& name, AstNodeVisitor* visitor, const std::vector<std::string>& requires = std::vector<std::string>());
+
+    // Without fusion every pass gets a walk of its own, for comparison
+    void SetFusion(bool fuse){
+      fuse_ = fuse;
+    }
+
+    // Fails on unknown or cyclic requirements
+    bool Run(CodeUnit* unit);
+
+    bool HasError() const{
+      return !error_.empty();
+    }
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    size_t GetNumberOfPasses() const{
+      return passes_.size();
+    }
+
+    std::string GetPassName(size_t idx) const{
+      return passes_[idx].name;
+    }
+
+    // Walk the pass ran in during the last Run
+    size_t GetPassWalk(size_t idx) const{
+      return passes_[idx].walk;
+    }
+
+    // Seconds spent in the pass during the last Run, estimated from a
+    // sample of the nodes for fused passes
+    double GetPassTime(size_t idx) const{
+      return passes_[idx].seconds;
+    }
+
+    // Traversals made by the last Run, per function
+    size_t GetNumberOfWalks() const{
+      return walks_;
+    }
+
+    // Wall time of the last Run
+    double GetTotalTime() const{
+      return seconds_;
+    }
+  };
+}
+
+#endif //GLSLTOOLS_PASS_MANAGER_H
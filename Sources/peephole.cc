@@ -0,0 +1,327 @@
+#include "peephole.h"
+#include "trace.h"
+#include <cmath>
+#include <cstring>
+
+namespace GLSLTools{
+  static const char* kRuleNames[] = {
+  #define DEFINE_NAME(Name, Text) Text,
+    FOR_EACH_PEEPHOLE_RULE(DEFINE_NAME)
+  #undef DEFINE_NAME
+  };
+
+  enum ConstantClass{
+    kZero,
+    kOne,
+    kTwo,
+    kPowerOfTwo
+  };
+
+  enum Action{
+    kUseOther,            // x op c is x
+    kUseZero,             // x op c is 0
+    kAddSelf,             // x * 2 is x + x
+    kMultiplyReciprocal   // x / c is x * (1 / c)
+  };
+
+  // Identities and strength reductions of one operation with a constant
+  // scalar right operand. Constants of commutative operations are moved
+  // right first, so these cover 0 + x and 1 * x as well.
+  struct IdentityRule{
+    PeepholeOptimizer::Rule rule;
+    BinaryOpNode::Kind kind;
+    ConstantClass constant;
+    Action action;
+    bool integer_only;
+    // runs in the second walk, after the constants it could hide were merged
+    bool late;
+  };
+
+  static const IdentityRule kIdentityRules[] = {
+    { PeepholeOptimizer::kAddZero, BinaryOpNode::kAdd, kZero, kUseOther, false, false },
+    { PeepholeOptimizer::kSubtractZero, BinaryOpNode::kSubtract, kZero, kUseOther, false, false },
+    { PeepholeOptimizer::kMultiplyOne, BinaryOpNode::kMultiply, kOne, kUseOther, false, false },
+    { PeepholeOptimizer::kDivideOne, BinaryOpNode::kDivide, kOne, kUseOther, false, false },
+    // 0 * NaN isn't 0, only integers fold
+    { PeepholeOptimizer::kMultiplyZero, BinaryOpNode::kMultiply, kZero, kUseZero, true, false },
+    { PeepholeOptimizer::kMultiplyTwo, BinaryOpNode::kMultiply, kTwo, kAddSelf, false, true },
+    { PeepholeOptimizer::kDivideByPowerOfTwo, BinaryOpNode::kDivide, kPowerOfTwo, kMultiplyReciprocal, false, false },
+  };
+
+  static Value* GetConstant(AstNode* node){
+    LiteralNode* literal = node->AsLiteral();
+    return literal != nullptr ? literal->GetValue() : nullptr;
+  }
+
+  static bool IsConstantScalar(Value* value){
+    return value != nullptr && value->IsConstant() && !value->IsScalar();
+  }
+
+  static bool IsConstantVector(Value* value){
+    if(value == nullptr || !value->IsScalar()) return false;
+    for(size_t i = 0; i < value->GetScalarSize(); i++){
+      if(!IsConstantScalar(value->GetAt(i))) return false;
+    }
+    return true;
+  }
+
+  static bool IsPowerOfTwo(double value){
+    int exponent;
+    return std::isfinite(value) && value != 0.0 && std::fabs(std::frexp(value, &exponent)) == 0.5;
+  }
+
+  static bool Matches(ConstantClass constant, Value* value){
+    double number = value->AsDouble();
+    switch(constant){
+      case kZero: return number == 0.0;
+      case kOne: return number == 1.0;
+      case kTwo: return number == 2.0;
+      case kPowerOfTwo: return !value->GetType()->IsNumber() && IsPowerOfTwo(number);
+      default: return false;
+    }
+  }
+
+  // Component type of values of type, nullptr when unknown
+  static Type* GetScalarType(Type* type){
+    if(type == Type::VEC2 || type == Type::VEC3 || type == Type::VEC4) return Type::FLOAT;
+    if(type == Type::FLOAT || type == Type::DOUBLE || type == Type::INT || type == Type::UINT) return type;
+    return nullptr;
+  }
+
+  // Folds two constant operands, componentwise when either is a vector
+  static Value* FoldValues(BinaryOpNode::Kind kind, Value* left, Value* right){
+    bool left_vector = IsConstantVector(left);
+    bool right_vector = IsConstantVector(right);
+    if(!left_vector && !right_vector) return BinaryOpNode::Fold(kind, left, right);
+    // GLSL compares vectors with functions, not operators
+    if(BinaryOpNode::IsComparison(kind)) return nullptr;
+    if(left_vector && right_vector && left->GetScalarSize() != right->GetScalarSize()) return nullptr;
+    if((!left_vector && !IsConstantScalar(left)) || (!right_vector && !IsConstantScalar(right))) return nullptr;
+
+    size_t size = left_vector ? left->GetScalarSize() : right->GetScalarSize();
+    Value* result = Value::NewVector(size);
+    for(size_t i = 0; i < size; i++){
+      Value* component = BinaryOpNode::Fold(kind, left_vector ? left->GetAt(i) : left, right_vector ? right->GetAt(i) : right);
+      if(component == nullptr){
+        delete result;
+        return nullptr;
+      }
+      result->SetAt(i, component);
+    }
+    return result;
+  }
+
+  PeepholeOptimizer::PeepholeOptimizer():
+    result_(nullptr),
+    late_(false){
+    memset(counts_, 0, sizeof(counts_));
+  }
+
+  const char* PeepholeOptimizer::GetRuleName(Rule rule){
+    return kRuleNames[rule];
+  }
+
+  size_t PeepholeOptimizer::GetNumberOfRewrites() const{
+    size_t total = 0;
+    for(size_t i = 0; i < kNumberOfRules; i++){
+      total += counts_[i];
+    }
+    return total;
+  }
+
+  void PeepholeOptimizer::Run(Function* func){
+    late_ = false;
+    func->GetCode()->Visit(this);
+    late_ = true;
+    func->GetCode()->Visit(this);
+  }
+
+  void PeepholeOptimizer::Run(CodeUnit* unit){
+    TRACE_SCOPE("PeepholeOptimizer", "pass");
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      Run(unit->GetFunctionAt(i));
+    }
+  }
+
+  AstNode* PeepholeOptimizer::Rewrite(AstNode* node){
+    result_ = node;
+    node->Visit(this);
+    return result_;
+  }
+
+  static bool IsSelfStore(AstNode* node){
+    if(!node->IsStoreLocal()) return false;
+    AstNode* value = node->AsStoreLocal()->GetValue();
+    return value->IsLoadLocal() && value->AsLoadLocal()->GetLocal() == node->AsStoreLocal()->GetLocal();
+  }
+
+  void PeepholeOptimizer::VisitSequence(SequenceNode* node){
+    size_t kept = 0;
+    for(size_t i = 0; i < node->GetChildrenSize(); i++){
+      AstNode* child = Rewrite(node->GetChildAt(i));
+      if(IsSelfStore(child)){
+        counts_[kStoreSelf]++;
+        delete child;
+        continue;
+      }
+      node->SetChildAt(kept++, child);
+    }
+    node->Truncate(kept);
+    result_ = node;
+  }
+
+  void PeepholeOptimizer::VisitReturn(ReturnNode* node){
+    node->SetValue(Rewrite(node->GetValue()));
+    result_ = node;
+  }
+
+  void PeepholeOptimizer::VisitStoreLocal(StoreLocalNode* node){
+    node->SetValue(Rewrite(node->GetValue()));
+    result_ = node;
+  }
+
+  void PeepholeOptimizer::VisitIf(IfNode* node){
+    node->SetCondition(Rewrite(node->GetCondition()));
+    node->GetThen()->Visit(this);
+    if(node->HasElse()) node->GetElse()->Visit(this);
+    result_ = node;
+  }
+
+  void PeepholeOptimizer::VisitFor(ForNode* node){
+    if(node->GetInit() != nullptr) node->GetInit()->Visit(this);
+    node->SetCondition(Rewrite(node->GetCondition()));
+    if(node->GetStep() != nullptr) node->GetStep()->Visit(this);
+    node->GetBody()->Visit(this);
+    result_ = node;
+  }
+
+  void PeepholeOptimizer::VisitBinaryOp(BinaryOpNode* node){
+    node->SetLeft(Rewrite(node->GetLeft()));
+    node->SetRight(Rewrite(node->GetRight()));
+    result_ = Simplify(node);
+  }
+
+  AstNode* PeepholeOptimizer::Simplify(BinaryOpNode* node){
+    BinaryOpNode::Kind kind = node->GetKind();
+    bool commutative = kind == BinaryOpNode::kAdd || kind == BinaryOpNode::kMultiply;
+
+    // constants go right, so the rules below only look there
+    if(commutative && GetConstant(node->GetLeft()) != nullptr && GetConstant(node->GetRight()) == nullptr){
+      AstNode* left = node->GetLeft();
+      node->SetLeft(node->GetRight());
+      node->SetRight(left);
+    }
+
+    Value* right = GetConstant(node->GetRight());
+    Value* left = GetConstant(node->GetLeft());
+    if(left != nullptr && right != nullptr){
+      Value* value = FoldValues(kind, left, right);
+      if(value == nullptr) return node;
+      counts_[kFoldConstants]++;
+      LiteralNode* literal = new LiteralNode(value);
+      literal->SetSpan(node->GetSpan());
+      delete node;
+      return literal;
+    }
+
+    // (x op c1) op c2 is x op (c1 op c2). Integers wrap, so any chain
+    // merges; floats only when scaling by powers of two keeps it exact.
+    BinaryOpNode* inner = node->GetLeft()->AsBinaryOp();
+    if(commutative && right != nullptr && inner != nullptr && inner->GetKind() == kind){
+      Value* inner_right = GetConstant(inner->GetRight());
+      Type* type = inner_right != nullptr ? GetScalarType(inner_right->GetType()) : nullptr;
+      bool exact = type == Type::INT || type == Type::UINT ?
+                   GetScalarType(right->GetType()) == type :
+                   kind == BinaryOpNode::kMultiply && IsConstantScalar(inner_right) && IsConstantScalar(right) &&
+                   IsPowerOfTwo(inner_right->AsDouble()) && IsPowerOfTwo(right->AsDouble()) &&
+                   inner_right->GetType() == right->GetType();
+      Value* value = exact ? FoldValues(kind, inner_right, right) : nullptr;
+      if(value != nullptr){
+        counts_[kMergeConstants]++;
+        delete inner->GetRight();
+        inner->SetRight(new LiteralNode(value));
+        inner->GetRight()->SetSpan(node->GetRight()->GetSpan());
+        node->SetLeft(nullptr);
+        delete node;
+        return Simplify(inner);
+      }
+    }
+
+    return ApplyIdentities(node);
+  }
+
+  AstNode* PeepholeOptimizer::ApplyIdentities(BinaryOpNode* node){
+    for(auto& rule : kIdentityRules){
+      if(rule.kind != node->GetKind() || rule.late != late_) continue;
+
+      Value* constant = GetConstant(node->GetRight());
+      if(!IsConstantScalar(constant) || !Matches(rule.constant, constant)) continue;
+
+      AstNode* other = node->GetLeft();
+      Type* type = GetScalarType(other->GetType());
+      if(type == nullptr || type != constant->GetType()) continue;
+      if(rule.integer_only && !type->IsNumber()) continue;
+
+      AstNode* result = nullptr;
+      switch(rule.action){
+        case kUseOther:{
+          node->SetLeft(nullptr);
+          result = other;
+          break;
+        }
+        case kUseZero:{
+          // a vector would need a vector zero
+          if(other->GetType()->GetSize() != 1) continue;
+          result = new LiteralNode(constant->Copy());
+          result->SetSpan(node->GetSpan());
+          break;
+        }
+        case kAddSelf:{
+          // only duplicate what is free to evaluate twice
+          LoadLocalNode* load = other->AsLoadLocal();
+          if(load == nullptr) continue;
+          node->SetLeft(nullptr);
+          LoadLocalNode* copy = new LoadLocalNode(load->GetLocal());
+          copy->SetSpan(load->GetSpan());
+          result = new BinaryOpNode(BinaryOpNode::kAdd, load, copy);
+          result->SetSpan(node->GetSpan());
+          break;
+        }
+        case kMultiplyReciprocal:{
+          Value* reciprocal = constant->GetType() == Type::DOUBLE ?
+                              Value::NewInstance(1.0 / constant->AsDouble(), true) :
+                              Value::NewInstance(1.0f / constant->AsFloat(), true);
+          node->SetLeft(nullptr);
+          LiteralNode* literal = new LiteralNode(reciprocal);
+          literal->SetSpan(node->GetRight()->GetSpan());
+          result = new BinaryOpNode(BinaryOpNode::kMultiply, other, literal);
+          result->SetSpan(node->GetSpan());
+          break;
+        }
+      }
+
+      counts_[rule.rule]++;
+      delete node;
+      return result;
+    }
+
+    // x - x is 0 for integer locals
+    LoadLocalNode* left = node->GetLeft()->AsLoadLocal();
+    LoadLocalNode* right = node->GetRight()->AsLoadLocal();
+    if(node->GetKind() == BinaryOpNode::kSubtract && left != nullptr && right != nullptr &&
+       left->GetLocal() == right->GetLocal()){
+      Type* type = left->GetType();
+      Value* zero = type == Type::INT ? Value::NewInstance(0, true) :
+                    type == Type::UINT ? Value::NewInstance(0u, true) :
+                    nullptr;
+      if(zero != nullptr){
+        counts_[kSubtractSelf]++;
+        LiteralNode* literal = new LiteralNode(zero);
+        literal->SetSpan(node->GetSpan());
+        delete node;
+        return literal;
+      }
+    }
+    return node;
+  }
+}
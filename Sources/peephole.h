@@ -0,0 +1,72 @@
+#ifndef GLSLTOOLS_PEEPHOLE_H
+#define GLSLTOOLS_PEEPHOLE_H
+
+#include "ast.h"
+
+namespace GLSLTools{
+  #define FOR_EACH_PEEPHOLE_RULE(V) \
+    V(FoldConstants, "fold-constants") \
+    V(MergeConstants, "merge-constants") \
+    V(AddZero, "add-zero") \
+    V(SubtractZero, "sub-zero") \
+    V(SubtractSelf, "sub-self") \
+    V(MultiplyOne, "mul-one") \
+    V(MultiplyZero, "mul-zero") \
+    V(DivideOne, "div-one") \
+    V(MultiplyTwo, "mul-two") \
+    V(DivideByPowerOfTwo, "div-pow2") \
+    V(StoreSelf, "store-self")
+
+  // Rewrites BinaryOpNode trees bottom up: folds constant operands, scalar
+  // and vector alike, merges the constants of chained adds and multiplies
+  // ((v * 2.0) * 4.0 becomes one vector op v * 8.0), drops identities and
+  // strength reduces what is left. Every node is simplified after its
+  // operands, and each rewrite either removes nodes or ends the rules for
+  // that node, so a walk reaches the fixed point. A second walk turns
+  // x * 2 into x + x once no merge can use the constant anymore. Stores
+  // left assigning a local to itself, as unrolled copies do once n + 0
+  // folds to n, are dropped.
+  //
+  // Rewrites never change the type of an expression, float rewrites are
+  // limited to ones that are exact.
+  class PeepholeOptimizer : public AstNodeVisitor{
+  public:
+    enum Rule{
+    #define DEFINE_RULE(Name, Text) k##Name,
+      FOR_EACH_PEEPHOLE_RULE(DEFINE_RULE)
+    #undef DEFINE_RULE
+      kNumberOfRules
+    };
+  private:
+    size_t counts_[kNumberOfRules];
+    AstNode* result_;
+    bool late_;
+
+    AstNode* Rewrite(AstNode* node);
+    AstNode* Simplify(BinaryOpNode* node);
+    AstNode* ApplyIdentities(BinaryOpNode* node);
+  public:
+    PeepholeOptimizer();
+    ~PeepholeOptimizer(){}
+
+    void Run(Function* func);
+    void Run(CodeUnit* unit);
+
+    size_t GetCount(Rule rule) const{
+      return counts_[rule];
+    }
+
+    size_t GetNumberOfRewrites() const;
+
+    static const char* GetRuleName(Rule rule);
+
+    void VisitSequence(SequenceNode* node);
+    void VisitReturn(ReturnNode* node);
+    void VisitBinaryOp(BinaryOpNode* node);
+    void VisitStoreLocal(StoreLocalNode* node);
+    void VisitIf(IfNode* node);
+    void VisitFor(ForNode* node);
+  };
+}
+
+#endif //GLSLTOOLS_PEEPHOLE_H
@@ -0,0 +1,427 @@
+#include "precision.h"
+#include "trace.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace GLSLTools{
+  const size_t PrecisionInference::kMaxIterations;
+  const size_t PrecisionInference::kMaxTrips;
+
+  // Guaranteed magnitudes indexed by Precision, float ranges are open
+  static const double kFloatLimits[] = { 0.0, 2.0, 16384.0, FLT_MAX };
+  static const double kIntLimits[] = { 0.0, 127.0, 32767.0, 2147483647.0 };
+  static const double kUIntLimits[] = { 0.0, 255.0, 65535.0, 4294967295.0 };
+
+  // lowp has an absolute precision of 2^-8, mediump 10 bits of mantissa
+  // and normals down to 2^-14, finer quanta are as good as unknown
+  static const double kLowQuantum = 1.0 / 256.0;
+  static const double kMediumQuantum = 1.0 / 16384.0;
+  static const int kMediumBits = 11;
+
+  static const double kInfinity = std::numeric_limits<double>::infinity();
+
+  static double Clamp(double quantum){
+    return quantum < kMediumQuantum ? 0.0 : quantum;
+  }
+
+  // Largest power of two dividing value
+  static double GetQuantum(double value){
+    if(value == 0.0) return kInfinity;
+    if(!std::isfinite(value)) return 0.0;
+    int exponent;
+    double mantissa = std::frexp(std::fabs(value), &exponent);
+    uint64_t bits = static_cast<uint64_t>(std::ldexp(mantissa, 53));
+    int zeros = 0;
+    for(; (bits & 1) == 0; bits >>= 1) zeros++;
+    return Clamp(std::ldexp(1.0, exponent - 53 + zeros));
+  }
+
+  ValueRange ValueRange::Join(const ValueRange& other) const{
+    if(IsEmpty()) return other;
+    if(other.IsEmpty()) return *this;
+    return ValueRange(std::min(min, other.min), std::max(max, other.max), std::min(quantum, other.quantum));
+  }
+
+  ValueRange ValueRange::Of(double value){
+    return ValueRange(value, value, GetQuantum(value));
+  }
+
+  ValueRange ValueRange::Empty(){
+    return ValueRange();
+  }
+
+  ValueRange ValueRange::Unbounded(){
+    return ValueRange(-kInfinity, kInfinity);
+  }
+
+  static ValueRange GetBounds(const double* values, size_t count){
+    ValueRange range = ValueRange::Empty();
+    for(size_t i = 0; i < count; i++){
+      // inf - inf and the like
+      if(std::isnan(values[i])) return ValueRange::Unbounded();
+      range = range.Join(ValueRange(values[i], values[i]));
+    }
+    return range;
+  }
+
+  // A zero operand bounds the product, even against an unbounded one
+  static double Multiply(double a, double b){
+    return a == 0.0 || b == 0.0 ? 0.0 : a * b;
+  }
+
+  static ValueRange WithQuantum(ValueRange range, double quantum){
+    range.quantum = quantum;
+    return range;
+  }
+
+  static ValueRange Apply(BinaryOpNode::Kind kind, const ValueRange& left, const ValueRange& right){
+    if(left.IsEmpty() || right.IsEmpty()) return ValueRange::Empty();
+    switch(kind){
+      case BinaryOpNode::kAdd:{
+        double bounds[] = { left.min + right.min, left.max + right.max };
+        return WithQuantum(GetBounds(bounds, 2), std::min(left.quantum, right.quantum));
+      }
+      case BinaryOpNode::kSubtract:{
+        double bounds[] = { left.min - right.max, left.max - right.min };
+        return WithQuantum(GetBounds(bounds, 2), std::min(left.quantum, right.quantum));
+      }
+      case BinaryOpNode::kMultiply:{
+        double bounds[] = {
+          Multiply(left.min, right.min), Multiply(left.min, right.max),
+          Multiply(left.max, right.min), Multiply(left.max, right.max)
+        };
+        // a product with zero is zero
+        double quantum = left.quantum == kInfinity || right.quantum == kInfinity ?
+                         kInfinity :
+                         Clamp(left.quantum * right.quantum);
+        return WithQuantum(GetBounds(bounds, 4), quantum);
+      }
+      case BinaryOpNode::kDivide:{
+        if(right.min <= 0.0 && right.max >= 0.0) return ValueRange::Unbounded();
+        double bounds[] = {
+          left.min / right.min, left.min / right.max,
+          left.max / right.min, left.max / right.max
+        };
+        return GetBounds(bounds, 4);
+      }
+      default: return ValueRange(0.0, 1.0, 1.0);
+    }
+  }
+
+  static bool Fits(Type* type, Precision precision, const ValueRange& range){
+    if(range.IsEmpty()) return true;
+    if(type == Type::UINT) return range.min >= 0.0 && range.max <= kUIntLimits[precision];
+    if(type->IsCompatibile(*Type::INT)) return range.min >= -kIntLimits[precision] - 1.0 && range.max <= kIntLimits[precision];
+    if(range.min <= -kFloatLimits[precision] || range.max >= kFloatLimits[precision]) return false;
+    if(precision == kHighPrecision) return true;
+
+    // lower precisions have to hold every value exactly
+    if(precision == kLowPrecision) return range.quantum >= kLowQuantum;
+    double magnitude = std::max(std::fabs(range.min), std::fabs(range.max));
+    return range.quantum >= kMediumQuantum && magnitude <= std::ldexp(range.quantum, kMediumBits);
+  }
+
+  Precision PrecisionInference::GetCheapest(Type* type, const ValueRange& range){
+    if(Fits(type, kLowPrecision, range)) return kLowPrecision;
+    if(Fits(type, kMediumPrecision, range)) return kMediumPrecision;
+    return kHighPrecision;
+  }
+
+  // Raises the operands of every operation evaluated at a precision its
+  // range doesn't fit. Operations are settled bottom up, an operation only
+  // holding literals takes the precision of whatever it's used with.
+  class OperandRaiser : public AstNodeVisitor{
+  private:
+    const std::unordered_map<BinaryOpNode*, Precision>& operations_;
+    const std::unordered_set<LocalVariable*>& candidates_;
+    Precision result_;
+
+    // Precision node is evaluated at, kDefaultPrecision for literals
+    Precision Settle(AstNode* node){
+      result_ = kHighPrecision;
+      node->Visit(this);
+      return result_;
+    }
+
+    void Raise(AstNode* node, Precision precision){
+      if(node->IsBinaryOp()){
+        Raise(node->AsBinaryOp()->GetLeft(), precision);
+        Raise(node->AsBinaryOp()->GetRight(), precision);
+        return;
+      }
+      if(!node->IsLoadLocal()) return;
+      LocalVariable* local = node->AsLoadLocal()->GetLocal();
+      if(candidates_.find(local) != candidates_.end() && local->GetPrecision() < precision) local->SetPrecision(precision);
+    }
+  public:
+    OperandRaiser(const std::unordered_map<BinaryOpNode*, Precision>& operations, const std::unordered_set<LocalVariable*>& candidates):
+      operations_(operations),
+      candidates_(candidates),
+      result_(kHighPrecision){}
+    ~OperandRaiser(){}
+
+    void VisitReturn(ReturnNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitSequence(SequenceNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitIf(IfNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitFor(ForNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitLiteral(LiteralNode*){
+      result_ = kDefaultPrecision;
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      LocalVariable* local = node->GetLocal();
+      result_ = local->GetPrecision() != kDefaultPrecision ?
+                local->GetPrecision() :
+                kHighPrecision;
+    }
+
+    void VisitCall(CallNode*){
+      result_ = kHighPrecision;
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      Precision left = Settle(node->GetLeft());
+      Precision precision = std::max(left, Settle(node->GetRight()));
+      auto pos = operations_.find(node);
+      if(precision != kDefaultPrecision && pos != operations_.end() && precision < pos->second){
+        // at most twice along any chain, each time a level up
+        Raise(node, pos->second);
+        precision = pos->second;
+      }
+      result_ = precision;
+    }
+  };
+
+  void PrecisionInference::Run(Function* func){
+    // clear() would keep the buckets of the largest function so far
+    state_ = State();
+    ranges_ = State();
+    operations_ = std::unordered_map<BinaryOpNode*, Precision>();
+    declared_.clear();
+    candidates_ = std::unordered_set<LocalVariable*>();
+    trips_ = 0;
+    func->GetCode()->Visit(this);
+
+    for(LocalVariable* local : declared_){
+      if(local->GetPrecision() != kDefaultPrecision || !local->GetType()->HasPrecision()) continue;
+      local->SetPrecision(GetCheapest(local->GetType(), ranges_[local]));
+      candidates_.insert(local);
+    }
+    // raising only makes other operations more precise, one pass settles them
+    OperandRaiser raiser(operations_, candidates_);
+    func->GetCode()->Visit(&raiser);
+
+    for(LocalVariable* local : declared_){
+      if(candidates_.find(local) == candidates_.end()) continue;
+      if(local->GetPrecision() == kHighPrecision){
+        local->SetPrecision(kDefaultPrecision);
+        kept_++;
+      } else{
+        changes_.push_back({ func, local, ranges_[local] });
+      }
+    }
+  }
+
+  void PrecisionInference::Run(CodeUnit* unit){
+    TRACE_SCOPE("PrecisionInference", "pass");
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      Run(unit->GetFunctionAt(i));
+    }
+  }
+
+  void PrecisionInference::Print(std::ostream& stream) const{
+    stream << "Lowered: " << changes_.size() << ", kept: " << kept_ << std::endl;
+    for(auto& change : changes_){
+      LocalVariable* local = change.local;
+      stream << "  " << change.function->GetName() << " ";
+      stream << GetPrecisionName(local->GetPrecision()) << " " << local->GetType()->GetName() << " " << local->GetName();
+      stream << " [" << change.range.min << ", " << change.range.max << "]" << std::endl;
+    }
+  }
+
+  ValueRange PrecisionInference::Evaluate(AstNode* node){
+    result_ = ValueRange::Unbounded();
+    result_type_ = Type::ERROR;
+    node->Visit(this);
+    return result_;
+  }
+
+  void PrecisionInference::Store(LocalVariable* local, const ValueRange& range){
+    state_[local] = range;
+    auto pos = ranges_.find(local);
+    if(pos == ranges_.end()){
+      ranges_.insert({ local, range });
+    } else{
+      pos->second = pos->second.Join(range);
+    }
+  }
+
+  void PrecisionInference::Join(const State& other){
+    for(auto& entry : other){
+      auto pos = state_.find(entry.first);
+      if(pos == state_.end()){
+        state_.insert(entry);
+      } else{
+        pos->second = pos->second.Join(entry.second);
+      }
+    }
+  }
+
+  void PrecisionInference::VisitReturn(ReturnNode* node){
+    Evaluate(node->GetValue());
+  }
+
+  void PrecisionInference::VisitLiteral(LiteralNode* node){
+    Value* value = node->GetValue();
+    if(value == nullptr){
+      result_ = ValueRange::Unbounded();
+      return;
+    }
+    result_type_ = value->GetType();
+    if(!value->IsScalar()){
+      result_ = ValueRange::Of(value->AsDouble());
+      return;
+    }
+
+    ValueRange range = ValueRange::Empty();
+    for(size_t i = 0; i < value->GetScalarSize(); i++){
+      Value* component = value->GetAt(i);
+      if(component == nullptr){
+        range = ValueRange::Unbounded();
+        break;
+      }
+      range = range.Join(ValueRange::Of(component->AsDouble()));
+    }
+    result_ = range;
+  }
+
+  void PrecisionInference::VisitSequence(SequenceNode* node){
+    for(size_t i = 0; i < node->GetChildrenSize(); i++){
+      node->GetChildAt(i)->Visit(this);
+    }
+  }
+
+  void PrecisionInference::VisitBinaryOp(BinaryOpNode* node){
+    // GetType would walk the operands again
+    ValueRange left = Evaluate(node->GetLeft());
+    Type* left_type = result_type_;
+    ValueRange right = Evaluate(node->GetRight());
+    Type* type = BinaryOpNode::GetResultType(node->GetKind(), left_type, result_type_);
+    ValueRange result = Apply(node->GetKind(), left, right);
+    if(!BinaryOpNode::IsComparison(node->GetKind())){
+      if(node->GetKind() == BinaryOpNode::kDivide && type->IsCompatibile(*Type::INT)){
+        // integer division truncates towards zero
+        result = ValueRange(std::trunc(result.min), std::trunc(result.max), 1.0);
+      }
+      if(type == Type::UINT && result.min < 0.0){
+        // wraps around
+        result = ValueRange(0.0, kUIntLimits[kHighPrecision], 1.0);
+      }
+
+      // the precision the joined range needs
+      Precision needed = GetCheapest(type, result);
+      auto pos = operations_.find(node);
+      if(pos == operations_.end()){
+        operations_.insert({ node, needed });
+      } else{
+        pos->second = std::max(pos->second, needed);
+      }
+    }
+    result_ = result;
+    result_type_ = type;
+  }
+
+  void PrecisionInference::VisitLoadLocal(LoadLocalNode* node){
+    auto pos = state_.find(node->GetLocal());
+    result_ = pos != state_.end() ?
+              pos->second :
+              ValueRange::Unbounded();
+    result_type_ = node->GetLocal()->GetType();
+  }
+
+  void PrecisionInference::VisitStoreLocal(StoreLocalNode* node){
+    ValueRange range = Evaluate(node->GetValue());
+    LocalVariable* local = node->GetLocal();
+    if(node->IsDeclaration() && ranges_.find(local) == ranges_.end()) declared_.push_back(local);
+    Store(local, range);
+  }
+
+  void PrecisionInference::VisitCall(CallNode* node){
+    result_ = ValueRange::Unbounded();
+    result_type_ = node->GetType();
+  }
+
+  void PrecisionInference::VisitIf(IfNode* node){
+    Evaluate(node->GetCondition());
+    State before = state_;
+    node->GetThen()->Visit(this);
+    if(!node->HasElse()){
+      Join(before);
+      return;
+    }
+
+    State then_state = state_;
+    state_ = before;
+    node->GetElse()->Visit(this);
+    Join(then_state);
+  }
+
+  void PrecisionInference::VisitFor(ForNode* node){
+    if(node->GetInit() != nullptr) node->GetInit()->Visit(this);
+    WalkLoop(node);
+  }
+
+  void PrecisionInference::WalkLoop(ForNode* loop){
+    ForNode::Induction induction;
+    if(loop->GetInduction(kMaxTrips, &induction) && trips_ + induction.trips <= kMaxTrips){
+      // the step stores each value of the induction variable in turn
+      trips_ += induction.trips;
+      for(size_t i = 0; i < induction.trips; i++){
+        Evaluate(loop->GetCondition());
+        loop->GetBody()->Visit(this);
+        loop->GetStep()->Visit(this);
+      }
+      Evaluate(loop->GetCondition());
+      return;
+    }
+
+    for(size_t i = 0; ; i++){
+      State before = state_;
+      Evaluate(loop->GetCondition());
+      loop->GetBody()->Visit(this);
+      if(loop->GetStep() != nullptr) loop->GetStep()->Visit(this);
+      // the body may run any number of times
+      Join(before);
+      if(state_ == before) break;
+      if(i + 1 < kMaxIterations) continue;
+
+      for(auto& entry : state_){
+        auto pos = before.find(entry.first);
+        if(pos == before.end()) continue;
+        if(entry.second.min < pos->second.min) entry.second.min = -kInfinity;
+        if(entry.second.max > pos->second.max) entry.second.max = kInfinity;
+        if(entry.second.quantum < pos->second.quantum) entry.second.quantum = 0.0;
+      }
+    }
+    Evaluate(loop->GetCondition());
+  }
+}
@@ -0,0 +1,143 @@
+#ifndef GLSLTOOLS_PRECISION_H
+#define GLSLTOOLS_PRECISION_H
+
+#include "ast.h"
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace GLSLTools{
+  // Bounds of every value a local or expression may take, empty until
+  // something is stored. Vectors are bounded over all their components,
+  // unknown values by infinities. Every value is also a multiple of
+  // quantum, a power of two: infinity when they are all zero, 0 when
+  // nothing is known.
+  struct ValueRange{
+    double min;
+    double max;
+    double quantum;
+
+    ValueRange():
+      min(std::numeric_limits<double>::infinity()),
+      max(-std::numeric_limits<double>::infinity()),
+      quantum(std::numeric_limits<double>::infinity()){}
+    ValueRange(double lo, double hi, double q = 0.0):
+      min(lo),
+      max(hi),
+      quantum(q){}
+
+    bool IsEmpty() const{
+      return min > max;
+    }
+
+    bool operator==(const ValueRange& other) const{
+      return (IsEmpty() && other.IsEmpty()) ||
+             (min == other.min && max == other.max && quantum == other.quantum);
+    }
+
+    bool operator!=(const ValueRange& other) const{
+      return !(*this == other);
+    }
+
+    // Smallest range holding both
+    ValueRange Join(const ValueRange& other) const;
+
+    // The range holding exactly value
+    static ValueRange Of(double value);
+
+    static ValueRange Empty();
+    static ValueRange Unbounded();
+  };
+
+  // Lowers unqualified locals to the cheapest precision whose guaranteed
+  // range and precision (GLSL ES 3.00, section 4.5.1) hold every value they
+  // take exactly. A float is only lowered when all of its values lie on a
+  // grid the lower precision represents: multiples of 2^-8 for lowp, values
+  // of at most 11 significant bits no finer than 2^-14 for mediump. So
+  // 2000.25 stays highp, where mediump would round it to 2000.0. Ranges
+  // come from walking each function in order: branches are joined, loops
+  // with a constant trip count are walked once per iteration and any other
+  // loop until its ranges settle, widening whatever still grows to unbounded
+  // after kMaxIterations walks. Calls and divisions by a range holding zero
+  // are unbounded.
+  //
+  // An operation is evaluated at the highest precision of its operands, so
+  // once every local has its precision, the operands of an operation whose
+  // range wouldn't fit are raised again. Locals with a qualifier keep it.
+  class PrecisionInference : public AstNodeVisitor{
+  public:
+    static const size_t kMaxIterations = 8;
+    // Iterations per function walked one by one, loops past it are
+    // walked until they settle instead
+    static const size_t kMaxTrips = 4096;
+
+    struct Change{
+      Function* function;
+      LocalVariable* local;
+      ValueRange range;
+    };
+  private:
+    typedef std::unordered_map<LocalVariable*, ValueRange> State;
+
+    State state_;
+    State ranges_;
+    std::unordered_map<BinaryOpNode*, Precision> operations_;
+    std::vector<LocalVariable*> declared_;
+    std::unordered_set<LocalVariable*> candidates_;
+    size_t trips_;
+    ValueRange result_;
+    Type* result_type_;
+    std::vector<Change> changes_;
+    size_t kept_;
+
+    ValueRange Evaluate(AstNode* node);
+    void Store(LocalVariable* local, const ValueRange& range);
+    void Join(const State& other);
+    void WalkLoop(ForNode* loop);
+  public:
+    PrecisionInference():
+      state_(),
+      ranges_(),
+      operations_(),
+      declared_(),
+      candidates_(),
+      trips_(0),
+      result_(ValueRange::Empty()),
+      result_type_(Type::ERROR),
+      changes_(),
+      kept_(0){}
+    ~PrecisionInference(){}
+
+    void Run(Function* func);
+    void Run(CodeUnit* unit);
+
+    // Lowered locals in declaration order, with the values they take
+    const std::vector<Change>& GetChanges() const{
+      return changes_;
+    }
+
+    // Unqualified locals left at the default precision
+    size_t GetNumberOfKept() const{
+      return kept_;
+    }
+
+    void Print(std::ostream& stream) const;
+
+    // Cheapest precision of type holding range, kHighPrecision if none does
+    static Precision GetCheapest(Type* type, const ValueRange& range);
+
+    void VisitReturn(ReturnNode* node);
+    void VisitLiteral(LiteralNode* node);
+    void VisitSequence(SequenceNode* node);
+    void VisitBinaryOp(BinaryOpNode* node);
+    void VisitLoadLocal(LoadLocalNode* node);
+    void VisitStoreLocal(StoreLocalNode* node);
+    void VisitCall(CallNode* node);
+    void VisitIf(IfNode* node);
+    void VisitFor(ForNode* node);
+  };
+}
+
+#endif //GLSLTOOLS_PRECISION_H
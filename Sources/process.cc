@@ -0,0 +1,34 @@
+#include "process.h"
+#include <cstdio>
+#if defined(__linux__)
+  #include <unistd.h>
+#endif
+#if defined(__GLIBC__)
+  #include <malloc.h>
+#endif
+
+namespace GLSLTools{
+  size_t GetResidentSetSize(){
+  #if defined(__linux__)
+    FILE* file = fopen("/proc/self/statm", "r");
+    if(file == nullptr) return 0;
+    unsigned long pages = 0;
+    unsigned long resident = 0;
+    int read = fscanf(file, "%lu %lu", &pages, &resident);
+    fclose(file);
+    if(read != 2) return 0;
+    return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  #else
+    return 0;
+  #endif
+  }
+
+  size_t GetHeapInUse(){
+  #if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+  #else
+    return 0;
+  #endif
+  }
+}
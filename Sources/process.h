@@ -0,0 +1,14 @@
+#ifndef GLSLTOOLS_PROCESS_H
+#define GLSLTOOLS_PROCESS_H
+
+#include <cstddef>
+
+namespace GLSLTools{
+  // Current resident set size of this process in bytes, 0 if unknown
+  size_t GetResidentSetSize();
+
+  // Bytes currently allocated from the heap, 0 if unknown
+  size_t GetHeapInUse();
+}
+
+#endif //GLSLTOOLS_PROCESS_H
@@ -1,7 +1,21 @@
 #include "scope.h"
 
 namespace GLSLTools{
-  bool LocalScope::Lookup(std::string name, LocalVariable** result){
+  const int LocalVariable::kNoLocation;
+
+  LocalScope::~LocalScope(){
+    for(size_t i = 0; i < locals_.Length(); i++){
+      if(locals_[i]->GetOwner() == this) delete locals_[i];
+    }
+
+    if(parent_ != nullptr){
+      LocalScope** link = &parent_->child_;
+      while(*link != nullptr && *link != this) link = &(*link)->sibling_;
+      if(*link == this) *link = sibling_;
+    }
+  }
+
+  bool LocalScope::Lookup(const std::string& name, LocalVariable** result){
     LocalScope* curr = this;
     while(curr != nullptr){
       if(curr->LocalLookup(name, result)){
@@ -13,25 +27,23 @@ namespace GLSLTools{
     return false;
   }
 
-  bool LocalScope::LocalLookup(std::string name, LocalVariable** result){
-    for(int i = 0; i < locals_.Length(); i++){
-      if(locals_[i]->GetName() == name){
-        *result = locals_[i];
-        return true;
-      }
+  bool LocalScope::LocalLookup(const std::string& name, LocalVariable** result){
+    auto pos = names_.find(name);
+    if(pos != names_.end()){
+      *result = pos->second;
+      return true;
     }
     *result = nullptr;
     return false;
   }
 
-  bool LocalScope::HasLocal(std::string name){
+  bool LocalScope::HasLocal(const std::string& name){
     LocalVariable* result = nullptr;
-    Lookup(name, &result);
-    return result != nullptr;
+    return LocalLookup(name, &result);
   }
 
   bool LocalScope::AddLocal(LocalVariable* local){
-    if(HasLocal(local->GetName())) return false;
+    if(!names_.insert({ local->GetName(), local }).second) return false;
     locals_.Add(local);
     if(local->GetOwner() == nullptr) local->SetOwner(this);
     return true;
@@ -2,24 +2,48 @@
 #define GLSLTOOLS_SCOPE_H
 
 #include <string>
+#include <unordered_map>
 #include "array.h"
 #include "type.h"
 
 namespace GLSLTools{
   class LocalScope;
 
+  // Stage interface of a global: inputs are read only like uniforms, outputs
+  // are stored to like builtins
+  enum Interface{
+    kNoInterface,
+    kInputInterface,
+    kOutputInterface
+  };
+
+  // A LocalVariable owns its constant Value
   class LocalVariable{
+  public:
+    static const int kNoLocation = -1;
   private:
     std::string name_;
     LocalScope* owner_;
     Type* type_;
+    Precision precision_;
+    bool uniform_;
+    Interface interface_;
+    int location_;
     Value* value_;
   public:
-    LocalVariable(std::string name, Type* type):
+    LocalVariable(std::string name, Type* type, Precision precision = kDefaultPrecision):
       name_(name),
+      owner_(nullptr),
       type_(type),
-      value_(nullptr),
-      owner_(nullptr){}
+      precision_(precision),
+      uniform_(false),
+      interface_(kNoInterface),
+      location_(kNoLocation),
+      value_(nullptr){}
+    LocalVariable(const LocalVariable& other) = delete;
+    ~LocalVariable(){
+      delete value_;
+    }
 
     std::string GetName() const{
       return name_;
@@ -33,6 +57,53 @@ namespace GLSLTools{
       return type_;
     }
 
+    Precision GetPrecision() const{
+      return precision_;
+    }
+
+    void SetPrecision(Precision precision){
+      precision_ = precision;
+    }
+
+    // Uniforms live in their CodeUnit's global scope and are never stored
+    bool IsUniform() const{
+      return uniform_;
+    }
+
+    void SetUniform(bool uniform){
+      uniform_ = uniform;
+    }
+
+    Interface GetInterface() const{
+      return interface_;
+    }
+
+    bool IsInput() const{
+      return interface_ == kInputInterface;
+    }
+
+    bool IsOutput() const{
+      return interface_ == kOutputInterface;
+    }
+
+    void SetInterface(Interface interface){
+      interface_ = interface;
+    }
+
+    // The layout location of an interface variable, kNoLocation when it is
+    // matched by name
+    int GetLocation() const{
+      return location_;
+    }
+
+    bool HasLocation() const{
+      return location_ != kNoLocation;
+    }
+
+    void SetLocation(int location){
+      location_ = location;
+    }
+
     Value* GetConstantValue() const{
       return value_;
     }
@@ -45,38 +116,56 @@ namespace GLSLTools{
       owner_ = owner;
     }
 
+    // Takes ownership of val
     void SetConstantValue(Value* val){
+      if(val == value_) return;
+      delete value_;
       value_ = val;
     }
   };
 
+  // A LocalScope owns the locals it was the first owner of; it doesn't own
+  // its child scopes, those belong to the nodes that created them. Names are
+  // hashed per scope, a local may shadow one of an enclosing scope.
   class LocalScope{
   private:
     LocalScope* parent_;
     LocalScope* child_;
     LocalScope* sibling_;
-    Array<LocalVariable*> locals_;
+    Array<LocalVariable*, 4> locals_;
+    std::unordered_map<std::string, LocalVariable*> names_;
   public:
     LocalScope(LocalScope* parent = nullptr):
       parent_(parent),
       child_(nullptr),
       sibling_(nullptr),
-      locals_(10){
+      locals_(),
+      names_(){
 
       if(parent != nullptr){
         sibling_ = parent->child_;
         parent->child_ = this;
       }
     }
+    LocalScope(const LocalScope& other) = delete;
+    ~LocalScope();
 
     LocalScope* GetParent() const{
       return parent_;
     }
 
+    size_t GetNumberOfLocals() const{
+      return locals_.Length();
+    }
+
+    LocalVariable* GetLocalAt(size_t idx) const{
+      return locals_[idx];
+    }
+
     bool AddLocal(LocalVariable* local);
-    bool HasLocal(std::string name);
-    bool LocalLookup(std::string name, LocalVariable** result);
-    bool Lookup(std::string name, LocalVariable** result);
+    bool HasLocal(const std::string& name);
+    bool LocalLookup(const std::string& name, LocalVariable** result);
+    bool Lookup(const std::string& name, LocalVariable** result);
   };
 }
 
@@ -0,0 +1,401 @@
+#include "server.h"
+#include "compilation.h"
+#include "ir.h"
+#include "peephole.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace GLSLTools{
+  class FrameReader{
+  private:
+    int fd_;
+    char buffer_[4096];
+    size_t start_;
+    size_t end_;
+
+    bool Fill(){
+      if(start_ < end_) return true;
+      ssize_t count;
+      do{
+        count = read(fd_, buffer_, sizeof(buffer_));
+      } while(count < 0 && errno == EINTR);
+      if(count <= 0) return false;
+      start_ = 0;
+      end_ = static_cast<size_t>(count);
+      return true;
+    }
+  public:
+    FrameReader(int fd):
+      fd_(fd),
+      start_(0),
+      end_(0){}
+
+    bool ReadLine(std::string* line, size_t max_length){
+      line->clear();
+      while(Fill()){
+        char c = buffer_[start_++];
+        if(c == '\n') return true;
+        if(line->size() >= max_length) return false;
+        line->push_back(c);
+      }
+      return false;
+    }
+
+    bool Read(std::string* data, size_t length){
+      data->clear();
+      data->reserve(length);
+      while(data->size() < length && Fill()){
+        size_t count = std::min(end_ - start_, length - data->size());
+        data->append(buffer_ + start_, count);
+        start_ += count;
+      }
+      return data->size() == length;
+    }
+  };
+
+  static bool WriteFully(int fd, const std::string& data){
+    size_t written = 0;
+    while(written < data.size()){
+      ssize_t count = write(fd, data.data() + written, data.size() - written);
+      if(count < 0 && errno == EINTR) continue;
+      if(count <= 0) return false;
+      written += static_cast<size_t>(count);
+    }
+    return true;
+  }
+
+  // Responses of one connection. Requests are handled in parallel, a slot is
+  // reserved for each as it is read and a finished response is only written
+  // once the ones before it were.
+  class ResponseQueue{
+  private:
+    struct Response{
+      bool ready;
+      std::string text;
+    };
+
+    int fd_;
+    std::mutex mutex_;
+    std::condition_variable drained_;
+    std::deque<Response> responses_;
+    size_t first_;
+    bool failed_;
+  public:
+    ResponseQueue(int fd):
+      fd_(fd),
+      mutex_(),
+      drained_(),
+      responses_(),
+      first_(0),
+      failed_(false){}
+
+    size_t Reserve(){
+      std::lock_guard<std::mutex> lock(mutex_);
+      responses_.push_back({ false, std::string() });
+      return first_ + responses_.size() - 1;
+    }
+
+    void Complete(size_t slot, const std::string& text){
+      std::lock_guard<std::mutex> lock(mutex_);
+      responses_[slot - first_] = { true, text };
+      while(!responses_.empty() && responses_.front().ready){
+        if(!failed_ && !WriteFully(fd_, responses_.front().text)) failed_ = true;
+        responses_.pop_front();
+        first_++;
+      }
+      if(responses_.empty()) drained_.notify_all();
+    }
+
+    // Whether writing to the client failed, later responses are dropped
+    bool HasFailed(){
+      std::lock_guard<std::mutex> lock(mutex_);
+      return failed_;
+    }
+
+    // Blocks until every reserved response was written
+    void Drain(){
+      std::unique_lock<std::mutex> lock(mutex_);
+      drained_.wait(lock, [this]{ return responses_.empty(); });
+    }
+  };
+
+  static bool IsCompileCommand(const std::string& command){
+    return command == "parse" || command == "emit" || command == "optimize" || command == "ir";
+  }
+
+  CompileServer::CompileServer(size_t threads):
+    pool_(threads),
+    symbols_(),
+    cache_mutex_(),
+    cache_(),
+    cache_order_(),
+    stats_mutex_(),
+    latencies_(),
+    next_latency_(0),
+    requests_(0),
+    cache_hits_(0),
+    stopping_(false),
+    listen_fd_(-1),
+    clients_mutex_(),
+    clients_done_(),
+    clients_(){}
+
+  bool CompileServer::Compile(const std::string& command, const std::string& name, const std::string& source, std::string* result){
+    std::string key = command + '\n' + name + '\n' + source;
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex_);
+      auto pos = cache_.find(key);
+      if(pos != cache_.end()){
+        *result = pos->second;
+        std::lock_guard<std::mutex> stats(stats_mutex_);
+        cache_hits_++;
+        return true;
+      }
+    }
+
+    Compilation comp(name);
+    if(!comp.Parse(source.data(), source.size())){
+      *result = comp.GetError();
+      return false;
+    }
+    symbols_.AddUnit(comp.GetUnit());
+
+    std::stringstream stream;
+    CodeUnit* unit = comp.GetUnit();
+    if(command == "emit"){
+      comp.Emit(stream);
+    } else if(command == "optimize"){
+      PeepholeOptimizer optimizer;
+      optimizer.Run(unit);
+      comp.Emit(stream);
+    } else if(command == "ir"){
+      for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+        std::string error;
+        IrFunction* ir = IrFunction::Lower(unit->GetFunctionAt(i), &error, unit);
+        if(ir == nullptr){
+          *result = error;
+          return false;
+        }
+        ir->Print(stream);
+        delete ir;
+      }
+    } else{
+      for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+        Function* func = unit->GetFunctionAt(i);
+        stream << func->GetResultType()->GetName() << " " << func->GetName() << "()" << std::endl;
+      }
+    }
+    *result = stream.str();
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if(cache_.insert({ key, *result }).second){
+      cache_order_.push_back(key);
+      if(cache_order_.size() > kMaxCacheEntries){
+        cache_.erase(cache_order_.front());
+        cache_order_.pop_front();
+      }
+    }
+    return true;
+  }
+
+  static void PrintUnits(std::ostream& stream, const char* title, const std::vector<std::string>& units){
+    stream << title << ":" << std::endl;
+    for(auto& unit : units){
+      stream << "  " << unit << std::endl;
+    }
+  }
+
+  bool CompileServer::Handle(const std::string& command, const std::string& name, const std::string& payload, std::string* result){
+    TRACE_SCOPE_DETAIL("Handle", "server", command);
+    if(IsCompileCommand(command)){
+      return Compile(command, name, payload, result);
+    } else if(command == "symbol"){
+      std::stringstream stream;
+      PrintUnits(stream, "Defined in", symbols_.GetDefinitions(payload));
+      PrintUnits(stream, "Called from", symbols_.GetCallers(payload));
+      PrintUnits(stream, "Referenced from", symbols_.GetReferences(payload));
+      *result = stream.str();
+      return true;
+    } else if(command == "stats"){
+      *result = GetStats();
+      return true;
+    } else if(command == "shutdown"){
+      Stop();
+      *result = "";
+      return true;
+    }
+    *result = "Unknown command: " + command;
+    return false;
+  }
+
+  void CompileServer::RecordLatency(uint32_t micros){
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    requests_++;
+    if(latencies_.size() < kMaxLatencySamples){
+      latencies_.push_back(micros);
+    } else{
+      latencies_[next_latency_] = micros;
+      next_latency_ = (next_latency_ + 1) % kMaxLatencySamples;
+    }
+  }
+
+  std::string CompileServer::GetStats(){
+    std::vector<uint32_t> samples;
+    size_t requests;
+    size_t hits;
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      samples = latencies_;
+      requests = requests_;
+      hits = cache_hits_;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::stringstream stream;
+    stream << "requests " << requests << std::endl;
+    stream << "cache_hits " << hits << std::endl;
+    stream << "units " << symbols_.GetNumberOfUnits() << std::endl;
+    static const double kPercentiles[] = { 50.0, 90.0, 99.0 };
+    for(double p : kPercentiles){
+      uint32_t value = 0;
+      if(!samples.empty()){
+        // nearest rank
+        size_t rank = static_cast<size_t>((p / 100.0) * samples.size() + 0.5);
+        if(rank > 0) rank--;
+        value = samples[std::min(rank, samples.size() - 1)];
+      }
+      stream << "p" << static_cast<int>(p) << "_us " << value << std::endl;
+    }
+    return stream.str();
+  }
+
+  void CompileServer::Stop(){
+    stopping_ = true;
+    int fd = listen_fd_.exchange(-1);
+    if(fd >= 0){
+      shutdown(fd, SHUT_RDWR);
+      close(fd);
+    }
+
+    // wake up connections blocked waiting for their next request
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    for(int client : clients_){
+      shutdown(client, SHUT_RD);
+    }
+  }
+
+  void CompileServer::Respond(const std::string& command, const std::string& name, const std::string& payload, ResponseQueue* responses, size_t slot){
+    auto start = std::chrono::steady_clock::now();
+    std::string result;
+    bool ok = Handle(command, name, payload, &result);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    RecordLatency(static_cast<uint32_t>(elapsed.count()));
+
+    std::stringstream response;
+    response << (ok ? "ok " : "error ") << result.size() << "\n" << result;
+    responses->Complete(slot, response.str());
+  }
+
+  void CompileServer::Serve(int in_fd, int out_fd){
+    static const size_t kMaxHeaderLength = 1024;
+
+    FrameReader reader(in_fd);
+    ResponseQueue responses(out_fd);
+    std::string header;
+    while(!stopping_ && !responses.HasFailed() && reader.ReadLine(&header, kMaxHeaderLength)){
+      std::stringstream fields(header);
+      std::string command;
+      std::string name;
+      size_t length = 0;
+      if(!(fields >> command >> name >> length)){
+        responses.Complete(responses.Reserve(), "error 14\nInvalid header");
+        break;
+      }
+      std::string* payload = new std::string();
+      if(!reader.Read(payload, length)){
+        delete payload;
+        break;
+      }
+
+      // the other commands read what earlier requests did, so they wait
+      // for those and run here
+      if(!IsCompileCommand(command)){
+        responses.Drain();
+        Respond(command, name, *payload, &responses, responses.Reserve());
+        delete payload;
+        continue;
+      }
+      size_t slot = responses.Reserve();
+      pool_.Submit([this, command, name, payload, &responses, slot]{
+        Respond(command, name, *payload, &responses, slot);
+        delete payload;
+      });
+    }
+    responses.Drain();
+  }
+
+  bool CompileServer::Listen(const std::string& path, std::string* error){
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)){
+      *error = "Socket path too long: " + path;
+      return false;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+      *error = std::string("socket: ") + strerror(errno);
+      return false;
+    }
+    unlink(path.c_str());
+    if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 64) < 0){
+      *error = std::string("bind: ") + strerror(errno);
+      close(fd);
+      return false;
+    }
+    listen_fd_ = fd;
+
+    while(!stopping_){
+      int client = accept(fd, nullptr, nullptr);
+      if(client < 0){
+        if(errno == EINTR) continue;
+        break;
+      }
+      // a connection waits for requests on a thread of its own, so idle
+      // clients don't hold pool workers
+      {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        clients_.insert(client);
+      }
+      std::thread([this, client]{
+        Serve(client, client);
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        clients_.erase(client);
+        close(client);
+        clients_done_.notify_all();
+      }).detach();
+    }
+
+    Stop();
+    {
+      std::unique_lock<std::mutex> lock(clients_mutex_);
+      clients_done_.wait(lock, [this]{ return clients_.empty(); });
+    }
+    pool_.Wait();
+    unlink(path.c_str());
+    return true;
+  }
+}
@@ -0,0 +1,73 @@
+#ifndef GLSLTOOLS_SERVER_H
+#define GLSLTOOLS_SERVER_H
+
+#include "thread_pool.h"
+#include "symbol_table.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace GLSLTools{
+  class ResponseQueue;
+
+  // Long running compile service. Requests are framed as
+  //
+  //   <command> <name> <length>\n<length bytes of payload>
+  //
+  // and answered with "ok <length>\n<payload>" or "error <length>\n<message>".
+  // Commands are parse, emit, optimize and ir (payload is the shader
+  // source), symbol (payload is a symbol name), stats and shutdown. Results
+  // are cached by command and source, parsed units stay indexed in a shared
+  // SymbolTable.
+  //
+  // Each connection is read on a thread of its own and its compile commands
+  // run on the pool as they arrive, so a slow compile holds up neither the
+  // requests behind it nor other clients. Responses are written in request
+  // order; symbol, stats and shutdown wait for the requests before them.
+  class CompileServer{
+  private:
+    static const size_t kMaxCacheEntries = 4096;
+    static const size_t kMaxLatencySamples = 4096;
+
+    ThreadPool pool_;
+    SymbolTable symbols_;
+    std::mutex cache_mutex_;
+    std::unordered_map<std::string, std::string> cache_;
+    std::deque<std::string> cache_order_;
+    std::mutex stats_mutex_;
+    std::vector<uint32_t> latencies_;
+    size_t next_latency_;
+    size_t requests_;
+    size_t cache_hits_;
+    std::atomic<bool> stopping_;
+    std::atomic<int> listen_fd_;
+    std::mutex clients_mutex_;
+    std::condition_variable clients_done_;
+    std::unordered_set<int> clients_;
+
+    bool Compile(const std::string& command, const std::string& name, const std::string& source, std::string* result);
+    bool Handle(const std::string& command, const std::string& name, const std::string& payload, std::string* result);
+    void Respond(const std::string& command, const std::string& name, const std::string& payload, ResponseQueue* responses, size_t slot);
+    void RecordLatency(uint32_t micros);
+    void Stop();
+  public:
+    CompileServer(size_t threads = 0);
+    CompileServer(const CompileServer& other) = delete;
+    ~CompileServer(){}
+
+    // Accepts connections on a Unix domain socket until a shutdown request
+    bool Listen(const std::string& path, std::string* error);
+
+    // Serves requests from in_fd until end of input or shutdown
+    void Serve(int in_fd, int out_fd);
+
+    std::string GetStats();
+  };
+}
+
+#endif //GLSLTOOLS_SERVER_H
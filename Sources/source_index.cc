@@ -0,0 +1,159 @@
+#include "source_index.h"
+#include <algorithm>
+
+namespace GLSLTools{
+  class SpanCollector : public AstNodeVisitor{
+  private:
+    std::vector<SourceIndex::Entry>& entries_;
+    Function* function_;
+
+    void Add(AstNode* node){
+      const SourceSpan& span = node->GetSpan();
+      if(span.IsEmpty()) return;
+      SourceIndex::Entry entry;
+      entry.start = span.start.GetKey();
+      entry.end = span.end.GetKey();
+      entry.node = node;
+      entry.function = function_;
+      entries_.push_back(entry);
+    }
+  public:
+    SpanCollector(std::vector<SourceIndex::Entry>& entries):
+      entries_(entries),
+      function_(nullptr){}
+    ~SpanCollector(){}
+
+    void SetFunction(Function* function){
+      function_ = function;
+    }
+
+    void VisitSequence(SequenceNode* node){
+      Add(node);
+      node->VisitChildren(this);
+    }
+
+    void VisitReturn(ReturnNode* node){
+      Add(node);
+      node->VisitChildren(this);
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      Add(node);
+      node->VisitChildren(this);
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      Add(node);
+      node->VisitChildren(this);
+    }
+
+    void VisitLiteral(LiteralNode* node){
+      Add(node);
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      Add(node);
+    }
+
+    void VisitCall(CallNode* node){
+      Add(node);
+    }
+
+    void VisitIf(IfNode* node){
+      Add(node);
+      node->VisitChildren(this);
+    }
+
+    void VisitFor(ForNode* node){
+      Add(node);
+      node->VisitChildren(this);
+    }
+  };
+
+  SourceIndex::SourceIndex(CodeUnit* unit):
+    entries_(),
+    max_end_(),
+    leaves_(0){
+    SpanCollector collector(entries_);
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      Function* func = unit->GetFunctionAt(i);
+      collector.SetFunction(func);
+      func->GetCode()->Visit(&collector);
+    }
+    Build();
+  }
+
+  void SourceIndex::Build(){
+    // spans are properly nested, so with this order a node comes after
+    // every node enclosing it
+    std::stable_sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b){
+      if(a.start != b.start) return a.start < b.start;
+      return a.end > b.end;
+    });
+
+    leaves_ = 1;
+    while(leaves_ < entries_.size()) leaves_ <<= 1;
+    max_end_.assign(leaves_ * 2, 0);
+    for(size_t i = 0; i < entries_.size(); i++){
+      max_end_[leaves_ + i] = entries_[i].end;
+    }
+    for(size_t i = leaves_ - 1; i > 0; i--){
+      max_end_[i] = std::max(max_end_[i * 2], max_end_[i * 2 + 1]);
+    }
+  }
+
+  size_t SourceIndex::UpperBound(uint64_t key) const{
+    // number of entries starting at or before key
+    size_t lo = 0;
+    size_t hi = entries_.size();
+    while(lo < hi){
+      size_t mid = lo + (hi - lo) / 2;
+      if(entries_[mid].start <= key){
+        lo = mid + 1;
+      } else{
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  size_t SourceIndex::FindLast(size_t tree, size_t lo, size_t hi, size_t limit, uint64_t key) const{
+    // rightmost entry below limit that ends after key
+    if(lo >= limit || max_end_[tree] <= key) return entries_.size();
+    if(hi - lo == 1) return lo;
+    size_t mid = lo + (hi - lo) / 2;
+    size_t result = FindLast(tree * 2 + 1, mid, hi, limit, key);
+    if(result != entries_.size()) return result;
+    return FindLast(tree * 2, lo, mid, limit, key);
+  }
+
+  void SourceIndex::Collect(size_t tree, size_t lo, size_t hi, size_t limit, uint64_t key, std::vector<AstNode*>* result) const{
+    if(lo >= limit || max_end_[tree] <= key) return;
+    if(hi - lo == 1){
+      result->push_back(entries_[lo].node);
+      return;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    Collect(tree * 2, lo, mid, limit, key, result);
+    Collect(tree * 2 + 1, mid, hi, limit, key, result);
+  }
+
+  AstNode* SourceIndex::GetNodeAt(const SourcePosition& pos, Function** function) const{
+    if(entries_.empty()) return nullptr;
+    uint64_t key = pos.GetKey();
+    size_t idx = FindLast(1, 0, leaves_, UpperBound(key), key);
+    if(idx == entries_.size()) return nullptr;
+    if(function != nullptr) *function = entries_[idx].function;
+    return entries_[idx].node;
+  }
+
+  std::vector<AstNode*> SourceIndex::GetNodesIn(const SourceSpan& span) const{
+    std::vector<AstNode*> result;
+    if(entries_.empty() || span.IsEmpty()) return result;
+    // entries starting before the range ends and ending after it starts
+    uint64_t key = span.start.GetKey();
+    size_t limit = UpperBound(span.end.GetKey() - 1);
+    Collect(1, 0, leaves_, limit, key, &result);
+    return result;
+  }
+}
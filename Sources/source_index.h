@@ -0,0 +1,54 @@
+#ifndef GLSLTOOLS_SOURCE_INDEX_H
+#define GLSLTOOLS_SOURCE_INDEX_H
+
+#include "ast.h"
+#include "token.h"
+#include <cstdint>
+#include <vector>
+
+namespace GLSLTools{
+  // Interval index over the spans of every node in a CodeUnit. Spans are
+  // kept sorted by start (ties broken by the longer span first) with a
+  // max-end tree on top, so point and range queries run in O(log n) plus the
+  // number of nodes returned. Nodes and functions are borrowed from the unit.
+  class SourceIndex{
+  public:
+    struct Entry{
+      uint64_t start;
+      uint64_t end;
+      AstNode* node;
+      Function* function;
+    };
+  private:
+    std::vector<Entry> entries_;
+    std::vector<uint64_t> max_end_;
+    size_t leaves_;
+
+    friend class SpanCollector;
+
+    void Build();
+    size_t UpperBound(uint64_t key) const;
+    size_t FindLast(size_t tree, size_t lo, size_t hi, size_t limit, uint64_t key) const;
+    void Collect(size_t tree, size_t lo, size_t hi, size_t limit, uint64_t key, std::vector<AstNode*>* result) const;
+  public:
+    SourceIndex(CodeUnit* unit);
+    SourceIndex(const SourceIndex& other) = delete;
+    ~SourceIndex(){}
+
+    size_t GetNumberOfNodes() const{
+      return entries_.size();
+    }
+
+    const Entry& GetEntryAt(size_t idx) const{
+      return entries_[idx];
+    }
+
+    // Innermost node whose span contains pos, or nullptr
+    AstNode* GetNodeAt(const SourcePosition& pos, Function** function = nullptr) const;
+
+    // Every node whose span overlaps span, outermost first
+    std::vector<AstNode*> GetNodesIn(const SourceSpan& span) const;
+  };
+}
+
+#endif //GLSLTOOLS_SOURCE_INDEX_H
@@ -0,0 +1,186 @@
+#include "symbol_table.h"
+#include "ast.h"
+#include "scope.h"
+#include <unordered_set>
+
+namespace GLSLTools{
+  // Call targets and the globals loaded or stored, builtins included
+  class ReferenceCollector : public AstNodeVisitor{
+  private:
+    LocalScope* globals_;
+    std::unordered_set<std::string>& targets_;
+    std::unordered_set<std::string>& references_;
+  public:
+    ReferenceCollector(LocalScope* globals, std::unordered_set<std::string>& targets, std::unordered_set<std::string>& references):
+      globals_(globals),
+      targets_(targets),
+      references_(references){}
+    ~ReferenceCollector(){}
+
+    void VisitSequence(SequenceNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitReturn(ReturnNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      if(node->GetLocal()->GetOwner() == globals_) references_.insert(node->GetLocal()->GetName());
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      if(node->GetLocal()->GetOwner() == globals_) references_.insert(node->GetLocal()->GetName());
+      node->VisitChildren(this);
+    }
+
+    void VisitCall(CallNode* node){
+      targets_.insert(node->GetTarget());
+    }
+
+    void VisitIf(IfNode* node){
+      node->VisitChildren(this);
+    }
+
+    void VisitFor(ForNode* node){
+      node->VisitChildren(this);
+    }
+  };
+
+  static void RemovePosting(std::vector<SymbolTable::UnitId>& ids, SymbolTable::UnitId id){
+    for(size_t i = 0; i < ids.size(); i++){
+      if(ids[i] == id){
+        ids[i] = ids.back();
+        ids.pop_back();
+        return;
+      }
+    }
+  }
+
+  SymbolTable::UnitId SymbolTable::AddUnit(CodeUnit* unit){
+    std::unordered_set<std::string> targets;
+    std::unordered_set<std::string> references;
+    ReferenceCollector collector(unit->GetGlobals(), targets, references);
+    UnitEntry entry;
+    entry.name = unit->GetName();
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      Function* func = unit->GetFunctionAt(i);
+      entry.definitions.push_back(func->GetName());
+      func->GetCode()->Visit(&collector);
+    }
+    for(size_t i = 0; i < unit->GetNumberOfUniforms(); i++){
+      entry.definitions.push_back(unit->GetUniformAt(i)->GetName());
+    }
+    for(size_t i = 0; i < unit->GetNumberOfInputs(); i++){
+      entry.definitions.push_back(unit->GetInputAt(i)->GetName());
+    }
+    for(size_t i = 0; i < unit->GetNumberOfOutputs(); i++){
+      entry.definitions.push_back(unit->GetOutputAt(i)->GetName());
+    }
+    entry.calls.assign(targets.begin(), targets.end());
+    entry.references.assign(references.begin(), references.end());
+
+    // one update at a time, queries only wait on the shards they touch
+    std::lock_guard<std::mutex> update(update_mutex_);
+    UnitId id;
+    UnitEntry previous;
+    {
+      std::lock_guard<std::mutex> lock(units_mutex_);
+      auto pos = unit_ids_.find(entry.name);
+      if(pos != unit_ids_.end()){
+        id = pos->second;
+        previous = units_[id];
+        units_[id] = entry;
+      } else{
+        id = static_cast<UnitId>(units_.size());
+        units_.push_back(entry);
+        unit_ids_.insert({ entry.name, id });
+      }
+    }
+
+    for(auto& symbol : previous.definitions){
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      RemovePosting(shard.symbols[symbol].definitions, id);
+    }
+    for(auto& symbol : previous.calls){
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      RemovePosting(shard.symbols[symbol].callers, id);
+    }
+    for(auto& symbol : previous.references){
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      RemovePosting(shard.symbols[symbol].references, id);
+    }
+
+    for(auto& symbol : entry.definitions){
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.symbols[symbol].definitions.push_back(id);
+    }
+    for(auto& symbol : entry.calls){
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.symbols[symbol].callers.push_back(id);
+    }
+    for(auto& symbol : entry.references){
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.symbols[symbol].references.push_back(id);
+    }
+    return id;
+  }
+
+  size_t SymbolTable::GetNumberOfUnits(){
+    std::lock_guard<std::mutex> lock(units_mutex_);
+    return units_.size();
+  }
+
+  std::vector<std::string> SymbolTable::GetUnitNames(const std::vector<UnitId>& ids){
+    std::vector<std::string> names;
+    names.reserve(ids.size());
+    std::lock_guard<std::mutex> lock(units_mutex_);
+    for(auto id : ids){
+      names.push_back(units_[id].name);
+    }
+    return names;
+  }
+
+  std::vector<std::string> SymbolTable::GetDefinitions(const std::string& symbol){
+    std::vector<UnitId> ids;
+    {
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto pos = shard.symbols.find(symbol);
+      if(pos != shard.symbols.end()) ids = pos->second.definitions;
+    }
+    return GetUnitNames(ids);
+  }
+
+  std::vector<std::string> SymbolTable::GetCallers(const std::string& symbol){
+    std::vector<UnitId> ids;
+    {
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto pos = shard.symbols.find(symbol);
+      if(pos != shard.symbols.end()) ids = pos->second.callers;
+    }
+    return GetUnitNames(ids);
+  }
+
+  std::vector<std::string> SymbolTable::GetReferences(const std::string& symbol){
+    std::vector<UnitId> ids;
+    {
+      Shard& shard = GetShard(symbol);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto pos = shard.symbols.find(symbol);
+      if(pos != shard.symbols.end()) ids = pos->second.references;
+    }
+    return GetUnitNames(ids);
+  }
+}
@@ -0,0 +1,72 @@
+#ifndef GLSLTOOLS_SYMBOL_TABLE_H
+#define GLSLTOOLS_SYMBOL_TABLE_H
+
+#include "type.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+namespace GLSLTools{
+  // Symbol index shared by many CodeUnits. Units are added as they are
+  // parsed and can be queried from any thread while others are still being
+  // added. Adding a unit under a name that is already indexed replaces its
+  // symbols. Only names are stored, the table never references a CodeUnit
+  // after AddUnit returns.
+  //
+  // Functions, uniforms, inputs and outputs are definitions of their unit.
+  // A unit calling a function is one of its callers, one loading or storing
+  // a global references it.
+  class SymbolTable{
+  public:
+    typedef uint32_t UnitId;
+  private:
+    static const size_t kNumberOfShards = 16;
+
+    struct Postings{
+      std::vector<UnitId> definitions;
+      std::vector<UnitId> callers;
+      std::vector<UnitId> references;
+    };
+
+    struct Shard{
+      std::mutex mutex;
+      std::unordered_map<std::string, Postings> symbols;
+    };
+
+    struct UnitEntry{
+      std::string name;
+      std::vector<std::string> definitions;
+      std::vector<std::string> calls;
+      std::vector<std::string> references;
+    };
+
+    Shard shards_[kNumberOfShards];
+    std::mutex update_mutex_;
+    std::mutex units_mutex_;
+    std::vector<UnitEntry> units_;
+    std::unordered_map<std::string, UnitId> unit_ids_;
+
+    Shard& GetShard(const std::string& symbol){
+      return shards_[std::hash<std::string>()(symbol) % kNumberOfShards];
+    }
+
+    std::vector<std::string> GetUnitNames(const std::vector<UnitId>& ids);
+  public:
+    SymbolTable():
+      update_mutex_(),
+      units_mutex_(),
+      units_(),
+      unit_ids_(){}
+    ~SymbolTable(){}
+
+    UnitId AddUnit(CodeUnit* unit);
+
+    size_t GetNumberOfUnits();
+    std::vector<std::string> GetDefinitions(const std::string& symbol);
+    std::vector<std::string> GetCallers(const std::string& symbol);
+    std::vector<std::string> GetReferences(const std::string& symbol);
+  };
+}
+
+#endif //GLSLTOOLS_SYMBOL_TABLE_H
@@ -0,0 +1,68 @@
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace GLSLTools{
+  ThreadPool::ThreadPool(size_t threads):
+    workers_(),
+    tasks_(),
+    mutex_(),
+    available_(),
+    idle_(),
+    running_(0),
+    stopping_(false){
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    if(threads == 0) threads = 1;
+    for(size_t i = 0; i < threads; i++){
+      workers_.push_back(std::thread(&ThreadPool::Work, this));
+    }
+  }
+
+  ThreadPool::~ThreadPool(){
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    available_.notify_all();
+    for(auto& worker : workers_){
+      worker.join();
+    }
+  }
+
+  void ThreadPool::Submit(std::function<void()> task){
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(task);
+    }
+    available_.notify_one();
+  }
+
+  void ThreadPool::Wait(){
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]{ return tasks_.empty() && running_ == 0; });
+  }
+
+  void ThreadPool::Work(){
+    while(true){
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        available_.wait(lock, [this]{ return stopping_ || !tasks_.empty(); });
+        if(tasks_.empty()) return;
+        task = tasks_.front();
+        tasks_.pop_front();
+        running_++;
+      }
+
+      {
+        TRACE_SCOPE("Task", "pool");
+        task();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_--;
+        if(tasks_.empty() && running_ == 0) idle_.notify_all();
+      }
+    }
+  }
+}
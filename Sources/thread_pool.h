@@ -0,0 +1,40 @@
+#ifndef GLSLTOOLS_THREAD_POOL_H
+#define GLSLTOOLS_THREAD_POOL_H
+
+#include <functional>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+
+namespace GLSLTools{
+  class ThreadPool{
+  private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::condition_variable idle_;
+    size_t running_;
+    bool stopping_;
+
+    void Work();
+  public:
+    // 0 picks the number of hardware threads
+    ThreadPool(size_t threads = 0);
+    ThreadPool(const ThreadPool& other) = delete;
+    ~ThreadPool();
+
+    size_t GetNumberOfThreads() const{
+      return workers_.size();
+    }
+
+    void Submit(std::function<void()> task);
+
+    // Blocks until every submitted task has finished
+    void Wait();
+  };
+}
+
+#endif //GLSLTOOLS_THREAD_POOL_H
@@ -4,14 +4,29 @@
 #include <string>
 #include <sstream>
 #include <cstring>
+#include <cstdint>
 
 namespace GLSLTools{
 #define FOR_EACH_KEYWORD(V) \
   V(kRETURN, "return") \
   V(kVEC2, "vec2") \
   V(kVEC3, "vec3") \
-  V(kVEC4, "vec4")
-
+  V(kVEC4, "vec4") \
+  V(kIF, "if") \
+  V(kELSE, "else") \
+  V(kFOR, "for") \
+  V(kWHILE, "while") \
+  V(kTRUE, "true") \
+  V(kFALSE, "false") \
+  V(kLOWP, "lowp") \
+  V(kMEDIUMP, "mediump") \
+  V(kHIGHP, "highp") \
+  V(kUNIFORM, "uniform") \
+  V(kIN, "in") \
+  V(kOUT, "out") \
+  V(kLAYOUT, "layout")
+
+// Symbols may be two characters long, the lexers take the longest match
 #define FOR_EACH_SYMBOL(V) \
   V(kEQUALS, "=") \
   V(kLBRACE, "{") \
@@ -23,7 +38,19 @@ namespace GLSLTools{
   V(kDIVIDE, "/") \
   V(kLPAREN, "(") \
   V(kRPAREN, ")") \
-  V(kCOMMA, ",")
+  V(kCOMMA, ",") \
+  V(kLESS, "<") \
+  V(kGREATER, ">") \
+  V(kLESS_EQUALS, "<=") \
+  V(kGREATER_EQUALS, ">=") \
+  V(kEQUALS_EQUALS, "==") \
+  V(kNOT_EQUALS, "!=") \
+  V(kINCREMENT, "++") \
+  V(kDECREMENT, "--") \
+  V(kPLUS_EQUALS, "+=") \
+  V(kMINUS_EQUALS, "-=") \
+  V(kMUL_EQUALS, "*=") \
+  V(kDIVIDE_EQUALS, "/=")
 
 #define FOR_EACH_LITERAL(V) \
   V(kLIT_STRING, "<literal string>") \
@@ -47,32 +74,78 @@ namespace GLSLTools{
     SourcePosition(unsigned int r, unsigned int c):
       row(r),
       column(c){}
+
+    // Orders positions by row, then column
+    uint64_t GetKey() const{
+      return (static_cast<uint64_t>(row) << 32) | column;
+    }
+  };
+
+  // Half open range [start, end) of source text, rows and columns start at 0
+  struct SourceSpan{
+    SourcePosition start;
+    SourcePosition end;
+
+    SourceSpan():
+      start(0, 0),
+      end(0, 0){}
+    SourceSpan(const SourcePosition& s, const SourcePosition& e):
+      start(s),
+      end(e){}
+
+    bool IsEmpty() const{
+      return end.GetKey() <= start.GetKey();
+    }
+
+    bool Contains(const SourcePosition& pos) const{
+      return start.GetKey() <= pos.GetKey() && pos.GetKey() < end.GetKey();
+    }
+
+    bool Overlaps(const SourceSpan& other) const{
+      return start.GetKey() < other.end.GetKey() && other.start.GetKey() < end.GetKey();
+    }
+
+    std::string ToString() const{
+      std::stringstream stream;
+      stream << "(" << start.row << ", " << start.column << ")-(" << end.row << ", " << end.column << ")";
+      return stream.str();
+    }
   };
 
   class Token{
   private:
     std::string text_;
     TokenKind kind_;
+    SourcePosition start_;
     SourcePosition position_;
   public:
     Token(std::string text, TokenKind kind, SourcePosition* pos):
       text_(text),
       kind_(kind),
+      start_(0, 0),
       position_(0, 0){
       if(pos != nullptr){
         std::memcpy(&position_, pos, sizeof(SourcePosition));
+        start_ = position_;
       }
     }
+    Token(std::string text, TokenKind kind, const SourcePosition& start, const SourcePosition& end):
+      text_(text),
+      kind_(kind),
+      start_(start),
+      position_(end){}
     Token(std::string text, TokenKind kind, unsigned int row, unsigned int column):
       text_(text),
       kind_(kind),
+      start_(row, column),
       position_(row, column){}
     Token(std::string text, TokenKind kind):
       text_(text),
       kind_(kind),
+      start_(-1, -1),
       position_(-1, -1){}
 
-    std::string GetText() const{
+    const std::string& GetText() const{
       return text_;
     }
 
@@ -88,6 +161,15 @@ namespace GLSLTools{
       return kind_;
     }
 
+    // Position of the first character, GetRow/GetColumn are just past the last
+    const SourcePosition& GetStart() const{
+      return start_;
+    }
+
+    const SourcePosition& GetEnd() const{
+      return position_;
+    }
+
     std::string GetKindDescription() const{
       #define DEFINE_SWITCH_CASE(Tk, Name) \
         case Tk: return #Name;
@@ -100,6 +182,7 @@ namespace GLSLTools{
           case kEOF: return "<eof>";
           default: return "<unknown>";
         }
+      #undef DEFINE_SWITCH_CASE
     }
 
     std::string GetPosition() const{
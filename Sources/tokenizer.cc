@@ -0,0 +1,225 @@
+#include "tokenizer.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "number_scanner.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace GLSLTools{
+  const size_t Tokenizer::kMinChunkSize;
+
+  void TokenBuffer::Append(const TokenBuffer& other, uint32_t row_offset){
+    for(size_t i = 0; i < other.GetNumberOfTokens(); i++){
+      Add(other.GetKind(i), other.GetOffset(i), other.GetLength(i), other.GetRow(i) + row_offset, other.GetColumn(i));
+    }
+  }
+
+  static bool IsSymbolChar(char c){
+    #define DEFINE_CHECK(Tk, Name) \
+      if(c == Name[0]) return true;
+    FOR_EACH_SYMBOL(DEFINE_CHECK)
+    #undef DEFINE_CHECK
+    return false;
+  }
+
+  // Longest symbol text starts with, kINVALID if none
+  static TokenKind GetSymbolKind(const char* text, size_t available, size_t* length){
+    TokenKind kind = kINVALID;
+    *length = 0;
+    #define DEFINE_CHECK(Tk, Name) \
+      if(sizeof(Name) - 1 > *length && sizeof(Name) - 1 <= available && memcmp(text, Name, sizeof(Name) - 1) == 0){ \
+        kind = Tk; \
+        *length = sizeof(Name) - 1; \
+      }
+    FOR_EACH_SYMBOL(DEFINE_CHECK)
+    #undef DEFINE_CHECK
+    return kind;
+  }
+
+  static TokenKind GetWordKind(const char* word, size_t length){
+    #define DEFINE_CHECK(Tk, Name) \
+      if(length == sizeof(Name) - 1 && memcmp(word, Name, length) == 0) return Tk;
+    FOR_EACH_KEYWORD(DEFINE_CHECK)
+    #undef DEFINE_CHECK
+    return kIDENTIFIER;
+  }
+
+  struct Chunk{
+    size_t begin;
+    size_t end;
+    // where lexing stopped, past end if the last token ran over
+    size_t stop;
+    uint32_t stop_row;
+    uint32_t stop_column;
+    uint32_t newlines;
+    uint32_t row_offset;
+    TokenBuffer* tokens;
+  };
+
+  class ChunkLexer{
+  private:
+    const char* data_;
+    size_t length_;
+    size_t pos_;
+    uint32_t row_;
+    uint32_t column_;
+
+    char Peek(size_t ahead = 0) const{
+      return pos_ + ahead < length_ ? data_[pos_ + ahead] : '\0';
+    }
+
+    char Next(){
+      char c = data_[pos_++];
+      if(c == '\n'){
+        row_++;
+        column_ = 0;
+      } else{
+        column_++;
+      }
+      return c;
+    }
+  public:
+    ChunkLexer(const char* data, size_t length):
+      data_(data),
+      length_(length),
+      pos_(0),
+      row_(0),
+      column_(0){}
+    ~ChunkLexer(){}
+
+    // Lexes every token starting in [begin, limit), rows counted from row
+    void Lex(Chunk* chunk, size_t begin, size_t limit, uint32_t row, uint32_t column){
+      TokenBuffer* tokens = chunk->tokens;
+      pos_ = begin;
+      row_ = row;
+      column_ = column;
+      while(pos_ < limit){
+        char c = Peek();
+        if(isspace(c)){
+          Next();
+          continue;
+        }
+
+        size_t start = pos_;
+        uint32_t start_row = row_;
+        uint32_t start_column = column_;
+        if(c == '/' && Peek(1) == '/'){
+          while(pos_ < length_ && Peek() != '\n') Next();
+          continue;
+        } else if(c == '/' && Peek(1) == '*'){
+          Next();
+          Next();
+          while(pos_ < length_ && !(Peek() == '*' && Peek(1) == '/')) Next();
+          if(pos_ < length_){
+            Next();
+            Next();
+          }
+          continue;
+        } else if(c == '"'){
+          Next();
+          while(pos_ < length_ && Peek() != '"') Next();
+          tokens->Add(kLIT_STRING, static_cast<uint32_t>(start + 1), static_cast<uint32_t>(pos_ - start - 1), start_row, start_column);
+          if(pos_ < length_) Next();
+          continue;
+        }
+
+        size_t symbol_length;
+        TokenKind kind = GetSymbolKind(data_ + pos_, length_ - pos_, &symbol_length);
+        if(kind != kINVALID){
+          for(size_t i = 0; i < symbol_length; i++) Next();
+        } else if(isdigit(c) || c == '.'){
+          bool hex = c == '0' && (Peek(1) == 'x' || Peek(1) == 'X');
+          Next();
+          while(NumberScanner::IsContinuation(data_[pos_ - 1], Peek(), hex)) Next();
+          kind = kLIT_NUMBER;
+        } else{
+          // a lone '!' is a word of its own, like in the parser
+          Next();
+          while(pos_ < length_ && !isspace(c = Peek()) && !IsSymbolChar(c)) Next();
+          kind = GetWordKind(data_ + start, pos_ - start);
+        }
+        tokens->Add(kind, static_cast<uint32_t>(start), static_cast<uint32_t>(pos_ - start), start_row, start_column);
+      }
+      chunk->stop = pos_;
+      chunk->stop_row = row_;
+      chunk->stop_column = column_;
+    }
+  };
+
+  TokenBuffer* Tokenizer::Tokenize(const char* data, size_t length, size_t threads){
+    TRACE_SCOPE("Tokenize", "lex");
+    // the sequential lexer stops at the first NUL
+    const char* nul = reinterpret_cast<const char*>(memchr(data, '\0', length));
+    if(nul != nullptr) length = static_cast<size_t>(nul - data);
+
+    if(threads == 0) threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    size_t count = std::max<size_t>(1, std::min(threads, length / kMinChunkSize));
+
+    std::vector<Chunk> chunks;
+    size_t begin = 0;
+    for(size_t i = 0; i < count && begin < length; i++){
+      size_t end = i + 1 == count ? length : std::max(begin, length / count * (i + 1));
+      // split just after a newline so every chunk starts at column 0
+      while(end < length && data[end - 1] != '\n') end++;
+      Chunk chunk;
+      chunk.begin = begin;
+      chunk.end = end;
+      chunk.stop = end;
+      chunk.stop_row = 0;
+      chunk.stop_column = 0;
+      chunk.newlines = 0;
+      chunk.row_offset = 0;
+      chunk.tokens = new TokenBuffer(data);
+      chunks.push_back(chunk);
+      begin = end;
+    }
+
+    auto lex = [data, length](Chunk* chunk){
+      TRACE_SCOPE("LexChunk", "lex");
+      chunk->newlines = static_cast<uint32_t>(std::count(data + chunk->begin, data + chunk->end, '\n'));
+      ChunkLexer lexer(data, length);
+      lexer.Lex(chunk, chunk->begin, chunk->end, 0, 0);
+    };
+    if(chunks.size() > 1){
+      ThreadPool pool(chunks.size());
+      for(auto& chunk : chunks){
+        Chunk* c = &chunk;
+        pool.Submit([&lex, c]{ lex(c); });
+      }
+      pool.Wait();
+    } else if(!chunks.empty()){
+      lex(&chunks[0]);
+    }
+
+    // rows are chunk relative until the newline counts before them are known
+    uint32_t row = 0;
+    for(size_t i = 0; i < chunks.size(); i++){
+      chunks[i].row_offset = row;
+      row += chunks[i].newlines;
+    }
+
+    TokenBuffer* result = new TokenBuffer(data);
+    for(size_t i = 0; i < chunks.size(); i++){
+      Chunk& chunk = chunks[i];
+      if(i > 0 && chunks[i - 1].stop > chunk.begin){
+        // the previous chunk's last string or comment ran into this one
+        Chunk& previous = chunks[i - 1];
+        chunk.tokens->Clear();
+        if(previous.stop >= chunk.end){
+          chunk.stop = previous.stop;
+          chunk.stop_row = previous.stop_row + previous.row_offset - chunk.row_offset;
+          chunk.stop_column = previous.stop_column;
+        } else{
+          ChunkLexer lexer(data, length);
+          lexer.Lex(&chunk, previous.stop, chunk.end, previous.stop_row + previous.row_offset - chunk.row_offset, previous.stop_column);
+        }
+      }
+      result->Append(*chunk.tokens, chunk.row_offset);
+      delete chunk.tokens;
+    }
+    return result;
+  }
+}
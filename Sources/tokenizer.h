@@ -0,0 +1,100 @@
+#ifndef GLSLTOOLS_TOKENIZER_H
+#define GLSLTOOLS_TOKENIZER_H
+
+#include "array.h"
+#include "token.h"
+#include <cstdint>
+#include <string>
+
+namespace GLSLTools{
+  // Struct-of-arrays token list over a borrowed source buffer. Token text
+  // is the range [offset, offset + length) of the source, string literals
+  // exclude their quotes.
+  class TokenBuffer{
+  private:
+    const char* data_;
+    Array<uint8_t> kinds_;
+    Array<uint32_t> offsets_;
+    Array<uint32_t> lengths_;
+    Array<uint32_t> rows_;
+    Array<uint32_t> columns_;
+  public:
+    TokenBuffer(const char* data = nullptr):
+      data_(data),
+      kinds_(64),
+      offsets_(64),
+      lengths_(64),
+      rows_(64),
+      columns_(64){}
+    TokenBuffer(const TokenBuffer& other) = delete;
+    ~TokenBuffer(){}
+
+    const char* GetData() const{
+      return data_;
+    }
+
+    size_t GetNumberOfTokens() const{
+      return kinds_.Length();
+    }
+
+    TokenKind GetKind(size_t idx) const{
+      return static_cast<TokenKind>(kinds_[idx]);
+    }
+
+    uint32_t GetOffset(size_t idx) const{
+      return offsets_[idx];
+    }
+
+    uint32_t GetLength(size_t idx) const{
+      return lengths_[idx];
+    }
+
+    uint32_t GetRow(size_t idx) const{
+      return rows_[idx];
+    }
+
+    uint32_t GetColumn(size_t idx) const{
+      return columns_[idx];
+    }
+
+    std::string GetText(size_t idx) const{
+      return std::string(data_ + offsets_[idx], lengths_[idx]);
+    }
+
+    void Add(TokenKind kind, uint32_t offset, uint32_t length, uint32_t row, uint32_t column){
+      kinds_.Add(static_cast<uint8_t>(kind));
+      offsets_.Add(offset);
+      lengths_.Add(length);
+      rows_.Add(row);
+      columns_.Add(column);
+    }
+
+    void Clear(){
+      kinds_.Clear();
+      offsets_.Clear();
+      lengths_.Clear();
+      rows_.Clear();
+      columns_.Clear();
+    }
+
+    // Appends other's tokens, shifting their rows by row_offset
+    void Append(const TokenBuffer& other, uint32_t row_offset);
+  };
+
+  // Lexes a whole buffer on several threads. The buffer is split just after
+  // newlines and every chunk lexed on its own; a chunk owns the tokens that
+  // start inside it and reads past its end to finish a string literal or
+  // block comment. A sequential pass then re-lexes any chunk whose start was
+  // swallowed that way from where the previous chunk stopped, and the chunks
+  // are concatenated. The rules mirror Parser::LexToken.
+  class Tokenizer{
+  public:
+    // Chunks smaller than this aren't worth a thread
+    static const size_t kMinChunkSize = 64 * 1024;
+
+    // Returns a new TokenBuffer borrowing data; inputs over 4 GiB aren't supported
+    static TokenBuffer* Tokenize(const char* data, size_t length, size_t threads = 0);
+  };
+}
+
+#endif //GLSLTOOLS_TOKENIZER_H
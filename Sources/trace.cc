@@ -0,0 +1,130 @@
+#include "trace.h"
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+namespace GLSLTools{
+  std::atomic<bool> Trace::enabled_(false);
+
+  struct TraceEvent{
+    const char* name;
+    const char* category;
+    int64_t start;
+    int64_t end;
+    std::string detail;
+  };
+
+  // Written by its thread only, read by Write once that thread is done
+  struct TraceBuffer{
+    uint32_t tid;
+    std::vector<TraceEvent> events;
+  };
+
+  static std::mutex buffers_mutex;
+  static std::vector<std::unique_ptr<TraceBuffer>> buffers;
+  static std::once_flag epoch_once;
+  static Trace::Clock::time_point epoch;
+  static thread_local TraceBuffer* buffer = nullptr;
+
+  static TraceBuffer* GetBuffer(){
+    if(buffer != nullptr) return buffer;
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer()));
+    buffer = buffers.back().get();
+    buffer->tid = static_cast<uint32_t>(buffers.size());
+    return buffer;
+  }
+
+  static int64_t Nanos(Trace::Clock::time_point time){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch).count();
+  }
+
+  static std::string JsonString(const std::string& text){
+    std::string result = "\"";
+    for(char c : text){
+      if(c == '"' || c == '\\'){
+        result += '\\';
+        result += c;
+      } else if(static_cast<unsigned char>(c) < 0x20){
+        char escape[8];
+        snprintf(escape, sizeof(escape), "\\u%04x", c);
+        result += escape;
+      } else{
+        result += c;
+      }
+    }
+    return result + "\"";
+  }
+
+  void Trace::Enable(){
+    std::call_once(epoch_once, []{ epoch = Clock::now(); });
+    // the enabling thread is listed first
+    GetBuffer();
+    enabled_.store(true, std::memory_order_relaxed);
+  }
+
+  void Trace::Disable(){
+    enabled_.store(false, std::memory_order_relaxed);
+  }
+
+  void Trace::Record(const char* name, const char* category, Clock::time_point start, Clock::time_point end, const std::string& detail){
+    GetBuffer()->events.push_back({ name, category, Nanos(start), Nanos(end), detail });
+  }
+
+  size_t Trace::GetNumberOfEvents(){
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    size_t count = 0;
+    for(auto& buffer : buffers){
+      count += buffer->events.size();
+    }
+    return count;
+  }
+
+  void Trace::Write(std::ostream& stream){
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    // complete events ("X") in microseconds, threads named by metadata events
+    int pid = static_cast<int>(getpid());
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for(auto& buffer : buffers){
+      stream << (first ? "" : ",") << std::endl;
+      first = false;
+      stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+             << ",\"args\":{\"name\":\"";
+      if(buffer->tid == 1){
+        stream << "main";
+      } else{
+        stream << "worker " << buffer->tid - 1;
+      }
+      stream << "\"}}";
+      for(auto& event : buffer->events){
+        char times[64];
+        snprintf(times, sizeof(times), "%.3f,\"dur\":%.3f", event.start / 1000.0, (event.end - event.start) / 1000.0);
+        stream << "," << std::endl
+               << "{\"name\":" << JsonString(event.name) << ",\"cat\":" << JsonString(event.category)
+               << ",\"ph\":\"X\",\"ts\":" << times << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid;
+        if(!event.detail.empty()) stream << ",\"args\":{\"detail\":" << JsonString(event.detail) << "}";
+        stream << "}";
+      }
+    }
+    stream << std::endl << "]}" << std::endl;
+  }
+
+  bool Trace::WriteFile(const std::string& filename, std::string* error){
+    std::ofstream stream(filename);
+    if(!stream){
+      *error = "Cannot open file: " + filename;
+      return false;
+    }
+    Write(stream);
+    stream.flush();
+    if(!stream){
+      *error = "Cannot write file: " + filename;
+      return false;
+    }
+    return true;
+  }
+}
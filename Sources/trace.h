@@ -0,0 +1,76 @@
+#ifndef GLSLTOOLS_TRACE_H
+#define GLSLTOOLS_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace GLSLTools{
+  // Process wide timeline of scoped events, written out in the Chrome trace
+  // event format that chrome://tracing and Perfetto open. Every thread
+  // records into a buffer of its own, so recording takes no locks; a thread
+  // only locks once, to register its buffer. While tracing is off a
+  // TraceScope costs a relaxed atomic load.
+  //
+  // Write reads every buffer, so it must not run while traced work does,
+  // call it once the threads doing that work were joined or are idle.
+  class Trace{
+  public:
+    typedef std::chrono::steady_clock Clock;
+  private:
+    static std::atomic<bool> enabled_;
+  public:
+    static bool IsEnabled(){
+      return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Times are taken relative to the first call
+    static void Enable();
+    static void Disable();
+
+    // name and category must outlive the trace, string literals do
+    static void Record(const char* name, const char* category, Clock::time_point start, Clock::time_point end, const std::string& detail = std::string());
+
+    static size_t GetNumberOfEvents();
+
+    static void Write(std::ostream& stream);
+    static bool WriteFile(const std::string& filename, std::string* error);
+  };
+
+  // Records the time from its construction to its destruction, see TRACE_SCOPE
+  class TraceScope{
+  private:
+    const char* name_;
+    const char* category_;
+    const std::string* detail_;
+    bool enabled_;
+    Trace::Clock::time_point start_;
+  public:
+    TraceScope(const char* name, const char* category, const std::string* detail = nullptr):
+      name_(name),
+      category_(category),
+      detail_(detail),
+      enabled_(Trace::IsEnabled()),
+      start_(){
+      if(enabled_) start_ = Trace::Clock::now();
+    }
+    TraceScope(const TraceScope& other) = delete;
+    ~TraceScope(){
+      if(enabled_) Trace::Record(name_, category_, start_, Trace::Clock::now(), detail_ != nullptr ? *detail_ : std::string());
+    }
+  };
+
+  #define TRACE_CONCAT_(Left, Right) Left##Right
+  #define TRACE_CONCAT(Left, Right) TRACE_CONCAT_(Left, Right)
+
+  // Traces the rest of the enclosing block. The detail variant shows a
+  // std::string with the event, which must live until the block ends.
+  #define TRACE_SCOPE(Name, Category) \
+    GLSLTools::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(Name, Category)
+  #define TRACE_SCOPE_DETAIL(Name, Category, Detail) \
+    GLSLTools::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(Name, Category, &(Detail))
+}
+
+#endif //GLSLTOOLS_TRACE_H
@@ -5,12 +5,25 @@
 namespace GLSLTools{
   Type* Type::FLOAT = new Type("float", 1, false);
   Type* Type::INT = new Type("int", 1, true);
+  Type* Type::UINT = new Type("uint", 1, true);
+  Type* Type::DOUBLE = new Type("double", 1, false);
+  // stored as an int of 0 or 1
+  Type* Type::BOOL = new Type("bool", 1, true);
   Type* Type::VEC2 = new Type("vec2", 2, false);
   Type* Type::VEC3 = new Type("vec3", 3, false);
   Type* Type::VEC4 = new Type("vec4", 4, false);
   Type* Type::VOID = new Type("void", 0, true);
   Type* Type::ERROR = new Type("__ERROR__", 0, true);
 
+  const char* GetPrecisionName(Precision precision){
+    switch(precision){
+    #define DEFINE_NAME(Name, Text) case k##Name##Precision: return Text;
+      FOR_EACH_PRECISION(DEFINE_NAME)
+    #undef DEFINE_NAME
+      default: return "";
+    }
+  }
+
   Value* Value::NewInstance(float value, bool is_constant){
     Value* val = new Value(Type::FLOAT, is_constant);
     val->float_value_ = value;
@@ -23,6 +36,24 @@ namespace GLSLTools{
     return val;
   }
 
+  Value* Value::NewInstance(unsigned int value, bool is_constant){
+    Value* val = new Value(Type::UINT, is_constant);
+    val->uint_value_ = value;
+    return val;
+  }
+
+  Value* Value::NewInstance(double value, bool is_constant){
+    Value* val = new Value(Type::DOUBLE, is_constant);
+    val->double_value_ = value;
+    return val;
+  }
+
+  Value* Value::NewInstance(bool value, bool is_constant){
+    Value* val = new Value(Type::BOOL, is_constant);
+    val->int_value_ = value ? 1 : 0;
+    return val;
+  }
+
   Value* Value::NewVector(size_t size){
     Value* val;
     switch(size){
@@ -31,11 +62,34 @@ namespace GLSLTools{
       case 4: val = new Value(Type::VEC4, false); break;
       default: return nullptr;
     }
-    val->vec_value_.values = reinterpret_cast<Value**>(malloc(sizeof(Value*) * size));
+    val->vec_value_.values = reinterpret_cast<Value**>(calloc(size, sizeof(Value*)));
     val->vec_value_.values_len = size;
     return val;
   }
 
+  Value::~Value(){
+    if(IsScalar()){
+      for(size_t i = 0; i < vec_value_.values_len; i++){
+        delete vec_value_.values[i];
+      }
+      free(vec_value_.values);
+    }
+  }
+
+  Value* Value::Copy() const{
+    if(IsScalar()){
+      Value* val = NewVector(GetScalarSize());
+      for(size_t i = 0; i < GetScalarSize(); i++){
+        if(GetAt(i) != nullptr) val->SetAt(i, GetAt(i)->Copy());
+      }
+      return val;
+    }
+
+    Value* val = new Value(type_, is_constant_);
+    memcpy(&val->vec_value_, &vec_value_, sizeof(vec_value_));
+    return val;
+  }
+
   bool Value::IsScalar() const{
     return GetType()->IsCompatibile(*Type::VEC2) ||
            GetType()->IsCompatibile(*Type::VEC3) ||
@@ -51,7 +105,13 @@ namespace GLSLTools{
   std::string Value::ToString(){
     std::stringstream stream;
     if(IsConstant()){
-      if(GetType()->IsCompatibile((*Type::FLOAT))){
+      if(GetType() == Type::DOUBLE){
+        stream << AsDouble();
+      } else if(GetType() == Type::UINT){
+        stream << AsUInt();
+      } else if(GetType() == Type::BOOL){
+        stream << (AsInt() != 0 ? "true" : "false");
+      } else if(GetType()->IsCompatibile((*Type::FLOAT))){
         stream << AsFloat();
       } else if(GetType()->IsCompatibile((*Type::INT))){
         stream << AsInt();
@@ -83,4 +143,45 @@ namespace GLSLTools{
   Function::~Function(){
     delete code_;
   }
+
+  CodeUnit::CodeUnit(std::string name):
+    name_(name),
+    functions_(10),
+    function_index_(),
+    globals_(new LocalScope()),
+    uniforms_(),
+    inputs_(),
+    outputs_(){
+    SequenceNode::AddBuiltins(globals_);
+  }
+
+  CodeUnit::~CodeUnit(){
+    // the bodies' scopes unlink themselves from the globals, whose list of
+    // child scopes starts with the newest
+    for(size_t i = functions_.Length(); i > 0; i--){
+      delete functions_[i - 1];
+    }
+    delete globals_;
+  }
+
+  bool CodeUnit::AddUniform(LocalVariable* uniform){
+    if(!globals_->AddLocal(uniform)) return false;
+    uniform->SetUniform(true);
+    uniforms_.Add(uniform);
+    return true;
+  }
+
+  bool CodeUnit::AddInput(LocalVariable* local){
+    if(!globals_->AddLocal(local)) return false;
+    local->SetInterface(kInputInterface);
+    inputs_.Add(local);
+    return true;
+  }
+
+  bool CodeUnit::AddOutput(LocalVariable* local){
+    if(!globals_->AddLocal(local)) return false;
+    local->SetInterface(kOutputInterface);
+    outputs_.Add(local);
+    return true;
+  }
 }
@@ -4,17 +4,37 @@
 #include <string>
 #include <cstring>
 #include <iostream>
+#include <unordered_map>
 #include "array.h"
 
 namespace GLSLTools{
   class Type;
   class Value;
 
+  // Precision qualifiers, lowest first
+  #define FOR_EACH_PRECISION(V) \
+    V(Low, "lowp") \
+    V(Medium, "mediump") \
+    V(High, "highp")
+
+  // Unqualified declarations take kDefaultPrecision, which is highp for every
+  // type here
+  enum Precision{
+    kDefaultPrecision,
+  #define DEFINE_PRECISION(Name, Text) k##Name##Precision,
+    FOR_EACH_PRECISION(DEFINE_PRECISION)
+  #undef DEFINE_PRECISION
+  };
+
+  // The qualifier's keyword, empty for kDefaultPrecision
+  const char* GetPrecisionName(Precision precision);
+
   struct Vector{
     Value** values;
     size_t values_len;
   };
 
+  // A vector Value owns the Values of its components
   class Value{
   private:
     Type* type_;
@@ -22,13 +42,16 @@ namespace GLSLTools{
     union{
       float float_value_;
       int int_value_;
+      unsigned int uint_value_;
+      double double_value_;
       Vector vec_value_;
     };
   public:
     Value(Type* type, bool is_constant):
       type_(type),
       is_constant_(is_constant){}
-    ~Value(){}
+    Value(const Value& other) = delete;
+    ~Value();
 
     Type* GetType() const{
       return type_;
@@ -42,14 +65,18 @@ namespace GLSLTools{
 
     size_t GetScalarSize() const;
 
+    // uint and bool share the int bits, a double is narrowed
     int AsInt() const{
       return int_value_;
     }
 
-    float AsFloat() const{
-      return float_value_;
+    unsigned int AsUInt() const{
+      return uint_value_;
     }
 
+    inline float AsFloat() const;
+    inline double AsDouble() const;
+
     Value* GetAt(size_t idx) const{
       return vec_value_.values[idx];
     }
@@ -60,8 +87,14 @@ namespace GLSLTools{
 
     std::string ToString();
 
+    // Deep copy, owned by the caller
+    Value* Copy() const;
+
     static Value* NewInstance(float floatValue, bool is_constant = false);
     static Value* NewInstance(int intValue, bool is_constant = false);
+    static Value* NewInstance(unsigned int uintValue, bool is_constant = false);
+    static Value* NewInstance(double doubleValue, bool is_constant = false);
+    static Value* NewInstance(bool boolValue, bool is_constant = false);
     static Value* NewVector(size_t size);
   };
 
@@ -86,6 +119,11 @@ namespace GLSLTools{
       return is_number_;
     }
 
+    // Only float and int based types take a precision qualifier
+    bool HasPrecision() const{
+      return size_ > 0 && this != DOUBLE && this != BOOL;
+    }
+
     bool IsCompatibile(const Type& other) const{
       return size_ == other.size_ &&
              is_number_ == other.is_number_;
@@ -97,6 +135,9 @@ namespace GLSLTools{
 
     static Type* FLOAT;
     static Type* INT;
+    static Type* UINT;
+    static Type* DOUBLE;
+    static Type* BOOL;
     static Type* VEC2;
     static Type* VEC3;
     static Type* VEC4;
@@ -116,14 +157,37 @@ namespace GLSLTools{
         return VEC4;
       } else if(value == "int"){
         return INT;
+      } else if(value == "uint"){
+        return UINT;
+      } else if(value == "double"){
+        return DOUBLE;
+      } else if(value == "bool"){
+        return BOOL;
       } else{
         return ERROR;
       }
     }
   };
 
+  float Value::AsFloat() const{
+    return type_ == Type::DOUBLE ?
+           static_cast<float>(double_value_) :
+           float_value_;
+  }
+
+  // Any scalar widened to double
+  double Value::AsDouble() const{
+    if(type_ == Type::DOUBLE) return double_value_;
+    if(type_ == Type::UINT) return uint_value_;
+    if(type_->IsCompatibile(*Type::INT)) return int_value_;
+    return float_value_;
+  }
+
   class SequenceNode;
+  class LocalScope;
+  class LocalVariable;
 
+  // A Function owns its body, a CodeUnit owns its Functions
   class Function{
   private:
     std::string name_;
@@ -131,6 +195,7 @@ namespace GLSLTools{
     SequenceNode* code_;
   public:
     Function(std::string name, Type* result_type, SequenceNode* code);
+    Function(const Function& other) = delete;
     ~Function();
 
     Type* GetResultType() const{
@@ -146,22 +211,87 @@ namespace GLSLTools{
     }
   };
 
+  // A CodeUnit also owns its global scope, holding the builtins, the
+  // uniforms and the stage's inputs and outputs; the bodies of its Functions
+  // are blocks nested in it.
   class CodeUnit{
   private:
+    std::string name_;
     Array<Function*> functions_;
+    std::unordered_map<std::string, Function*> function_index_;
+    LocalScope* globals_;
+    Array<LocalVariable*> uniforms_;
+    Array<LocalVariable*> inputs_;
+    Array<LocalVariable*> outputs_;
   public:
-    CodeUnit():
-      functions_(10){}
+    CodeUnit(std::string name = "");
+    CodeUnit(const CodeUnit& other) = delete;
+    ~CodeUnit();
+
+    std::string GetName() const{
+      return name_;
+    }
+
+    void SetName(std::string name){
+      name_ = name;
+    }
 
     void AddFunction(Function* func){
       functions_.Add(func);
+      function_index_.insert({ func->GetName(), func });
     }
 
-    Function* GetFunction(std::string name){
-      for(size_t i = 0; i < functions_.Length(); i++){
-        if(functions_[i]->GetName() == name) return functions_[i];
-      }
-      return nullptr;
+    size_t GetNumberOfFunctions() const{
+      return functions_.Length();
+    }
+
+    Function* GetFunctionAt(size_t idx) const{
+      return functions_[idx];
+    }
+
+    Function* GetFunction(const std::string& name) const{
+      auto pos = function_index_.find(name);
+      return pos != function_index_.end() ?
+             pos->second :
+             nullptr;
+    }
+
+    LocalScope* GetGlobals() const{
+      return globals_;
+    }
+
+    // Takes ownership of uniform, false if the name is taken
+    bool AddUniform(LocalVariable* uniform);
+
+    size_t GetNumberOfUniforms() const{
+      return uniforms_.Length();
+    }
+
+    // In declaration order
+    LocalVariable* GetUniformAt(size_t idx) const{
+      return uniforms_[idx];
+    }
+
+    // Take ownership of local, false if the name is taken
+    bool AddInput(LocalVariable* local);
+    bool AddOutput(LocalVariable* local);
+
+    size_t GetNumberOfInputs() const{
+      return inputs_.Length();
+    }
+
+    // In declaration order
+    LocalVariable* GetInputAt(size_t idx) const{
+      return inputs_[idx];
+    }
+
+    size_t GetNumberOfOutputs() const{
+      return outputs_.Length();
+    }
+
+    // In declaration order
+    LocalVariable* GetOutputAt(size_t idx) const{
+      return outputs_[idx];
     }
   };
 }
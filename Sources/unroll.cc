@@ -0,0 +1,222 @@
+#include "unroll.h"
+#include "trace.h"
+#include <unordered_map>
+
+namespace GLSLTools{
+  const size_t LoopUnroller::kDefaultBudget;
+
+  class NodeCounter : public AstNodeVisitor{
+  private:
+    size_t count_;
+  public:
+    NodeCounter():
+      count_(0){}
+    ~NodeCounter(){}
+
+    size_t GetCount() const{
+      return count_;
+    }
+
+  #define DEFINE_VISIT(BaseName) \
+    void Visit##BaseName(BaseName##Node* node){ count_++; node->VisitChildren(this); }
+    FOR_EACH_NODE(DEFINE_VISIT)
+  #undef DEFINE_VISIT
+  };
+
+  // Copies a loop body for one iteration. Locals declared in the copy get
+  // LocalVariables of their own, the induction variable becomes a literal
+  // and every other local is shared with the original.
+  class BodyCopier : public AstNodeVisitor{
+  private:
+    LocalVariable* induction_;
+    Value* value_;
+    LocalScope* scope_;
+    std::unordered_map<LocalVariable*, LocalVariable*> locals_;
+    AstNode* result_;
+
+    LocalVariable* GetLocal(LocalVariable* local){
+      auto pos = locals_.find(local);
+      return pos != locals_.end() ?
+             pos->second :
+             local;
+    }
+  public:
+    BodyCopier(LocalVariable* induction, Value* value):
+      induction_(induction),
+      value_(value),
+      scope_(nullptr),
+      locals_(),
+      result_(nullptr){}
+    ~BodyCopier(){}
+
+    // Copying a valid tree can't fail, declarations land in fresh scopes
+    AstNode* Copy(AstNode* node){
+      result_ = nullptr;
+      node->Visit(this);
+      AstNode* result = result_;
+      result_ = nullptr;
+      return result;
+    }
+
+    // Appends copies of the children of block to target
+    void CopyInto(SequenceNode* block, SequenceNode* target){
+      LocalScope* parent = scope_;
+      scope_ = target->GetScope();
+      for(size_t i = 0; i < block->GetChildrenSize(); i++){
+        target->Add(Copy(block->GetChildAt(i)));
+      }
+      scope_ = parent;
+    }
+
+    void VisitSequence(SequenceNode* node){
+      SequenceNode* copy = new SequenceNode(scope_);
+      copy->SetSpan(node->GetSpan());
+      CopyInto(node, copy);
+      result_ = copy;
+    }
+
+    void VisitLiteral(LiteralNode* node){
+      result_ = new LiteralNode(node->GetValue() != nullptr ? node->GetValue()->Copy() : nullptr);
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitReturn(ReturnNode* node){
+      result_ = new ReturnNode(Copy(node->GetValue()));
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      AstNode* left = Copy(node->GetLeft());
+      AstNode* right = Copy(node->GetRight());
+      result_ = new BinaryOpNode(node->GetKind(), left, right);
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      if(node->GetLocal() == induction_){
+        result_ = new LiteralNode(value_->Copy());
+      } else{
+        result_ = new LoadLocalNode(GetLocal(node->GetLocal()));
+      }
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      AstNode* value = Copy(node->GetValue());
+      LocalVariable* local;
+      if(node->IsDeclaration()){
+        LocalVariable* old = node->GetLocal();
+        local = new LocalVariable(old->GetName(), old->GetType(), old->GetPrecision());
+        scope_->AddLocal(local);
+        locals_[old] = local;
+      } else{
+        local = GetLocal(node->GetLocal());
+      }
+      result_ = new StoreLocalNode(local, value, node->IsDeclaration());
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitCall(CallNode* node){
+      result_ = new CallNode(node->GetTarget());
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitIf(IfNode* node){
+      AstNode* condition = Copy(node->GetCondition());
+      SequenceNode* then_block = Copy(node->GetThen())->AsSequence();
+      SequenceNode* else_block = node->HasElse() ? Copy(node->GetElse())->AsSequence() : nullptr;
+      result_ = new IfNode(condition, then_block, else_block);
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitFor(ForNode* node){
+      ForNode* copy = new ForNode(scope_);
+      LocalScope* parent = scope_;
+      scope_ = copy->GetScope();
+      if(node->GetInit() != nullptr) copy->SetInit(Copy(node->GetInit()));
+      copy->SetCondition(Copy(node->GetCondition()));
+      if(node->GetStep() != nullptr) copy->SetStep(Copy(node->GetStep()));
+      copy->SetBody(Copy(node->GetBody())->AsSequence());
+      scope_ = parent;
+      copy->SetSpan(node->GetSpan());
+      result_ = copy;
+    }
+  };
+
+  void LoopUnroller::Run(Function* func){
+    func->GetCode()->Visit(this);
+  }
+
+  void LoopUnroller::Run(CodeUnit* unit){
+    TRACE_SCOPE("LoopUnroller", "pass");
+    for(size_t i = 0; i < unit->GetNumberOfFunctions(); i++){
+      Run(unit->GetFunctionAt(i));
+    }
+  }
+
+  AstNode* LoopUnroller::Rewrite(AstNode* node){
+    result_ = node;
+    node->Visit(this);
+    return result_;
+  }
+
+  void LoopUnroller::VisitSequence(SequenceNode* node){
+    for(size_t i = 0; i < node->GetChildrenSize(); i++){
+      node->SetChildAt(i, Rewrite(node->GetChildAt(i)));
+    }
+    result_ = node;
+  }
+
+  void LoopUnroller::VisitIf(IfNode* node){
+    node->GetThen()->Visit(this);
+    if(node->HasElse()) node->GetElse()->Visit(this);
+    result_ = node;
+  }
+
+  void LoopUnroller::VisitFor(ForNode* node){
+    node->GetBody()->Visit(this);
+    result_ = Unroll(node);
+  }
+
+  AstNode* LoopUnroller::Unroll(ForNode* loop){
+    // every copy holds at least one node, so no loop running longer fits
+    ForNode::Induction induction;
+    if(!loop->GetInduction(budget_, &induction)) return loop;
+
+    NodeCounter counter;
+    loop->GetBody()->Visit(&counter);
+    if(induction.trips * counter.GetCount() > budget_){
+      skipped_++;
+      return loop;
+    }
+
+    SequenceNode* block = new SequenceNode(loop->GetScope()->GetParent());
+    block->SetSpan(loop->GetSpan());
+    SequenceNode* body = loop->GetBody();
+    bool declares = body->GetScope()->GetNumberOfLocals() > 0;
+    for(size_t i = 0; i < induction.trips; i++){
+      int64_t number = induction.start + static_cast<int64_t>(i) * induction.step;
+      Value* value = induction.local->GetType() == Type::UINT ?
+                     Value::NewInstance(static_cast<unsigned int>(number), true) :
+                     Value::NewInstance(static_cast<int>(number), true);
+      BodyCopier copier(induction.local, value);
+      if(declares){
+        // a block per copy, so every copy declares its own locals
+        SequenceNode* copy = new SequenceNode(block->GetScope());
+        copy->SetSpan(body->GetSpan());
+        copier.CopyInto(body, copy);
+        block->Add(copy);
+      } else{
+        copier.CopyInto(body, block);
+      }
+      delete value;
+    }
+    unrolled_++;
+    delete loop;
+
+    // inner loops bounded by the induction variable may have a constant
+    // trip count now
+    VisitSequence(block);
+    return block;
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef GLSLTOOLS_UNROLL_H
+#define GLSLTOOLS_UNROLL_H
+
+#include "ast.h"
+
+namespace GLSLTools{
+  // Fully unrolls loops whose trip count is constant, see
+  // ForNode::GetInduction. A loop is replaced by a block holding one copy
+  // of its body per iteration, with the induction variable turned into a
+  // literal, so the constant folder and peephole rules can simplify every
+  // copy on their own. Bodies declaring locals keep a block per copy.
+  //
+  // Inner loops are unrolled first. The budget caps the nodes a single
+  // unrolled loop may grow to, trip count times body size; larger loops are
+  // left as they are.
+  class LoopUnroller : public AstNodeVisitor{
+  public:
+    static const size_t kDefaultBudget = 512;
+  private:
+    size_t budget_;
+    size_t unrolled_;
+    size_t skipped_;
+    AstNode* result_;
+
+    AstNode* Rewrite(AstNode* node);
+    AstNode* Unroll(ForNode* loop);
+  public:
+    LoopUnroller(size_t budget = kDefaultBudget):
+      budget_(budget),
+      unrolled_(0),
+      skipped_(0),
+      result_(nullptr){}
+    ~LoopUnroller(){}
+
+    void Run(Function* func);
+    void Run(CodeUnit* unit);
+
+    size_t GetNumberOfUnrolled() const{
+      return unrolled_;
+    }
+
+    // Loops with a constant trip count whose copies wouldn't fit the budget
+    size_t GetNumberOfSkipped() const{
+      return skipped_;
+    }
+
+    void VisitSequence(SequenceNode* node);
+    void VisitIf(IfNode* node);
+    void VisitFor(ForNode* node);
+  };
+}
+
+#endif //GLSLTOOLS_UNROLL_H
@@ -0,0 +1,356 @@
+#include "variant.h"
+#include "glsl_emitter.h"
+#include "number_scanner.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <sstream>
+
+namespace GLSLTools{
+  Variant::~Variant(){
+    for(auto& constant : constants_){
+      delete constant.second;
+    }
+  }
+
+  void Variant::Bind(const std::string& name, Value* value){
+    auto pos = constants_.find(name);
+    if(pos != constants_.end()){
+      delete pos->second;
+      pos->second = value;
+      return;
+    }
+    constants_.insert({ name, value });
+  }
+
+  Variant* Variant::Parse(const std::string& line, std::string* error){
+    std::stringstream fields(line);
+    std::string name;
+    if(!(fields >> name)){
+      *error = "Missing variant name";
+      return nullptr;
+    }
+
+    Variant* variant = new Variant(name);
+    std::string binding;
+    while(fields >> binding){
+      size_t equals = binding.find('=');
+      if(equals == std::string::npos || equals == 0){
+        *error = "Invalid binding: " + binding;
+        delete variant;
+        return nullptr;
+      }
+
+      // GLSL literals have no sign, the scanner reads the magnitude
+      const char* text = binding.data() + equals + 1;
+      const char* end = binding.data() + binding.size();
+      bool negative = text != end && *text == '-';
+      if(negative) text++;
+      NumberLiteral literal;
+      if(text == end || NumberScanner::Scan(text, end, &literal) != static_cast<size_t>(end - text)){
+        *error = "Invalid value in binding: " + binding;
+        delete variant;
+        return nullptr;
+      }
+      if(negative && literal.kind == NumberLiteral::kInt && literal.uint_value > 0x80000000u){
+        *error = "Value out of range in binding: " + binding;
+        delete variant;
+        return nullptr;
+      }
+
+      if(negative){
+        switch(literal.kind){
+          // 0x80000000 negates to INT_MIN, a uint wraps like -1u does
+          case NumberLiteral::kInt: literal.int_value = static_cast<int32_t>(0u - literal.uint_value); break;
+          case NumberLiteral::kUInt: literal.uint_value = 0u - literal.uint_value; break;
+          case NumberLiteral::kFloat: literal.float_value = -literal.float_value; break;
+          default: literal.double_value = -literal.double_value; break;
+        }
+      }
+
+      Value* value;
+      switch(literal.kind){
+        case NumberLiteral::kInt: value = Value::NewInstance(static_cast<int>(literal.int_value), true); break;
+        case NumberLiteral::kUInt: value = Value::NewInstance(static_cast<unsigned int>(literal.uint_value), true); break;
+        case NumberLiteral::kFloat: value = Value::NewInstance(literal.float_value, true); break;
+        default: value = Value::NewInstance(literal.double_value, true); break;
+      }
+      variant->Bind(binding.substr(0, equals), value);
+    }
+    return variant;
+  }
+
+  Value* Variant::Convert(Value* value, Type* type){
+    if(type == Type::DOUBLE) return Value::NewInstance(value->AsDouble(), true);
+    if(type == Type::FLOAT) return Value::NewInstance(static_cast<float>(value->AsDouble()), true);
+    if(type == Type::UINT) return Value::NewInstance(static_cast<unsigned int>(value->AsDouble()), true);
+    if(type == Type::INT) return Value::NewInstance(static_cast<int>(value->AsDouble()), true);
+    if(type == Type::BOOL) return Value::NewInstance(value->AsDouble() != 0.0, true);
+    return nullptr;
+  }
+
+  // Copies a function body, giving the copy its own scopes and locals
+  class Specializer : public AstNodeVisitor{
+  private:
+    const Variant* variant_;
+    LocalScope* globals_;
+    LocalScope* scope_;
+    std::unordered_map<LocalVariable*, LocalVariable*> locals_;
+    AstNode* result_;
+    std::string error_;
+
+    // Visits leave the copy in result_, nullptr when they failed
+    AstNode* Copy(AstNode* node){
+      result_ = nullptr;
+      node->Visit(this);
+      AstNode* result = result_;
+      result_ = nullptr;
+      return result;
+    }
+
+    void SetError(const std::string& error){
+      if(error_.empty()) error_ = error;
+    }
+
+    LocalVariable* GetLocal(LocalVariable* local){
+      auto pos = locals_.find(local);
+      if(pos != locals_.end()) return pos->second;
+      SetError("Local used outside of its scope: " + local->GetName());
+      return nullptr;
+    }
+
+    // Replaces node by a literal when it folds to a constant
+    AstNode* Fold(AstNode* node){
+      if(!node->IsConstantExpr()) return node;
+      Value* value = node->EvalConstantExpr();
+      if(value == nullptr) return node;
+      delete node;
+      return new LiteralNode(value);
+    }
+  public:
+    Specializer(const Variant* variant, CodeUnit* base, CodeUnit* unit):
+      variant_(variant),
+      globals_(unit->GetGlobals()),
+      scope_(unit->GetGlobals()),
+      locals_(),
+      result_(nullptr),
+      error_(){
+      // builtins and uniforms of the copy go by the same names
+      LocalScope* globals = base->GetGlobals();
+      for(size_t i = 0; i < globals->GetNumberOfLocals(); i++){
+        LocalVariable* local;
+        if(globals_->LocalLookup(globals->GetLocalAt(i)->GetName(), &local)) locals_[globals->GetLocalAt(i)] = local;
+      }
+    }
+    ~Specializer(){}
+
+    std::string GetError() const{
+      return error_;
+    }
+
+    SequenceNode* CopyBody(SequenceNode* code){
+      return static_cast<SequenceNode*>(Copy(code));
+    }
+
+    void VisitSequence(SequenceNode* node){
+      SequenceNode* copy = new SequenceNode(scope_);
+      copy->SetSpan(node->GetSpan());
+
+      // builtins exist before any declaration
+      LocalScope* scope = node->GetScope();
+      for(size_t i = 0; i < scope->GetNumberOfLocals(); i++){
+        LocalVariable* local;
+        if(copy->GetScope()->LocalLookup(scope->GetLocalAt(i)->GetName(), &local)) locals_[scope->GetLocalAt(i)] = local;
+      }
+
+      LocalScope* parent = scope_;
+      scope_ = copy->GetScope();
+      for(size_t i = 0; i < node->GetChildrenSize(); i++){
+        AstNode* child = Copy(node->GetChildAt(i));
+        if(child != nullptr) copy->Add(child);
+      }
+      scope_ = parent;
+      result_ = copy;
+    }
+
+    void VisitLiteral(LiteralNode* node){
+      result_ = new LiteralNode(node->GetValue() != nullptr ? node->GetValue()->Copy() : nullptr);
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitReturn(ReturnNode* node){
+      AstNode* value = Copy(node->GetValue());
+      if(value == nullptr) return;
+      result_ = new ReturnNode(value);
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitBinaryOp(BinaryOpNode* node){
+      AstNode* left = Copy(node->GetLeft());
+      AstNode* right = Copy(node->GetRight());
+      if(left == nullptr || right == nullptr){
+        delete left;
+        delete right;
+        result_ = nullptr;
+        return;
+      }
+      result_ = new BinaryOpNode(node->GetKind(), left, right);
+      result_->SetSpan(node->GetSpan());
+      result_ = Fold(result_);
+    }
+
+    void VisitLoadLocal(LoadLocalNode* node){
+      LocalVariable* local = GetLocal(node->GetLocal());
+      if(local == nullptr) return;
+      result_ = new LoadLocalNode(local);
+      result_->SetSpan(node->GetSpan());
+      result_ = Fold(result_);
+    }
+
+    void VisitStoreLocal(StoreLocalNode* node){
+      AstNode* value = Copy(node->GetValue());
+      if(value == nullptr) return;
+
+      LocalVariable* old = node->GetLocal();
+      LocalVariable* local;
+      if(node->IsDeclaration()){
+        local = new LocalVariable(old->GetName(), old->GetType(), old->GetPrecision());
+        if(!scope_->AddLocal(local)){
+          SetError("Redefinition of local: " + old->GetName());
+          delete local;
+          delete value;
+          return;
+        }
+        locals_[old] = local;
+
+        // only the function's own locals are bound, not ones shadowing them
+        Value* constant = variant_ != nullptr && scope_->GetParent() == globals_ ?
+                          variant_->GetConstant(old->GetName()) :
+                          nullptr;
+        if(constant != nullptr){
+          constant = Variant::Convert(constant, old->GetType());
+          if(constant == nullptr){
+            SetError("Specialization constant must be a scalar: " + old->GetName());
+            delete value;
+            return;
+          }
+          delete value;
+          value = new LiteralNode(constant->Copy());
+          local->SetConstantValue(constant);
+        }
+      } else{
+        local = GetLocal(old);
+        if(local == nullptr){
+          delete value;
+          return;
+        }
+        if(local->IsConstant()){
+          SetError("Specialization constant is assigned: " + old->GetName());
+          delete value;
+          return;
+        }
+      }
+
+      result_ = new StoreLocalNode(local, value, node->IsDeclaration());
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitCall(CallNode* node){
+      result_ = new CallNode(node->GetTarget());
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitIf(IfNode* node){
+      AstNode* condition = Copy(node->GetCondition());
+      AstNode* then_block = Copy(node->GetThen());
+      AstNode* else_block = node->HasElse() ? Copy(node->GetElse()) : nullptr;
+      if(condition == nullptr || then_block == nullptr || (node->HasElse() && else_block == nullptr)){
+        delete condition;
+        delete then_block;
+        delete else_block;
+        return;
+      }
+      result_ = new IfNode(condition, then_block->AsSequence(), else_block != nullptr ? else_block->AsSequence() : nullptr);
+      result_->SetSpan(node->GetSpan());
+    }
+
+    void VisitFor(ForNode* node){
+      ForNode* copy = new ForNode(scope_);
+      LocalScope* parent = scope_;
+      scope_ = copy->GetScope();
+      if(node->GetInit() != nullptr) copy->SetInit(Copy(node->GetInit()));
+      copy->SetCondition(Copy(node->GetCondition()));
+      if(node->GetStep() != nullptr) copy->SetStep(Copy(node->GetStep()));
+      AstNode* body = Copy(node->GetBody());
+      copy->SetBody(body != nullptr ? body->AsSequence() : nullptr);
+      scope_ = parent;
+      if((node->GetInit() != nullptr && copy->GetInit() == nullptr) || copy->GetCondition() == nullptr ||
+         (node->GetStep() != nullptr && copy->GetStep() == nullptr) || copy->GetBody() == nullptr){
+        delete copy;
+        return;
+      }
+      result_ = copy;
+      result_->SetSpan(node->GetSpan());
+    }
+  };
+
+  CodeUnit* VariantCompiler::Specialize(CodeUnit* base, const Variant* variant, std::string* error){
+    CodeUnit* unit = new CodeUnit(variant != nullptr ? variant->GetName() : base->GetName());
+    for(size_t i = 0; i < base->GetNumberOfUniforms(); i++){
+      LocalVariable* uniform = base->GetUniformAt(i);
+      unit->AddUniform(new LocalVariable(uniform->GetName(), uniform->GetType(), uniform->GetPrecision()));
+    }
+    for(size_t i = 0; i < base->GetNumberOfInputs(); i++){
+      LocalVariable* input = base->GetInputAt(i);
+      LocalVariable* copy = new LocalVariable(input->GetName(), input->GetType(), input->GetPrecision());
+      copy->SetLocation(input->GetLocation());
+      unit->AddInput(copy);
+    }
+    for(size_t i = 0; i < base->GetNumberOfOutputs(); i++){
+      LocalVariable* output = base->GetOutputAt(i);
+      LocalVariable* copy = new LocalVariable(output->GetName(), output->GetType(), output->GetPrecision());
+      copy->SetLocation(output->GetLocation());
+      unit->AddOutput(copy);
+    }
+    for(size_t i = 0; i < base->GetNumberOfFunctions(); i++){
+      Function* func = base->GetFunctionAt(i);
+      Specializer specializer(variant, base, unit);
+      SequenceNode* code = specializer.CopyBody(func->GetCode());
+      if(code == nullptr || !specializer.GetError().empty()){
+        *error = func->GetName() + ": " + specializer.GetError();
+        delete code;
+        delete unit;
+        return nullptr;
+      }
+      unit->AddFunction(new Function(func->GetName(), func->GetResultType(), code));
+    }
+    return unit;
+  }
+
+  bool VariantCompiler::Compile(const std::vector<Variant*>& variants, std::vector<std::string>* outputs, std::vector<std::string>* errors){
+    outputs->assign(variants.size(), std::string());
+    errors->assign(variants.size(), std::string());
+    auto compile = [&](size_t idx){
+      std::string name = variants[idx]->GetName();
+      TRACE_SCOPE_DETAIL("Specialize", "variant", name);
+      CodeUnit* unit = Specialize(base_, variants[idx], &(*errors)[idx]);
+      if(unit == nullptr) return;
+      std::stringstream stream;
+      GlslEmitter emitter(stream);
+      emitter.EmitUnit(unit);
+      delete unit;
+      (*outputs)[idx] = stream.str();
+    };
+
+    // the base unit is shared read only, each task writes its own slots
+    ThreadPool pool(threads_);
+    for(size_t i = 0; i < variants.size(); i++){
+      pool.Submit([&compile, i]{ compile(i); });
+    }
+    pool.Wait();
+
+    for(auto& error : *errors){
+      if(!error.empty()) return false;
+    }
+    return true;
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef GLSLTOOLS_VARIANT_H
+#define GLSLTOOLS_VARIANT_H
+
+#include "ast.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GLSLTools{
+  // One permutation of a shader: a name and values for some of its locals.
+  // A Variant owns its bound Values.
+  class Variant{
+  private:
+    std::string name_;
+    std::unordered_map<std::string, Value*> constants_;
+  public:
+    Variant(std::string name):
+      name_(name),
+      constants_(){}
+    Variant(const Variant& other) = delete;
+    ~Variant();
+
+    std::string GetName() const{
+      return name_;
+    }
+
+    size_t GetNumberOfConstants() const{
+      return constants_.size();
+    }
+
+    // Takes ownership of value, replacing any earlier binding of name
+    void Bind(const std::string& name, Value* value);
+
+    Value* GetConstant(const std::string& name) const{
+      auto pos = constants_.find(name);
+      return pos != constants_.end() ?
+             pos->second :
+             nullptr;
+    }
+
+    // Parses "<name> <local>=<number> ...", where a number may start with
+    // '-', returns nullptr and sets error if the line is malformed
+    static Variant* Parse(const std::string& line, std::string* error);
+
+    // Copy of a bound value as a constant of type, nullptr unless type is a
+    // scalar
+    static Value* Convert(Value* value, Type* type);
+  };
+
+  // Compiles many Variants of one parsed CodeUnit. The base unit is only
+  // read, every variant gets its own copy in which the declarations of bound
+  // locals take the bound value, loads of them become literals and constant
+  // expressions are folded.
+  class VariantCompiler{
+  private:
+    CodeUnit* base_;
+    size_t threads_;
+  public:
+    VariantCompiler(CodeUnit* base, size_t threads = 0):
+      base_(base),
+      threads_(threads){}
+    ~VariantCompiler(){}
+
+    // Returns a new CodeUnit owned by the caller, or nullptr and sets error.
+    // Bound locals must be scalars that aren't assigned after their
+    // declaration. Without bindings this is a deep copy.
+    static CodeUnit* Specialize(CodeUnit* base, const Variant* variant, std::string* error);
+
+    // Specializes and emits every variant on up to threads_ threads (0 for
+    // all cores). outputs receives the GLSL of each variant, errors the
+    // message of each failed one. Returns whether all of them compiled.
+    bool Compile(const std::vector<Variant*>& variants, std::vector<std::string>* outputs, std::vector<std::string>* errors);
+  };
+}
+
+#endif //GLSLTOOLS_VARIANT_H
@@ -0,0 +1,258 @@
+#include "watch.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace GLSLTools{
+  const int ShaderWatcher::kDefaultQuietMillis;
+
+  static const uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+
+  static std::string JoinPath(const std::string& directory, const std::string& name){
+    return directory == "/" ? directory + name : directory + "/" + name;
+  }
+
+  // The directory part of filename with its slash, empty for the working
+  // directory
+  static std::string GetDirectory(const std::string& filename){
+    size_t slash = filename.rfind('/');
+    return slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+  }
+
+  std::string GetCanonicalPath(const std::string& filename){
+    size_t slash = filename.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : filename.substr(0, slash));
+    char* resolved = realpath(directory.c_str(), nullptr);
+    if(resolved == nullptr) return filename;
+    std::string path = JoinPath(resolved, filename.substr(slash == std::string::npos ? 0 : slash + 1));
+    free(resolved);
+    return path;
+  }
+
+  static bool Expand(const std::string& filename, std::vector<std::string>* stack, std::string* source, std::vector<std::string>* files, std::string* error){
+    std::string canonical = GetCanonicalPath(filename);
+    if(std::find(stack->begin(), stack->end(), canonical) != stack->end()){
+      *error = "Include cycle: " + filename;
+      return false;
+    }
+    if(std::find(files->begin(), files->end(), canonical) == files->end()) files->push_back(canonical);
+    std::ifstream stream(filename, std::ifstream::binary);
+    if(!stream){
+      *error = "Cannot open file: " + filename;
+      return false;
+    }
+
+    stack->push_back(canonical);
+    std::string line;
+    size_t row = 0;
+    while(std::getline(stream, line)){
+      row++;
+      size_t start = line.find_first_not_of(" \t");
+      if(start == std::string::npos || line.compare(start, 8, "#include") != 0){
+        source->append(line);
+        source->push_back('\n');
+        continue;
+      }
+
+      size_t open = line.find('"', start + 8);
+      size_t close = open != std::string::npos ? line.find('"', open + 1) : std::string::npos;
+      if(close == std::string::npos || close == open + 1){
+        *error = filename + ":" + std::to_string(row) + ": expected #include \"<file>\"";
+        return false;
+      }
+      std::string include = line.substr(open + 1, close - open - 1);
+      if(include[0] != '/') include = GetDirectory(filename) + include;
+      if(!Expand(include, stack, source, files, error)) return false;
+    }
+    stack->pop_back();
+    return true;
+  }
+
+  bool ExpandIncludes(const std::string& filename, std::string* source, std::vector<std::string>* files, std::string* error){
+    std::vector<std::string> stack;
+    return Expand(filename, &stack, source, files, error);
+  }
+
+  ShaderWatcher::ShaderWatcher(std::ostream& log, Handler handler, int quiet_millis):
+    log_(log),
+    handler_(handler),
+    quiet_millis_(quiet_millis),
+    fd_(inotify_init1(IN_CLOEXEC)),
+    shaders_(),
+    dependents_(),
+    directories_(),
+    watched_(),
+    batches_(0){}
+
+  ShaderWatcher::~ShaderWatcher(){
+    for(auto& shader : shaders_){
+      delete shader.comp;
+    }
+    if(fd_ >= 0) close(fd_);
+  }
+
+  bool ShaderWatcher::Build(size_t idx){
+    Shader& shader = shaders_[idx];
+    TRACE_SCOPE_DETAIL("Rebuild", "watch", shader.filename);
+    auto start = std::chrono::steady_clock::now();
+    std::string source;
+    std::string error;
+    std::vector<std::string> files;
+    Compilation* comp = nullptr;
+    bool built = ExpandIncludes(shader.filename, &source, &files, &error);
+    if(built){
+      comp = new Compilation(shader.filename);
+      built = comp->Parse(source.data(), source.size());
+      if(!built){
+        error = comp->GetError();
+        delete comp;
+      }
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    // a failed expansion stops at the first bad include, the files after it
+    // stay watched so fixing either rebuilds the shader
+    if(!built){
+      for(auto& file : shader.files){
+        if(std::find(files.begin(), files.end(), file) == files.end()) files.push_back(file);
+      }
+    }
+    shader.files = files;
+    if(!built){
+      log_ << "  " << shader.filename << ": " << error << std::endl;
+      return false;
+    }
+
+    delete shader.comp;
+    shader.comp = comp;
+    log_ << "  " << shader.filename << ": built in " << elapsed.count() << "ms";
+    if(files.size() > 1) log_ << " (" << files.size() - 1 << " includes)";
+    log_ << std::endl;
+    if(handler_) handler_(shader.filename, comp->GetUnit());
+    return true;
+  }
+
+  bool ShaderWatcher::Watch(const std::string& file, std::string* error){
+    std::string directory = file.substr(0, file.rfind('/'));
+    if(directory.empty()) directory = "/";
+    if(watched_.find(directory) != watched_.end()) return true;
+    int wd = inotify_add_watch(fd_, directory.c_str(), kWatchMask);
+    if(wd < 0){
+      *error = "Cannot watch " + directory + ": " + strerror(errno);
+      return false;
+    }
+    watched_.insert(directory);
+    directories_[wd] = directory;
+    return true;
+  }
+
+  bool ShaderWatcher::Index(std::string* error){
+    // shaders may have gained or lost includes, so this starts over
+    dependents_ = std::unordered_map<std::string, std::vector<size_t>>();
+    for(size_t i = 0; i < shaders_.size(); i++){
+      for(auto& file : shaders_[i].files){
+        dependents_[file].push_back(i);
+        if(!Watch(file, error)) return false;
+      }
+    }
+    return true;
+  }
+
+  bool ShaderWatcher::Add(const std::string& filename, std::string* error){
+    if(fd_ < 0){
+      *error = "Cannot watch files, inotify is unavailable";
+      return false;
+    }
+    shaders_.push_back({ filename, nullptr, { GetCanonicalPath(filename) } });
+    Build(shaders_.size() - 1);
+    return Index(error);
+  }
+
+  bool ShaderWatcher::ReadEvents(std::unordered_set<std::string>* changed, size_t* events, std::string* error){
+    alignas(struct inotify_event) char buffer[4096 + NAME_MAX + 1];
+    ssize_t count = read(fd_, buffer, sizeof(buffer));
+    if(count < 0){
+      if(errno == EINTR || errno == EAGAIN) return true;
+      *error = std::string("read: ") + strerror(errno);
+      return false;
+    }
+
+    for(char* pos = buffer; pos < buffer + count;){
+      struct inotify_event* event = reinterpret_cast<struct inotify_event*>(pos);
+      pos += sizeof(struct inotify_event) + event->len;
+      if(event->mask & IN_Q_OVERFLOW){
+        // events were dropped, any file may have changed
+        for(auto& entry : dependents_){
+          changed->insert(entry.first);
+        }
+        (*events)++;
+        continue;
+      }
+      auto directory = directories_.find(event->wd);
+      if(directory == directories_.end() || event->len == 0) continue;
+      std::string path = JoinPath(directory->second, event->name);
+      if(dependents_.find(path) == dependents_.end()) continue;
+      changed->insert(path);
+      (*events)++;
+    }
+    return true;
+  }
+
+  bool ShaderWatcher::Run(size_t max_batches, std::string* error){
+    while(max_batches == 0 || batches_ < max_batches){
+      // waits for a change, then until the quiet period passes without one
+      std::unordered_set<std::string> changed;
+      size_t events = 0;
+      int timeout = -1;
+      while(true){
+        struct pollfd pfd = { fd_, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout);
+        if(ready < 0){
+          if(errno == EINTR) continue;
+          *error = std::string("poll: ") + strerror(errno);
+          return false;
+        }
+        if(ready == 0) break;
+        if(!ReadEvents(&changed, &events, error)) return false;
+        if(!changed.empty()) timeout = quiet_millis_;
+      }
+
+      TRACE_SCOPE("Batch", "watch");
+      batches_++;
+      auto start = std::chrono::steady_clock::now();
+      std::vector<bool> stale(shaders_.size(), false);
+      std::vector<std::string> names(changed.begin(), changed.end());
+      std::sort(names.begin(), names.end());
+      log_ << "Changed:";
+      for(auto& name : names){
+        log_ << " " << name;
+        for(auto idx : dependents_[name]){
+          stale[idx] = true;
+        }
+      }
+      log_ << " (" << events << (events == 1 ? " event)" : " events)") << std::endl;
+
+      size_t rebuilt = 0;
+      size_t failed = 0;
+      for(size_t i = 0; i < shaders_.size(); i++){
+        if(!stale[i]) continue;
+        rebuilt++;
+        if(!Build(i)) failed++;
+      }
+      if(!Index(error)) return false;
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      log_ << "Rebuilt " << rebuilt << " of " << shaders_.size() << " shaders in " << elapsed.count() << "ms";
+      if(failed > 0) log_ << ", " << failed << " failed";
+      log_ << std::endl;
+    }
+    return true;
+  }
+}
@@ -0,0 +1,87 @@
+#ifndef GLSLTOOLS_WATCH_H
+#define GLSLTOOLS_WATCH_H
+
+#include "compilation.h"
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace GLSLTools{
+  // Replaces every line of the form #include "<path>" in filename with the
+  // contents of path, read relative to the including file, recursively. The
+  // canonical paths of the files read are appended to files, also when it
+  // fails on an unreadable file or an include cycle.
+  bool ExpandIncludes(const std::string& filename, std::string* source, std::vector<std::string>* files, std::string* error);
+
+  // Absolute path of filename with its directory resolved, so the path of a
+  // file that was deleted or renamed over stays the same
+  std::string GetCanonicalPath(const std::string& filename);
+
+  // Keeps a set of shaders parsed and rebuilds them as they change on disk.
+  // inotify watches the directories of the shaders and of the files they
+  // include, since editors often save by renaming a new file over the old
+  // one. Events are collected until none arrived for the quiet period, then
+  // every shader reading a changed file is rebuilt once, so rapid saves
+  // batch into one rebuild. A shader that fails to build keeps its last
+  // unit.
+  class ShaderWatcher{
+  public:
+    // Called after every successful build with the new unit, which stays
+    // owned by the watcher
+    typedef std::function<void(const std::string& filename, CodeUnit* unit)> Handler;
+
+    static const int kDefaultQuietMillis = 50;
+  private:
+    struct Shader{
+      std::string filename;
+      Compilation* comp;
+      std::vector<std::string> files;
+    };
+
+    std::ostream& log_;
+    Handler handler_;
+    int quiet_millis_;
+    int fd_;
+    std::vector<Shader> shaders_;
+    std::unordered_map<std::string, std::vector<size_t>> dependents_;
+    std::unordered_map<int, std::string> directories_;
+    std::unordered_set<std::string> watched_;
+    size_t batches_;
+
+    bool Build(size_t idx);
+    bool Watch(const std::string& file, std::string* error);
+    bool Index(std::string* error);
+    bool ReadEvents(std::unordered_set<std::string>* changed, size_t* events, std::string* error);
+  public:
+    ShaderWatcher(std::ostream& log, Handler handler, int quiet_millis = kDefaultQuietMillis);
+    ShaderWatcher(const ShaderWatcher& other) = delete;
+    ~ShaderWatcher();
+
+    // Builds filename and adds it to the watched shaders, false and sets
+    // error only if it can't be watched
+    bool Add(const std::string& filename, std::string* error);
+
+    size_t GetNumberOfShaders() const{
+      return shaders_.size();
+    }
+
+    // The last unit that built, nullptr if none has
+    CodeUnit* GetUnit(size_t idx) const{
+      return shaders_[idx].comp != nullptr ? shaders_[idx].comp->GetUnit() : nullptr;
+    }
+
+    size_t GetNumberOfBatches() const{
+      return batches_;
+    }
+
+    // Blocks rebuilding shaders after each batch of changes until
+    // max_batches were handled (0 for no limit), false and sets error if
+    // watching fails
+    bool Run(size_t max_batches, std::string* error);
+  };
+}
+
+#endif //GLSLTOOLS_WATCH_H